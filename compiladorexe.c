@@ -4,11 +4,34 @@
  * Implementação de um compilador para a linguagem PasKenzie,
  * conforme as especificações do trabalho e alinhado com o código de referência.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VARREDURA_X86 1
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
 
 // Enumeração de todos os tokens da linguagem PasKenzie
 typedef enum {
@@ -34,607 +57,9047 @@ typedef struct {
     int linha;
     union {
         int numero;
-        char id[16];
+        uint32_t simbolo;   // identificador: índice na tabela de símbolos
         char ch;
     } atributo;
 } TInfoAtomo;
 
-// Variáveis globais
-char *buffer;
-int nLinha;
-TInfoAtomo lookahead;
+// Símbolo internado: o nome fica no próprio fonte (offset, tamanho)
+typedef struct {
+    uint32_t offset;
+    uint32_t hash;
+    uint8_t tamanho;
+    uint8_t tipo;       // 0: não declarado; CHAR, INTEGER ou BOOLEAN após a declaração
+} TSimbolo;
+
+typedef struct {
+    TSimbolo *simbolos;
+    uint32_t quantidade;
+    uint32_t capacidade;
+    uint32_t *slots;    // endereçamento aberto: índice do símbolo + 1, 0 = vazio
+    uint32_t mascara;   // número de slots - 1 (potência de 2)
+    // Com nomes_proprios, o offset aponta para uma cópia do nome em nomes, e
+    // não para o fonte (modo documento, em que o texto muda de lugar)
+    int nomes_proprios;
+    char *nomes;
+    uint32_t uso_nomes, capacidade_nomes;
+} TTabelaSimbolos;
+
+// Texto-fonte carregado: mapeado do arquivo ou lido de um pipe
+typedef struct {
+    const char *dados;
+    size_t tamanho;
+    size_t tamanho_reservado; // bytes reservados (mapeamento ou malloc), incluindo a folga
+    int mapeado;
+    char erro[160];           // motivo, quando carrega_fonte falha
+} TFonte;
+
+// Bytes nulos garantidos após o fim do texto: o '\0' sentinela do léxico
+// e espaço para leituras adiantadas sem sair da região válida
+#define FOLGA_FONTE 64
+
+// Modos de saída do trace de átomos
+typedef enum { TRACE_TEXTO, TRACE_BINARIO, TRACE_DESLIGADO } TModoTrace;
+
+// Registro de largura fixa do trace binário (24 bytes, little-endian).
+// O fluxo começa com o cabeçalho "PKTR", versão (u16) e tamanho do registro (u16).
+typedef struct {
+    uint32_t linha;
+    uint8_t atomo;
+    uint8_t tamanho;    // bytes válidos em atributo.texto (identificadores)
+    uint16_t reservado;
+    union {
+        int32_t numero;
+        char ch;
+        char texto[16];
+    } atributo;
+} TRegistroTrace;
+
+#define VERSAO_TRACE_BINARIO 1
+#define TAM_SAIDA (1 << 20)
+
+/*
+ * Tabela de átomos em estrutura de arrays, preenchida por uma passada
+ * léxica completa antes da análise sintática (--lex=bulk). Os arrays
+ * quentes (átomo, linha, posição no fonte) ficam separados da tabela
+ * lateral de atributos: valor de constint, caractere de constchar e, para
+ * identificadores, o índice do símbolo internado.
+ */
+typedef struct {
+    uint8_t *atomo;
+    uint32_t *linha;
+    uint32_t *offset;
+    int32_t *atributo;
+    size_t quantidade;
+    size_t capacidade;
+    char erro[160];     // erro léxico adiado até o parser alcançar o átomo ERRO
+} TTabelaAtomos;
+
+/*
+ * Canal de trivia: comentários não chegam ao parser. O léxico registra cada
+ * um aqui (posição, tamanho, linha) e a saída os intercala com os átomos
+ * pela posição no fonte, reproduzindo as linhas "# n:comentario" do trace.
+ */
+typedef struct {
+    uint32_t offset, tamanho, linha;
+} TTrivia;
+
+typedef struct {
+    TTrivia *itens;
+    size_t quantidade, capacidade;
+    size_t cursor;      // primeiro registro ainda não impresso
+    int descartando;    // em sincroniza: comentários pulados junto com os átomos somem do trace
+} TCanalTrivia;
+
+typedef enum { LEX_SOB_DEMANDA, LEX_EM_LOTE, LEX_ESTEIRA } TModoLexico;
+
+// Compilador residente num socket Unix (--server=), seu cliente e o benchmark de latência
+typedef enum { SERVIDOR_NADA, SERVIDOR_ESCUTA, SERVIDOR_CLIENTE, SERVIDOR_BENCH } TModoServidor;
+
+// Consulta ao cache de compilação (--cache=), de cache_compila até cache_conclui
+typedef struct {
+    uint64_t chave[2];
+    FILE *destino;      // destino da saída, restaurado em cache_conclui
+    int gravar;         // falta: compilou e a entrada deve ser gravada
+} TConsultaCache;
+
+// Árvore sintática: nós num único vetor, ligados por índices de 32 bits
+// (primeiro filho / próximo irmão). O índice 0 é reservado como "nenhum".
+typedef enum {
+    NO_PROGRAMA, NO_BLOCO, NO_DECLARACOES, NO_DECLARACAO, NO_COMPOSTO,
+    NO_ATRIBUICAO, NO_LEITURA, NO_ESCRITA, NO_SE, NO_ENQUANTO, NO_VAZIO,
+    NO_BINARIO, NO_NAO, NO_ID, NO_CONSTINT, NO_CONSTCHAR, NO_LOGICO,
+    NO_DESLOCA          // x * 2^valor, criado pela redução de força
+} TTipoNo;
+
+typedef struct {
+    uint8_t tipo;       // TTipoNo
+    uint8_t atomo;      // operador de NO_BINARIO, tipo declarado em NO_DECLARACAO
+    uint16_t reservado;
+    uint32_t offset;    // posição no fonte do átomo que inicia o nó
+    uint32_t filho;     // primeiro filho
+    uint32_t irmao;     // próximo irmão
+    int32_t valor;      // constante; símbolo em NO_ID
+} TNo;
+
+typedef struct {
+    TNo *nos;
+    uint32_t quantidade;
+    uint32_t capacidade;
+} TArena;
+
+#define NO_NULO 0u
+
+typedef enum { AST_NADA, AST_DESPEJO, AST_ESTATISTICAS } TModoAst;
+
+// Bytecode de pilha: cada instrução é uma palavra de opcode, seguida de um
+// operando nas que o usam (índice de constante, variável ou destino de salto)
+typedef enum {
+    OP_CONST, OP_CARREGA, OP_ARMAZENA,
+    OP_SOMA, OP_SUBTRAI, OP_MULTIPLICA, OP_DIVIDE,
+    OP_IGUAL, OP_DIFERENTE, OP_MENOR, OP_MAIOR, OP_MENOR_IGUAL, OP_MAIOR_IGUAL,
+    OP_E, OP_OU, OP_NAO, OP_DESLOCA,
+    OP_SALTA, OP_SALTA_FALSO,
+    OP_LE_INTEIRO, OP_LE_CHAR, OP_ESCREVE_INTEIRO, OP_ESCREVE_CHAR, OP_ESCREVE_LOGICO,
+    OP_ESPACO, OP_FIM_LINHA, OP_FIM,
+    OP_CONTA,                    // --profile: incrementa um contador; nunca aparece fora dele
+    TOTAL_OPCODES
+} TOpcode;
+
+// Ponto de contagem do --profile: um comando simples, if ou while. Cada ponto
+// p tem os contadores 2p (entradas) e 2p+1 (voltas do while, then do if)
+typedef struct {
+    uint32_t no;
+    int32_t linha;
+    uint32_t pai;                // ponto que o contém, UINT32_MAX no nível do programa
+    uint32_t custo;              // instruções próprias executadas a cada entrada
+    uint32_t custo_segundo;      // e a cada incremento do segundo contador
+} TPontoPerfil;
+
+// Pilhas explícitas da geração de código: comando e expressão em andamento
+typedef struct {
+    uint32_t no;
+    uint32_t etapa;              // filhos já gerados; composto: próximo filho
+    uint32_t salto;              // if/while: operando de salto a corrigir
+    uint32_t inicio;             // while: início da condição
+    uint32_t ponto_pai;          // --profile: ponto a restaurar ao fechar
+    uint32_t antes;              // --profile: instruções emitidas ao abrir
+} TQuadroComando;
+
+typedef struct {
+    uint32_t no;
+    uint32_t etapa;
+    uint32_t profundidade;       // operandos já na pilha quando a expressão começa
+} TQuadroExpressao;
+
+typedef struct {
+    int32_t *codigo;
+    uint32_t tamanho;
+    uint32_t capacidade;
+    int32_t *constantes;
+    uint32_t n_constantes;
+    uint32_t cap_constantes;
+    uint32_t *slots_constantes;  // hash valor -> índice + 1, para não repetir constantes
+    uint32_t mascara_constantes;
+    uint32_t n_variaveis;
+    uint8_t *tipo_variavel;      // CHAR, INTEGER ou BOOLEAN por variável
+    uint32_t *variavel_do_simbolo;
+    uint32_t profundidade_pilha; // maior profundidade da pilha de operandos
+    uint32_t instrucoes;         // instruções emitidas até agora, sem contar OP_CONTA
+    TPontoPerfil *pontos;        // --profile: pontos de contagem e seus contadores
+    uint32_t n_pontos;
+    uint32_t cap_pontos;
+    uint32_t ponto_atual;
+    uint64_t *contadores;
+    TQuadroComando *comandos;    // pilhas de gera_statement e gera_expression
+    size_t cap_comandos;
+    TQuadroExpressao *expressoes;
+    size_t cap_expressoes;
+} TPrograma;
+
+typedef enum { DESPACHO_GOTO, DESPACHO_SWITCH, DESPACHO_JIT } TModoDespacho;
+
+// Código x86-64 em construção: bytes, rótulos e deslocamentos a corrigir
+typedef struct {
+    uint8_t *codigo;
+    uint32_t tamanho;
+    uint32_t capacidade;
+    uint32_t *rotulos;       // posição de cada rótulo no código
+    uint32_t n_rotulos;
+    uint32_t cap_rotulos;
+    uint32_t *correcoes;     // pares (posição do rel32, rótulo)
+    uint32_t n_correcoes;
+    uint32_t cap_correcoes;
+    uint32_t *dados;         // ELF: pares (posição do imm32, deslocamento no segmento de dados)
+    uint32_t n_dados;
+    uint32_t cap_dados;
+} TCodigoNativo;
+
+// Rotinas de suporte chamadas pelo código nativo
+typedef enum {
+    RT_LE_INTEIRO, RT_LE_CHAR, RT_ESCREVE_INTEIRO, RT_ESCREVE_CHAR, RT_ESCREVE_LOGICO,
+    RT_ESPACO, RT_FIM_LINHA, RT_ERRO_DIVISAO,
+    TOTAL_ROTINAS
+} TRotina;
+
+// Aritmética de 32 bits feita em unsigned: o estouro dá a volta em complemento
+// de dois, como no hardware, sem comportamento indefinido
+#define ARIT(a, op, b) ((int32_t)((uint32_t)(a) op (uint32_t)(b)))
+
+// Passos de otimização sobre a árvore, ligados individualmente por --opt=
+enum {
+    OTIM_COPIAS = 1 << 0,   // propagação de cópias e constantes em sequências de atribuições
+    OTIM_DOBRA = 1 << 1,    // dobra de constantes
+    OTIM_FORCA = 1 << 2,    // redução de força (multiplicação por potência de 2, identidades)
+    OTIM_RAMOS = 1 << 3,    // eliminação de ramos e laços mortos
+    OTIM_TODAS = OTIM_COPIAS | OTIM_DOBRA | OTIM_FORCA | OTIM_RAMOS
+};
+
+typedef struct {
+    uint32_t copias;        // usos de variável substituídos
+    uint32_t dobras;        // operações avaliadas em tempo de compilação
+    uint32_t reducoes;      // multiplicações/identidades simplificadas
+    uint32_t ramos;         // if com condição constante resolvidos
+    uint32_t lacos;         // while false removidos
+    double tempo[4];        // segundos gastos em cada passo
+} TEstatisticasOtim;
+
+// Análises de fluxo de dados com aviso, ligadas por --check=
+enum {
+    VERIF_INICIALIZACAO = 1 << 0,   // uso de variável que pode não ter recebido valor
+    VERIF_ESCRITA_MORTA = 1 << 1,   // atribuição cujo valor nunca é lido
+    VERIF_TODAS = VERIF_INICIALIZACAO | VERIF_ESCRITA_MORTA
+};
+
+// Variáveis por faixa do resolvedor de fluxo, em palavras de 64 bits
+#define PALAVRAS_FAIXA 32
+
+typedef struct {
+    uint32_t blocos;        // blocos básicos do grafo de fluxo
+    uint32_t referencias;   // usos e definições de variáveis
+    uint32_t faixas;        // faixas de variáveis com alguma referência
+    uint64_t visitas[2];    // blocos visitados pelo resolvedor, somados nas faixas
+    uint32_t avisos[2];
+    double tempo[3];        // montagem do grafo e cada análise
+} TEstatisticasFluxo;
+
+#if defined(__GNUC__)
+#define TEM_GOTO_COMPUTADO 1
+#endif
+
+#if defined(__x86_64__) && defined(__linux__)
+#define TEM_NATIVO 1
+#endif
+
+// Núcleos de varredura de espaços e comentários (--simd=...)
+typedef enum { VARREDURA_AUTO, VARREDURA_ESCALAR, VARREDURA_SSE2, VARREDURA_AVX2 } TModoVarredura;
+typedef const char *(*TFuncVarredura)(const char *p, int *linhas);
+
+typedef struct TDocumento TDocumento;
+typedef struct TEsteira TEsteira;
+
+// Pilhas explícitas do parser (statement_part, expression)
+typedef enum { QUADRO_LISTA, QUADRO_SE_ENTAO, QUADRO_SE_SENAO, QUADRO_ENQUANTO } TTipoQuadro;
+
+typedef struct {
+    uint8_t tipo;                  // TTipoQuadro
+    uint32_t no, ultimo;           // nó do comando aberto e seu último filho ligado
+    uint64_t sincronia;            // conjunto de sincronização a restaurar ao fechar
+    size_t atomo;                  // lista no modo documento: átomo onde começa o comando corrente
+} TQuadro;
+
+typedef enum { OPERADOR_BINARIO, OPERADOR_PARENTESE, OPERADOR_NAO } TTipoOperador;
+
+typedef struct {
+    uint8_t tipo;                  // TTipoOperador
+    uint8_t atomo;                 // binário: o operador
+    uint8_t relacional;            // '(': o nível de fora já tinha relacional
+    uint32_t valor;                // binário: offset do operador; not: o nó NO_NAO
+    uint64_t sincronia;            // '(': conjunto a restaurar no ')'
+} TOperador;
+
+/*
+ * Instrumentação opcional: compilada só com -DPK_ESTATISTICAS e relatada
+ * com --stats. Sem a macro, ESTAT e ESTAT_CRONOMETRO não geram código
+ * nenhum, e o caminho quente fica como está.
+ */
+#ifdef PK_ESTATISTICAS
+enum { ESTAT_CARGA, ESTAT_LEXICO, ESTAT_SINTATICO, ESTAT_SAIDA, N_ESTAT };
+
+typedef struct {
+    double parede, cpu;
+} TMarca;
+
+typedef struct {
+    double parede[N_ESTAT], cpu[N_ESTAT];   // trechos medidos de uma vez (carga, léxico em lote)
+    double parede_analise, cpu_analise;     // análise sintática inteira, com o que roda dentro dela
+    double chamadas_lexico, chamadas_saida; // soma de obter_atomo e emite_atomo dentro da análise
+    TMarca inicio_analise;
+    int analisando;
+    uint64_t atomos[EOS + 1];
+    uint64_t bytes_espaco, bytes_comentario;
+    uint32_t profundidade_expressao, profundidade_comando;   // aninhamento máximo visto
+    uint64_t alocacoes, bytes_alocados;
+} TEstatisticas;
+
+typedef struct {
+    double inicio;
+    double *destino;
+} TCronometro;
+
+#define ESTAT(...) __VA_ARGS__
+#define ESTAT_CRONOMETRO(campo) \
+    TCronometro cronometro_ __attribute__((cleanup(estat_para))) = { agora(), &ctx->estat.campo }
+#else
+#define ESTAT(...)
+#define ESTAT_CRONOMETRO(campo) ((void)0)
+#endif
+
+/*
+ * Estado de uma compilação. Nada aqui é compartilhado entre threads: cada
+ * arquivo do modo em lote tem o seu, e ctx aponta para o contexto que a
+ * thread corrente está compilando. Erros fatais saltam para salto_erro,
+ * armado por compila_arquivo, em vez de encerrar o processo.
+ */
+typedef struct {
+    TFonte fonte;
+    const char *buffer;
+    int nLinha;
+    TInfoAtomo lookahead;
+    const char *inicio_fonte;      // primeiro byte do texto-fonte
+    const char *inicio_atomo;      // início do último átomo reconhecido por obter_atomo
+    TTabelaAtomos tabela;          // usada apenas em --lex=bulk
+    TCanalTrivia trivia;           // comentários fora do fluxo de átomos
+    size_t cursor_tabela;          // próximo átomo da tabela a entregar ao parser
+    uint32_t offset_lookahead;     // posição no fonte do átomo em lookahead
+    TArena ast;                    // árvore construída pelo parser
+    TTabelaSimbolos simbolos;      // identificadores internados e seus tipos
+    uint32_t raiz;                 // nó NO_PROGRAMA, depois de uma análise bem-sucedida
+    double tempo_analise;          // segundos de análise sintática
+    double tempo_lexico;           // segundos da passada léxica em lote
+    uint32_t *inicios_linha;       // índice de linhas de linha_do_offset
+    uint32_t total_linhas;
+
+    // Trace e mensagens: com destino, buffer fixo descarregado em destino;
+    // sem destino, tudo fica acumulado em memória (modo em lote)
+    char *saida_buf;
+    size_t saida_uso;
+    size_t saida_capacidade;
+    FILE *destino;
+
+    // Durante a passada em lote, erros léxicos voltam para lexa_em_lote;
+    // na thread da esteira, identificadores saem com o hash, sem internar
+    int lexico_em_lote;
+    int adia_simbolos;
+    jmp_buf salto_lexico;
+    jmp_buf salto_erro;
+    int falha_fatal;    // houve erro_fatal (memória, threads): o resultado não vai para o cache
+
+    // Recuperação de erros (--max-errors): átomos em que a análise pode
+    // retomar depois de um erro sintático, e erros relatados até aqui
+    uint64_t sincronia;
+    int erros;
+    uint32_t fim_panico;           // offset + 1 do átomo onde o último descarte parou
+
+    TDocumento *documento;         // análise incremental em andamento (--bench-edits), ou NULL
+    TEsteira *esteira;             // átomos vindos da thread léxica (--lex=pipeline), ou NULL
+    uint32_t pedacos, costurados;  // última divisão da parte de comandos (--parse-threads): pedaços e quantos valeram
+    double tempo_divisao;          // segundos da varredura prévia dessa divisão
+
+    // Pilhas explícitas do parser: molduras dos comandos abertos e, dentro
+    // de uma expressão, operadores e operandos pendentes
+    TQuadro *quadros;
+    size_t n_quadros, capacidade_quadros;
+    TOperador *operadores;
+    size_t n_operadores, capacidade_operadores;
+    uint32_t *operandos;
+    size_t n_operandos, capacidade_operandos;
+#ifdef PK_ESTATISTICAS
+    TEstatisticas estat;
+#endif
+} TContexto;
+
+// Configuração: definida em main e só lida durante a compilação
+
+// Reconhecimento de palavras reservadas: 0 = cadeia de strcmp, 1 = hash perfeito
+typedef enum { PALAVRAS_STRCMP, PALAVRAS_HASH } TModoPalavras;
+TModoPalavras modo_palavras = PALAVRAS_HASH;
+TModoTrace modo_trace = TRACE_TEXTO;
+TModoLexico modo_lexico = LEX_SOB_DEMANDA;
+
+TModoAst modo_ast = AST_NADA;
+int executar;                  // --run: gera bytecode e executa após a análise
+#ifdef TEM_GOTO_COMPUTADO
+TModoDespacho modo_despacho = DESPACHO_GOTO;
+#else
+TModoDespacho modo_despacho = DESPACHO_SWITCH;
+#endif
+FILE *saida_vm;                // destino de write durante a execução
+unsigned otimizacoes = OTIM_TODAS;
+int relatorio_otim;            // --opt-stats
+unsigned verificacoes;         // --check=: análises de fluxo de dados com aviso
+int relatorio_fluxo;           // --check-stats
+const char *caminho_elf;       // --emit-elf=: executável nativo a escrever
+const char *caminho_imagem;    // --emit-image=: imagem binária do programa a escrever
+int perfilar;                  // --profile: contadores por comando durante --run
+const char *caminho_perfil;    // --profile=: pilhas colapsadas para flame graph
+int max_erros = 1;             // --max-errors=N: diagnósticos antes de encerrar a análise
+int tarefas;                   // --jobs N: modo em lote com N threads
+int threads_analise;           // --parse-threads=N: parte de comandos analisada em pedaços por N threads
+TModoServidor modo_servidor;   // --server=, --client= ou --bench-server
+const char *caminho_socket;
+const char *diretorio_cache;   // --cache=: entradas da compilação em disco
+uint64_t limite_cache = 256u << 20;  // --cache-size=
+int relatorio_cache;           // --cache-stats
+
+TModoVarredura modo_varredura = VARREDURA_AUTO;
+TFuncVarredura pula_espacos;     // primeiro byte que não é ' ', '\t', '\n' ou '\r'
+TFuncVarredura fim_comentario;   // primeiro "*)" ou o '\0' final
+TFuncVarredura evento_divisao;   // primeiro ';', '(', '\'', '\0' ou b/e no início de palavra (--parse-threads)
+
+_Thread_local TContexto *ctx;  // compilação em andamento nesta thread
 
 // Protótipos das Funções
 TInfoAtomo obter_atomo();
 void reconhece_numero(TInfoAtomo *infoAtomo);
 void reconhece_id(TInfoAtomo *infoAtomo);
+uint32_t interna(const char *lexema, int tamanho);
+uint32_t interna_com_hash(const char *lexema, int tamanho, uint32_t h);
+static inline uint32_t hash_lexema(const char *lexema, int tamanho);
+const char *nome_simbolo(uint32_t simbolo, int *tamanho);
+void libera_simbolos(TTabelaSimbolos *t);
 void reconhece_constchar(TInfoAtomo *infoAtomo);
-void reconhece_qualquer(TInfoAtomo *infoAtomo);
 void reconhece_comentario(TInfoAtomo *infoAtomo);
-void consome(TAtomo esperado);
+TAtomo classifica_palavra(const char *lexema, int tamanho);
+TAtomo palavra_strcmp(const char *lexema, int tamanho);
+TAtomo palavra_hash(const char *lexema, int tamanho);
+void bench_palavras(long repeticoes);
+double agora();
+int carrega_fonte(const char *caminho, TFonte *fonte);
+void libera_fonte(TFonte *fonte);
+void inicia_nomes();
+void inicia_lexico();
+void inicia_saida(FILE *destino);
+void inicia_trace_binario();
+void saida_descarrega();
+void saida_escreve(const char *dados, size_t n);
+void emite_atomo(const TInfoAtomo *atomo);
+void emite_trivia(uint32_t limite);
+void emite_resumo(int linhas);
+void emite_mensagem(const char *formato, va_list args);
+void mensagem(const char *formato, ...);
+void erro_fatal(const char *formato, ...);
+void conta_erro();
+void erro_compilacao(const char *formato, ...);
+void inicia_contexto(TContexto *c, FILE *destino);
+void libera_contexto(TContexto *c);
+int compila_arquivo(const char *caminho);
+int compila_fonte();
+void recicla_contexto(TContexto *c);
+int servidor(const char *caminho);
+int cliente(const char *caminho, const char *arquivo);
+void bench_servidor(const char *arquivo, int pedidos);
+int compila_em_lote(const char **argumentos, size_t n_argumentos, int n_threads);
+int cache_compila(const char *caminho, TConsultaCache *q, TPrograma *prog);
+void cache_conclui(TConsultaCache *q, int status, const TPrograma *prog);
+void cache_relata();
+const char *diretorio_cache_padrao();
+void erro_lexico(const char *formato, ...);
+const char *seleciona_varredura(TModoVarredura modo);
+void lexa_em_lote(TTabelaAtomos *t, size_t tamanho_fonte);
+void libera_tabela(TTabelaAtomos *t);
+void esteira_inicia();
+void esteira_encerra();
+void esteira_avanca();
+void bench_lex(const char *caminho);
+void avanca();
+uint32_t novo_no(TTipoNo tipo, TAtomo atomo, uint32_t offset, int32_t valor);
+static void arena_reserva(TArena *arena, uint32_t nova);
+void libera_arena(TArena *arena);
+int linha_do_offset(uint32_t offset);
+void despeja_ast(uint32_t no, int nivel);
+void otimiza(uint32_t raiz, unsigned passos, TEstatisticasOtim *est);
+int le_opcao_verificacao(const char *lista);
+void verifica_fluxo(uint32_t raiz, unsigned verificacoes, TEstatisticasFluxo *est);
+int le_opcao_otim(const char *lista);
+void gera_program(TPrograma *prog, uint32_t raiz);
+void libera_programa(TPrograma *prog);
+int executa(const TPrograma *prog, TModoDespacho despacho);
+void bench_despacho(const TPrograma *prog);
+void relata_perfil(const TPrograma *prog, const char *caminho);
+int executa_jit(const TPrograma *prog);
+int escreve_elf(const TPrograma *prog, const char *caminho);
+int escreve_imagem(const TPrograma *prog, uint32_t raiz, const char *caminho);
+int roda_imagem(const char *caminho);
+void bench_imagem(const char *arquivo, int execucoes);
+void bench_divisao(const char *caminho, int max_threads);
+uint32_t consome(TAtomo esperado);
 const char* nome_atomo(TAtomo a);
-void program();
-void block();
-void variable_declaration_part();
-void variable_declaration();
-void type();
-void statement_part();
-void statement();
-void assignment_statement();
-void read_statement();
-void write_statement();
-void if_statement();
-void while_statement();
-void expression();
-void simple_expression();
-void term();
-void factor();
-void relational_operator();
-void adding_operator();
-void multiplying_operator();
+uint32_t program();
+uint32_t block();
+uint32_t variable_declaration_part();
+uint32_t variable_declaration();
+TAtomo type();
+uint32_t statement_part();
+uint32_t statement_part_paralela();
+uint32_t statement();
+uint32_t elemento_lista(uint32_t lista, uint32_t anterior);
+void documento_registra(size_t atomo, uint32_t no, uint32_t lista, uint32_t anterior);
+int documento_abre(TDocumento *d, const char *texto, size_t tamanho);
+int documento_edita(TDocumento *d, size_t pos, size_t removidos, const char *inserido, size_t n);
+int documento_recompila(TDocumento *d);
+void documento_libera(TDocumento *d);
+int gera_edicoes(const char *arquivo, long n_edicoes);
+void bench_edicoes(const char *registro, const char *arquivo, int conferir_cada);
+int gera_programa(const char *opcoes);
+static int le_tamanho(const char *texto, uint64_t *tamanho);
+static const char *confere_codigo(const int32_t *codigo, uint32_t tamanho, uint32_t n_constantes, uint32_t n_variaveis, uint32_t profundidade);
+int bench_arquivos(const char **arquivos, size_t n, int repeticoes);
+uint32_t assignment_statement();
+uint32_t read_statement();
+uint32_t write_statement();
+uint32_t expression();
+uint32_t factor();
+
+#ifdef PK_ESTATISTICAS
+static double tempo_cpu() {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static inline TMarca estat_marca() {
+    TMarca m = { agora(), tempo_cpu() };
+    return m;
+}
+
+static inline void estat_fase(int fase, TMarca inicio) {
+    ctx->estat.parede[fase] += agora() - inicio.parede;
+    ctx->estat.cpu[fase] += tempo_cpu() - inicio.cpu;
+}
+
+static inline void estat_para(TCronometro *c) {
+    *c->destino += agora() - c->inicio;
+}
+
+static inline void estat_fecha_analise() {
+    if (!ctx->estat.analisando) return;
+    ctx->estat.parede_analise += agora() - ctx->estat.inicio_analise.parede;
+    ctx->estat.cpu_analise += tempo_cpu() - ctx->estat.inicio_analise.cpu;
+    ctx->estat.analisando = 0;
+}
+
+static inline void estat_aloca(size_t bytes) {
+    if (ctx == NULL) return;   // carrega_fonte também serve aos modos de medição, sem contexto
+    ctx->estat.alocacoes++;
+    ctx->estat.bytes_alocados += bytes;
+}
+
+/*
+ * Relatório de --stats em stderr, em tabela ou JSON. obter_atomo (léxico
+ * sob demanda) e emite_atomo rodam dentro da análise sintática e só têm o
+ * tempo de parede somado por chamada: o tempo de CPU deles é a fração da
+ * CPU da análise proporcional à parede, e o da análise é o que sobra.
+ */
+static void relata_estatisticas(int json) {
+    TEstatisticas *e = &ctx->estat;
+    static const char *nomes[N_ESTAT] = { "carga", "lexico", "sintatico", "saida" };
+    double parede[N_ESTAT], cpu[N_ESTAT];
+    int estimado[N_ESTAT] = { 0, e->chamadas_lexico > 0, 1, 1 };
+    double fracao = e->parede_analise > 0 ? e->cpu_analise / e->parede_analise : 0;
+    parede[ESTAT_CARGA] = e->parede[ESTAT_CARGA];
+    cpu[ESTAT_CARGA] = e->cpu[ESTAT_CARGA];
+    parede[ESTAT_LEXICO] = e->parede[ESTAT_LEXICO] + e->chamadas_lexico;
+    cpu[ESTAT_LEXICO] = e->cpu[ESTAT_LEXICO] + e->chamadas_lexico * fracao;
+    parede[ESTAT_SAIDA] = e->chamadas_saida;
+    cpu[ESTAT_SAIDA] = e->chamadas_saida * fracao;
+    parede[ESTAT_SINTATICO] = e->parede_analise - e->chamadas_lexico - e->chamadas_saida;
+    cpu[ESTAT_SINTATICO] = parede[ESTAT_SINTATICO] * fracao;
+    uint64_t total = 0;
+    for (int a = 0; a <= EOS; a++) total += e->atomos[a];
+
+    if (json) {
+        fprintf(stderr, "{\n  \"fases\": {\n");
+        for (int f = 0; f < N_ESTAT; f++)
+            fprintf(stderr, "    \"%s\": {\"parede_s\": %.6f, \"cpu_s\": %.6f, \"cpu_estimada\": %s}%s\n",
+                    nomes[f], parede[f], cpu[f], estimado[f] ? "true" : "false", f + 1 < N_ESTAT ? "," : "");
+        fprintf(stderr, "  },\n  \"atomos\": {\"total\": %llu", (unsigned long long)total);
+        for (int a = 0; a <= EOS; a++)
+            if (e->atomos[a]) fprintf(stderr, ", \"%s\": %llu", nome_atomo((TAtomo)a), (unsigned long long)e->atomos[a]);
+        fprintf(stderr, "},\n  \"bytes_fonte\": %zu,\n  \"bytes_espaco\": %llu,\n  \"bytes_comentario\": %llu,\n",
+                ctx->fonte.tamanho, (unsigned long long)e->bytes_espaco, (unsigned long long)e->bytes_comentario);
+        fprintf(stderr, "  \"profundidade_expression\": %u,\n  \"profundidade_statement\": %u,\n",
+                e->profundidade_expressao, e->profundidade_comando);
+        fprintf(stderr, "  \"alocacoes\": %llu,\n  \"bytes_alocados\": %llu\n}\n",
+                (unsigned long long)e->alocacoes, (unsigned long long)e->bytes_alocados);
+        return;
+    }
+    fprintf(stderr, "%-10s %12s %12s\n", "fase", "parede (s)", "cpu (s)");
+    for (int f = 0; f < N_ESTAT; f++)
+        fprintf(stderr, "%-10s %12.6f %11.6f%s\n", nomes[f], parede[f], cpu[f], estimado[f] ? "~" : " ");
+    fprintf(stderr, "(~: cpu rateada pela parede dentro da analise)\n\n");
+    fprintf(stderr, "atomos: %llu\n", (unsigned long long)total);
+    for (int a = 0; a <= EOS; a++)
+        if (e->atomos[a]) fprintf(stderr, "  %-12s %12llu  %5.1f%%\n", nome_atomo((TAtomo)a), (unsigned long long)e->atomos[a], 100.0 * e->atomos[a] / total);
+    double bytes = ctx->fonte.tamanho > 0 ? (double)ctx->fonte.tamanho : 1;
+    fprintf(stderr, "\nbytes: %zu no fonte, %llu de espacos (%.1f%%), %llu em comentarios (%.1f%%)\n", ctx->fonte.tamanho,
+            (unsigned long long)e->bytes_espaco, 100.0 * e->bytes_espaco / bytes,
+            (unsigned long long)e->bytes_comentario, 100.0 * e->bytes_comentario / bytes);
+    fprintf(stderr, "profundidade maxima: expression %u, statement %u\n", e->profundidade_expressao, e->profundidade_comando);
+    fprintf(stderr, "alocacoes: %llu (%.1f MB pedidos)\n", (unsigned long long)e->alocacoes, e->bytes_alocados / (1024.0 * 1024.0));
+}
+#endif
 
 // =================================================================
 // FUNÇÃO PRINCIPAL
 // =================================================================
-int main() {
-    FILE *f = fopen("compilador.txt", "r");
-    if (f == NULL) {
-        perror("Erro ao abrir o arquivo 'compilador.txt'");
+int main(int argc, char *argv[]) {
+    const char *caminho = "compilador.txt";
+    const char **arquivos = (const char**)malloc((size_t)argc * sizeof(char*));
+    size_t n_arquivos = 0;
+    int trace_explicito = 0;
+    int despacho_explicito = 0;
+    int pedidos_bench = 1000;
+    const char *registro_edicoes = NULL;   // --bench-edits=
+    long gerar_edicoes = 0;                // --gen-edits=
+    int conferir_edicoes = 0;              // --verify-edits
+    int medir = 0;                         // --bench
+    int estatisticas = 0;                  // --stats: 1 tabela, 2 JSON
+    int repeticoes_bench = 5;              // --bench-reps=
+    const char *imagem_entrada = NULL;     // --run-image=
+    int execucoes_bench_imagem = 0;        // --bench-image[=N]
+    int threads_bench_divisao = 0;         // --bench-parse[=N]
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--palavras=strcmp") == 0) modo_palavras = PALAVRAS_STRCMP;
+        else if (strcmp(argv[i], "--palavras=hash") == 0) modo_palavras = PALAVRAS_HASH;
+        else if (strcmp(argv[i], "--trace=text") == 0) { modo_trace = TRACE_TEXTO; trace_explicito = 1; }
+        else if (strcmp(argv[i], "--trace=binary") == 0) { modo_trace = TRACE_BINARIO; trace_explicito = 1; }
+        else if (strcmp(argv[i], "--trace=off") == 0) { modo_trace = TRACE_DESLIGADO; trace_explicito = 1; }
+        else if (strcmp(argv[i], "--lex=stream") == 0) modo_lexico = LEX_SOB_DEMANDA;
+        else if (strcmp(argv[i], "--lex=bulk") == 0) modo_lexico = LEX_EM_LOTE;
+        else if (strcmp(argv[i], "--lex=pipeline") == 0) modo_lexico = LEX_ESTEIRA;
+        else if (strcmp(argv[i], "--simd=auto") == 0) modo_varredura = VARREDURA_AUTO;
+        else if (strcmp(argv[i], "--simd=scalar") == 0) modo_varredura = VARREDURA_ESCALAR;
+        else if (strcmp(argv[i], "--simd=sse2") == 0) modo_varredura = VARREDURA_SSE2;
+        else if (strcmp(argv[i], "--simd=avx2") == 0) modo_varredura = VARREDURA_AVX2;
+        else if (strcmp(argv[i], "--ast=dump") == 0) modo_ast = AST_DESPEJO;
+        else if (strcmp(argv[i], "--ast=stats") == 0) modo_ast = AST_ESTATISTICAS;
+        else if (strcmp(argv[i], "--run") == 0) executar = 1;
+        else if (strcmp(argv[i], "--bench-dispatch") == 0) executar = 2;
+        else if (strcmp(argv[i], "--profile") == 0) perfilar = 1;
+        else if (strncmp(argv[i], "--profile=", 10) == 0) { perfilar = 1; caminho_perfil = argv[i] + 10; }
+        else if (strncmp(argv[i], "--opt=", 6) == 0) {
+            if (!le_opcao_otim(argv[i] + 6)) {
+                printf("Lista de otimizacoes invalida: %s\n", argv[i] + 6);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--opt-stats") == 0) relatorio_otim = 1;
+        else if (strcmp(argv[i], "--check") == 0) verificacoes = VERIF_TODAS;
+        else if (strncmp(argv[i], "--check=", 8) == 0) {
+            if (!le_opcao_verificacao(argv[i] + 8)) {
+                printf("Lista de verificacoes invalida: %s\n", argv[i] + 8);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--check-stats") == 0) relatorio_fluxo = 1;
+        else if (strcmp(argv[i], "--dispatch=switch") == 0) { modo_despacho = DESPACHO_SWITCH; despacho_explicito = 1; }
+        else if (strcmp(argv[i], "--dispatch=jit") == 0) {
+            despacho_explicito = 1;
+#ifdef TEM_NATIVO
+            modo_despacho = DESPACHO_JIT;
+#else
+            printf("Backend nativo disponivel apenas em x86-64/Linux; usando a maquina virtual.\n");
+#endif
+        }
+        else if (strncmp(argv[i], "--emit-elf=", 11) == 0) {
+#ifdef TEM_NATIVO
+            caminho_elf = argv[i] + 11;
+            executar = 3;
+#else
+            printf("Backend nativo disponivel apenas em x86-64/Linux.\n");
+            return 1;
+#endif
+        }
+        else if (strncmp(argv[i], "--emit-image=", 13) == 0) {
+            caminho_imagem = argv[i] + 13;
+            executar = 4;
+        }
+        else if (strncmp(argv[i], "--run-image=", 12) == 0) imagem_entrada = argv[i] + 12;
+        else if (strcmp(argv[i], "--bench-image") == 0) execucoes_bench_imagem = 200;
+        else if (strncmp(argv[i], "--bench-image=", 14) == 0) execucoes_bench_imagem = atoi(argv[i] + 14);
+        else if (strcmp(argv[i], "--dispatch=goto") == 0) {
+            despacho_explicito = 1;
+#ifdef TEM_GOTO_COMPUTADO
+            modo_despacho = DESPACHO_GOTO;
+#else
+            printf("Este compilador nao suporta goto computado; usando switch.\n");
+#endif
+        }
+        else if (strcmp(argv[i], "--bench-lex") == 0 && i + 1 < argc) {
+            seleciona_varredura(modo_varredura);
+            bench_lex(argv[i + 1]);
+            return 0;
+        }
+        else if (strcmp(argv[i], "--bench-palavras") == 0) {
+            bench_palavras(i + 1 < argc ? atol(argv[i + 1]) : 2000000);
+            return 0;
+        }
+        else if (strncmp(argv[i], "--max-errors=", 13) == 0) {
+            max_erros = atoi(argv[i] + 13);
+            if (max_erros <= 0) max_erros = INT_MAX;   // 0: sem limite
+        }
+        else if (strncmp(argv[i], "--parse-threads=", 16) == 0) threads_analise = atoi(argv[i] + 16);
+        else if (strcmp(argv[i], "--bench-parse") == 0) threads_bench_divisao = 4;
+        else if (strncmp(argv[i], "--bench-parse=", 14) == 0) threads_bench_divisao = atoi(argv[i] + 14);
+        else if (strncmp(argv[i], "--jobs=", 7) == 0) tarefas = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) tarefas = atoi(argv[++i]);
+        else if (strncmp(argv[i], "--server=", 9) == 0) { modo_servidor = SERVIDOR_ESCUTA; caminho_socket = argv[i] + 9; }
+        else if (strncmp(argv[i], "--client=", 9) == 0) { modo_servidor = SERVIDOR_CLIENTE; caminho_socket = argv[i] + 9; }
+        else if (strcmp(argv[i], "--bench-server") == 0) modo_servidor = SERVIDOR_BENCH;
+        else if (strncmp(argv[i], "--bench-server=", 15) == 0) { modo_servidor = SERVIDOR_BENCH; pedidos_bench = atoi(argv[i] + 15); }
+        else if (strncmp(argv[i], "--gen-edits=", 12) == 0) gerar_edicoes = atol(argv[i] + 12);
+        else if (strncmp(argv[i], "--bench-edits=", 14) == 0) registro_edicoes = argv[i] + 14;
+        else if (strcmp(argv[i], "--verify-edits") == 0) conferir_edicoes = 1;
+        else if (strncmp(argv[i], "--gen-program=", 14) == 0) return gera_programa(argv[i] + 14);
+        else if (strcmp(argv[i], "--bench") == 0) medir = 1;
+        else if (strcmp(argv[i], "--stats") == 0) estatisticas = 1;
+        else if (strcmp(argv[i], "--stats=json") == 0) estatisticas = 2;
+        else if (strncmp(argv[i], "--bench-reps=", 13) == 0) repeticoes_bench = atoi(argv[i] + 13);
+        else if (strncmp(argv[i], "--cache=", 8) == 0) diretorio_cache = argv[i] + 8;
+        else if (strcmp(argv[i], "--cache") == 0) diretorio_cache = "";
+        else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            if (!le_tamanho(argv[i] + 13, &limite_cache) || strchr(argv[i], ',') != NULL) {
+                printf("Tamanho de cache invalido: %s\n", argv[i] + 13);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cache-stats") == 0) relatorio_cache = 1;
+        else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) caminho = arquivos[n_arquivos++] = argv[i];
+        else {
+            printf("Opcao desconhecida: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+#ifndef PK_ESTATISTICAS
+    if (estatisticas) {
+        printf("--stats exige compilar com -DPK_ESTATISTICAS.\n");
+        return 1;
+    }
+#endif
+
+    if (diretorio_cache != NULL) {
+        if (modo_ast != AST_NADA || modo_trace == TRACE_BINARIO || relatorio_otim || verificacoes || estatisticas || modo_servidor != SERVIDOR_NADA || executar == 4) {
+            printf("--cache aceita analise e --run, com trace em texto ou desligado, sem --ast, --opt-stats, --check, --stats, --emit-image ou servidor.\n");
+            return 1;
+        }
+        if (diretorio_cache[0] == '\0') diretorio_cache = diretorio_cache_padrao();
+    }
+
+    if (perfilar && (executar != 1 || diretorio_cache != NULL || execucoes_bench_imagem > 0 || modo_despacho == DESPACHO_JIT)) {
+        printf("--profile exige --run, na maquina virtual (--dispatch=goto ou switch), sem --cache nem --bench-image.\n");
+        return 1;
+    }
+
+    seleciona_varredura(modo_varredura);
+    inicia_nomes();
+    inicia_lexico();
+
+    if (gerar_edicoes > 0 || registro_edicoes != NULL) {
+        free(arquivos);
+        if (gerar_edicoes > 0) return gera_edicoes(caminho, gerar_edicoes);
+        bench_edicoes(registro_edicoes, caminho, conferir_edicoes);
+        return 0;
+    }
+
+    if (imagem_entrada != NULL) {
+        free(arquivos);
+        // O goto computado copiaria o código inteiro antes de rodar
+        if (!despacho_explicito) modo_despacho = DESPACHO_SWITCH;
+        return roda_imagem(imagem_entrada);
+    }
+
+    if (execucoes_bench_imagem > 0) {
+        free(arquivos);
+        bench_imagem(caminho, execucoes_bench_imagem);
+        return 0;
+    }
+
+    if (threads_bench_divisao > 0) {
+        free(arquivos);
+        bench_divisao(caminho, threads_bench_divisao > 1 ? threads_bench_divisao : 2);
+        return 0;
+    }
+
+    if (medir) {
+        if (n_arquivos == 0) arquivos[n_arquivos++] = caminho;
+        int status = bench_arquivos(arquivos, n_arquivos, repeticoes_bench > 0 ? repeticoes_bench : 1);
+        free(arquivos);
+        return status;
+    }
+
+    if (modo_servidor != SERVIDOR_NADA) {
+        if (executar || modo_ast != AST_NADA || verificacoes || modo_trace == TRACE_BINARIO || tarefas > 0) {
+            printf("--server, --client e --bench-server aceitam apenas analise, com trace em texto ou desligado, sem --check.\n");
+            return 1;
+        }
+        free(arquivos);
+        if (modo_servidor == SERVIDOR_ESCUTA) return servidor(caminho_socket);
+        if (modo_servidor == SERVIDOR_CLIENTE) return cliente(caminho_socket, caminho);
+        bench_servidor(caminho, pedidos_bench > 0 ? pedidos_bench : 1000);
+        return 0;
+    }
+
+    if (tarefas > 0) {
+        if (executar || modo_ast != AST_NADA || verificacoes || modo_trace == TRACE_BINARIO) {
+            printf("--jobs aceita apenas analise, com trace em texto ou desligado, sem --check.\n");
+            return 1;
+        }
+        if (!trace_explicito) modo_trace = TRACE_DESLIGADO;
+        int status = compila_em_lote(arquivos, n_arquivos, tarefas);
+        if (diretorio_cache != NULL && relatorio_cache) cache_relata();
+        free(arquivos);
+        return status;
+    }
+    free(arquivos);
+
+    // Executando, a saída padrão pertence ao programa: sem trace, salvo pedido explícito
+    if (executar && !trace_explicito) modo_trace = TRACE_DESLIGADO;
+
+    TContexto contexto;
+    TConsultaCache consulta;
+    TPrograma prog;
+    memset(&prog, 0, sizeof(prog));
+    inicia_contexto(&contexto, stdout);
+    int status = diretorio_cache != NULL ? cache_compila(caminho, &consulta, &prog) : compila_arquivo(caminho);
+#ifdef PK_ESTATISTICAS
+    if (estatisticas) {
+        saida_descarrega();
+        relata_estatisticas(estatisticas == 2);
+    }
+#endif
+    // Falta de memória depois da análise (--ast, --check, geração) também encerra com erro
+    if (status == 0) {
+        if (setjmp(ctx->salto_erro) != 0) status = 1;
+    }
+
+    if (status == 0 && modo_ast == AST_DESPEJO) despeja_ast(ctx->raiz, 0);
+    else if (status == 0 && modo_ast == AST_ESTATISTICAS) {
+        fprintf(stderr, "ast: %u nos, %zu bytes por no, %.1f MB, %.3f s de analise (%.1f M nos/s)\n",
+                ctx->ast.quantidade - 1, sizeof(TNo), ctx->ast.quantidade * sizeof(TNo) / (1024.0 * 1024.0),
+                ctx->tempo_analise, (ctx->ast.quantidade - 1) / ctx->tempo_analise / 1e6);
+    }
+    // Antes da otimização, que reescreve a árvore
+    if (status == 0 && verificacoes) {
+        TEstatisticasFluxo est;
+        verifica_fluxo(ctx->raiz, verificacoes, &est);
+        if (relatorio_fluxo) {
+            fprintf(stderr, "grafo        : %u blocos, %u referencias, %u faixas de %d variaveis (%.3f s)\n", est.blocos, est.referencias, est.faixas, 64 * PALAVRAS_FAIXA, est.tempo[0]);
+            fprintf(stderr, "inicializacao: %s%llu visitas, %u avisos (%.3f s)\n", verificacoes & VERIF_INICIALIZACAO ? "" : "[desligado] ", (unsigned long long)est.visitas[0], est.avisos[0], est.tempo[1]);
+            fprintf(stderr, "escrita morta: %s%llu visitas, %u avisos (%.3f s)\n", verificacoes & VERIF_ESCRITA_MORTA ? "" : "[desligado] ", (unsigned long long)est.visitas[1], est.avisos[1], est.tempo[2]);
+        }
+    }
+    // Num acerto do cache o bytecode já veio pronto
+    if (status == 0 && executar && prog.codigo == NULL) {
+        TEstatisticasOtim est;
+        otimiza(ctx->raiz, otimizacoes, &est);
+        if (relatorio_otim) {
+            fprintf(stderr, "copias : %s%u usos substituidos (%.3f s)\n", otimizacoes & OTIM_COPIAS ? "" : "[desligado] ", est.copias, est.tempo[0]);
+            fprintf(stderr, "dobra  : %s%u operacoes avaliadas (%.3f s)\n", otimizacoes & OTIM_DOBRA ? "" : "[desligado] ", est.dobras, est.tempo[1]);
+            fprintf(stderr, "forca  : %s%u operacoes reduzidas (%.3f s)\n", otimizacoes & OTIM_FORCA ? "" : "[desligado] ", est.reducoes, est.tempo[2]);
+            fprintf(stderr, "ramos  : %s%u if resolvidos, %u while removidos (%.3f s)\n", otimizacoes & OTIM_RAMOS ? "" : "[desligado] ", est.ramos, est.lacos, est.tempo[3]);
+        }
+        gera_program(&prog, ctx->raiz);
+    }
+    if (diretorio_cache != NULL) cache_conclui(&consulta, status, &prog);
+    if (status == 0 && executar) {
+        saida_vm = stdout;
+        if (executar == 2) bench_despacho(&prog);
+#ifdef TEM_NATIVO
+        else if (executar == 3) status = escreve_elf(&prog, caminho_elf) ? 0 : 1;
+#endif
+        else if (executar == 4) status = escreve_imagem(&prog, ctx->raiz, caminho_imagem) ? 0 : 1;
+        else status = executa(&prog, modo_despacho);
+        if (perfilar) relata_perfil(&prog, caminho_perfil);
+    }
+    libera_programa(&prog);
+    libera_contexto(&contexto);
+    if (diretorio_cache != NULL && relatorio_cache) cache_relata();
+    return status;
+}
+
+// =================================================================
+// CONTEXTO DE COMPILAÇÃO E MODO EM LOTE
+// =================================================================
+
+// Zera o contexto e o torna o corrente desta thread; destino NULL guarda a saída em memória
+void inicia_contexto(TContexto *c, FILE *destino) {
+    memset(c, 0, sizeof(*c));
+    ctx = c;
+    inicia_saida(destino);
+}
+
+/*
+ * Prepara o contexto para outra compilação sem devolver memória: arena,
+ * símbolos, tabela de átomos e saída mantêm a capacidade. Dos slots de
+ * símbolos só os ocupados são zerados, então o custo acompanha a
+ * compilação anterior e não o tamanho que a tabela já atingiu.
+ */
+void recicla_contexto(TContexto *c) {
+    TTabelaSimbolos *t = &c->simbolos;
+    for (uint32_t i = 0; i < t->quantidade; i++) {
+        uint32_t j = t->simbolos[i].hash & t->mascara;
+        while (t->slots[j] != i + 1) j = (j + 1) & t->mascara;
+        t->slots[j] = 0;
+    }
+    t->quantidade = 0;
+    t->uso_nomes = 0;
+    c->ast.quantidade = 0;
+    c->tabela.quantidade = 0;
+    c->tabela.erro[0] = '\0';
+    c->cursor_tabela = 0;
+    c->trivia.quantidade = c->trivia.cursor = 0;
+    c->lexico_em_lote = 0;
+    c->raiz = 0;
+    if (c->fonte.dados != NULL) libera_fonte(&c->fonte);
+    free(c->inicios_linha);
+    c->inicios_linha = NULL;
+    c->total_linhas = 0;
+    c->saida_uso = 0;
+    if (modo_trace == TRACE_BINARIO) inicia_trace_binario();
+}
+
+void libera_contexto(TContexto *c) {
+    libera_arena(&c->ast);
+    libera_simbolos(&c->simbolos);
+    libera_tabela(&c->tabela);
+    free(c->trivia.itens);
+    memset(&c->trivia, 0, sizeof(c->trivia));
+    if (c->fonte.dados != NULL) libera_fonte(&c->fonte);
+    free(c->inicios_linha);
+    free(c->saida_buf);
+    free(c->quadros);
+    free(c->operadores);
+    free(c->operandos);
+    c->inicios_linha = NULL;
+    c->saida_buf = NULL;
+    c->quadros = NULL;
+    c->operadores = NULL;
+    c->operandos = NULL;
+    c->n_quadros = c->capacidade_quadros = 0;
+    c->n_operadores = c->capacidade_operadores = 0;
+    c->n_operandos = c->capacidade_operandos = 0;
+    if (ctx == c) ctx = NULL;
+}
+
+/*
+ * Carrega e analisa um arquivo no contexto corrente. Devolve 0 com a árvore
+ * em ctx->raiz, ou 1 depois de emitir o diagnóstico; em ambos os casos a
+ * memória continua no contexto até libera_contexto.
+ */
+int compila_arquivo(const char *caminho) {
+    TFonte *fonte = &ctx->fonte;
+    ESTAT(TMarca carga = estat_marca();)
+    if (!carrega_fonte(caminho, fonte)) {
+        if (ctx->destino != NULL) fprintf(stderr, "%s\n", fonte->erro);
+        else mensagem("%s\n", fonte->erro);
+        return 1;
+    }
+    ESTAT(estat_fase(ESTAT_CARGA, carga);)
+    return compila_fonte();
+}
+
+// Analisa o texto já presente em ctx->fonte (com a folga de FOLGA_FONTE zeros)
+int compila_fonte() {
+    if (setjmp(ctx->salto_erro) != 0) {
+        if (ctx->esteira != NULL) esteira_encerra();
+        ESTAT(estat_fecha_analise();)
+        return 1;
+    }
+
+    TFonte *fonte = &ctx->fonte;
+    ctx->buffer = ctx->inicio_fonte = fonte->dados;
+    ctx->nLinha = 1;
+    ctx->erros = 0;
+    ctx->fim_panico = 0;
+    ctx->trivia.quantidade = ctx->trivia.cursor = 0;
+    ctx->trivia.descartando = 0;
+
+    if (modo_lexico == LEX_EM_LOTE) {
+        if (fonte->tamanho > UINT32_MAX) erro_fatal("Arquivo grande demais para --lex=bulk (limite de 4 GiB).\n");
+        double ini_lexico = agora();
+        ESTAT(TMarca lexico = estat_marca();)
+        lexa_em_lote(&ctx->tabela, fonte->tamanho);
+        ESTAT(estat_fase(ESTAT_LEXICO, lexico);)
+        ctx->tempo_lexico = agora() - ini_lexico;
+    } else if (modo_lexico == LEX_ESTEIRA) {
+        if (fonte->tamanho > UINT32_MAX) erro_fatal("Arquivo grande demais para --lex=pipeline (limite de 4 GiB).\n");
+        esteira_inicia();
+    }
+
+    double ini_parse = agora();
+    ESTAT(ctx->estat.inicio_analise = estat_marca(); ctx->estat.analisando = 1;)
+    // Estimativa de um nó a cada ~4 bytes de fonte evita realocar a arena no meio da análise
+    uint32_t estimativa = (uint32_t)(fonte->tamanho / 4 < UINT32_MAX / 2 ? fonte->tamanho / 4 + 1024 : UINT32_MAX / 2);
+    if (ctx->ast.capacidade < estimativa) arena_reserva(&ctx->ast, estimativa);
+    novo_no(NO_VAZIO, 0, 0, 0); // ocupa o índice 0 (NO_NULO)
+    avanca();
+    ctx->raiz = program();
+
+    consome(EOS);
+    if (ctx->esteira != NULL) esteira_encerra();
+    ctx->tempo_analise = agora() - ini_parse;
+    ESTAT(estat_fecha_analise();)
+    if (ctx->erros > 0) {
+        mensagem("%d linhas analisadas, %d erros\n", ctx->nLinha, ctx->erros);
+        return 1;
+    }
+    if (!executar) emite_resumo(ctx->nLinha);
+    else saida_descarrega();
+    return 0;
+}
+
+/*
+ * Modo em lote (--jobs N): cada thread começa com uma faixa contígua da
+ * lista e a consome pela frente; sem trabalho, rouba a metade final da
+ * faixa de outra thread. Resultados são impressos pela thread principal
+ * na ordem da lista, à medida que ficam prontos, com o caminho na frente
+ * de cada linha.
+ */
+typedef struct {
+    pthread_mutex_t trava;
+    size_t inicio, fim;           // índices ainda não iniciados
+} TFilaTarefas;
+
+typedef struct {
+    const char *caminho;
+    char *saida;
+    size_t tamanho;
+    int status;
+    int pronto;
+} TResultadoLote;
+
+typedef struct {
+    TResultadoLote *resultados;
+    TFilaTarefas *filas;
+    int n_filas;
+    pthread_mutex_t trava_prontos;
+    pthread_cond_t prontos;
+} TLote;
+
+typedef struct {
+    TLote *lote;
+    int id;
+} TTrabalhador;
+
+static int pega_tarefa(TLote *lote, int id, size_t *tarefa) {
+    TFilaTarefas *propria = &lote->filas[id];
+    for (;;) {
+        pthread_mutex_lock(&propria->trava);
+        int tem = propria->inicio < propria->fim;
+        if (tem) *tarefa = propria->inicio++;
+        pthread_mutex_unlock(&propria->trava);
+        if (tem) return 1;
+
+        // Roubo: metade final da primeira fila não vazia, a partir da vizinha
+        size_t ini = 0, fim = 0;
+        for (int k = 1; k < lote->n_filas && ini == fim; k++) {
+            TFilaTarefas *vitima = &lote->filas[(id + k) % lote->n_filas];
+            pthread_mutex_lock(&vitima->trava);
+            if (vitima->inicio < vitima->fim) {
+                size_t meio = vitima->inicio + (vitima->fim - vitima->inicio) / 2;
+                ini = meio;
+                fim = vitima->fim;
+                vitima->fim = meio;
+            }
+            pthread_mutex_unlock(&vitima->trava);
+        }
+        if (ini == fim) return 0;
+        pthread_mutex_lock(&propria->trava);
+        propria->inicio = ini;
+        propria->fim = fim;
+        pthread_mutex_unlock(&propria->trava);
+    }
+}
+
+static void *trabalhador_lote(void *arg) {
+    TTrabalhador *t = (TTrabalhador*)arg;
+    TLote *lote = t->lote;
+    size_t i;
+    while (pega_tarefa(lote, t->id, &i)) {
+        TResultadoLote *r = &lote->resultados[i];
+        TContexto c;
+        inicia_contexto(&c, NULL);
+        if (c.saida_buf == NULL) r->status = 1;   // sem memória: o arquivo falha e o lote segue
+        else if (diretorio_cache != NULL) {
+            TConsultaCache consulta;
+            r->status = cache_compila(r->caminho, &consulta, NULL);
+            cache_conclui(&consulta, r->status, NULL);
+        } else r->status = compila_arquivo(r->caminho);
+        r->saida = c.saida_buf;
+        r->tamanho = c.saida_uso;
+        c.saida_buf = NULL;
+        libera_contexto(&c);
+
+        pthread_mutex_lock(&lote->trava_prontos);
+        r->pronto = 1;
+        pthread_cond_broadcast(&lote->prontos);
+        pthread_mutex_unlock(&lote->trava_prontos);
+    }
+    return NULL;
+}
+
+// Acrescenta uma cópia de caminho à lista; devolve 0 se faltar memória
+static int lista_acrescenta(const char ***lista, size_t *k, size_t *cap, const char *caminho) {
+    if (*k == *cap) {
+        const char **nova = (const char**)realloc(*lista, *cap * 2 * sizeof(char*));
+        if (nova == NULL) return 0;
+        *lista = nova;
+        *cap *= 2;
+    }
+    char *copia = strdup(caminho);
+    if (copia == NULL) return 0;
+    (*lista)[(*k)++] = copia;
+    return 1;
+}
+
+// Expande "@lista" (um caminho por linha) e copia os demais argumentos; NULL se faltar memória
+static const char **lista_de_arquivos(const char **argumentos, size_t n, size_t *total, int *falhou) {
+    size_t cap = n + 16, k = 0;
+    const char **lista = (const char**)malloc(cap * sizeof(char*));
+    int sem_memoria = lista == NULL;
+    for (size_t i = 0; !sem_memoria && i < n; i++) {
+        if (argumentos[i][0] != '@') {
+            sem_memoria = !lista_acrescenta(&lista, &k, &cap, argumentos[i]);
+            continue;
+        }
+        FILE *f = fopen(argumentos[i] + 1, "r");
+        if (f == NULL) {
+            fprintf(stderr, "Erro ao abrir a lista '%s': %s\n", argumentos[i] + 1, strerror(errno));
+            *falhou = 1;
+            continue;
+        }
+        char *linha = NULL;
+        size_t tam = 0;
+        ssize_t n_lido;
+        while (!sem_memoria && (n_lido = getline(&linha, &tam, f)) > 0) {
+            while (n_lido > 0 && (linha[n_lido - 1] == '\n' || linha[n_lido - 1] == '\r')) linha[--n_lido] = '\0';
+            if (n_lido == 0) continue;
+            sem_memoria = !lista_acrescenta(&lista, &k, &cap, linha);
+        }
+        free(linha);
+        fclose(f);
+    }
+    if (sem_memoria) {
+        fprintf(stderr, "Erro ao alocar memoria.\n");
+        for (size_t i = 0; i < k; i++) free((char*)lista[i]);
+        free(lista);
+        return NULL;
+    }
+    *total = k;
+    return lista;
+}
+
+int compila_em_lote(const char **argumentos, size_t n_argumentos, int n_threads) {
+    size_t n;
+    int lista_falhou = 0;
+    const char **arquivos = lista_de_arquivos(argumentos, n_argumentos, &n, &lista_falhou);
+    if (arquivos == NULL) return 1;
+    TLote lote;
+    lote.resultados = (TResultadoLote*)calloc(n + 1, sizeof(TResultadoLote));
+    lote.n_filas = n_threads;
+    lote.filas = (TFilaTarefas*)calloc((size_t)n_threads, sizeof(TFilaTarefas));
+    pthread_t *threads = (pthread_t*)malloc((size_t)n_threads * sizeof(pthread_t));
+    TTrabalhador *trabalhadores = (TTrabalhador*)malloc((size_t)n_threads * sizeof(TTrabalhador));
+    if (lote.resultados == NULL || lote.filas == NULL || threads == NULL || trabalhadores == NULL) {
+        fprintf(stderr, "Erro ao alocar memoria.\n");
+        for (size_t i = 0; i < n; i++) free((char*)arquivos[i]);
+        free(threads);
+        free(trabalhadores);
+        free(lote.filas);
+        free(lote.resultados);
+        free(arquivos);
         return 1;
     }
+    pthread_mutex_init(&lote.trava_prontos, NULL);
+    pthread_cond_init(&lote.prontos, NULL);
+    for (size_t i = 0; i < n; i++) lote.resultados[i].caminho = arquivos[i];
+    for (int t = 0; t < n_threads; t++) {
+        pthread_mutex_init(&lote.filas[t].trava, NULL);
+        lote.filas[t].inicio = n * (size_t)t / (size_t)n_threads;
+        lote.filas[t].fim = n * (size_t)(t + 1) / (size_t)n_threads;
+    }
+
+    // As filas de threads que não puderam ser criadas são esvaziadas por roubo
+    double ini = agora();
+    int criadas = 0;
+    for (int t = 0; t < n_threads; t++) {
+        trabalhadores[t].lote = &lote;
+        trabalhadores[t].id = t;
+        int erro = pthread_create(&threads[criadas], NULL, trabalhador_lote, &trabalhadores[t]);
+        if (erro != 0) {
+            fprintf(stderr, "Erro ao criar thread: %s\n", strerror(erro));
+            break;
+        }
+        criadas++;
+    }
+    // Sem nenhuma thread, o próprio chamador faz o trabalho
+    if (criadas == 0) trabalhador_lote(&trabalhadores[0]);
+
+    size_t erros = 0;
+    for (size_t i = 0; i < n; i++) {
+        TResultadoLote *r = &lote.resultados[i];
+        pthread_mutex_lock(&lote.trava_prontos);
+        while (!r->pronto) pthread_cond_wait(&lote.prontos, &lote.trava_prontos);
+        pthread_mutex_unlock(&lote.trava_prontos);
+        for (size_t p = 0; p < r->tamanho; ) {
+            const char *fim = memchr(r->saida + p, '\n', r->tamanho - p);
+            size_t len = fim ? (size_t)(fim - (r->saida + p)) : r->tamanho - p;
+            printf("%s: %.*s\n", r->caminho, (int)len, r->saida + p);
+            p += len + 1;
+        }
+        if (r->saida == NULL && r->status != 0) printf("%s: Erro ao alocar memoria.\n", r->caminho);
+        erros += r->status != 0;
+        free(r->saida);
+    }
+    double dt = agora() - ini;
+
+    for (int t = 0; t < criadas; t++) pthread_join(threads[t], NULL);
+    fflush(stdout);
+    fprintf(stderr, "%zu arquivos, %zu com erro, %.3f s com %d threads (%.0f arquivos/s)\n",
+            n, erros, dt, criadas > 0 ? criadas : 1, n / (dt > 0 ? dt : 1e-9));
+
+    for (int t = 0; t < n_threads; t++) pthread_mutex_destroy(&lote.filas[t].trava);
+    pthread_mutex_destroy(&lote.trava_prontos);
+    pthread_cond_destroy(&lote.prontos);
+    for (size_t i = 0; i < n; i++) free((char*)arquivos[i]);
+    free(threads);
+    free(trabalhadores);
+    free(lote.filas);
+    free(lote.resultados);
+    free(arquivos);
+    return erros || lista_falhou ? 1 : 0;
+}
+
+// =================================================================
+// SERVIDOR DE COMPILAÇÃO (SOCKET UNIX)
+// =================================================================
+
+/*
+ * --server=CAMINHO fica residente num socket Unix e atende os pedidos em
+ * sequência com um único contexto, reciclado entre pedidos: depois do
+ * aquecimento, um arquivo do tamanho dos anteriores não faz nenhuma
+ * alocação. Cada conexão pode trazer vários pedidos; conexões simultâneas
+ * são intercaladas pedido a pedido.
+ *
+ * Pedido:   tipo (1 byte: 'P' caminho, 'F' texto-fonte), modo de trace
+ *           (TModoTrace, texto ou desligado), modo léxico (TModoLexico),
+ *           1 byte reservado, tamanho (u32) e os dados. Um caminho passa
+ *           de TAM_MAXIMO_CAMINHO ou um texto de TAM_MAXIMO_PEDIDO derruba
+ *           a conexão, como um pedido malformado.
+ * Resposta: status (i32: 0 ok, 1 erro), tamanho (u32) e a saída que o
+ *           compilador imprimiria (trace, resumo ou diagnóstico).
+ * Inteiros little-endian, como no trace binário.
+ */
+#define TAM_CABECALHO_PEDIDO 8
+#define TAM_MAXIMO_PEDIDO (256u << 20)     // texto-fonte maior que isso derruba a conexão
+#define TAM_MAXIMO_CAMINHO 4096
+#define LIMITE_BUFFER_OCIOSO (64u << 20)   // acima disso o servidor devolve a memória depois do pedido
+
+typedef struct {
+    char *texto;            // arquivo de um pedido 'P', com a folga de FOLGA_FONTE zeros
+    size_t capacidade_texto;
+} TServidor;
+
+// Estado de uma conexão: o pedido chega aos pedaços e a resposta sai aos pedaços
+typedef struct {
+    unsigned char cabecalho[TAM_CABECALHO_PEDIDO];
+    size_t recebido;        // bytes do pedido corrente já lidos, cabeçalho incluído
+    char *dados;            // corpo do pedido, com a folga de FOLGA_FONTE zeros
+    size_t capacidade_dados;
+    char *resposta;         // resposta que o socket não aceitou de uma vez
+    size_t capacidade_resposta;
+    size_t tamanho_resposta;
+    size_t enviado;
+} TConexao;
+
+static volatile sig_atomic_t servidor_encerrar;
+
+static void servidor_sinal(int sinal) {
+    (void)sinal;
+    servidor_encerrar = 1;
+}
+
+static int le_tudo(int fd, void *dados, size_t n) {
+    char *p = (char*)dados;
+    while (n > 0) {
+        ssize_t lido = read(fd, p, n);
+        if (lido < 0 && errno == EINTR) continue;
+        if (lido <= 0) return 0;
+        p += lido;
+        n -= (size_t)lido;
+    }
+    return 1;
+}
+
+// Descarta das partes os bytes já escritos
+static void avanca_partes(struct iovec **partes, int *n, size_t escrito) {
+    while (*n > 0 && escrito >= (*partes)->iov_len) {
+        escrito -= (*partes)->iov_len;
+        (*partes)++;
+        (*n)--;
+    }
+    if (*n > 0) {
+        (*partes)->iov_base = (char*)(*partes)->iov_base + escrito;
+        (*partes)->iov_len -= escrito;
+    }
+}
+
+static int escreve_tudo(int fd, struct iovec *partes, int n) {
+    while (n > 0) {
+        ssize_t escrito = writev(fd, partes, n);
+        if (escrito < 0 && errno == EINTR) continue;
+        if (escrito <= 0) return 0;
+        avanca_partes(&partes, &n, (size_t)escrito);
+    }
+    return 1;
+}
+
+static int garante_buffer(char **buf, size_t *capacidade, size_t necessario) {
+    if (*capacidade >= necessario) return 1;
+    size_t nova = *capacidade ? *capacidade : 4096;
+    while (nova < necessario) nova *= 2;
+    char *novo = (char*)realloc(*buf, nova);
+    if (novo == NULL) return 0;
+    *buf = novo;
+    *capacidade = nova;
+    return 1;
+}
+
+// Lê o arquivo inteiro para o buffer de texto do servidor, no lugar do mapeamento de carrega_fonte
+static int le_arquivo_servidor(TServidor *s, const char *caminho, size_t *tamanho, char *erro, size_t tam_erro) {
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) {
+        snprintf(erro, tam_erro, "Erro ao abrir o arquivo '%s': %s", caminho, strerror(errno));
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        snprintf(erro, tam_erro, "%s: nao e um arquivo regular", caminho);
+        close(fd);
+        return 0;
+    }
+    if (!garante_buffer(&s->texto, &s->capacidade_texto, (size_t)st.st_size + FOLGA_FONTE)) {
+        snprintf(erro, tam_erro, "Erro ao alocar memoria.");
+        close(fd);
+        return 0;
+    }
+    size_t usado = 0;
+    while (usado < (size_t)st.st_size) {
+        ssize_t lido = read(fd, s->texto + usado, (size_t)st.st_size - usado);
+        if (lido < 0 && errno == EINTR) continue;
+        if (lido < 0) {
+            snprintf(erro, tam_erro, "%s: %s", caminho, strerror(errno));
+            close(fd);
+            return 0;
+        }
+        if (lido == 0) break;
+        usado += (size_t)lido;
+    }
+    close(fd);
+    *tamanho = usado;
+    return 1;
+}
+
+/*
+ * Cabeçalho completo: confere os campos e o tamanho, que é recusado antes
+ * de qualquer alocação se passar do máximo, e reserva o corpo
+ */
+static int aceita_cabecalho(TConexao *c) {
+    uint32_t tamanho;
+    memcpy(&tamanho, c->cabecalho + 4, 4);
+    if ((c->cabecalho[0] != 'P' && c->cabecalho[0] != 'F') ||
+        (c->cabecalho[1] != TRACE_TEXTO && c->cabecalho[1] != TRACE_DESLIGADO) || c->cabecalho[2] > LEX_ESTEIRA)
+        return 0;
+    if (tamanho > (c->cabecalho[0] == 'P' ? TAM_MAXIMO_CAMINHO : TAM_MAXIMO_PEDIDO)) return 0;
+    return garante_buffer(&c->dados, &c->capacidade_dados, (size_t)tamanho + FOLGA_FONTE);
+}
+
+// Lê o que já chegou do pedido corrente: 1 completo, 0 falta chegar, -1 fim da conexão ou pedido malformado
+static int recebe_pedido(int fd, TConexao *c) {
+    for (;;) {
+        char *destino;
+        size_t falta;
+        if (c->recebido < TAM_CABECALHO_PEDIDO) {
+            destino = (char*)c->cabecalho + c->recebido;
+            falta = TAM_CABECALHO_PEDIDO - c->recebido;
+        } else {
+            uint32_t tamanho;
+            memcpy(&tamanho, c->cabecalho + 4, 4);
+            size_t lido = c->recebido - TAM_CABECALHO_PEDIDO;
+            if (lido == tamanho) return 1;
+            destino = c->dados + lido;
+            falta = tamanho - lido;
+        }
+        ssize_t n = read(fd, destino, falta);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+        c->recebido += (size_t)n;
+        if (c->recebido == TAM_CABECALHO_PEDIDO && !aceita_cabecalho(c)) return -1;
+    }
+}
+
+// Escreve o quanto o socket aceitar: 1 tudo enviado, 0 ainda falta, -1 conexão perdida
+static int envia_pendente(int fd, TConexao *c) {
+    while (c->enviado < c->tamanho_resposta) {
+        ssize_t escrito = write(fd, c->resposta + c->enviado, c->tamanho_resposta - c->enviado);
+        if (escrito < 0 && errno == EINTR) continue;
+        if (escrito < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (escrito <= 0) return -1;
+        c->enviado += (size_t)escrito;
+    }
+    c->tamanho_resposta = c->enviado = 0;
+    if (c->capacidade_resposta > LIMITE_BUFFER_OCIOSO) {
+        free(c->resposta);
+        c->resposta = NULL;
+        c->capacidade_resposta = 0;
+    }
+    return 1;
+}
+
+/*
+ * Envia a resposta direto do buffer de saída; o que o socket não aceitar
+ * agora é copiado para a conexão, porque o buffer de saída volta a ser
+ * usado pelo próximo pedido, e sai quando o poll der POLLOUT.
+ */
+static int envia_resposta(int fd, TConexao *c, struct iovec *partes, int n) {
+    while (n > 0) {
+        ssize_t escrito = writev(fd, partes, n);
+        if (escrito < 0 && errno == EINTR) continue;
+        if (escrito < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (escrito <= 0) return -1;
+        avanca_partes(&partes, &n, (size_t)escrito);
+    }
+    if (n == 0) return 1;
+    size_t resto = 0;
+    for (int i = 0; i < n; i++) resto += partes[i].iov_len;
+    if (!garante_buffer(&c->resposta, &c->capacidade_resposta, resto)) return -1;
+    for (int i = 0; i < n; i++) {
+        memcpy(c->resposta + c->tamanho_resposta, partes[i].iov_base, partes[i].iov_len);
+        c->tamanho_resposta += partes[i].iov_len;
+    }
+    c->enviado = 0;
+    return 0;
+}
+
+// Compila o pedido completo da conexão e responde, com o resultado de envia_resposta
+static int atende_pedido(TServidor *s, int fd, TConexao *c) {
+    uint32_t tamanho;
+    memcpy(&tamanho, c->cabecalho + 4, 4);
+    c->recebido = 0;
+    modo_trace = (TModoTrace)c->cabecalho[1];
+    modo_lexico = (TModoLexico)c->cabecalho[2];
+    recicla_contexto(ctx);
+
+    int32_t status = 1;
+    char *texto = c->dados;
+    size_t tamanho_fonte = tamanho;
+    char erro[sizeof(ctx->fonte.erro)];
+    if (c->cabecalho[0] == 'P') {
+        c->dados[tamanho] = '\0';
+        if (!le_arquivo_servidor(s, c->dados, &tamanho_fonte, erro, sizeof(erro))) {
+            mensagem("%s\n", erro);
+            tamanho_fonte = SIZE_MAX;
+        }
+        texto = s->texto;
+    }
+    if (tamanho_fonte != SIZE_MAX) {
+        memset(texto + tamanho_fonte, 0, FOLGA_FONTE);
+        ctx->fonte.dados = texto;
+        ctx->fonte.tamanho = tamanho_fonte;
+        status = compila_fonte();
+        ctx->fonte.dados = NULL;   // o texto pertence ao servidor
+    }
+
+    uint32_t tamanho_saida = (uint32_t)ctx->saida_uso;
+    unsigned char resposta[8];
+    memcpy(resposta, &status, 4);
+    memcpy(resposta + 4, &tamanho_saida, 4);
+    struct iovec partes[2] = { { resposta, sizeof(resposta) }, { ctx->saida_buf, ctx->saida_uso } };
+    int r = envia_resposta(fd, c, partes, 2);
+
+    // Um pedido excepcionalmente grande não deixa o servidor ocioso com a memória dele
+    if (s->capacidade_texto > LIMITE_BUFFER_OCIOSO) {
+        free(s->texto);
+        s->texto = NULL;
+        s->capacidade_texto = 0;
+    }
+    if (c->capacidade_dados > LIMITE_BUFFER_OCIOSO) {
+        free(c->dados);
+        c->dados = NULL;
+        c->capacidade_dados = 0;
+    }
+    if ((size_t)ctx->ast.capacidade * sizeof(TNo) > LIMITE_BUFFER_OCIOSO || ctx->saida_capacidade > LIMITE_BUFFER_OCIOSO) {
+        TContexto *contexto = ctx;
+        libera_contexto(contexto);
+        inicia_contexto(contexto, NULL);
+    }
+    return r;
+}
+
+static void libera_conexao(int fd, TConexao *c) {
+    close(fd);
+    free(c->dados);
+    free(c->resposta);
+}
+
+static int endereco_socket(const char *caminho, struct sockaddr_un *endereco) {
+    memset(endereco, 0, sizeof(*endereco));
+    endereco->sun_family = AF_UNIX;
+    if (strlen(caminho) >= sizeof(endereco->sun_path)) {
+        fprintf(stderr, "Caminho de socket longo demais: %s\n", caminho);
+        return 0;
+    }
+    strcpy(endereco->sun_path, caminho);
+    return 1;
+}
+
+int servidor(const char *caminho) {
+    struct sockaddr_un endereco;
+    if (!endereco_socket(caminho, &endereco)) return 1;
+    int escuta = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (escuta < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return 1;
+    }
+    unlink(caminho);
+    if (bind(escuta, (struct sockaddr*)&endereco, sizeof(endereco)) != 0 || listen(escuta, 64) != 0) {
+        fprintf(stderr, "%s: %s\n", caminho, strerror(errno));
+        close(escuta);
+        return 1;
+    }
+
+    // Sem SA_RESTART: o sinal interrompe o accept e o laço termina removendo o socket
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = servidor_sinal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    TContexto contexto;
+    TServidor s;
+    memset(&s, 0, sizeof(s));
+    inicia_contexto(&contexto, NULL);
+    fprintf(stderr, "servidor: escutando em %s\n", caminho);
+
+    /*
+     * Conexões abertas ficam no poll junto com o socket de escuta, todas sem
+     * bloqueio. Cada uma acumula o pedido conforme os bytes chegam e só é
+     * compilada com ele completo; a resposta que não couber no socket
+     * espera por POLLOUT. Um cliente lento, parado no meio do pedido ou sem
+     * ler a resposta, não trava os outros. Um pedido por conexão por volta.
+     */
+    size_t n_conexoes = 1, capacidade = 16;
+    struct pollfd *fds = (struct pollfd*)malloc(capacidade * sizeof(struct pollfd));
+    TConexao *conexoes = (TConexao*)calloc(capacidade, sizeof(TConexao));
+    if (fds == NULL || conexoes == NULL) {
+        fprintf(stderr, "Erro ao alocar memoria.\n");
+        free(fds);
+        free(conexoes);
+        close(escuta);
+        unlink(caminho);
+        libera_contexto(&contexto);
+        return 1;
+    }
+    fds[0].fd = escuta;
+    fds[0].events = POLLIN;
+    unsigned long pedidos = 0;
+    while (!servidor_encerrar) {
+        if (poll(fds, n_conexoes, -1) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            break;
+        }
+        for (size_t i = n_conexoes; i-- > 1;) {
+            if (fds[i].revents == 0) continue;
+            TConexao *c = &conexoes[i];
+            int r;
+            if (c->tamanho_resposta > 0) r = envia_pendente(fds[i].fd, c);
+            else {
+                r = recebe_pedido(fds[i].fd, c);
+                if (r == 1) {
+                    r = atende_pedido(&s, fds[i].fd, c);
+                    pedidos++;
+                }
+            }
+            if (r >= 0) {
+                fds[i].events = r == 0 && c->tamanho_resposta > 0 ? POLLOUT : POLLIN;
+                continue;
+            }
+            libera_conexao(fds[i].fd, c);
+            n_conexoes--;
+            fds[i] = fds[n_conexoes];
+            conexoes[i] = conexoes[n_conexoes];
+        }
+        if (fds[0].revents & POLLIN) {
+            int conexao = accept4(escuta, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (conexao >= 0 && n_conexoes == capacidade) {
+                struct pollfd *novos_fds = (struct pollfd*)realloc(fds, 2 * capacidade * sizeof(struct pollfd));
+                if (novos_fds != NULL) fds = novos_fds;
+                TConexao *novas = novos_fds != NULL ? (TConexao*)realloc(conexoes, 2 * capacidade * sizeof(TConexao)) : NULL;
+                if (novas != NULL) {
+                    conexoes = novas;
+                    capacidade *= 2;
+                } else {
+                    fprintf(stderr, "servidor: sem memoria para mais conexoes\n");
+                    close(conexao);
+                    conexao = -1;
+                }
+            }
+            if (conexao >= 0) {
+                memset(&conexoes[n_conexoes], 0, sizeof(TConexao));
+                fds[n_conexoes].fd = conexao;
+                fds[n_conexoes].events = POLLIN;
+                fds[n_conexoes++].revents = 0;
+            }
+        }
+    }
+
+    fprintf(stderr, "servidor: %lu pedidos atendidos\n", pedidos);
+    for (size_t i = 1; i < n_conexoes; i++) libera_conexao(fds[i].fd, &conexoes[i]);
+    free(fds);
+    free(conexoes);
+    close(escuta);
+    unlink(caminho);
+    libera_contexto(&contexto);
+    free(s.texto);
+    return 0;
+}
+
+static int conecta_servidor(const char *caminho) {
+    struct sockaddr_un endereco;
+    if (!endereco_socket(caminho, &endereco)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&endereco, sizeof(endereco)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Envia um pedido e recebe a saída em *resposta (buffer reaproveitado entre chamadas); -1 se a conexão falhar
+static int pede_ao_servidor(int fd, char tipo, const char *dados, uint32_t tamanho,
+                            char **resposta, size_t *capacidade, uint32_t *tamanho_resposta) {
+    unsigned char cabecalho[TAM_CABECALHO_PEDIDO] = { (unsigned char)tipo, (unsigned char)modo_trace, (unsigned char)modo_lexico, 0 };
+    memcpy(cabecalho + 4, &tamanho, 4);
+    struct iovec partes[2] = { { cabecalho, sizeof(cabecalho) }, { (void*)dados, tamanho } };
+    if (!escreve_tudo(fd, partes, 2)) return -1;
+
+    unsigned char cabecalho_resposta[8];
+    int32_t status;
+    if (!le_tudo(fd, cabecalho_resposta, sizeof(cabecalho_resposta))) return -1;
+    memcpy(&status, cabecalho_resposta, 4);
+    memcpy(tamanho_resposta, cabecalho_resposta + 4, 4);
+    if (!garante_buffer(resposta, capacidade, *tamanho_resposta + 1)) return -1;
+    if (!le_tudo(fd, *resposta, *tamanho_resposta)) return -1;
+    return status;
+}
+
+/*
+ * --client=CAMINHO arquivo: compila no servidor e imprime a resposta como se
+ * o compilador tivesse rodado aqui. Arquivos vão pelo caminho absoluto (o
+ * servidor pode ter outro diretório corrente); "-" envia o texto do stdin.
+ */
+int cliente(const char *caminho, const char *arquivo) {
+    int fd = conecta_servidor(caminho);
+    if (fd < 0) {
+        fprintf(stderr, "Servidor indisponivel em %s: %s\n", caminho, strerror(errno));
+        return 1;
+    }
+    TFonte fonte;
+    memset(&fonte, 0, sizeof(fonte));
+    char tipo = 'F';
+    const char *dados;
+    size_t tamanho;
+    char *absoluto = NULL;
+    if (strcmp(arquivo, "-") == 0) {
+        if (!carrega_fonte("-", &fonte)) {
+            fprintf(stderr, "%s\n", fonte.erro);
+            close(fd);
+            return 1;
+        }
+        dados = fonte.dados;
+        tamanho = fonte.tamanho;
+    } else {
+        absoluto = realpath(arquivo, NULL);
+        tipo = 'P';
+        dados = absoluto != NULL ? absoluto : arquivo;   // inexistente: o servidor relata o erro
+        tamanho = strlen(dados);
+    }
+
+    char *resposta = NULL;
+    size_t capacidade = 0;
+    uint32_t tamanho_resposta = 0;
+    int status = tamanho > UINT32_MAX ? -1 : pede_ao_servidor(fd, tipo, dados, (uint32_t)tamanho, &resposta, &capacidade, &tamanho_resposta);
+    if (status < 0) {
+        fprintf(stderr, "Falha na comunicacao com o servidor em %s\n", caminho);
+        status = 1;
+    } else {
+        fwrite(resposta, 1, tamanho_resposta, stdout);
+    }
+    close(fd);
+    free(resposta);
+    free(absoluto);
+    if (fonte.dados != NULL) libera_fonte(&fonte);
+    return status;
+}
+
+static int compara_tempos(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void relata_latencias(const char *rotulo, double *tempos, int n) {
+    double soma = 0;
+    for (int i = 0; i < n; i++) soma += tempos[i];
+    qsort(tempos, (size_t)n, sizeof(double), compara_tempos);
+    int i99 = n * 99 / 100 < n ? n * 99 / 100 : n - 1;
+    printf("%-22s %10.1f %10.1f %10.1f\n", rotulo, tempos[n / 2] * 1e6, tempos[i99] * 1e6, soma / n * 1e6);
+}
+
+// Tempo de fork, exec e espera de um processo sem entrada e com a saída descartada
+static double tempo_processo(char *const argumentos[], int nulo) {
+    double ini = agora();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(nulo, STDIN_FILENO);
+        dup2(nulo, STDOUT_FILENO);
+        dup2(nulo, STDERR_FILENO);
+        execv(argumentos[0], argumentos);
+        _exit(127);
+    }
+    int st;
+    if (pid > 0) waitpid(pid, &st, 0);
+    return agora() - ini;
+}
+
+/*
+ * --bench-server[=N] arquivo: sobe um servidor num processo filho e mede a
+ * latência de N pedidos por uma conexão persistente (por caminho e por
+ * texto), contra N execuções de fork+exec do próprio binário, compilando
+ * diretamente e como cliente do servidor.
+ */
+void bench_servidor(const char *arquivo, int pedidos) {
+    char executavel[4096];
+    ssize_t n = readlink("/proc/self/exe", executavel, sizeof(executavel) - 1);
+    char *absoluto = realpath(arquivo, NULL);
+    if (n < 0 || absoluto == NULL) {
+        fprintf(stderr, "%s: %s\n", n < 0 ? "/proc/self/exe" : arquivo, strerror(errno));
+        free(absoluto);
+        return;
+    }
+    executavel[n] = '\0';
+    TFonte fonte;
+    if (!carrega_fonte(absoluto, &fonte)) {
+        fprintf(stderr, "%s\n", fonte.erro);
+        free(absoluto);
+        return;
+    }
+
+    char caminho[64], opcao_socket[80];
+    snprintf(caminho, sizeof(caminho), "/tmp/pk-bench-%d.sock", (int)getpid());
+    snprintf(opcao_socket, sizeof(opcao_socket), "--client=%s", caminho);
+    int nulo = open("/dev/null", O_RDWR);
+    pid_t filho = fork();
+    if (filho == 0) {
+        dup2(nulo, STDERR_FILENO);
+        _exit(servidor(caminho));
+    }
+    int fd = -1;
+    for (int tentativa = 0; tentativa < 5000 && (fd = conecta_servidor(caminho)) < 0; tentativa++) usleep(1000);
+    if (fd < 0) {
+        fprintf(stderr, "Servidor de teste nao respondeu em %s\n", caminho);
+        kill(filho, SIGTERM);
+        waitpid(filho, NULL, 0);
+        libera_fonte(&fonte);
+        free(absoluto);
+        close(nulo);
+        return;
+    }
+
+    double *tempos = (double*)malloc((size_t)pedidos * sizeof(double));
+    char *resposta = NULL;
+    size_t capacidade = 0;
+    uint32_t tamanho_resposta = 0;
+    const char *trace = modo_trace == TRACE_DESLIGADO ? "--trace=off" : "--trace=text";
+    const char *lexico = modo_lexico == LEX_EM_LOTE ? "--lex=bulk" : modo_lexico == LEX_ESTEIRA ? "--lex=pipeline" : "--lex=stream";
+    char *direto[] = { executavel, (char*)trace, (char*)lexico, absoluto, NULL };
+    char *via_cliente[] = { executavel, (char*)trace, (char*)lexico, opcao_socket, absoluto, NULL };
+
+    printf("%s: %zu bytes, %d pedidos por modo, trace %s\n", arquivo, fonte.tamanho, pedidos, trace + 8);
+    printf("%-22s %10s %10s %10s\n", "", "p50 (us)", "p99 (us)", "media (us)");
+
+    // Aquecimento: o servidor dimensiona os buffers no primeiro pedido
+    pede_ao_servidor(fd, 'P', absoluto, (uint32_t)strlen(absoluto), &resposta, &capacidade, &tamanho_resposta);
+    for (int i = 0; i < pedidos; i++) {
+        double ini = agora();
+        pede_ao_servidor(fd, 'P', absoluto, (uint32_t)strlen(absoluto), &resposta, &capacidade, &tamanho_resposta);
+        tempos[i] = agora() - ini;
+    }
+    relata_latencias("servidor (caminho)", tempos, pedidos);
+    if (fonte.tamanho <= UINT32_MAX) {
+        for (int i = 0; i < pedidos; i++) {
+            double ini = agora();
+            pede_ao_servidor(fd, 'F', fonte.dados, (uint32_t)fonte.tamanho, &resposta, &capacidade, &tamanho_resposta);
+            tempos[i] = agora() - ini;
+        }
+        relata_latencias("servidor (texto)", tempos, pedidos);
+    }
+    fflush(stdout);
+    for (int i = 0; i < pedidos; i++) tempos[i] = tempo_processo(via_cliente, nulo);
+    relata_latencias("fork+exec --client", tempos, pedidos);
+    fflush(stdout);
+    for (int i = 0; i < pedidos; i++) tempos[i] = tempo_processo(direto, nulo);
+    relata_latencias("fork+exec compilador", tempos, pedidos);
+
+    close(fd);
+    kill(filho, SIGTERM);
+    waitpid(filho, NULL, 0);
+    close(nulo);
+    free(tempos);
+    free(resposta);
+    libera_fonte(&fonte);
+    free(absoluto);
+}
+
+// =================================================================
+// CACHE DE COMPILAÇÃO EM DISCO (--cache=)
+// =================================================================
+
+/*
+ * Uma entrada por combinação de texto-fonte, versão da saída do compilador
+ * (VERSAO_COMPILADOR) e opções que mudam o resultado, com o nome dado pelo hash de 128 bits dessa chave.
+ * A entrada guarda o status, a saída que a compilação imprimiria (trace,
+ * diagnósticos, resumo) e, com --run, o bytecode pronto: num acerto a
+ * análise, a otimização e a geração de código não rodam.
+ *
+ * Escritas vão para um temporário no mesmo diretório e entram com
+ * rename(), atômico entre processos; quem lê vê a entrada inteira ou
+ * nenhuma. Cada acerto renova o mtime do arquivo, e quando o diretório
+ * passa de --cache-size= as entradas de mtime mais antigo são removidas
+ * até sobrar 3/4 do limite (LRU).
+ */
+#define VERSAO_CACHE 1        // formato do arquivo de entrada
+#define VERSAO_COMPILADOR 1   // sobe a cada mudança no texto do trace, nos diagnósticos ou no bytecode
+
+typedef struct {
+    char magica[4];             // "PKCC"
+    uint32_t versao;
+    uint64_t chave[2];
+    int32_t status;
+    uint32_t tamanho_codigo;    // palavras de bytecode; 0 sem programa
+    uint32_t n_constantes;
+    uint32_t n_variaveis;
+    uint32_t profundidade_pilha;
+    uint32_t reservado;
+    uint64_t tamanho_saida;
+    uint64_t soma;              // hash do corpo: entrada truncada ou corrompida conta como falta
+} TCabecalhoCache;
+
+static struct {
+    pthread_mutex_t trava;      // estimativa de uso e poda
+    uint64_t uso;               // bytes no diretório, estimados desde a última varredura
+    int uso_conhecido;
+    unsigned long acertos, faltas, gravacoes, removidas, descartadas;
+    unsigned long temporarios;  // sufixo dos arquivos temporários deste processo
+} cache = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+#define CONTA_CACHE(campo) __atomic_fetch_add(&cache.campo, 1, __ATOMIC_RELAXED)
+
+static inline uint64_t mistura(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 33);
+}
+
+// Hash de 128 bits em duas faixas de 64, 16 bytes por iteração; h entra com a semente
+static void hash_bytes(const void *dados, size_t n, uint64_t h[2]) {
+    const unsigned char *p = (const unsigned char*)dados;
+    uint64_t a = h[0] ^ 0x9e3779b97f4a7c15ull, b = h[1] ^ 0xc2b2ae3d27d4eb4full;
+    uint64_t palavras[2];
+    for (size_t resto = n; ; resto -= 16, p += 16) {
+        if (resto >= 16) memcpy(palavras, p, 16);
+        else {
+            memset(palavras, 0, 16);
+            if (resto > 0) memcpy(palavras, p, resto);
+        }
+        a = (a ^ palavras[0]) * 0x87c37b91114253d5ull;
+        a = (a << 31 | a >> 33) + b;
+        b = (b ^ palavras[1]) * 0x4cf5ad432745937full;
+        b = (b << 29 | b >> 35) + a;
+        if (resto <= 16) break;
+    }
+    h[0] = mistura(a ^ n);
+    h[1] = mistura(b + h[0]);
+}
+
+// Opções que mudam a saída ou o bytecode; as demais (--simd, --palavras, --dispatch) não entram
+static void chave_cache(const TFonte *fonte, uint64_t chave[2]) {
+    struct {
+        uint32_t versao, versao_compilador;
+        int32_t trace, lexico, executar, max_erros;
+        uint32_t otimizacoes;
+    } opcoes;
+    memset(&opcoes, 0, sizeof(opcoes));
+    opcoes.versao = VERSAO_CACHE;
+    opcoes.versao_compilador = VERSAO_COMPILADOR;
+    opcoes.trace = modo_trace;
+    opcoes.lexico = modo_lexico;
+    opcoes.executar = executar != 0;
+    opcoes.max_erros = max_erros;
+    opcoes.otimizacoes = executar ? otimizacoes : 0;
+    chave[0] = chave[1] = 0;
+    hash_bytes(&opcoes, sizeof(opcoes), chave);
+    hash_bytes(fonte->dados, fonte->tamanho, chave);
+}
+
+static void caminho_entrada(const uint64_t chave[2], char *caminho, size_t tamanho) {
+    snprintf(caminho, tamanho, "%s/%016llx%016llx.pkc", diretorio_cache,
+             (unsigned long long)chave[0], (unsigned long long)chave[1]);
+}
+
+static uint64_t soma_corpo(const TCabecalhoCache *c, const char *saida, const int32_t *codigo, const int32_t *constantes) {
+    uint64_t h[2] = { c->chave[0], c->chave[1] };
+    hash_bytes(saida, c->tamanho_saida, h);
+    hash_bytes(codigo, c->tamanho_codigo * sizeof(int32_t), h);
+    hash_bytes(constantes, c->n_constantes * sizeof(int32_t), h);
+    return h[0];
+}
+
+// --cache sem diretório: $XDG_CACHE_HOME/paskenzie ou ~/.cache/paskenzie
+const char *diretorio_cache_padrao() {
+    static char caminho[4096];
+    const char *base = getenv("XDG_CACHE_HOME");
+    if (base != NULL && base[0] == '/') snprintf(caminho, sizeof(caminho), "%s/paskenzie", base);
+    else if ((base = getenv("HOME")) != NULL && base[0] != '\0') snprintf(caminho, sizeof(caminho), "%s/.cache/paskenzie", base);
+    else return ".pkcache";
+    return caminho;
+}
+
+// Cria o diretório e os que faltarem acima dele
+static int cria_diretorio(const char *caminho) {
+    char parcial[4096];
+    size_t n = strlen(caminho);
+    if (n >= sizeof(parcial)) return 0;
+    memcpy(parcial, caminho, n + 1);
+    for (size_t i = 1; i <= n; i++) {
+        if (parcial[i] != '/' && parcial[i] != '\0') continue;
+        char c = parcial[i];
+        parcial[i] = '\0';
+        if (mkdir(parcial, 0755) != 0 && errno != EEXIST) return 0;
+        parcial[i] = c;
+    }
+    return 1;
+}
+
+typedef struct {
+    struct timespec uso;
+    uint64_t tamanho;
+    char nome[40];
+} TEntradaDiretorio;
+
+static int compara_uso(const void *a, const void *b) {
+    const struct timespec *x = &((const TEntradaDiretorio*)a)->uso, *y = &((const TEntradaDiretorio*)b)->uso;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/*
+ * Varre o diretório, refaz a estimativa de uso e, acima do limite, remove
+ * as entradas usadas há mais tempo. Temporários de mais de uma hora são de
+ * processos que morreram no meio da gravação. Chamada com cache.trava.
+ */
+static void cache_poda() {
+    DIR *dir = opendir(diretorio_cache);
+    if (dir == NULL) return;
+    size_t n = 0, capacidade = 256;
+    TEntradaDiretorio *entradas = (TEntradaDiretorio*)malloc(capacidade * sizeof(TEntradaDiretorio));
+    uint64_t total = 0;
+    time_t agora_s = time(NULL);
+    struct dirent *d;
+    while (entradas != NULL && (d = readdir(dir)) != NULL) {
+        size_t tam_nome = strlen(d->d_name);
+        int temporario = strncmp(d->d_name, ".tmp-", 5) == 0;
+        if (!temporario && (tam_nome != 36 || strcmp(d->d_name + 32, ".pkc") != 0)) continue;
+        struct stat st;
+        if (fstatat(dirfd(dir), d->d_name, &st, 0) != 0) continue;
+        if (temporario) {
+            if (agora_s - st.st_mtime > 3600) unlinkat(dirfd(dir), d->d_name, 0);
+            continue;
+        }
+        if (n == capacidade) entradas = (TEntradaDiretorio*)realloc(entradas, (capacidade *= 2) * sizeof(TEntradaDiretorio));
+        if (entradas == NULL) break;
+        entradas[n].uso = st.st_mtim;
+        entradas[n].tamanho = (uint64_t)st.st_size;
+        memcpy(entradas[n].nome, d->d_name, tam_nome + 1);
+        total += entradas[n++].tamanho;
+    }
+    if (total > limite_cache && entradas != NULL) {
+        qsort(entradas, n, sizeof(TEntradaDiretorio), compara_uso);
+        for (size_t i = 0; i < n && total > limite_cache / 4 * 3; i++) {
+            if (unlinkat(dirfd(dir), entradas[i].nome, 0) != 0) continue;
+            total -= entradas[i].tamanho;
+            cache.removidas++;
+        }
+    }
+    closedir(dir);
+    free(entradas);
+    cache.uso = total;
+    cache.uso_conhecido = 1;
+}
+
+/*
+ * Lê e confere a entrada; num acerto põe a saída no buffer do contexto e o
+ * bytecode em prog. O diretório pode ser compartilhado, então o hash não
+ * basta: cada campo de tamanho é conferido contra o arquivo sem risco de
+ * estouro, e o bytecode passa pelo mesmo verificador das imagens antes de
+ * chegar à máquina virtual ou ao JIT. Qualquer falha conta como falta.
+ */
+static int cache_le(const uint64_t chave[2], int *status, TPrograma *prog) {
+    char caminho[4200];
+    caminho_entrada(chave, caminho, sizeof(caminho));
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) return 0;
+    TCabecalhoCache c;
+    struct stat st;
+    char *corpo = NULL;
+    int32_t *codigo = NULL, *constantes = NULL;
+    int ok = fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(c) && le_tudo(fd, &c, sizeof(c)) &&
+             memcmp(c.magica, "PKCC", 4) == 0 && c.versao == VERSAO_CACHE &&
+             c.chave[0] == chave[0] && c.chave[1] == chave[1];
+    uint64_t tamanho_corpo = ok ? (uint64_t)st.st_size - sizeof(c) : 0;
+    // tamanho_codigo e n_constantes têm 32 bits: a soma em 64 não estoura
+    ok = ok && c.tamanho_saida <= tamanho_corpo &&
+         tamanho_corpo - c.tamanho_saida == ((uint64_t)c.tamanho_codigo + c.n_constantes) * sizeof(int32_t) &&
+         tamanho_corpo < SIZE_MAX;
+    if (ok) {
+        corpo = (char*)malloc((size_t)tamanho_corpo + 1);
+        if (corpo == NULL) {
+            close(fd);
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+        ok = le_tudo(fd, corpo, (size_t)tamanho_corpo);
+    }
+    if (ok) {
+        const char *corpo_codigo = corpo + c.tamanho_saida;
+        const char *corpo_constantes = corpo_codigo + (size_t)c.tamanho_codigo * sizeof(int32_t);
+        ok = soma_corpo(&c, corpo, (const int32_t*)corpo_codigo, (const int32_t*)corpo_constantes) == c.soma &&
+             (prog == NULL || c.status != 0 || c.tamanho_codigo > 0);
+        // Cópias alinhadas, conferidas antes de qualquer uso
+        if (ok && prog != NULL && c.tamanho_codigo > 0) {
+            codigo = (int32_t*)malloc((size_t)c.tamanho_codigo * sizeof(int32_t));
+            constantes = (int32_t*)malloc(((size_t)c.n_constantes + 1) * sizeof(int32_t));
+            if (codigo == NULL || constantes == NULL) {
+                close(fd);
+                free(corpo);
+                free(codigo);
+                free(constantes);
+                erro_fatal("Erro ao alocar memoria.\n");
+            }
+            memcpy(codigo, corpo_codigo, (size_t)c.tamanho_codigo * sizeof(int32_t));
+            memcpy(constantes, corpo_constantes, (size_t)c.n_constantes * sizeof(int32_t));
+            ok = c.profundidade_pilha <= c.tamanho_codigo &&
+                 confere_codigo(codigo, c.tamanho_codigo, c.n_constantes, c.n_variaveis, c.profundidade_pilha) == NULL;
+        }
+    }
+    if (!ok) {
+        // Entrada de outro formato ou estragada: sai do caminho da próxima gravação
+        close(fd);
+        free(corpo);
+        free(codigo);
+        free(constantes);
+        unlink(caminho);
+        CONTA_CACHE(descartadas);
+        return 0;
+    }
+    futimens(fd, NULL);   // uso mais recente, para a poda
+    close(fd);
+
+    saida_escreve(corpo, c.tamanho_saida);
+    if (codigo != NULL) {
+        prog->codigo = codigo;
+        prog->constantes = constantes;
+        prog->tamanho = prog->capacidade = c.tamanho_codigo;
+        prog->n_constantes = prog->cap_constantes = c.n_constantes;
+        prog->n_variaveis = c.n_variaveis;
+        prog->profundidade_pilha = c.profundidade_pilha;
+    }
+    free(corpo);
+    *status = c.status;
+    return 1;
+}
+
+static void cache_grava(const uint64_t chave[2], int status, const char *saida, size_t tamanho_saida, const TPrograma *prog) {
+    TCabecalhoCache c;
+    memset(&c, 0, sizeof(c));
+    memcpy(c.magica, "PKCC", 4);
+    c.versao = VERSAO_CACHE;
+    c.chave[0] = chave[0];
+    c.chave[1] = chave[1];
+    c.status = status;
+    c.tamanho_saida = tamanho_saida;
+    if (prog != NULL && status == 0) {
+        c.tamanho_codigo = prog->tamanho;
+        c.n_constantes = prog->n_constantes;
+        c.n_variaveis = prog->n_variaveis;
+        c.profundidade_pilha = prog->profundidade_pilha;
+    }
+    uint64_t tamanho = sizeof(c) + tamanho_saida + ((uint64_t)c.tamanho_codigo + c.n_constantes) * sizeof(int32_t);
+    if (tamanho > limite_cache / 2) return;   // ocuparia o cache sozinha
+    c.soma = soma_corpo(&c, saida, c.tamanho_codigo ? prog->codigo : NULL, c.n_constantes ? prog->constantes : NULL);
+
+    char temporario[4200], caminho[4200];
+    snprintf(temporario, sizeof(temporario), "%s/.tmp-%ld-%lu", diretorio_cache, (long)getpid(),
+             __atomic_fetch_add(&cache.temporarios, 1, __ATOMIC_RELAXED));
+    caminho_entrada(chave, caminho, sizeof(caminho));
+    int fd = open(temporario, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == ENOENT && cria_diretorio(diretorio_cache)) fd = open(temporario, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return;
+    struct iovec partes[4] = {
+        { &c, sizeof(c) },
+        { (void*)saida, tamanho_saida },
+        { c.tamanho_codigo ? prog->codigo : NULL, c.tamanho_codigo * sizeof(int32_t) },
+        { c.n_constantes ? prog->constantes : NULL, c.n_constantes * sizeof(int32_t) },
+    };
+    int ok = escreve_tudo(fd, partes, 4);
+    if (close(fd) != 0) ok = 0;
+    if (!ok || rename(temporario, caminho) != 0) {
+        unlink(temporario);
+        return;
+    }
+    CONTA_CACHE(gravacoes);
+
+    pthread_mutex_lock(&cache.trava);
+    if (!cache.uso_conhecido) cache_poda();
+    else if ((cache.uso += tamanho) > limite_cache) cache_poda();
+    pthread_mutex_unlock(&cache.trava);
+}
+
+/*
+ * Carrega o arquivo e procura a entrada. Num acerto a saída guardada vai
+ * para o buffer do contexto e, com --run, o bytecode para prog; numa falta
+ * o arquivo é compilado. Nos dois casos a saída fica em memória até
+ * cache_conclui, que grava a entrada nova e a entrega ao destino.
+ */
+int cache_compila(const char *caminho, TConsultaCache *q, TPrograma *prog) {
+    q->destino = ctx->destino;
+    q->gravar = 0;
+    if (!carrega_fonte(caminho, &ctx->fonte)) {
+        if (ctx->destino != NULL) fprintf(stderr, "%s\n", ctx->fonte.erro);
+        else mensagem("%s\n", ctx->fonte.erro);
+        return 1;
+    }
+    chave_cache(&ctx->fonte, q->chave);
+    ctx->destino = NULL;
+    // Falta de memória ao ler a entrada encerra a compilação com erro; compila_fonte arma o seu próprio salto
+    if (setjmp(ctx->salto_erro) != 0) return 1;
+    int status;
+    if (cache_le(q->chave, &status, executar ? prog : NULL)) {
+        CONTA_CACHE(acertos);
+        return status;
+    }
+    CONTA_CACHE(faltas);
+    q->gravar = 1;
+    return compila_fonte();
+}
+
+void cache_conclui(TConsultaCache *q, int status, const TPrograma *prog) {
+    // Uma falha de recurso não é o resultado do fonte e não fica no cache
+    if (q->gravar && !ctx->falha_fatal) cache_grava(q->chave, status, ctx->saida_buf, ctx->saida_uso, executar ? prog : NULL);
+    ctx->destino = q->destino;
+    saida_descarrega();
+}
+
+void cache_relata() {
+    fprintf(stderr, "cache %s: %lu acertos, %lu faltas, %lu gravadas, %lu removidas pelo limite, %lu descartadas\n",
+            diretorio_cache, cache.acertos, cache.faltas, cache.gravacoes, cache.removidas, cache.descartadas);
+}
+
+// =================================================================
+// LEITURA DO TEXTO-FONTE
+// =================================================================
+
+/*
+ * Arquivos regulares são mapeados sem cópia. Antes do arquivo reserva-se uma
+ * região anônima com uma página a mais e o arquivo é mapeado por cima dela
+ * (MAP_FIXED): o resto da última página do arquivo vem zerado pelo kernel e a
+ * página anônima seguinte também, então sempre existe um '\0' logo após o
+ * último byte sem precisar escrever nada no mapeamento. Pipes, terminais e
+ * "-" (stdin) caem na leitura em blocos para um buffer com a mesma folga.
+ */
+static int carrega_fluxo(int fd, const char *caminho, TFonte *fonte) {
+    size_t capacidade = 1 << 16, usado = 0;
+    ESTAT(estat_aloca(capacidade + FOLGA_FONTE);)
+    char *dados = (char*)malloc(capacidade + FOLGA_FONTE);
+    if (dados == NULL) {
+        snprintf(fonte->erro, sizeof(fonte->erro), "Erro ao alocar memoria.");
+        return 0;
+    }
+    for (;;) {
+        if (usado == capacidade) {
+            capacidade *= 2;
+            ESTAT(estat_aloca(capacidade + FOLGA_FONTE);)
+            char *novo = (char*)realloc(dados, capacidade + FOLGA_FONTE);
+            if (novo == NULL) {
+                snprintf(fonte->erro, sizeof(fonte->erro), "Erro ao alocar memoria.");
+                free(dados);
+                return 0;
+            }
+            dados = novo;
+        }
+        ssize_t lido = read(fd, dados + usado, capacidade - usado);
+        if (lido == 0) break;
+        if (lido < 0) {
+            snprintf(fonte->erro, sizeof(fonte->erro), "%s: %s", caminho, strerror(errno));
+            free(dados);
+            return 0;
+        }
+        usado += (size_t)lido;
+    }
+    memset(dados + usado, 0, FOLGA_FONTE);
+    fonte->dados = dados;
+    fonte->tamanho = usado;
+    fonte->tamanho_reservado = capacidade + FOLGA_FONTE;
+    fonte->mapeado = 0;
+    return 1;
+}
+
+int carrega_fonte(const char *caminho, TFonte *fonte) {
+    if (strcmp(caminho, "-") == 0) return carrega_fluxo(STDIN_FILENO, "stdin", fonte);
+
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) {
+        snprintf(fonte->erro, sizeof(fonte->erro), "Erro ao abrir o arquivo '%s': %s", caminho, strerror(errno));
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        int ok = carrega_fluxo(fd, caminho, fonte);
+        close(fd);
+        return ok;
+    }
+
+    size_t pagina = (size_t)sysconf(_SC_PAGESIZE);
+    size_t tamanho = (size_t)st.st_size;
+    size_t reservado = (tamanho + pagina - 1) / pagina * pagina + pagina;
+    ESTAT(estat_aloca(reservado);)
+    char *base = (char*)mmap(NULL, reservado, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        snprintf(fonte->erro, sizeof(fonte->erro), "mmap: %s", strerror(errno));
+        close(fd);
+        return 0;
+    }
+    if (tamanho > 0) {
+        if (mmap(base, tamanho, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            snprintf(fonte->erro, sizeof(fonte->erro), "mmap: %s", strerror(errno));
+            munmap(base, reservado);
+            close(fd);
+            return 0;
+        }
+        madvise(base, tamanho, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    fonte->dados = base;
+    fonte->tamanho = tamanho;
+    fonte->tamanho_reservado = reservado;
+    fonte->mapeado = 1;
+    return 1;
+}
+
+void libera_fonte(TFonte *fonte) {
+    if (fonte->mapeado) munmap((void*)fonte->dados, fonte->tamanho_reservado);
+    else free((void*)fonte->dados);
+    fonte->dados = NULL;
+}
+
+// =================================================================
+// VARREDURA DE ESPAÇOS E COMENTÁRIOS
+// =================================================================
+
+/*
+ * Os núcleos vetoriais leem blocos de 16/32 bytes sem checar o fim do texto:
+ * o '\0' sentinela para a varredura e a folga de FOLGA_FONTE bytes nulos
+ * garantida por carrega_fonte cobre a leitura além dele. As quebras de linha
+ * são contadas com popcount sobre a máscara de comparação, somente até o
+ * ponto de parada, para que nLinha fique idêntico ao do núcleo escalar.
+ */
+static inline int eh_espaco(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static const char *pula_espacos_escalar(const char *p, int *linhas) {
+    while (eh_espaco(*p)) {
+        if (*p == '\n') (*linhas)++;
+        p++;
+    }
+    return p;
+}
+
+static const char *fim_comentario_escalar(const char *p, int *linhas) {
+    while (*p != '\0') {
+        if (*p == '*' && *(p + 1) == ')') return p;
+        if (*p == '\n') (*linhas)++;
+        p++;
+    }
+    return p;
+}
+
+// Classes de byte do autômato do léxico, preenchidas por inicia_lexico; a varredura também as usa
+typedef enum {
+    CLASSE_OUTRO, CLASSE_FIM,
+    CLASSE_LETRA, CLASSE_DIGITO,     // adjacentes: continua_id testa as duas de uma vez
+    CLASSE_APOSTROFO,
+    CLASSE_SIMBOLOS                  // primeira classe dos caracteres de operador
+} TClasse;
+
+static uint8_t classe_caractere[256];
+
+static inline int continua_id(char c) {
+    return (unsigned)(classe_caractere[(unsigned char)c] - CLASSE_LETRA) <= CLASSE_DIGITO - CLASSE_LETRA;
+}
+
+static inline int eh_digito(char c) {
+    return classe_caractere[(unsigned char)c] == CLASSE_DIGITO;
+}
+
+// Lê p[-1]: quem chama garante ao menos um byte de texto antes de p
+static const char *evento_divisao_escalar(const char *p, int *linhas) {
+    for (;; p++) {
+        char c = *p;
+        if (c == ';' || c == '(' || c == '\'' || c == '\0') return p;
+        if ((c == 'b' || c == 'e') && !continua_id(p[-1])) return p;
+        if (c == '\n') (*linhas)++;
+    }
+}
+
+#ifdef VARREDURA_X86
+static inline unsigned mascara_antes(unsigned i) {
+    return i >= 32 ? 0xFFFFFFFFu : (1u << i) - 1;
+}
+
+static const char *pula_espacos_sse2(const char *p, int *linhas) {
+    // Atalho para o caso comum de um único separador entre átomos
+    if (!eh_espaco(p[0])) return p;
+    if (!eh_espaco(p[1])) {
+        *linhas += p[0] == '\n';
+        return p + 1;
+    }
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    for (;;) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m_nl = _mm_cmpeq_epi8(v, nl);
+        __m128i esp = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                                   _mm_or_si128(m_nl, _mm_cmpeq_epi8(v, cr)));
+        unsigned nao_espaco = ~(unsigned)_mm_movemask_epi8(esp) & 0xFFFFu;
+        unsigned quebras = (unsigned)_mm_movemask_epi8(m_nl);
+        if (nao_espaco) {
+            unsigned i = (unsigned)__builtin_ctz(nao_espaco);
+            *linhas += __builtin_popcount(quebras & mascara_antes(i));
+            return p + i;
+        }
+        *linhas += __builtin_popcount(quebras);
+        p += 16;
+    }
+}
+
+static const char *fim_comentario_sse2(const char *p, int *linhas) {
+    const __m128i ast = _mm_set1_epi8('*'), fecha = _mm_set1_epi8(')');
+    const __m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+    for (;;) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i prox = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i fim = _mm_and_si128(_mm_cmpeq_epi8(v, ast), _mm_cmpeq_epi8(prox, fecha));
+        unsigned parada = (unsigned)_mm_movemask_epi8(_mm_or_si128(fim, _mm_cmpeq_epi8(v, zero)));
+        unsigned quebras = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (parada) {
+            unsigned i = (unsigned)__builtin_ctz(parada);
+            *linhas += __builtin_popcount(quebras & mascara_antes(i));
+            return p + i;
+        }
+        *linhas += __builtin_popcount(quebras);
+        p += 16;
+    }
+}
+
+// Bytes de v entre lo e hi; bytes >= 0x80 são negativos e ficam de fora
+static inline __m128i faixa_sse2(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(lo - 1))), _mm_cmplt_epi8(v, _mm_set1_epi8((char)(hi + 1))));
+}
+
+static const char *evento_divisao_sse2(const char *p, int *linhas) {
+    const __m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+    for (;;) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i ant = _mm_loadu_si128((const __m128i*)(p - 1));
+        __m128i palavra = _mm_or_si128(_mm_or_si128(faixa_sse2(_mm_or_si128(ant, _mm_set1_epi8(0x20)), 'a', 'z'),
+                                                    faixa_sse2(ant, '0', '9')),
+                                       _mm_cmpeq_epi8(ant, _mm_set1_epi8('_')));
+        __m128i inicio = _mm_andnot_si128(palavra, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('b')),
+                                                                _mm_cmpeq_epi8(v, _mm_set1_epi8('e'))));
+        __m128i ev = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(';')), _mm_cmpeq_epi8(v, _mm_set1_epi8('('))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(v, zero)));
+        unsigned parada = (unsigned)_mm_movemask_epi8(_mm_or_si128(ev, inicio));
+        unsigned quebras = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (parada) {
+            unsigned i = (unsigned)__builtin_ctz(parada);
+            *linhas += __builtin_popcount(quebras & mascara_antes(i));
+            return p + i;
+        }
+        *linhas += __builtin_popcount(quebras);
+        p += 16;
+    }
+}
+
+__attribute__((target("avx2,popcnt")))
+static inline __m256i faixa_avx2(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((char)(lo - 1))), _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(hi + 1)), v));
+}
+
+__attribute__((target("avx2,popcnt")))
+static const char *evento_divisao_avx2(const char *p, int *linhas) {
+    const __m256i nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256();
+    for (;;) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i ant = _mm256_loadu_si256((const __m256i*)(p - 1));
+        __m256i palavra = _mm256_or_si256(_mm256_or_si256(faixa_avx2(_mm256_or_si256(ant, _mm256_set1_epi8(0x20)), 'a', 'z'),
+                                                          faixa_avx2(ant, '0', '9')),
+                                          _mm256_cmpeq_epi8(ant, _mm256_set1_epi8('_')));
+        __m256i inicio = _mm256_andnot_si256(palavra, _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('b')),
+                                                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('e'))));
+        __m256i ev = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('('))),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')), _mm256_cmpeq_epi8(v, zero)));
+        unsigned parada = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(ev, inicio));
+        unsigned quebras = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (parada) {
+            unsigned i = (unsigned)__builtin_ctz(parada);
+            *linhas += __builtin_popcount(quebras & mascara_antes(i));
+            return p + i;
+        }
+        *linhas += __builtin_popcount(quebras);
+        p += 32;
+    }
+}
+
+__attribute__((target("avx2,popcnt")))
+static const char *pula_espacos_avx2(const char *p, int *linhas) {
+    if (!eh_espaco(p[0])) return p;
+    if (!eh_espaco(p[1])) {
+        *linhas += p[0] == '\n';
+        return p + 1;
+    }
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    for (;;) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m_nl = _mm256_cmpeq_epi8(v, nl);
+        __m256i esp = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+                                      _mm256_or_si256(m_nl, _mm256_cmpeq_epi8(v, cr)));
+        unsigned nao_espaco = ~(unsigned)_mm256_movemask_epi8(esp);
+        unsigned quebras = (unsigned)_mm256_movemask_epi8(m_nl);
+        if (nao_espaco) {
+            unsigned i = (unsigned)__builtin_ctz(nao_espaco);
+            *linhas += __builtin_popcount(quebras & mascara_antes(i));
+            return p + i;
+        }
+        *linhas += __builtin_popcount(quebras);
+        p += 32;
+    }
+}
+
+__attribute__((target("avx2,popcnt")))
+static const char *fim_comentario_avx2(const char *p, int *linhas) {
+    const __m256i ast = _mm256_set1_epi8('*'), fecha = _mm256_set1_epi8(')');
+    const __m256i nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256();
+    for (;;) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i prox = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i fim = _mm256_and_si256(_mm256_cmpeq_epi8(v, ast), _mm256_cmpeq_epi8(prox, fecha));
+        unsigned parada = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(fim, _mm256_cmpeq_epi8(v, zero)));
+        unsigned quebras = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (parada) {
+            unsigned i = (unsigned)__builtin_ctz(parada);
+            *linhas += __builtin_popcount(quebras & mascara_antes(i));
+            return p + i;
+        }
+        *linhas += __builtin_popcount(quebras);
+        p += 32;
+    }
+}
+#endif
+
+// Escolhe os núcleos; em "auto" consulta a CPU em tempo de execução.
+// Devolve o nome do núcleo efetivamente usado.
+const char *seleciona_varredura(TModoVarredura modo) {
+    pula_espacos = pula_espacos_escalar;
+    fim_comentario = fim_comentario_escalar;
+    evento_divisao = evento_divisao_escalar;
+#ifdef VARREDURA_X86
+    __builtin_cpu_init();
+    if (modo == VARREDURA_AUTO) modo = __builtin_cpu_supports("avx2") ? VARREDURA_AVX2 : VARREDURA_SSE2;
+    if (modo == VARREDURA_AVX2 && !__builtin_cpu_supports("avx2")) modo = VARREDURA_SSE2;
+    if (modo == VARREDURA_AVX2) {
+        pula_espacos = pula_espacos_avx2;
+        fim_comentario = fim_comentario_avx2;
+        evento_divisao = evento_divisao_avx2;
+        return "avx2";
+    }
+    if (modo == VARREDURA_SSE2) {
+        pula_espacos = pula_espacos_sse2;
+        fim_comentario = fim_comentario_sse2;
+        evento_divisao = evento_divisao_sse2;
+        return "sse2";
+    }
+#else
+    (void)modo;
+#endif
+    return "escalar";
+}
+
+// =================================================================
+// ANALISADOR LÉXICO
+// =================================================================
+
+const char* nome_atomo(TAtomo a) {
+    if (a >= 0 && a <= EOS) return TAtomo_str[a];
+    return "TOKEN_DESCONHECIDO";
+}
+
+/*
+ * Autômato do léxico. classe_caractere dá a classe de cada um dos 256
+ * bytes sem passar por <ctype.h>, então o locale não muda nada, e a
+ * tabela de transições é gerada por inicia_lexico a partir das regras
+ * abaixo. Operadores são reconhecidos só pelo autômato (no máximo dois
+ * passos); nos estados de identificador, número, constchar e comentário
+ * ele entrega o resto do lexema a laços próprios, que consomem vários
+ * bytes por iteração.
+ */
+typedef enum { ACAO_ERRO, ACAO_ATOMO, ACAO_ID, ACAO_NUMERO, ACAO_CONSTCHAR, ACAO_COMENTARIO, ACAO_FIM } TAcaoLexica;
+
+typedef struct {
+    const char *grafia;     // prefixo que leva ao estado; "" para as regras por classe
+    uint8_t classe;         // regras por classe: classe do primeiro byte
+    uint8_t acao;
+    uint8_t atomo;
+} TRegraLexica;
+
+static const TRegraLexica regras_lexicas[] = {
+    { "", CLASSE_FIM, ACAO_FIM, EOS },
+    { "", CLASSE_LETRA, ACAO_ID, IDENTIFICADOR },
+    { "", CLASSE_DIGITO, ACAO_NUMERO, CONSTINT },
+    { "", CLASSE_APOSTROFO, ACAO_CONSTCHAR, CONSTCHAR },
+    { "(*", 0, ACAO_COMENTARIO, COMENTARIO },
+    { "+", 0, ACAO_ATOMO, MAIS },        { "-", 0, ACAO_ATOMO, MENOS },
+    { "*", 0, ACAO_ATOMO, ASTERISCO },   { ";", 0, ACAO_ATOMO, PONTO_VIRGULA },
+    { ",", 0, ACAO_ATOMO, VIRGULA },     { ".", 0, ACAO_ATOMO, PONTO },
+    { "(", 0, ACAO_ATOMO, ABRE_PAR },    { ")", 0, ACAO_ATOMO, FECHA_PAR },
+    { "=", 0, ACAO_ATOMO, IGUAL },       { ":", 0, ACAO_ATOMO, DOIS_PONTOS },
+    { ":=", 0, ACAO_ATOMO, ATRIBUICAO }, { "<", 0, ACAO_ATOMO, MENOR },
+    { "<=", 0, ACAO_ATOMO, MENOR_IGUAL }, { "<>", 0, ACAO_ATOMO, NEGACAO },
+    { ">", 0, ACAO_ATOMO, MAIOR },       { ">=", 0, ACAO_ATOMO, MAIOR_IGUAL },
+};
+
+#define MAX_CLASSES 32
+#define MAX_ESTADOS 32
+
+static uint8_t transicao[MAX_ESTADOS][MAX_CLASSES];   // 0: sem transição (o estado inicial nunca é destino)
+static uint8_t acao_estado[MAX_ESTADOS];              // o estado 0 fica com ACAO_ERRO: símbolo desconhecido
+static uint8_t atomo_estado[MAX_ESTADOS];
+
+void inicia_lexico() {
+    memset(classe_caractere, CLASSE_OUTRO, sizeof(classe_caractere));
+    for (int c = 'a'; c <= 'z'; c++) classe_caractere[c] = classe_caractere[c - 'a' + 'A'] = CLASSE_LETRA;
+    classe_caractere['_'] = CLASSE_LETRA;
+    for (int c = '0'; c <= '9'; c++) classe_caractere[c] = CLASSE_DIGITO;
+    classe_caractere['\''] = CLASSE_APOSTROFO;
+    classe_caractere['\0'] = CLASSE_FIM;
+
+    int classes = CLASSE_SIMBOLOS, estados = 1;
+    memset(transicao, 0, sizeof(transicao));
+    for (size_t r = 0; r < sizeof(regras_lexicas) / sizeof(regras_lexicas[0]); r++) {
+        const TRegraLexica *regra = &regras_lexicas[r];
+        int estado = 0;
+        if (regra->grafia[0] == '\0') {
+            estado = transicao[0][regra->classe] = (uint8_t)estados++;
+        }
+        for (const char *g = regra->grafia; *g; g++) {
+            unsigned char c = (unsigned char)*g;
+            if (classe_caractere[c] == CLASSE_OUTRO) classe_caractere[c] = (uint8_t)classes++;
+            uint8_t *destino = &transicao[estado][classe_caractere[c]];
+            if (*destino == 0) *destino = (uint8_t)estados++;
+            estado = *destino;
+        }
+        acao_estado[estado] = regra->acao;
+        atomo_estado[estado] = regra->atomo;
+    }
+    if (classes > MAX_CLASSES || estados > MAX_ESTADOS) {
+        fprintf(stderr, "regras lexicas excedem as tabelas do automato\n");
+        exit(1);
+    }
+}
+
+TInfoAtomo obter_atomo() {
+    TInfoAtomo infoAtomo;
+    infoAtomo.atomo = ERRO;
+
+    ESTAT(const char *antes = ctx->buffer;)
+    ctx->buffer = pula_espacos(ctx->buffer, &ctx->nLinha);
+    ESTAT(ctx->estat.bytes_espaco += (uint64_t)(ctx->buffer - antes);)
+
+    infoAtomo.linha = ctx->nLinha;
+    ctx->inicio_atomo = ctx->buffer;
+
+    // Lê o prefixo pelo autômato; a folga de zeros do fonte torna seguro olhar adiante do '\0'
+    const char *p = ctx->buffer;
+    unsigned estado = 0, proximo;
+    while ((proximo = transicao[estado][classe_caractere[(unsigned char)*p]]) != 0) {
+        estado = proximo;
+        p++;
+    }
+    switch ((TAcaoLexica)acao_estado[estado]) {
+        case ACAO_ATOMO:
+            infoAtomo.atomo = (TAtomo)atomo_estado[estado];
+            ctx->buffer = p;
+            break;
+        case ACAO_ID: reconhece_id(&infoAtomo); break;
+        case ACAO_NUMERO: reconhece_numero(&infoAtomo); break;
+        case ACAO_CONSTCHAR: reconhece_constchar(&infoAtomo); break;
+        case ACAO_COMENTARIO: reconhece_comentario(&infoAtomo); break;
+        case ACAO_FIM: infoAtomo.atomo = EOS; break;
+        case ACAO_ERRO:
+            erro_lexico("# %d: erro lexico, simbolo desconhecido: %c\n", infoAtomo.linha, *ctx->buffer);
+    }
+    return infoAtomo;
+}
+
+void reconhece_comentario(TInfoAtomo *infoAtomo) {
+    ESTAT(const char *inicio = ctx->buffer;)
+    ctx->buffer += 2; // pula "(*"
+    ctx->buffer = fim_comentario(ctx->buffer, &ctx->nLinha);
+    if (*ctx->buffer != '\0') {
+        ctx->buffer += 2; // pula "*)"
+        ESTAT(ctx->estat.bytes_comentario += (uint64_t)(ctx->buffer - inicio);)
+        infoAtomo->atomo = COMENTARIO;
+        return;
+    }
+    erro_lexico("# %d: erro lexico, comentario nao fechado.\n", infoAtomo->linha);
+}
+
+/*
+ * Dígitos oito a oito (SWAR): um carregamento de 64 bits diz quantos dos
+ * próximos bytes são dígitos e converte até oito deles com três
+ * multiplicações, o primeiro byte do fonte no byte menos significativo.
+ */
+static inline uint64_t carrega8(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Quantos bytes de v, a partir do primeiro, são '0'..'9'
+static inline unsigned digitos_iniciais(uint64_t v) {
+    uint64_t t = (v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4);
+    uint64_t fora = t ^ 0x3333333333333333ull;   // byte nulo onde há dígito
+    return fora ? (unsigned)__builtin_ctzll(fora) >> 3 : 8;
+}
+
+// Valor dos k primeiros dígitos de v (1 <= k <= 8)
+static inline uint64_t valor_digitos(uint64_t v, unsigned k) {
+    v <<= 8 * (8 - k);   // descarta o que vem depois; os bytes zerados viram zeros à esquerda
+    v = ((v & 0x0F0F0F0F0F0F0F0Full) * 2561) >> 8;
+    v = ((v & 0x00FF00FF00FF00FFull) * 6553601) >> 16;
+    return ((v & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32;
+}
+
+// Fim da sequência de dígitos que começa em p
+static inline const char *pula_digitos(const char *p) {
+    unsigned k;
+    while ((k = digitos_iniciais(carrega8(p))) == 8) p += 8;
+    return p + k;
+}
+
+// Valor exato de n dígitos (n <= 16) a partir de p
+static inline uint64_t valor_decimal(const char *p, size_t n) {
+    uint64_t valor = 0;
+    if (n > 8) {
+        valor = valor_digitos(carrega8(p), 8);
+        p += 8;
+        n -= 8;
+        for (size_t i = 0; i < n; i++) valor *= 10;
+    }
+    return n > 0 ? valor + valor_digitos(carrega8(p), (unsigned)n) : valor;
+}
+
+/*
+ * constint: dígitos com expoente opcional 'd' (12d3 = 12000). O valor é
+ * exato: expoente positivo acrescenta zeros, negativo descarta os últimos
+ * dígitos (trunca, como a conversão de real para inteiro fazia). Acima de
+ * INT32_MAX é erro léxico.
+ */
+void reconhece_numero(TInfoAtomo *infoAtomo) {
+    const char *ini = ctx->buffer;
+    const char *fim = pula_digitos(ini);
+    ctx->buffer = fim;
+
+    int64_t expoente = 0;
+    if ((*ctx->buffer | 0x20) == 'd') {
+        ctx->buffer++;
+        int negativo = *ctx->buffer == '-';
+        if (*ctx->buffer == '-' || *ctx->buffer == '+') ctx->buffer++;
+        if (classe_caractere[(unsigned char)*ctx->buffer] != CLASSE_DIGITO) {
+             erro_lexico("# %d: erro lexico, 'd' de expoente deve ser seguido por um digito.\n", infoAtomo->linha);
+        }
+        while (*ctx->buffer == '0') ctx->buffer++;
+        const char *ini_expoente = ctx->buffer;
+        ctx->buffer = pula_digitos(ctx->buffer);
+        // Com mais de 15 dígitos o expoente satura: já estoura ou zera qualquer mantissa
+        size_t n = (size_t)(ctx->buffer - ini_expoente);
+        expoente = n > 15 ? INT64_C(1000000000000000) : (int64_t)valor_decimal(ini_expoente, n);
+        if (negativo) expoente = -expoente;
+    }
+
+    while (ini < fim && *ini == '0') ini++;
+    int64_t significativos = fim - ini;
+    int64_t tamanho = significativos + expoente;   // dígitos do resultado
+    uint64_t valor = 0;
+    if (significativos > 0 && tamanho > 0) {
+        if (tamanho <= 10) {
+            int64_t usados = tamanho < significativos ? tamanho : significativos;
+            valor = valor_decimal(ini, (size_t)usados);
+            for (int64_t i = usados; i < tamanho; i++) valor *= 10;
+        }
+        if (tamanho > 10 || valor > INT32_MAX) {
+            erro_lexico("# %d: erro lexico, constante inteira maior que %d.\n", infoAtomo->linha, INT32_MAX);
+        }
+    }
+    infoAtomo->atributo.numero = (int)valor;
+    infoAtomo->atomo = CONSTINT;
+}
+
+void reconhece_id(TInfoAtomo *infoAtomo){
+    const char *ini_lexema = ctx->buffer;
+    while(continua_id(*ctx->buffer)) ctx->buffer++;
+
+    int tamanho = ctx->buffer - ini_lexema;
+    if (tamanho > 15) {
+        erro_lexico("# %d: erro lexico, identificador com mais de 15 caracteres.\n", infoAtomo->linha);
+    }
+
+    if (modo_palavras == PALAVRAS_STRCMP) {
+        // O caminho antigo compara strings terminadas em '\0'
+        char lexema[16];
+        memcpy(lexema, ini_lexema, tamanho);
+        lexema[tamanho] = '\0';
+        infoAtomo->atomo = palavra_strcmp(lexema, tamanho);
+    } else {
+        infoAtomo->atomo = palavra_hash(ini_lexema, tamanho);
+    }
+    if (infoAtomo->atomo != IDENTIFICADOR) return;
+    // Na esteira a tabela de símbolos é do parser: o lexema segue só com o hash
+    if (ctx->adia_simbolos) infoAtomo->atributo.simbolo = hash_lexema(ini_lexema, tamanho);
+    else infoAtomo->atributo.simbolo = interna(ini_lexema, tamanho);
+}
+
+TAtomo classifica_palavra(const char *lexema, int tamanho) {
+    if (modo_palavras == PALAVRAS_HASH) return palavra_hash(lexema, tamanho);
+    return palavra_strcmp(lexema, tamanho);
+}
+
+// Caminho original: até 20 comparações por lexema
+TAtomo palavra_strcmp(const char *lexema, int tamanho) {
+    (void)tamanho;
+    if (strcmp(lexema, "div") == 0) return DIV;
+    else if (strcmp(lexema, "or") == 0) return OR;
+    else if (strcmp(lexema, "and") == 0) return AND;
+    else if (strcmp(lexema, "not") == 0) return NOT;
+    else if (strcmp(lexema, "if") == 0) return IF;
+    else if (strcmp(lexema, "then") == 0) return THEN;
+    else if (strcmp(lexema, "else") == 0) return ELSE;
+    else if (strcmp(lexema, "while") == 0) return WHILE;
+    else if (strcmp(lexema, "do") == 0) return DO;
+    else if (strcmp(lexema, "begin") == 0) return BEGIN;
+    else if (strcmp(lexema, "end") == 0) return END;
+    else if (strcmp(lexema, "read") == 0) return READ;
+    else if (strcmp(lexema, "write") == 0) return WRITE;
+    else if (strcmp(lexema, "var") == 0) return VAR;
+    else if (strcmp(lexema, "program") == 0) return PROGRAM;
+    else if (strcmp(lexema, "true") == 0) return TRUE_TOKEN;
+    else if (strcmp(lexema, "false") == 0) return FALSE_TOKEN;
+    else if (strcmp(lexema, "char") == 0) return CHAR;
+    else if (strcmp(lexema, "integer") == 0) return INTEGER;
+    else if (strcmp(lexema, "boolean") == 0) return BOOLEAN;
+    return IDENTIFICADOR;
+}
+
+/*
+ * Hash perfeito sobre as palavras reservadas de TAtomo_str (div .. boolean).
+ * O par (primeiro caractere, segundo caractere) já é único entre elas; as
+ * constantes 2 e 6 foram escolhidas para que, somadas ao tamanho, caiam em
+ * 64 posições sem colisão. A tabela é montada em tempo de compilação com
+ * inicializadores designados, então uma colisão aparece como aviso de
+ * -Woverride-init. Cada lexema faz uma única sondagem e um memcmp.
+ */
+#define PALAVRA_HASH(c0, c1, n) ((2u * (unsigned char)(c0) + 6u * (unsigned char)(c1) + (unsigned)(n)) & 63u)
+#define PALAVRA(txt, c0, c1, at) [PALAVRA_HASH(c0, c1, sizeof(txt) - 1)] = { txt, sizeof(txt) - 1, at }
+
+typedef struct {
+    char texto[8];
+    unsigned char tamanho;
+    unsigned char atomo;
+} TPalavraReservada;
+
+static const TPalavraReservada tabela_palavras[64] = {
+    PALAVRA("div", 'd', 'i', DIV),        PALAVRA("or", 'o', 'r', OR),
+    PALAVRA("and", 'a', 'n', AND),        PALAVRA("not", 'n', 'o', NOT),
+    PALAVRA("if", 'i', 'f', IF),          PALAVRA("then", 't', 'h', THEN),
+    PALAVRA("else", 'e', 'l', ELSE),      PALAVRA("while", 'w', 'h', WHILE),
+    PALAVRA("do", 'd', 'o', DO),          PALAVRA("begin", 'b', 'e', BEGIN),
+    PALAVRA("end", 'e', 'n', END),        PALAVRA("read", 'r', 'e', READ),
+    PALAVRA("write", 'w', 'r', WRITE),    PALAVRA("var", 'v', 'a', VAR),
+    PALAVRA("program", 'p', 'r', PROGRAM), PALAVRA("true", 't', 'r', TRUE_TOKEN),
+    PALAVRA("false", 'f', 'a', FALSE_TOKEN), PALAVRA("char", 'c', 'h', CHAR),
+    PALAVRA("integer", 'i', 'n', INTEGER), PALAVRA("boolean", 'b', 'o', BOOLEAN)
+};
+
+TAtomo palavra_hash(const char *lexema, int tamanho) {
+    if (tamanho < 2 || tamanho > 7) return IDENTIFICADOR;
+    const TPalavraReservada *p = &tabela_palavras[PALAVRA_HASH(lexema[0], lexema[1], tamanho)];
+    if (p->tamanho == tamanho && memcmp(p->texto, lexema, tamanho) == 0) return (TAtomo)p->atomo;
+    return IDENTIFICADOR;
+}
+
+// Microbenchmark: classifica a mesma massa de lexemas pelos dois caminhos
+double agora() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void bench_palavras(long repeticoes) {
+    // Mistura típica de código gerado: maioria identificadores, algumas palavras reservadas
+    static const char *amostra[] = {
+        "num_1", "num_2", "maior", "teste", "contador", "x", "soma", "i", "resultado", "valor",
+        "begin", "end", "if", "then", "else", "while", "do", "read", "write", "div",
+        "boolean", "booleano", "writer", "endereco", "iff", "programa", "tmp_15", "acumulador"
+    };
+    const int n = sizeof(amostra) / sizeof(amostra[0]);
+    int tamanhos[sizeof(amostra) / sizeof(amostra[0])];
+    for (int i = 0; i < n; i++) tamanhos[i] = (int)strlen(amostra[i]);
+
+    TModoPalavras modos[] = { PALAVRAS_STRCMP, PALAVRAS_HASH };
+    const char *nomes[] = { "strcmp", "hash" };
+    for (int m = 0; m < 2; m++) {
+        modo_palavras = modos[m];
+        volatile unsigned soma = 0;
+        double ini = agora();
+        for (long r = 0; r < repeticoes; r++)
+            for (int i = 0; i < n; i++) soma += classifica_palavra(amostra[i], tamanhos[i]);
+        double dt = agora() - ini;
+        printf("%-6s: %.1f milhoes de identificadores/s (%.2f ns/lexema, soma %u)\n", nomes[m],
+               (double)repeticoes * n / dt / 1e6, dt * 1e9 / ((double)repeticoes * n), soma);
+    }
+}
+
+void reconhece_constchar(TInfoAtomo *infoAtomo){
+    ctx->buffer++; // consome o '
+    if (*ctx->buffer != '\0' && *(ctx->buffer + 1) == '\'') {
+        infoAtomo->atributo.ch = *ctx->buffer;
+        ctx->buffer += 2;
+        infoAtomo->atomo = CONSTCHAR;
+    } else {
+        erro_lexico("# %d: erro lexico, constante char mal formada.\n", infoAtomo->linha);
+    }
+}
+
+// Erros léxicos: fatais no modo sob demanda; na passada em lote viram um
+// átomo ERRO que só é reportado quando o parser chega até ele, para que o
+// trace emitido antes do erro seja o mesmo nos dois modos
+void erro_lexico(const char *formato, ...) {
+    va_list args;
+    va_start(args, formato);
+    if (ctx->lexico_em_lote) {
+        vsnprintf(ctx->tabela.erro, sizeof(ctx->tabela.erro), formato, args);
+        va_end(args);
+        longjmp(ctx->salto_lexico, 1);
+    }
+    emite_trivia(UINT32_MAX);
+    emite_mensagem(formato, args);
+    va_end(args);
+    longjmp(ctx->salto_erro, 1);
+}
+
+// =================================================================
+// TABELA DE SÍMBOLOS
+// =================================================================
+
+/*
+ * Cada identificador é internado uma única vez: o hash FNV-1a do lexema
+ * indexa uma tabela de endereçamento aberto com sondagem linear, e o átomo
+ * passa a carregar só o índice de 32 bits do símbolo. O nome não é copiado;
+ * a entrada aponta para o lexema no fonte, que vive até o fim da análise.
+ * A exceção é o modo documento, em que o texto é editado no lugar: lá cada
+ * nome novo é copiado uma vez para o vetor nomes da tabela.
+ */
+static inline uint32_t hash_lexema(const char *lexema, int tamanho) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < tamanho; i++) h = (h ^ (unsigned char)lexema[i]) * 16777619u;
+    return h;
+}
+
+static void simbolos_redimensiona(TTabelaSimbolos *t, uint32_t slots) {
+    free(t->slots);
+    ESTAT(estat_aloca(slots * sizeof(uint32_t));)
+    t->slots = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    if (t->slots == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    t->mascara = slots - 1;
+    for (uint32_t i = 0; i < t->quantidade; i++) {
+        uint32_t j = t->simbolos[i].hash & t->mascara;
+        while (t->slots[j] != 0) j = (j + 1) & t->mascara;
+        t->slots[j] = i + 1;
+    }
+}
+
+uint32_t interna(const char *lexema, int tamanho) {
+    return interna_com_hash(lexema, tamanho, hash_lexema(lexema, tamanho));
+}
+
+// interna com o hash já calculado pelo léxico (esteira)
+uint32_t interna_com_hash(const char *lexema, int tamanho, uint32_t h) {
+    TTabelaSimbolos *t = &ctx->simbolos;
+    if (t->slots == NULL) simbolos_redimensiona(t, 1024);
+    uint32_t j = h & t->mascara;
+    for (;;) {
+        uint32_t k = t->slots[j];
+        if (k == 0) break;
+        const TSimbolo *s = &t->simbolos[k - 1];
+        if (s->hash == h && s->tamanho == tamanho && memcmp((t->nomes_proprios ? t->nomes : ctx->inicio_fonte) + s->offset, lexema, (size_t)tamanho) == 0)
+            return k - 1;
+        j = (j + 1) & t->mascara;
+    }
+
+    if (t->quantidade == t->capacidade) {
+        t->capacidade = t->capacidade ? t->capacidade * 2 : 256;
+        ESTAT(estat_aloca(t->capacidade * sizeof(TSimbolo));)
+        t->simbolos = (TSimbolo*)realloc(t->simbolos, t->capacidade * sizeof(TSimbolo));
+        if (t->simbolos == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+    }
+    uint32_t novo = t->quantidade++;
+    TSimbolo *s = &t->simbolos[novo];
+    if (t->nomes_proprios) {
+        if (t->uso_nomes + (uint32_t)tamanho > t->capacidade_nomes) {
+            t->capacidade_nomes = t->capacidade_nomes ? t->capacidade_nomes * 2 : 4096;
+            ESTAT(estat_aloca(t->capacidade_nomes);)
+            t->nomes = (char*)realloc(t->nomes, t->capacidade_nomes);
+            if (t->nomes == NULL) {
+                erro_fatal("Erro ao alocar memoria.\n");
+            }
+        }
+        memcpy(t->nomes + t->uso_nomes, lexema, (size_t)tamanho);
+        s->offset = t->uso_nomes;
+        t->uso_nomes += (uint32_t)tamanho;
+    } else {
+        s->offset = (uint32_t)(lexema - ctx->inicio_fonte);
+    }
+    s->hash = h;
+    s->tamanho = (uint8_t)tamanho;
+    s->tipo = 0;
+    t->slots[j] = novo + 1;
+    // Fator de carga máximo de 1/2
+    if (t->quantidade * 2 > t->mascara + 1) simbolos_redimensiona(t, (t->mascara + 1) * 2);
+    return novo;
+}
+
+const char *nome_simbolo(uint32_t simbolo, int *tamanho) {
+    const TSimbolo *s = &ctx->simbolos.simbolos[simbolo];
+    *tamanho = s->tamanho;
+    return (ctx->simbolos.nomes_proprios ? ctx->simbolos.nomes : ctx->inicio_fonte) + s->offset;
+}
+
+void libera_simbolos(TTabelaSimbolos *t) {
+    free(t->simbolos);
+    free(t->slots);
+    free(t->nomes);
+    memset(t, 0, sizeof(*t));
+}
+
+// =================================================================
+// PASSADA LÉXICA EM LOTE (--lex=bulk)
+// =================================================================
+
+static void tabela_reserva(TTabelaAtomos *t, size_t nova) {
+    ESTAT(estat_aloca(nova * sizeof(uint8_t)); for (int k = 0; k < 3; k++) estat_aloca(nova * sizeof(uint32_t));)
+    t->atomo = (uint8_t*)realloc(t->atomo, nova * sizeof(uint8_t));
+    t->linha = (uint32_t*)realloc(t->linha, nova * sizeof(uint32_t));
+    t->offset = (uint32_t*)realloc(t->offset, nova * sizeof(uint32_t));
+    t->atributo = (int32_t*)realloc(t->atributo, nova * sizeof(int32_t));
+    if (!t->atomo || !t->linha || !t->offset || !t->atributo) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    t->capacidade = nova;
+}
+
+static void tabela_cresce(TTabelaAtomos *t) {
+    tabela_reserva(t, t->capacidade ? t->capacidade * 2 : 4096);
+}
+
+static inline void tabela_insere(TTabelaAtomos *t, TAtomo atomo, int linha, size_t offset, int32_t atributo) {
+    if (t->quantidade == t->capacidade) tabela_cresce(t);
+    size_t i = t->quantidade++;
+    t->atomo[i] = (uint8_t)atomo;
+    t->linha[i] = (uint32_t)linha;
+    t->offset[i] = (uint32_t)offset;
+    t->atributo[i] = atributo;
+}
+
+// Acrescenta um comentário ao canal de trivia
+static void anota_trivia(uint32_t offset, uint32_t tamanho, uint32_t linha) {
+    TCanalTrivia *c = &ctx->trivia;
+    // Tudo já impresso: o canal recomeça, e sob demanda não cresce além dos pendentes
+    if (c->cursor == c->quantidade) c->quantidade = c->cursor = 0;
+    if (c->quantidade == c->capacidade) {
+        size_t nova = c->capacidade ? c->capacidade * 2 : 256;
+        ESTAT(estat_aloca(nova * sizeof(TTrivia));)
+        TTrivia *itens = (TTrivia*)realloc(c->itens, nova * sizeof(TTrivia));
+        if (itens == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+        c->itens = itens;
+        c->capacidade = nova;
+    }
+    TTrivia *t = &c->itens[c->quantidade++];
+    t->offset = offset;
+    t->tamanho = tamanho;
+    t->linha = linha;
+}
+
+// Registra no canal de trivia o comentário que obter_atomo acabou de reconhecer
+static void registra_trivia(int linha) {
+    anota_trivia((uint32_t)(ctx->inicio_atomo - ctx->inicio_fonte), (uint32_t)(ctx->buffer - ctx->inicio_atomo), (uint32_t)linha);
+}
+
+void lexa_em_lote(TTabelaAtomos *t, size_t tamanho_fonte) {
+    TInfoAtomo a;
+    // Um átomo a cada ~4 bytes cobre o código típico sem realocar no meio da
+    // passada; páginas não tocadas da reserva não chegam a ser alocadas
+    if (t->capacidade < tamanho_fonte / 4 + 1024) tabela_reserva(t, tamanho_fonte / 4 + 1024);
+    ctx->lexico_em_lote = 1;
+    if (setjmp(ctx->salto_lexico)) {
+        // Erro léxico: a posição do átomo ERRO é o início do lexema inválido
+        tabela_insere(t, ERRO, ctx->nLinha, (size_t)(ctx->inicio_atomo - ctx->inicio_fonte), 0);
+        ctx->lexico_em_lote = 0;
+        return;
+    }
+    do {
+        a = obter_atomo();
+        if (a.atomo == COMENTARIO) {
+            ESTAT(ctx->estat.atomos[COMENTARIO]++;)
+            registra_trivia(a.linha);
+            continue;
+        }
+        int32_t atributo = 0;
+        if (a.atomo == IDENTIFICADOR) atributo = (int32_t)a.atributo.simbolo;
+        else if (a.atomo == CONSTINT || a.atomo == NUMERO) atributo = a.atributo.numero;
+        else if (a.atomo == CONSTCHAR) atributo = (unsigned char)a.atributo.ch;
+        tabela_insere(t, a.atomo, a.linha, (size_t)(ctx->inicio_atomo - ctx->inicio_fonte), atributo);
+    } while (a.atomo != EOS);
+    ctx->lexico_em_lote = 0;
+}
+
+void libera_tabela(TTabelaAtomos *t) {
+    free(t->atomo);
+    free(t->linha);
+    free(t->offset);
+    free(t->atributo);
+    memset(t, 0, sizeof(*t));
+}
+
+// Entrega o próximo átomo ao parser: do léxico, da tabela em lote ou da esteira
+void avanca() {
+    if (modo_lexico == LEX_SOB_DEMANDA) {
+        ESTAT(double ini = agora();)
+        // Sem trace ninguém lê o canal; em lote ele é preenchido mesmo assim, para o --bench reimprimir
+        while ((ctx->lookahead = obter_atomo()).atomo == COMENTARIO) {
+            ESTAT(ctx->estat.atomos[COMENTARIO]++;)
+            if (modo_trace != TRACE_DESLIGADO) registra_trivia(ctx->lookahead.linha);
+        }
+        ESTAT(ctx->estat.chamadas_lexico += agora() - ini;)
+        ESTAT(ctx->estat.atomos[ctx->lookahead.atomo]++;)
+        ctx->offset_lookahead = (uint32_t)(ctx->inicio_atomo - ctx->inicio_fonte);
+        return;
+    }
+    if (modo_lexico == LEX_ESTEIRA) {
+        esteira_avanca();
+        return;
+    }
+    size_t i = ctx->cursor_tabela;
+    if (i >= ctx->tabela.quantidade) i = ctx->tabela.quantidade - 1; // repete o EOS
+    else ctx->cursor_tabela++;
+    ctx->lookahead.atomo = (TAtomo)ctx->tabela.atomo[i];
+    ctx->lookahead.linha = (int)ctx->tabela.linha[i];
+    ctx->offset_lookahead = ctx->tabela.offset[i];
+    switch (ctx->lookahead.atomo) {
+        case IDENTIFICADOR: ctx->lookahead.atributo.simbolo = (uint32_t)ctx->tabela.atributo[i]; break;
+        case CONSTCHAR: ctx->lookahead.atributo.ch = (char)ctx->tabela.atributo[i]; break;
+        case ERRO:
+            emite_trivia(ctx->offset_lookahead);
+            mensagem("%s", ctx->tabela.erro);
+            longjmp(ctx->salto_erro, 1);
+            break;
+        default: ctx->lookahead.atributo.numero = ctx->tabela.atributo[i]; break;
+    }
+    ESTAT(ctx->estat.atomos[ctx->lookahead.atomo]++;)
+}
+
+void bench_lex(const char *caminho) {
+    TContexto contexto;
+    inicia_contexto(&contexto, stdout);
+    TFonte *fonte = &ctx->fonte;
+    if (!carrega_fonte(caminho, fonte)) {
+        fprintf(stderr, "%s\n", fonte->erro);
+        exit(1);
+    }
+    if (setjmp(ctx->salto_erro) != 0) exit(1);
+    double mb = fonte->tamanho / (1024.0 * 1024.0);
+
+    // Sob demanda: o mesmo laço de chamadas que o parser faz, sem trace
+    ctx->buffer = ctx->inicio_fonte = fonte->dados;
+    ctx->nLinha = 1;
+    size_t n = 0;
+    double ini = agora();
+    TInfoAtomo a;
+    do { a = obter_atomo(); n++; } while (a.atomo != EOS);
+    double dt_stream = agora() - ini;
+
+    ctx->buffer = ctx->inicio_fonte = fonte->dados;
+    ctx->nLinha = 1;
+    TTabelaAtomos t;
+    memset(&t, 0, sizeof(t));
+    ini = agora();
+    lexa_em_lote(&t, fonte->tamanho);
+    double dt_bulk = agora() - ini;
+
+    printf("stream: %zu atomos em %.3f s (%.1f M atomos/s, %.1f MB/s)\n", n, dt_stream, n / dt_stream / 1e6, mb / dt_stream);
+    printf("bulk  : %zu atomos em %.3f s (%.1f M atomos/s, %.1f MB/s), tabela de %.1f MB\n", t.quantidade, dt_bulk,
+           t.quantidade / dt_bulk / 1e6, mb / dt_bulk, t.quantidade * 13.0 / (1024 * 1024));
+    libera_tabela(&t);
+    libera_contexto(&contexto);
+}
+
+// =================================================================
+// ESTEIRA LÉXICA (--lex=pipeline)
+// =================================================================
+
+/*
+ * O léxico roda numa thread produtora e o parser consome os átomos em
+ * lotes, por um anel de um produtor e um consumidor sem travas: o produtor
+ * só escreve publicados, o consumidor só escreve consumidos, e cada lado
+ * guarda na própria linha de cache a última leitura do índice do outro.
+ * Anel cheio segura o produtor e anel vazio segura o parser, girando um
+ * pouco e depois cedendo a CPU.
+ *
+ * A tabela de símbolos e o canal de trivia ficam só com o parser: o
+ * identificador viaja com posição, tamanho e hash e é internado na
+ * entrega; comentários seguem no mesmo fluxo, na ordem do fonte, como no
+ * modo sob demanda. Um erro léxico vira o último átomo (ERRO), com a
+ * mensagem no contexto da produtora; se o parser para antes do EOS, marca
+ * o anel como cancelado e a produtora desiste na próxima espera.
+ */
+#define ATOMOS_POR_LOTE 4096
+#define LOTES_NO_ANEL 16
+
+typedef struct {
+    uint8_t atomo;
+    uint8_t tamanho;    // do lexema de um identificador
+    uint32_t linha;
+    uint32_t offset;
+    int32_t atributo;   // valor, caractere, hash do identificador ou tamanho do comentário
+} TAtomoEsteira;
+
+typedef struct {
+    uint32_t quantidade;
+    TAtomoEsteira atomos[ATOMOS_POR_LOTE];
+} TLoteEsteira;
+
+struct TEsteira {
+    // Lado da produtora
+    _Alignas(64) size_t publicados;
+    size_t consumidos_vistos;
+    TLoteEsteira *enchendo;
+    double tempo_lexico;
+
+    // Lado do parser
+    _Alignas(64) size_t consumidos;
+    size_t publicados_vistos;
+    const TLoteEsteira *lendo;
+    uint32_t cursor;
+    int fim;                    // EOS já entregue: repete-o sem olhar o anel
+    int cancelado;
+
+    TContexto lexico;           // contexto da produtora: posição, linha e mensagem de erro
+    pthread_t thread;
+
+    // Não zerado: um lote só é lido depois de escrito, e as páginas que um
+    // fonte pequeno não alcança nem chegam a ser tocadas
+    _Alignas(64) TLoteEsteira lotes[LOTES_NO_ANEL];
+};
+
+static inline void esteira_espera(unsigned *voltas) {
+    if (++*voltas < 64) {
+#ifdef VARREDURA_X86
+        _mm_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+// Lote livre para a produtora encher; NULL se o parser cancelou
+static TLoteEsteira *esteira_reserva(TEsteira *e) {
+    unsigned voltas = 0;
+    while (e->publicados - e->consumidos_vistos == LOTES_NO_ANEL) {
+        e->consumidos_vistos = __atomic_load_n(&e->consumidos, __ATOMIC_ACQUIRE);
+        if (e->publicados - e->consumidos_vistos < LOTES_NO_ANEL) break;
+        if (__atomic_load_n(&e->cancelado, __ATOMIC_ACQUIRE)) return NULL;
+        esteira_espera(&voltas);
+    }
+    TLoteEsteira *lote = &e->lotes[e->publicados % LOTES_NO_ANEL];
+    lote->quantidade = 0;
+    return lote;
+}
+
+static inline void esteira_publica(TEsteira *e) {
+    e->enchendo = NULL;
+    __atomic_store_n(&e->publicados, e->publicados + 1, __ATOMIC_RELEASE);
+}
+
+// Acrescenta um átomo ao lote corrente, publicando-o quando enche; 0 se o parser cancelou
+static inline int esteira_empurra(TEsteira *e, TAtomo atomo, uint32_t linha, int32_t atributo, uint32_t tamanho) {
+    if (e->enchendo == NULL && (e->enchendo = esteira_reserva(e)) == NULL) return 0;
+    TAtomoEsteira *a = &e->enchendo->atomos[e->enchendo->quantidade++];
+    a->atomo = (uint8_t)atomo;
+    a->tamanho = (uint8_t)tamanho;
+    a->linha = linha;
+    a->offset = (uint32_t)(ctx->inicio_atomo - ctx->inicio_fonte);
+    a->atributo = atributo;
+    if (e->enchendo->quantidade == ATOMOS_POR_LOTE) esteira_publica(e);
+    return 1;
+}
+
+static void *esteira_produz(void *arg) {
+    TEsteira *e = (TEsteira*)arg;
+    ctx = &e->lexico;
+    double ini = agora();
+    if (setjmp(ctx->salto_lexico)) {
+        // A mensagem já está em ctx->tabela.erro; a publicação a torna visível ao parser
+        if (esteira_empurra(e, ERRO, (uint32_t)ctx->nLinha, 0, 0) && e->enchendo != NULL) esteira_publica(e);
+        e->tempo_lexico = agora() - ini;
+        return NULL;
+    }
+    TInfoAtomo a;
+    do {
+        a = obter_atomo();
+        int32_t atributo = 0;
+        uint32_t tamanho = 0;
+        if (a.atomo == IDENTIFICADOR) {
+            atributo = (int32_t)a.atributo.simbolo;
+            tamanho = (uint32_t)(ctx->buffer - ctx->inicio_atomo);
+        } else if (a.atomo == COMENTARIO) {
+            atributo = (int32_t)(ctx->buffer - ctx->inicio_atomo);
+        } else if (a.atomo == CONSTINT || a.atomo == NUMERO) {
+            atributo = a.atributo.numero;
+        } else if (a.atomo == CONSTCHAR) {
+            atributo = (unsigned char)a.atributo.ch;
+        }
+        if (!esteira_empurra(e, a.atomo, (uint32_t)a.linha, atributo, tamanho)) break;
+    } while (a.atomo != EOS);
+    if (e->enchendo != NULL) esteira_publica(e);
+    e->tempo_lexico = agora() - ini;
+    return NULL;
+}
+
+void esteira_inicia() {
+    TEsteira *e = NULL;
+    if (posix_memalign((void**)&e, 64, sizeof(TEsteira)) != 0) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    ESTAT(estat_aloca(sizeof(TEsteira));)
+    memset(e, 0, offsetof(TEsteira, lotes));
+    e->lexico.buffer = e->lexico.inicio_fonte = ctx->inicio_fonte;
+    e->lexico.nLinha = 1;
+    e->lexico.lexico_em_lote = 1;
+    e->lexico.adia_simbolos = 1;
+    if (pthread_create(&e->thread, NULL, esteira_produz, e) != 0) {
+        free(e);
+        erro_fatal("Erro ao criar a thread do lexico.\n");
+    }
+    ctx->esteira = e;
+}
+
+// Para a produtora (se ainda roda) e traz para o contexto do parser o que ela mediu
+void esteira_encerra() {
+    TEsteira *e = ctx->esteira;
+    ctx->esteira = NULL;
+    __atomic_store_n(&e->cancelado, 1, __ATOMIC_RELEASE);
+    pthread_join(e->thread, NULL);
+    ctx->tempo_lexico = e->tempo_lexico;
+    ESTAT(ctx->estat.bytes_espaco += e->lexico.estat.bytes_espaco;
+          ctx->estat.bytes_comentario += e->lexico.estat.bytes_comentario;)
+    free(e);
+}
+
+// Próximo átomo do anel; comentários vão para o canal de trivia do parser
+void esteira_avanca() {
+    TEsteira *e = ctx->esteira;
+    if (e->fim) {
+        ESTAT(ctx->estat.atomos[EOS]++;)
+        return;     // o lookahead continua EOS
+    }
+    TAtomoEsteira a;
+    do {
+        if (e->lendo == NULL) {
+            ESTAT(double ini = agora();)
+            unsigned voltas = 0;
+            while (e->consumidos == e->publicados_vistos) {
+                e->publicados_vistos = __atomic_load_n(&e->publicados, __ATOMIC_ACQUIRE);
+                if (e->consumidos != e->publicados_vistos) break;
+                esteira_espera(&voltas);
+            }
+            ESTAT(ctx->estat.chamadas_lexico += agora() - ini;)
+            e->lendo = &e->lotes[e->consumidos % LOTES_NO_ANEL];
+            e->cursor = 0;
+        }
+        a = e->lendo->atomos[e->cursor++];
+        if (e->cursor == e->lendo->quantidade) {
+            // Lote lido até o fim: devolve o espaço à produtora
+            e->lendo = NULL;
+            __atomic_store_n(&e->consumidos, e->consumidos + 1, __ATOMIC_RELEASE);
+        }
+        if (a.atomo == COMENTARIO) {
+            ESTAT(ctx->estat.atomos[COMENTARIO]++;)
+            if (modo_trace != TRACE_DESLIGADO) anota_trivia(a.offset, (uint32_t)a.atributo, a.linha);
+        }
+    } while (a.atomo == COMENTARIO);
+
+    ctx->lookahead.atomo = (TAtomo)a.atomo;
+    ctx->lookahead.linha = (int)a.linha;
+    ctx->offset_lookahead = a.offset;
+    // Sob demanda o léxico pára logo depois do lookahead, que nunca cruza uma
+    // quebra de linha: a contagem fica igual mesmo se o parser não chegar ao EOS
+    ctx->nLinha = ctx->lookahead.linha;
+    switch (ctx->lookahead.atomo) {
+        case IDENTIFICADOR:
+            ctx->lookahead.atributo.simbolo = interna_com_hash(ctx->inicio_fonte + a.offset, a.tamanho, (uint32_t)a.atributo);
+            break;
+        case CONSTCHAR: ctx->lookahead.atributo.ch = (char)a.atributo; break;
+        case ERRO:
+            emite_trivia(a.offset);
+            mensagem("%s", e->lexico.tabela.erro);
+            longjmp(ctx->salto_erro, 1);
+            break;
+        case EOS: e->fim = 1; /* fallthrough */
+        default: ctx->lookahead.atributo.numero = a.atributo; break;
+    }
+    ESTAT(ctx->estat.atomos[ctx->lookahead.atomo]++;)
+}
+
+// =================================================================
+// SAÍDA (TRACE DE ÁTOMOS)
+// =================================================================
+
+/*
+ * Todo o trace passa por um buffer de 1 MiB formatado à mão e descarregado
+ * com fwrite; não há printf por átomo. Mensagens de erro descarregam o
+ * buffer antes de serem impressas, preservando a ordem da saída. No modo
+ * binário erros e resumo vão para stderr para não corromper o fluxo.
+ * Sem destino (modo em lote) o buffer cresce e guarda a saída inteira.
+ */
+static unsigned char tamanho_nome[EOS + 1];
+
+void inicia_nomes() {
+    for (int a = 0; a <= EOS; a++) tamanho_nome[a] = (unsigned char)strlen(TAtomo_str[a]);
+}
+
+void saida_descarrega() {
+    if (ctx->destino == NULL) return;
+    if (ctx->saida_uso > 0) fwrite(ctx->saida_buf, 1, ctx->saida_uso, ctx->destino);
+    ctx->saida_uso = 0;
+    fflush(ctx->destino);
+}
+
+static void saida_amplia(size_t n) {
+    if (ctx->destino != NULL) {
+        fwrite(ctx->saida_buf, 1, ctx->saida_uso, ctx->destino);
+        ctx->saida_uso = 0;
+        return;
+    }
+    size_t capacidade = ctx->saida_capacidade > 0 ? ctx->saida_capacidade : 4096;
+    while (ctx->saida_uso + n > capacidade) capacidade *= 2;
+    ESTAT(estat_aloca(capacidade);)
+    char *novo = (char*)realloc(ctx->saida_buf, capacidade);
+    if (novo == NULL) {
+        // A compilação falha, não o processo: o que já foi capturado dá
+        // lugar ao diagnóstico, que cabe no buffer antigo
+        ctx->saida_uso = 0;
+        if (ctx->saida_capacidade >= 64) erro_fatal("Erro ao alocar memoria.\n");
+        ctx->falha_fatal = 1;
+        longjmp(ctx->salto_erro, 1);
+    }
+    ctx->saida_buf = novo;
+    ctx->saida_capacidade = capacidade;
+}
+
+static inline void saida_reserva(size_t n) {
+    if (ctx->saida_uso + n > ctx->saida_capacidade) saida_amplia(n);
+}
+
+void saida_escreve(const char *dados, size_t n) {
+    if (ctx->destino != NULL && n > ctx->saida_capacidade) {
+        // Bloco maior que o buffer (saída de um pedaço costurado): vai direto
+        if (ctx->saida_uso > 0) fwrite(ctx->saida_buf, 1, ctx->saida_uso, ctx->destino);
+        ctx->saida_uso = 0;
+        fwrite(dados, 1, n, ctx->destino);
+        return;
+    }
+    saida_reserva(n);
+    memcpy(ctx->saida_buf + ctx->saida_uso, dados, n);
+    ctx->saida_uso += n;
+}
+
+/*
+ * destino NULL acumula a saída em memória. Sem memória para o buffer
+ * inicial, o contexto em memória fica com saida_buf NULL: quem o criou
+ * decide se desiste, e a primeira escrita tenta alocar de novo, já sob
+ * salto_erro.
+ */
+void inicia_saida(FILE *destino) {
+    ctx->destino = destino;
+    ctx->saida_capacidade = destino != NULL ? TAM_SAIDA : 4096;
+    ESTAT(estat_aloca(ctx->saida_capacidade);)
+    ctx->saida_buf = (char*)malloc(ctx->saida_capacidade);
+    ctx->saida_uso = 0;
+    if (ctx->saida_buf == NULL) {
+        if (destino != NULL) {
+            printf("Erro ao alocar memoria.\n");
+            exit(1);
+        }
+        ctx->saida_capacidade = 0;
+        return;
+    }
+    if (modo_trace == TRACE_BINARIO) inicia_trace_binario();
+}
+
+// Cabeçalho do trace binário no início do buffer de saída
+void inicia_trace_binario() {
+    uint16_t versao = VERSAO_TRACE_BINARIO, tam = sizeof(TRegistroTrace);
+    memcpy(ctx->saida_buf, "PKTR", 4);
+    memcpy(ctx->saida_buf + 4, &versao, 2);
+    memcpy(ctx->saida_buf + 6, &tam, 2);
+    ctx->saida_uso = 8;
+}
+
+// Escreve o decimal de v em p e devolve o fim
+static inline char *escreve_inteiro(char *p, int v) {
+    char tmp[12];
+    int n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    do { tmp[n++] = (char)('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) *p++ = '-';
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+static void emite_binario(const TInfoAtomo *atomo) {
+    TRegistroTrace r;
+    memset(&r, 0, sizeof(r));
+    r.linha = (uint32_t)atomo->linha;
+    r.atomo = (uint8_t)atomo->atomo;
+    if (atomo->atomo == IDENTIFICADOR) {
+        int n;
+        const char *nome = nome_simbolo(atomo->atributo.simbolo, &n);
+        r.tamanho = (uint8_t)n;
+        memcpy(r.atributo.texto, nome, (size_t)n);
+    } else if (atomo->atomo == CONSTINT || atomo->atomo == NUMERO) {
+        r.atributo.numero = atomo->atributo.numero;
+    } else if (atomo->atomo == CONSTCHAR) {
+        r.atributo.ch = atomo->atributo.ch;
+    }
+    saida_reserva(sizeof(r));
+    memcpy(ctx->saida_buf + ctx->saida_uso, &r, sizeof(r));
+    ctx->saida_uso += sizeof(r);
+}
+
+// Mesmo formato "# linha:atomo" do printf original, inclusive as particularidades:
+// EOS não é impresso e constint sai sem valor
+static void escreve_atomo(const TInfoAtomo *atomo) {
+    if (modo_trace == TRACE_BINARIO) {
+        emite_binario(atomo);
+        return;
+    }
+    saida_reserva(64);
+    char *p = ctx->saida_buf + ctx->saida_uso;
+    *p++ = '#';
+    *p++ = ' ';
+    p = escreve_inteiro(p, atomo->linha);
+    *p++ = ':';
+    switch (atomo->atomo) {
+        case IDENTIFICADOR: {
+            int n;
+            const char *nome = nome_simbolo(atomo->atributo.simbolo, &n);
+            memcpy(p, "identifier : ", 13);
+            memcpy(p + 13, nome, (size_t)n);
+            p += 13 + n;
+            break;
+        }
+        case NUMERO:
+            memcpy(p, "constint : ", 11);
+            p = escreve_inteiro(p + 11, atomo->atributo.numero);
+            break;
+        case CONSTCHAR:
+            memcpy(p, "constchar : '", 13);
+            p[13] = atomo->atributo.ch;
+            p[14] = '\'';
+            p += 15;
+            break;
+        default: {
+            const char *nome = nome_atomo(atomo->atomo);
+            size_t n = (atomo->atomo >= 0 && atomo->atomo <= EOS) ? tamanho_nome[atomo->atomo] : strlen(nome);
+            memcpy(p, nome, n);
+            p += n;
+            break;
+        }
+    }
+    *p++ = '\n';
+    ctx->saida_uso = (size_t)(p - ctx->saida_buf);
+}
+
+// Imprime o lookahead, precedido dos comentários que ficaram antes dele
+void emite_atomo(const TInfoAtomo *atomo) {
+    if (modo_trace == TRACE_DESLIGADO) return;
+    ESTAT_CRONOMETRO(chamadas_saida);
+    const TCanalTrivia *c = &ctx->trivia;
+    if (c->cursor < c->quantidade && c->itens[c->cursor].offset < ctx->offset_lookahead) emite_trivia(ctx->offset_lookahead);
+    if (atomo->atomo != EOS) escreve_atomo(atomo);
+}
+
+// Tira do canal os comentários antes de limite, imprimindo-os fora de sincroniza
+void emite_trivia(uint32_t limite) {
+    TCanalTrivia *c = &ctx->trivia;
+    for (; c->cursor < c->quantidade && c->itens[c->cursor].offset < limite; c->cursor++) {
+        if (c->descartando || modo_trace == TRACE_DESLIGADO) continue;
+        TInfoAtomo comentario;
+        memset(&comentario, 0, sizeof(comentario));
+        comentario.atomo = COMENTARIO;
+        comentario.linha = (int)c->itens[c->cursor].linha;
+        escreve_atomo(&comentario);
+    }
+}
+
+// Mensagem de diagnóstico: em stderr no trace binário, senão junto com o trace
+void emite_mensagem(const char *formato, va_list args) {
+    if (ctx->destino != NULL && modo_trace == TRACE_BINARIO) {
+        saida_descarrega();
+        vfprintf(stderr, formato, args);
+        return;
+    }
+    va_list copia;
+    va_copy(copia, args);
+    int n = vsnprintf(NULL, 0, formato, copia);
+    va_end(copia);
+    if (n < 0) return;
+    saida_reserva((size_t)n + 1);
+    vsnprintf(ctx->saida_buf + ctx->saida_uso, (size_t)n + 1, formato, args);
+    ctx->saida_uso += (size_t)n;
+    saida_descarrega();
+}
+
+void mensagem(const char *formato, ...) {
+    va_list args;
+    va_start(args, formato);
+    emite_mensagem(formato, args);
+    va_end(args);
+}
+
+void emite_resumo(int linhas) {
+    mensagem("%d linhas analisadas, programa sintaticamente correto\n", linhas);
+}
+
+/*
+ * Diagnóstico de erro no programa analisado. Com --max-errors=N a análise
+ * segue até o N-ésimo erro e só então encerra como erro_fatal; o padrão
+ * (N = 1) para no primeiro, como a análise incremental sempre faz.
+ */
+void conta_erro() {
+    if (++ctx->erros < max_erros && ctx->documento == NULL) return;
+    if (max_erros > 1 && ctx->erros >= max_erros) mensagem("# limite de %d erros atingido, analise interrompida\n", max_erros);
+    longjmp(ctx->salto_erro, 1);
+}
+
+void erro_compilacao(const char *formato, ...) {
+    emite_trivia(ctx->offset_lookahead);
+    va_list args;
+    va_start(args, formato);
+    emite_mensagem(formato, args);
+    va_end(args);
+    conta_erro();
+}
+
+// Encerra a compilação corrente: compila_arquivo devolve erro
+void erro_fatal(const char *formato, ...) {
+    va_list args;
+    va_start(args, formato);
+    emite_mensagem(formato, args);
+    va_end(args);
+    ctx->falha_fatal = 1;
+    longjmp(ctx->salto_erro, 1);
+}
+
+// =================================================================
+// ÁRVORE SINTÁTICA (ARENA)
+// =================================================================
+
+/*
+ * Alocação por incremento num único vetor de TNo: novo_no só avança
+ * quantidade, e quando a capacidade acaba o vetor dobra. Como os nós se
+ * referem uns aos outros por índice, a realocação não invalida nada, e a
+ * árvore inteira é liberada de uma vez em libera_arena.
+ */
+static void arena_reserva(TArena *arena, uint32_t nova) {
+    ESTAT(estat_aloca((size_t)nova * sizeof(TNo));)
+    TNo *nos = (TNo*)realloc(arena->nos, (size_t)nova * sizeof(TNo));
+    if (nos == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    arena->nos = nos;
+    arena->capacidade = nova;
+}
+
+static void arena_cresce(TArena *arena) {
+    arena_reserva(arena, arena->capacidade ? arena->capacidade * 2 : 1024);
+}
+
+uint32_t novo_no(TTipoNo tipo, TAtomo atomo, uint32_t offset, int32_t valor) {
+    if (ctx->ast.quantidade == ctx->ast.capacidade) arena_cresce(&ctx->ast);
+    uint32_t i = ctx->ast.quantidade++;
+    TNo *no = &ctx->ast.nos[i];
+    no->tipo = (uint8_t)tipo;
+    no->atomo = (uint8_t)atomo;
+    no->reservado = 0;
+    no->offset = offset;
+    no->filho = NO_NULO;
+    no->irmao = NO_NULO;
+    no->valor = valor;
+    return i;
+}
+
+// Acrescenta filho ao fim da lista de pai; *ultimo guarda o último filho ligado
+static inline void liga_filho(uint32_t pai, uint32_t *ultimo, uint32_t filho) {
+    if (*ultimo == NO_NULO) ctx->ast.nos[pai].filho = filho;
+    else ctx->ast.nos[*ultimo].irmao = filho;
+    *ultimo = filho;
+}
+
+static uint32_t novo_binario(TAtomo op, uint32_t offset, uint32_t esq, uint32_t dir) {
+    uint32_t no = novo_no(NO_BINARIO, op, offset, 0);
+    ctx->ast.nos[no].filho = esq;
+    ctx->ast.nos[esq].irmao = dir;
+    return no;
+}
+
+void libera_arena(TArena *arena) {
+    free(arena->nos);
+    memset(arena, 0, sizeof(*arena));
+}
+
+// Linha de um offset: índice de inícios de linha montado na primeira consulta
+
+int linha_do_offset(uint32_t offset) {
+    if (ctx->inicios_linha == NULL) {
+        size_t tamanho = ctx->fonte.tamanho, capacidade = 1024;
+        ESTAT(estat_aloca(capacidade * sizeof(uint32_t));)
+        ctx->inicios_linha = (uint32_t*)malloc(capacidade * sizeof(uint32_t));
+        if (ctx->inicios_linha == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+        ctx->inicios_linha[ctx->total_linhas++] = 0;
+        for (const char *p = ctx->inicio_fonte; (p = memchr(p, '\n', tamanho - (size_t)(p - ctx->inicio_fonte))) != NULL; p++) {
+            if (ctx->total_linhas == capacidade) {
+                capacidade *= 2;
+                ESTAT(estat_aloca(capacidade * sizeof(uint32_t));)
+                uint32_t *inicios = (uint32_t*)realloc(ctx->inicios_linha, capacidade * sizeof(uint32_t));
+                if (inicios == NULL) {
+                    erro_fatal("Erro ao alocar memoria.\n");
+                }
+                ctx->inicios_linha = inicios;
+            }
+            ctx->inicios_linha[ctx->total_linhas++] = (uint32_t)(p - ctx->inicio_fonte + 1);
+        }
+    }
+    uint32_t ini = 0, fim = ctx->total_linhas;
+    while (fim - ini > 1) {
+        uint32_t meio = ini + (fim - ini) / 2;
+        if (ctx->inicios_linha[meio] <= offset) ini = meio;
+        else fim = meio;
+    }
+    return (int)ini + 1;
+}
+
+static const char *nome_no[] = {
+    "programa", "bloco", "declaracoes", "declaracao", "composto",
+    "atribuicao", "leitura", "escrita", "se", "enquanto", "vazio",
+    "binario", "nao", "id", "constint", "constchar", "logico", "desloca"
+};
+
+// Pré-ordem sem recursão: a pilha guarda, por nível aberto, o irmão que vem depois
+void despeja_ast(uint32_t no, int nivel) {
+    uint32_t *pilha = NULL;
+    size_t n_pilha = 0, capacidade = 0;
+    for (;;) {
+        if (no == NO_NULO) {
+            if (n_pilha == 0) break;
+            no = pilha[--n_pilha];
+            nivel--;
+            continue;
+        }
+        const TNo *n = &ctx->ast.nos[no];
+        printf("%*s%s", nivel * 2, "", nome_no[n->tipo]);
+        switch (n->tipo) {
+            case NO_ID: {
+                int tam;
+                const char *nome = nome_simbolo((uint32_t)n->valor, &tam);
+                printf(" %.*s", tam, nome);
+                break;
+            }
+            case NO_CONSTINT: printf(" %d", n->valor); break;
+            case NO_CONSTCHAR: printf(" '%c'", (char)n->valor); break;
+            case NO_LOGICO: printf(" %s", n->valor ? "true" : "false"); break;
+            case NO_DESLOCA: printf(" %d", n->valor); break;
+            case NO_BINARIO: case NO_DECLARACAO: printf(" %s", nome_atomo((TAtomo)n->atomo)); break;
+            default: break;
+        }
+        printf("  [#%u, linha %d]\n", no, linha_do_offset(n->offset));
+        if (n->filho == NO_NULO) {
+            no = n->irmao;
+            continue;
+        }
+        if (n_pilha == capacidade) {
+            capacidade = capacidade ? capacidade * 2 : 64;
+            uint32_t *nova = (uint32_t*)realloc(pilha, capacidade * sizeof(uint32_t));
+            if (nova == NULL) {
+                free(pilha);
+                erro_fatal("Erro ao alocar memoria.\n");
+            }
+            pilha = nova;
+        }
+        pilha[n_pilha++] = n->irmao;
+        no = n->filho;
+        nivel++;
+    }
+    free(pilha);
+}
+
+// =================================================================
+// ANALISADOR SINTÁTICO
+// =================================================================
+/*
+ * Recuperação em modo pânico: depois de relatar um erro sintático, o parser
+ * descarta átomos até um do conjunto de sincronização e segue como se a
+ * construção estivesse completa. Cada regra acrescenta ao conjunto os átomos
+ * em que ela sabe retomar (';' e end numa lista de comandos, then e do nas
+ * condições, else no ramo then, ')' entre parênteses, '.' no programa) e o
+ * restaura ao sair. Enquanto nenhum átomo é consumido depois do descarte,
+ * novos erros são cascata do primeiro e não são relatados.
+ *
+ * Depois de um comando da lista, qualquer átomo que não seja ';' ou end é
+ * erro, e o resto do comando é descartado até o que pode segui-lo. Assim
+ * "if a then b := 1 els b := 2;" dá um único diagnóstico, no els, e a
+ * análise retoma depois do ';' em vez de ler "els b" como atribuição.
+ */
+#define CONJ(a) (1ull << (a))
+
+static void sincroniza(uint64_t conjunto) {
+    conjunto |= ctx->sincronia | CONJ(EOS);
+    ctx->trivia.descartando = 1;
+    while (!(CONJ(ctx->lookahead.atomo) & conjunto)) avanca();
+    emite_trivia(ctx->offset_lookahead);
+    ctx->trivia.descartando = 0;
+    ctx->fim_panico = ctx->offset_lookahead + 1;
+}
+
+// Erro sintático no lookahead; conjunto são átomos extras em que retomar
+static void erro_sintatico(uint64_t conjunto, const char *formato, ...) {
+    emite_trivia(ctx->offset_lookahead);
+    if (ctx->offset_lookahead + 1 != ctx->fim_panico) {
+        va_list args;
+        va_start(args, formato);
+        emite_mensagem(formato, args);
+        va_end(args);
+        conta_erro();
+    }
+    sincroniza(conjunto);
+}
+
+// Consome o átomo esperado e devolve sua posição no fonte
+uint32_t consome(TAtomo esperado) {
+    uint32_t offset = ctx->offset_lookahead;
+    if (ctx->lookahead.atomo == esperado) {
+        // Imprime o token ANTES de obter o próximo
+        emite_atomo(&ctx->lookahead);
+        // Obtém o próximo token apenas se não for o fim
+        if (ctx->lookahead.atomo != EOS) {
+            avanca();
+        }
+    } else {
+        erro_sintatico(CONJ(esperado), "# %d:erro sintatico, esperado [%s] encontrado [%s]\n", ctx->lookahead.linha, nome_atomo(esperado), nome_atomo(ctx->lookahead.atomo));
+        // Retomou no próprio átomo esperado: ele fecha a construção
+        if (ctx->lookahead.atomo == esperado && esperado != EOS) {
+            emite_atomo(&ctx->lookahead);
+            avanca();
+        }
+    }
+    return offset;
+}
+
+// Uso de identificador: consulta direta ao tipo do símbolo, sem comparar nomes
+typedef enum { ID_NOME, ID_DECLARACAO, ID_USO } TUsoId;
+
+// Consome um identificador e devolve o nó NO_ID correspondente
+static uint32_t consome_id(TUsoId uso) {
+    uint32_t no = novo_no(NO_ID, 0, ctx->offset_lookahead, 0);
+    if (ctx->lookahead.atomo == IDENTIFICADOR) {
+        uint32_t simbolo = ctx->lookahead.atributo.simbolo;
+        TSimbolo *s = &ctx->simbolos.simbolos[simbolo];
+        if (uso == ID_DECLARACAO) {
+            if (s->tipo != 0) {
+                int n;
+                const char *nome = nome_simbolo(simbolo, &n);
+                erro_compilacao("# %d:erro semantico, identificador [%.*s] declarado mais de uma vez\n", ctx->lookahead.linha, n, nome);
+            }
+            s->tipo = IDENTIFICADOR; // pendente até type() definir o tipo
+        } else if (uso == ID_USO && s->tipo == 0) {
+            int n;
+            const char *nome = nome_simbolo(simbolo, &n);
+            erro_compilacao("# %d:erro semantico, identificador [%.*s] nao declarado\n", ctx->lookahead.linha, n, nome);
+        }
+        ctx->ast.nos[no].valor = (int32_t)simbolo;
+    }
+    consome(IDENTIFICADOR);
+    return no;
+}
+
+uint32_t program() {
+    ctx->sincronia = CONJ(PONTO);
+    uint32_t no = novo_no(NO_PROGRAMA, 0, consome(PROGRAM), 0);
+    uint32_t ultimo = NO_NULO;
+    liga_filho(no, &ultimo, consome_id(ID_NOME));
+    consome(PONTO_VIRGULA);
+    liga_filho(no, &ultimo, block());
+    consome(PONTO);
+    return no;
+}
+
+uint32_t block(){
+    uint32_t no = novo_no(NO_BLOCO, 0, ctx->offset_lookahead, 0);
+    uint32_t ultimo = NO_NULO;
+    liga_filho(no, &ultimo, variable_declaration_part());
+    liga_filho(no, &ultimo, statement_part());
+    return no;
+}
+
+uint32_t variable_declaration_part() {
+    uint32_t no = novo_no(NO_DECLARACOES, 0, ctx->offset_lookahead, 0);
+    uint32_t ultimo = NO_NULO;
+    if (ctx->lookahead.atomo == VAR) {
+        uint64_t sincronia = ctx->sincronia;
+        ctx->sincronia |= CONJ(PONTO_VIRGULA) | CONJ(BEGIN);
+        consome(VAR);
+        liga_filho(no, &ultimo, variable_declaration());
+        consome(PONTO_VIRGULA);
+        while (ctx->lookahead.atomo == IDENTIFICADOR) {
+            liga_filho(no, &ultimo, variable_declaration());
+            consome(PONTO_VIRGULA);
+        }
+        ctx->sincronia = sincronia;
+    }
+    return no;
+}
+
+uint32_t variable_declaration() {
+    uint32_t no = novo_no(NO_DECLARACAO, 0, ctx->offset_lookahead, 0);
+    uint32_t ultimo = NO_NULO;
+    liga_filho(no, &ultimo, consome_id(ID_DECLARACAO));
+    while (ctx->lookahead.atomo == VIRGULA) {
+        consome(VIRGULA);
+        liga_filho(no, &ultimo, consome_id(ID_DECLARACAO));
+    }
+    consome(DOIS_PONTOS);
+    TAtomo tipo = type();
+    ctx->ast.nos[no].atomo = (uint8_t)tipo;
+    // Registra o tipo de cada nome declarado na tabela plana de símbolos
+    for (uint32_t id = ctx->ast.nos[no].filho; id != NO_NULO; id = ctx->ast.nos[id].irmao)
+        ctx->simbolos.simbolos[ctx->ast.nos[id].valor].tipo = (uint8_t)tipo;
+    return no;
+}
+
+TAtomo type() {
+    TAtomo tipo = ctx->lookahead.atomo;
+    if (ctx->lookahead.atomo == CHAR) consome(CHAR);
+    else if (ctx->lookahead.atomo == INTEGER) consome(INTEGER);
+    else if (ctx->lookahead.atomo == BOOLEAN) consome(BOOLEAN);
+    else {
+        erro_sintatico(0, "# %d:erro sintatico, tipo invalido esperado [char, integer, boolean] mas encontrado [%s]\n", ctx->lookahead.linha, nome_atomo(ctx->lookahead.atomo));
+    }
+    return tipo;
+}
+
+/*
+ * Comandos e expressões são analisados sem recursão nativa: if, while e
+ * begin..end empilham uma moldura em ctx->quadros e o comando seguinte é
+ * lido no mesmo laço; ao terminar, ele é entregue à moldura do topo, que
+ * decide se ainda espera algo (else, ';' ou end) ou se fecha e entrega o
+ * próprio nó à de baixo. Assim a profundidade de aninhamento do fonte só
+ * custa memória das pilhas do contexto, não pilha da thread.
+ */
+static void *pilha_cresce(void *pilha, size_t *capacidade, size_t tamanho) {
+    size_t nova = *capacidade ? *capacidade * 2 : 64;
+    ESTAT(estat_aloca(nova * tamanho);)
+    void *p = realloc(pilha, nova * tamanho);
+    if (p == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    *capacidade = nova;
+    return p;
+}
+
+static void empilha_quadro(TTipoQuadro tipo, uint32_t no, uint32_t ultimo, uint64_t sincronia) {
+    if (ctx->n_quadros == ctx->capacidade_quadros)
+        ctx->quadros = (TQuadro*)pilha_cresce(ctx->quadros, &ctx->capacidade_quadros, sizeof(TQuadro));
+    TQuadro *q = &ctx->quadros[ctx->n_quadros++];
+    q->tipo = (uint8_t)tipo;
+    q->no = no;
+    q->ultimo = ultimo;
+    q->sincronia = sincronia;
+    q->atomo = 0;
+}
+
+// Antes de cada comando de uma lista; no modo documento, registra onde ele começa
+static inline void inicia_elemento(TQuadro *q) {
+    if (ctx->documento == NULL) return;
+    q->atomo = ctx->cursor_tabela - 1;
+}
+
+static void abre_lista() {
+    uint64_t sincronia = ctx->sincronia;
+    ctx->sincronia |= CONJ(PONTO_VIRGULA) | CONJ(END);
+    uint32_t no = novo_no(NO_COMPOSTO, 0, consome(BEGIN), 0);
+    empilha_quadro(QUADRO_LISTA, no, NO_NULO, sincronia);
+    inicia_elemento(&ctx->quadros[ctx->n_quadros - 1]);
+}
+
+static void abre_se() {
+    uint64_t sincronia = ctx->sincronia;
+    uint32_t no = novo_no(NO_SE, 0, consome(IF), 0);
+    uint32_t ultimo = NO_NULO;
+    ctx->sincronia = sincronia | CONJ(THEN);
+    liga_filho(no, &ultimo, expression());
+    ctx->sincronia = sincronia | CONJ(ELSE);
+    consome(THEN);
+    empilha_quadro(QUADRO_SE_ENTAO, no, ultimo, sincronia);
+}
+
+static void abre_enquanto() {
+    uint64_t sincronia = ctx->sincronia;
+    uint32_t no = novo_no(NO_ENQUANTO, 0, consome(WHILE), 0);
+    uint32_t ultimo = NO_NULO;
+    ctx->sincronia = sincronia | CONJ(DO);
+    liga_filho(no, &ultimo, expression());
+    ctx->sincronia = sincronia;
+    consome(DO);
+    empilha_quadro(QUADRO_ENQUANTO, no, ultimo, sincronia);
+}
+
+/*
+ * Analisa um comando (lista = 0) ou uma lista begin..end (lista = 1). As
+ * molduras deixadas por um erro que saltou para fora são descartadas aqui:
+ * a análise de comandos nunca é reentrada.
+ */
+static uint32_t continua_comandos(uint32_t desvio);
+
+static uint32_t analisa_comandos(int lista) {
+    ctx->n_quadros = 0;
+    if (lista) abre_lista();
+    return continua_comandos(!lista);   // statement() conta como um nível a mais que statement_part()
+}
+
+// Laço das molduras a partir das já empilhadas, começando um comando novo
+static uint32_t continua_comandos(uint32_t desvio) {
+    (void)desvio;
+    uint32_t no = NO_NULO;             // comando pronto a entregar; NO_NULO: começar um novo
+    for (;;) {
+        if (no == NO_NULO) {
+            ESTAT(uint32_t nivel = (uint32_t)ctx->n_quadros + desvio;
+                  if (nivel > ctx->estat.profundidade_comando) ctx->estat.profundidade_comando = nivel;)
+            switch (ctx->lookahead.atomo) {
+                case IDENTIFICADOR: no = assignment_statement(); break;
+                case READ: no = read_statement(); break;
+                case WRITE: no = write_statement(); break;
+                case IF: abre_se(); continue;
+                case WHILE: abre_enquanto(); continue;
+                case BEGIN: abre_lista(); continue;
+                default: no = novo_no(NO_VAZIO, 0, ctx->offset_lookahead, 0); break;   // Instrução Vazia
+            }
+        }
+        if (ctx->n_quadros == 0) return no;
+
+        TQuadro *q = &ctx->quadros[ctx->n_quadros - 1];
+        switch ((TTipoQuadro)q->tipo) {
+            case QUADRO_SE_ENTAO:
+                liga_filho(q->no, &q->ultimo, no);
+                ctx->sincronia = q->sincronia;
+                if (ctx->lookahead.atomo == ELSE) {
+                    consome(ELSE);
+                    q->tipo = QUADRO_SE_SENAO;
+                    no = NO_NULO;
+                    continue;
+                }
+                break;
+            case QUADRO_SE_SENAO:
+            case QUADRO_ENQUANTO:
+                liga_filho(q->no, &q->ultimo, no);
+                break;
+            case QUADRO_LISTA:
+                if (ctx->documento != NULL) documento_registra(q->atomo, no, q->no, q->ultimo);
+                liga_filho(q->no, &q->ultimo, no);
+                if (ctx->lookahead.atomo != PONTO_VIRGULA && ctx->lookahead.atomo != END) {
+                    // Relata o que o consome(END) relataria e descarta o resto do comando
+                    // até o que pode segui-lo: ';' ou end da lista, else ou '.' de fora
+                    erro_sintatico(0, "# %d:erro sintatico, esperado [%s] encontrado [%s]\n", ctx->lookahead.linha, nome_atomo(END), nome_atomo(ctx->lookahead.atomo));
+                }
+                if (ctx->lookahead.atomo == PONTO_VIRGULA) consome(PONTO_VIRGULA);
+                else {
+                    ctx->sincronia = q->sincronia;
+                    consome(END);
+                    break;
+                }
+                inicia_elemento(q);
+                no = NO_NULO;
+                continue;
+        }
+        // A moldura do topo está completa: seu nó é o comando que ela formou
+        no = q->no;
+        ctx->n_quadros--;
+    }
+}
+
+uint32_t statement_part() {
+    // Os pedaços relêem o fonte com o léxico sob demanda; documento e trace binário ficam em série
+    if (threads_analise > 1 && ctx->lookahead.atomo == BEGIN && modo_lexico == LEX_SOB_DEMANDA &&
+        modo_trace != TRACE_BINARIO && ctx->documento == NULL) return statement_part_paralela();
+    return analisa_comandos(1);
+}
+
+uint32_t statement() {
+    return analisa_comandos(0);
+}
+
+// Comando de uma lista begin..end; no modo documento, registra onde ele começa
+uint32_t elemento_lista(uint32_t lista, uint32_t anterior) {
+    if (ctx->documento == NULL) return statement();
+    size_t atomo = ctx->cursor_tabela - 1;
+    uint32_t no = statement();
+    documento_registra(atomo, no, lista, anterior);
+    return no;
+}
+
+uint32_t assignment_statement(){
+    uint32_t no = novo_no(NO_ATRIBUICAO, 0, ctx->offset_lookahead, 0);
+    uint32_t ultimo = NO_NULO;
+    liga_filho(no, &ultimo, consome_id(ID_USO));
+    consome(ATRIBUICAO);
+    liga_filho(no, &ultimo, expression());
+    return no;
+}
+
+uint32_t read_statement() {
+    uint32_t no = novo_no(NO_LEITURA, 0, consome(READ), 0);
+    uint32_t ultimo = NO_NULO;
+    consome(ABRE_PAR);
+    liga_filho(no, &ultimo, consome_id(ID_USO));
+    while (ctx->lookahead.atomo == VIRGULA) {
+        consome(VIRGULA);
+        liga_filho(no, &ultimo, consome_id(ID_USO));
+    }
+    consome(FECHA_PAR);
+    return no;
+}
+
+uint32_t write_statement() {
+    uint32_t no = novo_no(NO_ESCRITA, 0, consome(WRITE), 0);
+    uint32_t ultimo = NO_NULO;
+    consome(ABRE_PAR);
+    liga_filho(no, &ultimo, consome_id(ID_USO));
+    while (ctx->lookahead.atomo == VIRGULA) {
+        consome(VIRGULA);
+        liga_filho(no, &ultimo, consome_id(ID_USO));
+    }
+    consome(FECHA_PAR);
+    return no;
+}
+
+/*
+ * Expressões por precedência de operadores: potencia_operador dá a força
+ * de ligação de cada átomo (0 = não é operador binário). Relacionais ligam
+ * menos que aditivos, que ligam menos que multiplicativos; um relacional
+ * não associa e aparece no máximo uma vez por nível de parênteses, como na
+ * gramática. Os nós binários nascem quando o operador é reduzido, na mesma
+ * ordem em que a descida recursiva os criava.
+ */
+static const uint8_t potencia_operador[EOS + 1] = {
+    [ASTERISCO] = 3, [DIV] = 3,
+    [MAIS] = 2, [MENOS] = 2,
+    [MENOR] = 1, [MAIOR] = 1, [MENOR_IGUAL] = 1, [MAIOR_IGUAL] = 1,
+    [NEGACAO] = 1, [IGUAL] = 1, [OR] = 1, [AND] = 1,
+};
+
+static inline void empilha_operando(uint32_t no) {
+    if (ctx->n_operandos == ctx->capacidade_operandos)
+        ctx->operandos = (uint32_t*)pilha_cresce(ctx->operandos, &ctx->capacidade_operandos, sizeof(uint32_t));
+    ctx->operandos[ctx->n_operandos++] = no;
+}
+
+static inline TOperador *empilha_operador(TTipoOperador tipo) {
+    if (ctx->n_operadores == ctx->capacidade_operadores)
+        ctx->operadores = (TOperador*)pilha_cresce(ctx->operadores, &ctx->capacidade_operadores, sizeof(TOperador));
+    TOperador *op = &ctx->operadores[ctx->n_operadores++];
+    op->tipo = (uint8_t)tipo;
+    return op;
+}
+
+// Reduz os binários do topo que ligam com força >= potencia, até um '(' ou o fundo
+static inline void reduz(uint8_t potencia) {
+    while (ctx->n_operadores > 0) {
+        const TOperador *op = &ctx->operadores[ctx->n_operadores - 1];
+        if (op->tipo != OPERADOR_BINARIO || potencia_operador[op->atomo] < potencia) break;
+        uint32_t dir = ctx->operandos[--ctx->n_operandos];
+        uint32_t esq = ctx->operandos[ctx->n_operandos - 1];
+        ctx->operandos[ctx->n_operandos - 1] = novo_binario((TAtomo)op->atomo, op->valor, esq, dir);
+        ctx->n_operadores--;
+    }
+}
+
+uint32_t expression() {
+    ctx->n_operadores = 0;   // expression() não é reentrada; sobras de um erro são descartadas
+    ctx->n_operandos = 0;
+    int relacional = 0;      // o nível de parênteses corrente já tem seu operador relacional
+    ESTAT(uint32_t parenteses = 0;
+          if (ctx->estat.profundidade_expressao < 1) ctx->estat.profundidade_expressao = 1;)
+    for (;;) {
+        // Posição de prefixo: '(' e not abrem um fator, os demais o completam
+        if (ctx->lookahead.atomo == ABRE_PAR) {
+            TOperador *op = empilha_operador(OPERADOR_PARENTESE);
+            op->relacional = (uint8_t)relacional;
+            op->sincronia = ctx->sincronia;
+            ctx->sincronia |= CONJ(FECHA_PAR);
+            consome(ABRE_PAR);
+            relacional = 0;
+            ESTAT(if (++parenteses + 1 > ctx->estat.profundidade_expressao) ctx->estat.profundidade_expressao = parenteses + 1;)
+            continue;
+        }
+        if (ctx->lookahead.atomo == NOT) {
+            uint32_t no = novo_no(NO_NAO, 0, consome(NOT), 0);
+            empilha_operador(OPERADOR_NAO)->valor = no;
+            continue;
+        }
+        empilha_operando(factor());
+
+        // Posição de infixo: fatores completos, à espera de um operador
+        for (;;) {
+            while (ctx->n_operadores > 0 && ctx->operadores[ctx->n_operadores - 1].tipo == OPERADOR_NAO) {
+                uint32_t no = ctx->operadores[--ctx->n_operadores].valor;
+                ctx->ast.nos[no].filho = ctx->operandos[ctx->n_operandos - 1];
+                ctx->operandos[ctx->n_operandos - 1] = no;
+            }
+            TAtomo a = ctx->lookahead.atomo;
+            if (potencia_operador[a] > 1) break;
+            if (potencia_operador[a] == 1 && !relacional) {
+                relacional = 1;
+                break;
+            }
+            // Fim do nível: reduz tudo e fecha o '(' que o abriu, se houver
+            reduz(1);
+            if (ctx->n_operadores == 0) return ctx->operandos[0];
+            const TOperador *op = &ctx->operadores[--ctx->n_operadores];
+            ctx->sincronia = op->sincronia;
+            relacional = op->relacional;
+            ESTAT(parenteses--;)
+            consome(FECHA_PAR);
+        }
+        TAtomo a = ctx->lookahead.atomo;
+        reduz(potencia_operador[a]);
+        TOperador *op = empilha_operador(OPERADOR_BINARIO);
+        op->atomo = (uint8_t)a;
+        op->valor = ctx->offset_lookahead;
+        consome(a);
+    }
+}
+
+// Fatores sem subexpressão; '(' e not são tratados em expression()
+uint32_t factor() {
+    uint32_t no = NO_NULO;
+    if (ctx->lookahead.atomo == IDENTIFICADOR) no = consome_id(ID_USO);
+    else if (ctx->lookahead.atomo == CONSTINT) { // constint
+        no = novo_no(NO_CONSTINT, 0, ctx->offset_lookahead, ctx->lookahead.atributo.numero);
+        consome(CONSTINT);
+    }
+    else if (ctx->lookahead.atomo == NUMERO) {
+        no = novo_no(NO_CONSTINT, 0, ctx->offset_lookahead, ctx->lookahead.atributo.numero);
+        consome(NUMERO);
+    }
+    else if (ctx->lookahead.atomo == CONSTCHAR) {
+        no = novo_no(NO_CONSTCHAR, 0, ctx->offset_lookahead, (unsigned char)ctx->lookahead.atributo.ch);
+        consome(CONSTCHAR);
+    }
+    else if (ctx->lookahead.atomo == TRUE_TOKEN) no = novo_no(NO_LOGICO, 0, consome(TRUE_TOKEN), 1);
+    else if (ctx->lookahead.atomo == FALSE_TOKEN) no = novo_no(NO_LOGICO, 0, consome(FALSE_TOKEN), 0);
+    else {
+        no = novo_no(NO_VAZIO, 0, ctx->offset_lookahead, 0);   // ocupa o lugar do fator na árvore
+        erro_sintatico(0, "# %d:erro sintatico, Esperado: %s, Encontrado: %s\n", ctx->lookahead.linha, "fator", nome_atomo(ctx->lookahead.atomo));
+    }
+    return no;
+}
+
+// =================================================================
+// ANÁLISE PARALELA DA PARTE DE COMANDOS (--parse-threads=N)
+// =================================================================
+
+/*
+ * Os programas grandes costumam ser um único begin..end com milhões de
+ * comandos. Uma varredura prévia (evento_divisao, vetorial como a de
+ * espaços) acompanha o aninhamento de begin/end, pula comentários e
+ * constchar e corta a parte de comandos em ';' do nível de fora, em
+ * pedaços de tamanhos parecidos. Cada pedaço é lexado e analisado por uma
+ * thread, num contexto próprio com uma cópia da tabela de símbolos, como a
+ * sequência de comandos entre dois cortes; o último vai até o end.
+ *
+ * A costura segue a ordem do fonte: a saída de cada pedaço entra na do
+ * contexto principal, e os nós vão para o fim da arena com os índices
+ * deslocados (a numeração fica a da análise serial, que cria os nós na
+ * mesma ordem). O lookahead, a posição do léxico e os comentários ainda
+ * pendentes do último pedaço passam ao principal, que segue do end. Um
+ * pedaço só vale se analisou sem erro exatamente até o seu corte; no
+ * primeiro que falha, o principal descarta ele e os seguintes e retoma a
+ * análise serial do seu início. Diagnósticos, recuperação de erros e linhas
+ * são, assim, sempre os da análise serial.
+ */
+#define TAM_MIN_PEDACO (64 << 10)
+#define PEDACOS_POR_THREAD 4
+
+typedef struct {
+    uint32_t inicio;            // primeiro byte, logo depois do begin ou do ';' do corte anterior
+    uint32_t fim;               // o ';' do corte, ou o end da parte de comandos
+    int linha;                  // linha em inicio
+    int ultimo;
+    int ok;                     // analisado sem erro até fim
+    uint32_t primeiro_no, ultimo_no;   // comandos do pedaço, na arena do seu contexto
+    uint32_t base;              // deslocamento dos seus nós na arena do principal
+    TContexto contexto;
+} TPedaco;
+
+typedef struct {
+    TPedaco *pedacos;
+    size_t n;                   // pedaços da fase corrente
+    int fase;                   // 0: análise; 1: cópia dos nós para a arena do principal
+    size_t proximo;             // próximo pedaço sem thread (atômico)
+    size_t falhou;              // menor pedaço que falhou até aqui (atômico)
+    TContexto *principal;
+} TDivisao;
+
+static void acrescenta_pedaco(TPedaco **pedacos, size_t *n, size_t *capacidade, const char *inicio, const char *fim, int linha, int ultimo) {
+    if (*n == *capacidade) {
+        *capacidade = *capacidade ? *capacidade * 2 : 16;
+        TPedaco *v = (TPedaco*)realloc(*pedacos, *capacidade * sizeof(TPedaco));
+        if (v == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+        *pedacos = v;
+    }
+    TPedaco *pd = &(*pedacos)[(*n)++];
+    memset(pd, 0, sizeof(*pd));
+    pd->inicio = (uint32_t)(inicio - ctx->inicio_fonte);
+    pd->fim = (uint32_t)(fim - ctx->inicio_fonte);
+    pd->linha = linha;
+    pd->ultimo = ultimo;
+}
+
+/*
+ * Varredura prévia a partir do primeiro byte depois do begin de fora, na
+ * linha dada: corta no primeiro ';' do nível de fora depois de alvo bytes
+ * e termina no end que fecha a parte de comandos. Devolve o número de
+ * pedaços, ou 0 (texto sem esse end, comentário aberto, constchar mal
+ * formada): a análise serial fica com o caso e com o diagnóstico.
+ */
+static size_t divide_comandos(const char *p, int linha, size_t alvo, TPedaco **pedacos) {
+    size_t n = 0, capacidade = 0;
+    const char *inicio = p;
+    int linha_inicio = linha, profundidade = 0;
+    *pedacos = NULL;
+    for (;;) {
+        p = evento_divisao(p, &linha);
+        switch (*p) {
+            case '\0':
+                free(*pedacos);
+                *pedacos = NULL;
+                return 0;
+            case ';':
+                if (profundidade == 0 && (size_t)(p - inicio) >= alvo) {
+                    acrescenta_pedaco(pedacos, &n, &capacidade, inicio, p, linha_inicio, 0);
+                    inicio = p + 1;
+                    linha_inicio = linha;
+                }
+                p++;
+                break;
+            case '(':
+                if (p[1] != '*') {
+                    p++;
+                    break;
+                }
+                p = fim_comentario(p + 2, &linha);
+                if (*p == '\0') {
+                    free(*pedacos);
+                    *pedacos = NULL;
+                    return 0;
+                }
+                p += 2;
+                break;
+            case '\'':
+                // Como reconhece_constchar: qualquer byte entre os apóstrofos, sem contar linha
+                if (p[1] == '\0' || p[2] != '\'') {
+                    free(*pedacos);
+                    *pedacos = NULL;
+                    return 0;
+                }
+                p += 3;
+                break;
+            case 'b':
+                if (strncmp(p, "begin", 5) == 0 && !continua_id(p[5])) {
+                    profundidade++;
+                    p += 5;
+                } else {
+                    p++;
+                }
+                break;
+            default:   // 'e' no início de uma palavra
+                if (strncmp(p, "end", 3) != 0 || continua_id(p[3])) {
+                    p++;
+                    break;
+                }
+                if (profundidade-- == 0) {
+                    acrescenta_pedaco(pedacos, &n, &capacidade, inicio, p, linha_inicio, 1);
+                    return n;
+                }
+                p += 3;
+                break;
+        }
+    }
+}
+
+static void copia_simbolos(TTabelaSimbolos *d, const TTabelaSimbolos *o) {
+    *d = *o;
+    d->simbolos = NULL;
+    d->slots = NULL;
+    d->nomes = NULL;
+    if (o->simbolos != NULL) {
+        d->simbolos = (TSimbolo*)malloc(o->capacidade * sizeof(TSimbolo));
+        if (d->simbolos == NULL) erro_fatal("Erro ao alocar memoria.\n");
+        memcpy(d->simbolos, o->simbolos, o->quantidade * sizeof(TSimbolo));
+    }
+    if (o->slots != NULL) {
+        d->slots = (uint32_t*)malloc(((size_t)o->mascara + 1) * sizeof(uint32_t));
+        if (d->slots == NULL) erro_fatal("Erro ao alocar memoria.\n");
+        memcpy(d->slots, o->slots, ((size_t)o->mascara + 1) * sizeof(uint32_t));
+    }
+    if (o->nomes != NULL) {
+        d->nomes = (char*)malloc(o->capacidade_nomes);
+        if (d->nomes == NULL) erro_fatal("Erro ao alocar memoria.\n");
+        memcpy(d->nomes, o->nomes, o->uso_nomes);
+    }
+}
+
+// Analisa um pedaço no contexto dele; ok só se parar sem erro no átomo do corte
+static void analisa_pedaco(TPedaco *pd, const TContexto *principal) {
+    TContexto *c = &pd->contexto;
+    inicia_contexto(c, NULL);
+    if (setjmp(c->salto_erro) != 0) return;
+    c->inicio_fonte = principal->inicio_fonte;
+    c->buffer = c->inicio_fonte + pd->inicio;
+    c->nLinha = pd->linha;
+    copia_simbolos(&c->simbolos, &principal->simbolos);
+    arena_reserva(&c->ast, (pd->fim - pd->inicio) / 4 + 1024);   // a estimativa de compila_fonte
+    novo_no(NO_VAZIO, 0, 0, 0);   // ocupa o índice 0 (NO_NULO)
+    c->sincronia = CONJ(PONTO) | CONJ(PONTO_VIRGULA) | CONJ(END);   // a de dentro da lista de fora
+    avanca();
+    uint32_t ultimo = NO_NULO;
+    for (;;) {
+        uint32_t no = statement();
+        if (ultimo == NO_NULO) pd->primeiro_no = no;
+        else c->ast.nos[ultimo].irmao = no;
+        ultimo = no;
+        if (c->lookahead.atomo != PONTO_VIRGULA || c->offset_lookahead >= pd->fim) break;
+        consome(PONTO_VIRGULA);
+    }
+    pd->ultimo_no = ultimo;
+    if (c->erros > 0 || c->offset_lookahead != pd->fim || c->lookahead.atomo != (pd->ultimo ? END : PONTO_VIRGULA)) return;
+    // Símbolo novo só aparece com identificador não declarado, mas a tabela do principal não o teria
+    if (c->simbolos.quantidade != principal->simbolos.quantidade) return;
+    // O ';' do corte sai aqui, com os comentários antes dele; o pedaço seguinte lê o que vem depois
+    if (!pd->ultimo) emite_atomo(&c->lookahead);
+    pd->ok = 1;
+}
+
+// Nós do pedaço para o fim da arena do principal, com os índices deslocados de base
+static void copia_nos(TPedaco *pd, TArena *destino) {
+    TArena *origem = &pd->contexto.ast;
+    TNo *d = destino->nos + pd->base + 1;
+    for (uint32_t i = 1; i < origem->quantidade; i++) {
+        TNo no = origem->nos[i];
+        if (no.filho != NO_NULO) no.filho += pd->base;
+        if (no.irmao != NO_NULO) no.irmao += pd->base;
+        *d++ = no;
+    }
+    libera_arena(origem);
+}
+
+static void *trabalha_divisao(void *arg) {
+    TDivisao *dv = (TDivisao*)arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&dv->proximo, 1, __ATOMIC_RELAXED);
+        if (i >= dv->n) break;
+        if (dv->fase == 1) {
+            copia_nos(&dv->pedacos[i], &dv->principal->ast);
+            continue;
+        }
+        // Depois de um pedaço que falhou a análise volta a ser serial: não adianta analisar
+        if (i > __atomic_load_n(&dv->falhou, __ATOMIC_RELAXED)) continue;
+        analisa_pedaco(&dv->pedacos[i], dv->principal);
+        if (dv->pedacos[i].ok) continue;
+        size_t f = __atomic_load_n(&dv->falhou, __ATOMIC_RELAXED);
+        while (i < f && !__atomic_compare_exchange_n(&dv->falhou, &f, i, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+    return NULL;
+}
+
+// Roda uma fase com até n_threads threads; sem threads, a principal faz tudo, com o mesmo resultado
+static void executa_divisao(TDivisao *dv, size_t n_threads) {
+    TContexto *principal = ctx;
+    if (n_threads > dv->n) n_threads = dv->n;
+    dv->proximo = 0;
+    pthread_t *threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    size_t criadas = 0;
+    while (threads != NULL && criadas < n_threads && pthread_create(&threads[criadas], NULL, trabalha_divisao, dv) == 0) criadas++;
+    if (criadas == 0) trabalha_divisao(dv);
+    for (size_t i = 0; i < criadas; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    ctx = principal;
+}
+
+// Liga os comandos do pedaço, já copiados, à lista, e acrescenta sua saída à do principal
+static void costura_pedaco(TPedaco *pd, uint32_t lista, uint32_t *ultimo) {
+    TContexto *c = &pd->contexto;
+    if (c->saida_uso > 0) saida_escreve(c->saida_buf, c->saida_uso);
+    liga_filho(lista, ultimo, pd->primeiro_no + pd->base);
+    *ultimo = pd->ultimo_no + pd->base;
+    ESTAT(for (int a = 0; a <= EOS; a++) ctx->estat.atomos[a] += c->estat.atomos[a];
+          ctx->estat.bytes_espaco += c->estat.bytes_espaco;
+          ctx->estat.bytes_comentario += c->estat.bytes_comentario;
+          if (c->estat.profundidade_expressao > ctx->estat.profundidade_expressao) ctx->estat.profundidade_expressao = c->estat.profundidade_expressao;
+          if (c->estat.profundidade_comando > ctx->estat.profundidade_comando) ctx->estat.profundidade_comando = c->estat.profundidade_comando;)
+}
+
+static void libera_pedacos(TPedaco *pedacos, size_t n) {
+    for (size_t i = 0; i < n; i++) libera_contexto(&pedacos[i].contexto);
+    free(pedacos);
+}
+
+// statement_part com o lookahead no begin de fora
+uint32_t statement_part_paralela() {
+    size_t restante = ctx->fonte.tamanho - (size_t)(ctx->buffer - ctx->inicio_fonte);
+    size_t n_alvo = restante / TAM_MIN_PEDACO;
+    if (n_alvo > (size_t)threads_analise * PEDACOS_POR_THREAD) n_alvo = (size_t)threads_analise * PEDACOS_POR_THREAD;
+    if (n_alvo < 2) return analisa_comandos(1);
+    double ini = agora();
+    TPedaco *pedacos;
+    size_t n = divide_comandos(ctx->buffer, ctx->nLinha, restante / n_alvo, &pedacos);
+    ctx->tempo_divisao = agora() - ini;
+    ctx->pedacos = (uint32_t)n;
+    ctx->costurados = 0;
+    if (n < 2) {
+        free(pedacos);
+        return analisa_comandos(1);
+    }
+
+    // O begin, como em abre_lista, mas sem ler adiante: o primeiro pedaço começa logo depois dele
+    uint64_t sincronia = ctx->sincronia;
+    uint32_t offset = ctx->offset_lookahead;
+    emite_atomo(&ctx->lookahead);
+    uint32_t lista = novo_no(NO_COMPOSTO, 0, offset, 0);
+
+    TDivisao dv = { pedacos, n, 0, 0, n, ctx };
+    executa_divisao(&dv, (size_t)threads_analise);
+
+    // Os pedaços que valeram, até o primeiro que falhou, ocupam o fim da arena na ordem do fonte
+    size_t k = 0;
+    uint64_t total = ctx->ast.quantidade;
+    for (; k < n && pedacos[k].ok; k++) {
+        pedacos[k].base = (uint32_t)(total - 1);
+        total += pedacos[k].contexto.ast.quantidade - 1;
+    }
+    if (k > 0) {
+        if (ctx->ast.capacidade < total) arena_reserva(&ctx->ast, (uint32_t)total);
+        dv.n = k;
+        dv.fase = 1;
+        executa_divisao(&dv, (size_t)threads_analise);
+        ctx->ast.quantidade = (uint32_t)total;
+    }
+    uint32_t ultimo = NO_NULO;
+    for (size_t i = 0; i < k; i++) costura_pedaco(&pedacos[i], lista, &ultimo);
+    ctx->costurados = (uint32_t)k;
+    if (k == n) {
+        // Todos valeram: o end vem do último pedaço, com os comentários que o precedem
+        TContexto *c = &pedacos[n - 1].contexto;
+        ctx->lookahead = c->lookahead;
+        ctx->offset_lookahead = c->offset_lookahead;
+        ctx->buffer = c->buffer;
+        ctx->nLinha = c->nLinha;
+        for (size_t i = c->trivia.cursor; i < c->trivia.quantidade; i++)
+            anota_trivia(c->trivia.itens[i].offset, c->trivia.itens[i].tamanho, c->trivia.itens[i].linha);
+        libera_pedacos(pedacos, n);
+        ctx->sincronia = sincronia;
+        consome(END);
+        return lista;
+    }
+
+    // Retoma em série no pedaço k, como logo depois do ';' que o precede
+    ctx->buffer = ctx->inicio_fonte + pedacos[k].inicio;
+    ctx->nLinha = pedacos[k].linha;
+    libera_pedacos(pedacos, n);
+    ctx->sincronia = sincronia | CONJ(PONTO_VIRGULA) | CONJ(END);
+    avanca();
+    ctx->n_quadros = 0;
+    empilha_quadro(QUADRO_LISTA, lista, ultimo, sincronia);
+    return continua_comandos(0);
+}
+
+/*
+ * --bench-parse[=N] arquivo: compilação com a saída em memória, em série
+ * e com 2, 4, ... até N threads, 5 vezes cada; relata a mediana,
+ * o ganho sobre a série, os pedaços costurados e se a saída ficou igual.
+ */
+void bench_divisao(const char *caminho, int max_threads) {
+    TFonte fonte;
+    if (!carrega_fonte(caminho, &fonte)) {
+        fprintf(stderr, "%s\n", fonte.erro);
+        exit(1);
+    }
+    enum { REPETICOES = 5 };
+    TContexto contexto;
+    inicia_contexto(&contexto, NULL);
+    char *referencia = NULL;
+    size_t tamanho_referencia = 0;
+    double serial = 0;
+    printf("%s: %zu bytes\n", caminho, fonte.tamanho);
+    printf("%-8s %12s %8s %12s %10s %8s\n", "threads", "mediana (s)", "ganho", "varredura", "pedacos", "saida");
+    for (int t = 1; t <= max_threads; t = t * 2 <= max_threads || t == max_threads ? t * 2 : max_threads) {
+        double tempos[REPETICOES];
+        int status = 0;
+        for (int r = 0; r < REPETICOES; r++) {
+            threads_analise = t;
+            recicla_contexto(ctx);
+            ctx->pedacos = ctx->costurados = 0;
+            ctx->tempo_divisao = 0;
+            ctx->fonte = fonte;
+            double ini = agora();
+            status = compila_fonte();
+            tempos[r] = agora() - ini;
+            ctx->fonte.dados = NULL;   // o texto pertence a esta função
+        }
+        qsort(tempos, REPETICOES, sizeof(double), compara_tempos);
+        double mediana = tempos[REPETICOES / 2];
+        const char *igual = "-";
+        if (t == 1) {
+            serial = mediana;
+            referencia = (char*)malloc(ctx->saida_uso ? ctx->saida_uso : 1);
+            memcpy(referencia, ctx->saida_buf, ctx->saida_uso);
+            tamanho_referencia = ctx->saida_uso;
+            printf("%-8s %12.4f %8s %12s %10s %8s\n", "serie", mediana, "1.00", "-", "-", status ? "erro" : "-");
+        } else {
+            igual = ctx->saida_uso == tamanho_referencia && memcmp(ctx->saida_buf, referencia, tamanho_referencia) == 0 ? "igual" : "DIFERE";
+            char pedacos[32];
+            snprintf(pedacos, sizeof(pedacos), "%u/%u", ctx->costurados, ctx->pedacos);
+            printf("%-8d %12.4f %8.2f %10.1f ms %10s %8s\n", t, mediana, mediana > 0 ? serial / mediana : 0.0,
+                   ctx->tempo_divisao * 1e3, pedacos, igual);
+        }
+        if (t == max_threads) break;
+    }
+    free(referencia);
+    libera_contexto(&contexto);
+    libera_fonte(&fonte);
+    threads_analise = 0;
+}
+
+// =================================================================
+// ANÁLISE INCREMENTAL (DOCUMENTO EDITÁVEL)
+// =================================================================
+
+/*
+ * Um documento mantém texto, átomos e árvore de um programa sob edição. Uma
+ * edição (posição, bytes removidos, texto inserido) refaz só o trecho afetado:
+ *
+ * - Texto e átomos ficam em buffers com lacuna (gap) no ponto da última
+ *   edição. Antes da lacuna, offset e linha dos átomos são absolutos; depois
+ *   dela contam a partir do fim do texto, então uma edição não precisa
+ *   renumerar o resto do arquivo, e mover a lacuna custa a distância andada.
+ * - A reanálise léxica começa no átomo que contém a edição (ou no anterior)
+ *   e para assim que um átomo novo começa na mesma posição de um átomo
+ *   antigo depois do trecho editado: daí em diante os átomos são os mesmos.
+ *   O texto é copiado para uma janela que dobra quando um átomo a alcança.
+ * - A reanálise sintática refaz a sequência de comandos de uma lista
+ *   begin..end que cobre os átomos trocados, delimitada pelos ';', begin e
+ *   end do mesmo nível. Se a sequência nova não termina exatamente no
+ *   delimitador antigo, sobe para o comando da lista de fora, até chegar à
+ *   análise completa. Cada elemento de lista é registrado no átomo em que
+ *   começa (elemento vazio: no ';' ou end que o segue), com sua lista e seu
+ *   antecessor, e isso basta para trocar a sequência na árvore.
+ * - Um erro dentro da região é o mesmo que a análise completa daria, pois o
+ *   prefixo não mudou; a região fica pendente e entra na próxima edição.
+ *   Um erro léxico deixa átomos e árvore como estavam e o trecho de texto
+ *   sem átomos entra na próxima reanálise léxica.
+ *
+ * Edições em declarações ou no cabeçalho, as que mudam o saldo de
+ * begin/end e as feitas enquanto o programa tem um erro que só a análise
+ * completa encontrou recaem na análise completa. Os nós fora das regiões
+ * refeitas mantêm o offset da análise que os criou.
+ *
+ * Só listas begin..end são recortadas: comandos aninhados sem begin, como
+ * "while c do while c do ...", formam um único elemento da lista de fora, e
+ * uma edição em qualquer um deles refaz a cadeia inteira. É o pior caso:
+ * com --gen-program=1M,nest=100000,seed=1 (os 100000 whiles ocupam o
+ * programa todo) e --gen-edits=200, a edição incremental leva 27 ms de
+ * mediana contra 30 ms da análise completa. Somadas as subidas de nível, a
+ * reanálise nunca refaz mais átomos do que o documento tem; passado isso,
+ * vale a análise completa.
+ */
+typedef enum { EDICAO_INCREMENTAL, EDICAO_AMPLIADA, EDICAO_PENDENTE, EDICAO_COMPLETA } TResultadoEdicao;
+
+struct TDocumento {
+    char *texto;                   // [0, gap_texto) e [fim_gap_texto, capacidade_texto)
+    size_t capacidade_texto, gap_texto, fim_gap_texto;
+    size_t tamanho;
+    uint32_t linhas;               // número da última linha
+    size_t gap, fim_gap;           // lacuna nos vetores de ctx->tabela
+    size_t n_atomos;
+    uint32_t *elemento;            // por átomo: elemento de lista que começa nele, ou NO_NULO
+    size_t capacidade_elemento;
+    uint32_t *pai, *anterior;      // por elemento de lista: o NO_COMPOSTO e o elemento anterior
+    size_t capacidade_nos;
+    int atomos_validos;            // falso se a análise completa parou num erro léxico
+    int valido;                    // a árvore corresponde ao texto
+    int pendente;                  // região com erro, ainda com os nós antigos na árvore
+    size_t ini_pendente, fim_pendente;
+    uint32_t primeiro_pendente;
+    char *janela;
+    size_t capacidade_janela;
+    uint8_t *novo_atomo;           // átomos da reanálise léxica, antes de entrarem na lacuna
+    uint32_t *nova_linha, *novo_offset;
+    int32_t *novo_atributo;
+    size_t capacidade_novos;
+    int lexico_pendente;           // erro léxico: o texto [ini_dano, fim_dano) ainda não tem átomos
+    size_t ini_dano, fim_dano;
+    size_t atomo_dano;             // primeiro átomo a relexar, com posição e linha guardadas
+    uint32_t offset_dano, linha_dano;
+    uint32_t offset_erro, linha_erro;   // onde a última reanálise léxica falhou
+    size_t inicio_comandos;        // primeiro átomo depois do begin do programa
+    TResultadoEdicao resultado;    // como a última edição foi resolvida
+    size_t relexados;              // átomos novos na última edição
+};
+
+static inline size_t doc_fisico(const TDocumento *d, size_t i) {
+    return i < d->gap ? i : i + (d->fim_gap - d->gap);
+}
+
+static inline TAtomo doc_atomo(const TDocumento *d, size_t i) {
+    return (TAtomo)ctx->tabela.atomo[doc_fisico(d, i)];
+}
+
+static inline uint32_t doc_offset(const TDocumento *d, size_t i) {
+    if (i < d->gap) return ctx->tabela.offset[i];
+    return (uint32_t)(d->tamanho - ctx->tabela.offset[doc_fisico(d, i)]);
+}
+
+static inline uint32_t doc_linha(const TDocumento *d, size_t i) {
+    if (i < d->gap) return ctx->tabela.linha[i];
+    return d->linhas - ctx->tabela.linha[doc_fisico(d, i)];
+}
+
+static void *doc_realoca(void *p, size_t bytes) {
+    void *novo = realloc(p, bytes);
+    if (novo == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    return novo;
+}
+
+// Vetor elemento com a mesma capacidade da tabela de átomos, novas posições zeradas
+static void doc_acompanha_tabela(TDocumento *d) {
+    size_t cap = ctx->tabela.capacidade;
+    if (d->capacidade_elemento >= cap) return;
+    d->elemento = (uint32_t*)doc_realoca(d->elemento, cap * sizeof(uint32_t));
+    memset(d->elemento + d->capacidade_elemento, 0, (cap - d->capacidade_elemento) * sizeof(uint32_t));
+    d->capacidade_elemento = cap;
+}
+
+void documento_registra(size_t atomo, uint32_t no, uint32_t lista, uint32_t anterior) {
+    TDocumento *d = ctx->documento;
+    doc_acompanha_tabela(d);
+    d->elemento[atomo] = no;
+    if (no >= d->capacidade_nos) {
+        size_t cap = d->capacidade_nos ? d->capacidade_nos : 1024;
+        while (cap <= no) cap *= 2;
+        d->pai = (uint32_t*)doc_realoca(d->pai, cap * sizeof(uint32_t));
+        d->anterior = (uint32_t*)doc_realoca(d->anterior, cap * sizeof(uint32_t));
+        d->capacidade_nos = cap;
+    }
+    d->pai[no] = lista;
+    d->anterior[no] = anterior;
+}
+
+// Move a lacuna dos átomos para antes do átomo lógico pos, convertendo as coordenadas de quem passa por ela
+static void doc_move_gap(TDocumento *d, size_t pos) {
+    TTabelaAtomos *t = &ctx->tabela;
+    size_t n, de, para;
+    if (pos < d->gap) {
+        n = d->gap - pos;
+        de = pos;
+        para = d->fim_gap - n;
+    } else if (pos > d->gap) {
+        n = pos - d->gap;
+        de = d->fim_gap;
+        para = d->gap;
+    } else {
+        return;
+    }
+    memmove(t->atomo + para, t->atomo + de, n * sizeof(uint8_t));
+    memmove(t->linha + para, t->linha + de, n * sizeof(uint32_t));
+    memmove(t->offset + para, t->offset + de, n * sizeof(uint32_t));
+    memmove(t->atributo + para, t->atributo + de, n * sizeof(int32_t));
+    memmove(d->elemento + para, d->elemento + de, n * sizeof(uint32_t));
+    // absoluto <-> contado do fim: a mesma conta nos dois sentidos
+    for (size_t i = para; i < para + n; i++) {
+        t->offset[i] = (uint32_t)(d->tamanho - t->offset[i]);
+        t->linha[i] = d->linhas - t->linha[i];
+    }
+    d->fim_gap += pos < d->gap ? 0 - n : n;
+    d->gap = pos;
+}
+
+// Garante ao menos n posições livres na lacuna dos átomos
+static void doc_reserva_gap(TDocumento *d, size_t n) {
+    TTabelaAtomos *t = &ctx->tabela;
+    if (d->fim_gap - d->gap >= n) return;
+    size_t antiga = t->capacidade, cauda = antiga - d->fim_gap;
+    size_t nova = antiga * 2 > antiga + n + 1024 ? antiga * 2 : antiga + n + 1024;
+    tabela_reserva(t, nova);
+    doc_acompanha_tabela(d);
+    memmove(t->atomo + nova - cauda, t->atomo + d->fim_gap, cauda * sizeof(uint8_t));
+    memmove(t->linha + nova - cauda, t->linha + d->fim_gap, cauda * sizeof(uint32_t));
+    memmove(t->offset + nova - cauda, t->offset + d->fim_gap, cauda * sizeof(uint32_t));
+    memmove(t->atributo + nova - cauda, t->atributo + d->fim_gap, cauda * sizeof(int32_t));
+    memmove(d->elemento + nova - cauda, d->elemento + d->fim_gap, cauda * sizeof(uint32_t));
+    d->fim_gap = nova - cauda;
+}
+
+static void texto_move_gap(TDocumento *d, size_t pos) {
+    if (pos < d->gap_texto) {
+        size_t n = d->gap_texto - pos;
+        memmove(d->texto + d->fim_gap_texto - n, d->texto + pos, n);
+        d->gap_texto -= n;
+        d->fim_gap_texto -= n;
+    } else if (pos > d->gap_texto) {
+        size_t n = pos - d->gap_texto;
+        memmove(d->texto + d->gap_texto, d->texto + d->fim_gap_texto, n);
+        d->gap_texto += n;
+        d->fim_gap_texto += n;
+    }
+}
+
+static void texto_reserva_gap(TDocumento *d, size_t n) {
+    if (d->fim_gap_texto - d->gap_texto >= n) return;
+    size_t antiga = d->capacidade_texto, cauda = antiga - d->fim_gap_texto;
+    size_t nova = antiga * 2 > antiga + n + 4096 ? antiga * 2 : antiga + n + 4096;
+    d->texto = (char*)doc_realoca(d->texto, nova);
+    memmove(d->texto + nova - cauda, d->texto + d->fim_gap_texto, cauda);
+    d->fim_gap_texto = nova - cauda;
+    d->capacidade_texto = nova;
+}
+
+static uint32_t conta_linhas(const char *p, size_t n) {
+    uint32_t linhas = 0;
+    for (const char *fim = p + n; (p = memchr(p, '\n', (size_t)(fim - p))) != NULL; p++) linhas++;
+    return linhas;
+}
+
+static void texto_substitui(TDocumento *d, size_t pos, size_t removidos, const char *inserido, size_t n) {
+    texto_move_gap(d, pos);
+    d->linhas -= conta_linhas(d->texto + d->fim_gap_texto, removidos);
+    d->fim_gap_texto += removidos;
+    texto_reserva_gap(d, n + FOLGA_FONTE);
+    memcpy(d->texto + d->gap_texto, inserido, n);
+    d->gap_texto += n;
+    d->linhas += conta_linhas(inserido, n);
+    d->tamanho = d->tamanho - removidos + n;
+}
+
+// Copia n bytes do texto lógico a partir de ini, atravessando a lacuna
+static void texto_copia(const TDocumento *d, char *destino, size_t ini, size_t n) {
+    if (ini < d->gap_texto) {
+        size_t antes = d->gap_texto - ini < n ? d->gap_texto - ini : n;
+        memcpy(destino, d->texto + ini, antes);
+        destino += antes;
+        ini += antes;
+        n -= antes;
+    }
+    memcpy(destino, d->texto + ini + (d->fim_gap_texto - d->gap_texto), n);
+}
+
+/*
+ * Reanalisa o texto inteiro. O texto fica contíguo (lacuna no fim, com a
+ * folga de zeros), a tabela de átomos é refeita pela passada em lote e a
+ * lacuna dos átomos vai para o fim da tabela.
+ */
+static int documento_compila_tudo(TDocumento *d) {
+    texto_move_gap(d, d->tamanho);
+    texto_reserva_gap(d, FOLGA_FONTE);
+    memset(d->texto + d->tamanho, 0, FOLGA_FONTE);
+    recicla_contexto(ctx);
+    if (d->elemento != NULL) memset(d->elemento, 0, d->capacidade_elemento * sizeof(uint32_t));
+    d->pendente = 0;
+    d->lexico_pendente = 0;
+    d->resultado = EDICAO_COMPLETA;
+    ctx->fonte.dados = d->texto;
+    ctx->fonte.tamanho = d->tamanho;
+    jmp_buf fora;
+    memcpy(fora, ctx->salto_erro, sizeof(jmp_buf));
+    int status = compila_fonte();
+    memcpy(ctx->salto_erro, fora, sizeof(jmp_buf));
+    ctx->fonte.dados = NULL;   // o texto pertence ao documento
+    if (ctx->falha_fatal) longjmp(ctx->salto_erro, 1);
+
+    TTabelaAtomos *t = &ctx->tabela;
+    doc_acompanha_tabela(d);
+    d->atomos_validos = t->quantidade > 0 && t->atomo[t->quantidade - 1] == EOS;
+    d->n_atomos = t->quantidade;
+    d->gap = t->quantidade;
+    d->fim_gap = t->capacidade;
+    d->relexados = t->quantidade;
+    d->inicio_comandos = SIZE_MAX;
+    for (size_t i = 0; i < t->quantidade; i++) {
+        if (t->atomo[i] == BEGIN) {
+            d->inicio_comandos = i + 1;
+            break;
+        }
+    }
+    d->valido = status == 0;
+    if (status == 0) ctx->saida_uso = 0;   // descarta o resumo: só diagnósticos interessam aqui
+    return status;
+}
+
+/*
+ * As funções públicas do documento armam salto_erro e devolvem -1 se faltar
+ * memória; quem arma o seu próprio salto por dentro (compila_fonte,
+ * doc_analisa_lista) devolve o de fora ao terminar e repassa a falha.
+ */
+int documento_recompila(TDocumento *d) {
+    if (setjmp(ctx->salto_erro) != 0) return -1;
+    return documento_compila_tudo(d);
+}
+
+// Abre o documento no contexto corrente, que passa a trabalhar só para ele; -1 se faltar memória
+int documento_abre(TDocumento *d, const char *texto, size_t tamanho) {
+    memset(d, 0, sizeof(*d));
+    ctx->documento = d;
+    ctx->simbolos.nomes_proprios = 1;
+    if (setjmp(ctx->salto_erro) != 0) return -1;
+    d->capacidade_texto = tamanho + tamanho / 8 + 4096 + FOLGA_FONTE;
+    d->texto = (char*)malloc(d->capacidade_texto);
+    if (d->texto == NULL) return -1;
+    memcpy(d->texto, texto, tamanho);
+    d->tamanho = d->gap_texto = tamanho;
+    d->fim_gap_texto = d->capacidade_texto;
+    d->linhas = 1 + conta_linhas(texto, tamanho);
+    return documento_compila_tudo(d);
+}
+
+void documento_libera(TDocumento *d) {
+    free(d->texto);
+    free(d->elemento);
+    free(d->pai);
+    free(d->anterior);
+    free(d->janela);
+    free(d->novo_atomo);
+    free(d->nova_linha);
+    free(d->novo_offset);
+    free(d->novo_atributo);
+    if (ctx != NULL && ctx->documento == d) ctx->documento = NULL;
+}
+
+
+static void doc_reserva_novos(TDocumento *d, size_t n) {
+    if (d->capacidade_novos >= n) return;
+    size_t cap = d->capacidade_novos ? d->capacidade_novos : 256;
+    while (cap < n) cap *= 2;
+    d->novo_atomo = (uint8_t*)doc_realoca(d->novo_atomo, cap * sizeof(uint8_t));
+    d->nova_linha = (uint32_t*)doc_realoca(d->nova_linha, cap * sizeof(uint32_t));
+    d->novo_offset = (uint32_t*)doc_realoca(d->novo_offset, cap * sizeof(uint32_t));
+    d->novo_atributo = (int32_t*)doc_realoca(d->novo_atributo, cap * sizeof(int32_t));
+    d->capacidade_novos = cap;
+}
+
+typedef enum { JANELA_SINCRONIZOU, JANELA_CURTA, JANELA_ERRO, JANELA_INCONSISTENTE } TResultadoJanela;
+
+/*
+ * Lexa a janela [inicio, inicio + n) do texto até um átomo novo em
+ * q >= fim_edicao coincidir com um átomo antigo (depois da lacuna, contado
+ * do fim). *reaproveitado avança sobre os átomos antigos; *n_novos conta os
+ * átomos novos.
+ */
+static TResultadoJanela doc_lexa_janela(TDocumento *d, size_t inicio, size_t n, int no_fim, size_t fim_edicao,
+                                        size_t *reaproveitado, size_t *n_novos) {
+    TTabelaAtomos *t = &ctx->tabela;
+    ctx->lexico_em_lote = 1;
+    if (setjmp(ctx->salto_lexico)) {
+        // Perto da borda, o erro pode ser só o corte da janela (comentário,
+        // constchar ou expoente abertos)
+        ctx->lexico_em_lote = 0;
+        d->offset_erro = (uint32_t)(inicio + (size_t)(ctx->inicio_atomo - d->janela));
+        d->linha_erro = (uint32_t)ctx->nLinha;
+        return no_fim || (size_t)(ctx->buffer - d->janela) + 2 < n ? JANELA_ERRO : JANELA_CURTA;
+    }
+    for (;;) {
+        TInfoAtomo a = obter_atomo();
+        if (!no_fim && (size_t)(ctx->buffer - d->janela) >= n) break;
+        size_t q = inicio + (size_t)(ctx->inicio_atomo - d->janela);
+        if (q >= fim_edicao) {
+            while (*reaproveitado < t->capacidade && d->tamanho - t->offset[*reaproveitado] < q) (*reaproveitado)++;
+            if (*reaproveitado < t->capacidade && d->tamanho - t->offset[*reaproveitado] == q) {
+                ctx->lexico_em_lote = 0;
+                return JANELA_SINCRONIZOU;
+            }
+        }
+        // O EOS antigo sempre sincroniza; chegar aqui com EOS é inconsistência
+        if (a.atomo == EOS) {
+            ctx->lexico_em_lote = 0;
+            return JANELA_INCONSISTENTE;
+        }
+        if (a.atomo == COMENTARIO) continue;   // a tabela do documento não guarda trivia
+        size_t k = (*n_novos)++;
+        doc_reserva_novos(d, k + 1);
+        int32_t atributo = 0;
+        if (a.atomo == IDENTIFICADOR) atributo = (int32_t)a.atributo.simbolo;
+        else if (a.atomo == CONSTINT || a.atomo == NUMERO) atributo = a.atributo.numero;
+        else if (a.atomo == CONSTCHAR) atributo = (unsigned char)a.atributo.ch;
+        d->novo_atomo[k] = (uint8_t)a.atomo;
+        d->nova_linha[k] = (uint32_t)a.linha;
+        d->novo_offset[k] = (uint32_t)q;
+        d->novo_atributo[k] = atributo;
+    }
+    ctx->lexico_em_lote = 0;
+    return JANELA_CURTA;
+}
+
+/*
+ * Reanálise léxica a partir do átomo logo depois da lacuna (coordenadas
+ * antigas contadas do fim, texto já editado), que começa em inicio. Os
+ * átomos novos vão para novo_*; devolve o índice físico do primeiro átomo
+ * antigo reaproveitado, 0 em erro léxico (posição em offset_erro) ou
+ * SIZE_MAX se os átomos antigos não batem com o texto. fim_edicao é o fim
+ * do trecho alterado. Um átomo que alcança a borda da janela pede uma
+ * janela maior.
+ */
+static size_t doc_relexa(TDocumento *d, uint32_t inicio, uint32_t linha, size_t fim_edicao, size_t *n_novos) {
+    size_t janela = fim_edicao - inicio + 256;
+    for (;;) {
+        size_t fim_janela = inicio + janela < d->tamanho ? inicio + janela : d->tamanho;
+        int no_fim = fim_janela == d->tamanho;
+        size_t n = fim_janela - inicio;
+        if (d->capacidade_janela < n + FOLGA_FONTE) {
+            d->capacidade_janela = n + FOLGA_FONTE;
+            d->janela = (char*)doc_realoca(d->janela, d->capacidade_janela);
+        }
+        texto_copia(d, d->janela, inicio, n);
+        memset(d->janela + n, 0, FOLGA_FONTE);
+        ctx->buffer = ctx->inicio_fonte = d->janela;
+        ctx->nLinha = (int)linha;
+
+        size_t reaproveitado = d->fim_gap;
+        *n_novos = 0;
+        TResultadoJanela r = doc_lexa_janela(d, inicio, n, no_fim, fim_edicao, &reaproveitado, n_novos);
+        if (r == JANELA_SINCRONIZOU) return reaproveitado;
+        if (r == JANELA_ERRO) return 0;
+        if (r == JANELA_INCONSISTENTE) return SIZE_MAX;
+        janela *= 2;
+    }
+}
+
+// Variação e mínimo da profundidade begin/end num átomo
+static inline void doc_perfil(TAtomo a, int *profundidade, int *minimo) {
+    if (a == BEGIN) (*profundidade)++;
+    else if (a == END && --(*profundidade) < *minimo) *minimo = *profundidade;
+}
+
+/*
+ * Primeiro átomo da região que termina antes do átomo i: logo depois do ';'
+ * ou begin do nível da lista, saindo antes de 'sobe' begins ainda abertos.
+ * SIZE_MAX se chegar ao começo do programa.
+ */
+static size_t doc_inicio_regiao(const TDocumento *d, size_t i, int sobe) {
+    int fechados = 0;
+    while (i-- > 0) {
+        TAtomo a = doc_atomo(d, i);
+        if (a == END) fechados++;
+        else if (a == BEGIN) {
+            if (fechados > 0) fechados--;
+            else if (sobe > 0) sobe--;
+            else return i + 1;
+        }
+        else if (a == PONTO_VIRGULA && fechados == 0 && sobe == 0) return i + 1;
+    }
+    return SIZE_MAX;
+}
+
+// Delimitador (';' ou end) que fecha a região a partir do átomo i, na profundidade dada
+static size_t doc_fim_regiao(const TDocumento *d, size_t i, int profundidade) {
+    for (; i < d->n_atomos; i++) {
+        TAtomo a = doc_atomo(d, i);
+        if (a == BEGIN) profundidade++;
+        else if (a == END) {
+            if (profundidade == 0) return i;
+            profundidade--;
+        }
+        else if (a == PONTO_VIRGULA && profundidade == 0) return i;
+        else if (a == PONTO || a == EOS) break;
+    }
+    return SIZE_MAX;
+}
+
+typedef enum { REANALISE_OK, REANALISE_ERRO, REANALISE_AMPLIA } TReanalise;
+
+/*
+ * Analisa a partir do átomo ini a sequência de comandos de uma lista, até o
+ * delimitador fim (';' ou end, que não é consumido). Um erro antes de passar
+ * de fim é o mesmo que a análise completa daria; além dele, ou com a lista
+ * fechada antes de fim, a região precisa crescer.
+ */
+static TReanalise doc_analisa_sequencia(size_t ini, size_t fim, uint32_t lista, uint32_t anterior, uint32_t *primeiro, uint32_t *ultimo) {
+    ctx->cursor_tabela = ini;
+    ctx->saida_uso = 0;
+    ctx->trivia.quantidade = ctx->trivia.cursor = 0;
+    ctx->trivia.descartando = 0;
+    *primeiro = *ultimo = NO_NULO;
+    if (setjmp(ctx->salto_erro) != 0) return ctx->cursor_tabela <= fim + 1 ? REANALISE_ERRO : REANALISE_AMPLIA;
+    avanca();
+    for (;;) {
+        uint32_t no = elemento_lista(lista, *ultimo != NO_NULO ? *ultimo : anterior);
+        if (*primeiro == NO_NULO) *primeiro = no;
+        else ctx->ast.nos[*ultimo].irmao = no;
+        *ultimo = no;
+        if (ctx->lookahead.atomo != PONTO_VIRGULA || ctx->cursor_tabela - 1 >= fim) break;
+        consome(PONTO_VIRGULA);
+    }
+    // Fora do laço, statement_part chamaria consome(END): vale o end da própria
+    // lista, ou o ';' delimitador que o laço deixou de consumir; um end antes
+    // do delimitador muda a estrutura de fora, e qualquer outro átomo é o erro
+    // que consome daria
+    if (ctx->cursor_tabela - 1 == fim && (ctx->lookahead.atomo == END || ctx->lookahead.atomo == PONTO_VIRGULA))
+        return REANALISE_OK;
+    consome(END);
+    return REANALISE_AMPLIA;
+}
+
+static TReanalise doc_analisa_lista(size_t ini, size_t fim, uint32_t lista, uint32_t anterior, uint32_t *primeiro, uint32_t *ultimo) {
+    jmp_buf fora;
+    memcpy(fora, ctx->salto_erro, sizeof(jmp_buf));
+    TReanalise r = doc_analisa_sequencia(ini, fim, lista, anterior, primeiro, ultimo);
+    memcpy(ctx->salto_erro, fora, sizeof(jmp_buf));
+    if (ctx->falha_fatal) longjmp(ctx->salto_erro, 1);
+    return r;
+}
+
+/*
+ * Reanalisa os átomos [ini, fim) como a sequência de comandos da lista,
+ * entre o elemento anterior e o proximo, e troca a sequência antiga da
+ * árvore pela nova. fim é o delimitador; um EOS sentinela logo depois dele
+ * denuncia a análise que o consumiu.
+ */
+static TReanalise doc_reanalisa(TDocumento *d, size_t ini, size_t fim, uint32_t lista, uint32_t anterior, uint32_t proximo) {
+    TTabelaAtomos *t = &ctx->tabela;
+    doc_move_gap(d, fim + 1);
+    doc_reserva_gap(d, 1);
+    t->atomo[fim + 1] = EOS;
+    t->linha[fim + 1] = t->linha[fim];
+    t->offset[fim + 1] = t->offset[fim];
+    t->atributo[fim + 1] = 0;
+    t->quantidade = fim + 2;
+    memset(d->elemento + ini, 0, (fim + 1 - ini) * sizeof(uint32_t));
+
+    uint32_t primeiro, ultimo;
+    TReanalise r = doc_analisa_lista(ini, fim, lista, anterior, &primeiro, &ultimo);
+    if (r == REANALISE_OK) {
+        if (anterior != NO_NULO) ctx->ast.nos[anterior].irmao = primeiro;
+        else ctx->ast.nos[lista].filho = primeiro;
+        ctx->ast.nos[ultimo].irmao = proximo;
+        if (proximo != NO_NULO) d->anterior[proximo] = ultimo;
+    }
+    return r;
+}
+
+/*
+ * Diagnóstico de um erro léxico no trecho relexado, sem tocar nos átomos
+ * nem na árvore: a análise completa veria os átomos até a, os novos e o
+ * átomo ERRO, e pararia no primeiro erro até ele. Os novos vão para a
+ * lacuna só enquanto uma lista que os cobre é analisada, sem registrar
+ * elementos. Devolve 1 com o diagnóstico, ou 0 se nenhuma lista serve.
+ */
+static int doc_diagnostico_lexico(TDocumento *d, size_t a, size_t n_novos) {
+    TTabelaAtomos *t = &ctx->tabela;
+    size_t erro = a + n_novos;
+    doc_reserva_gap(d, n_novos + 1);
+    memcpy(t->atomo + a, d->novo_atomo, n_novos * sizeof(uint8_t));
+    memcpy(t->linha + a, d->nova_linha, n_novos * sizeof(uint32_t));
+    memcpy(t->offset + a, d->novo_offset, n_novos * sizeof(uint32_t));
+    memcpy(t->atributo + a, d->novo_atributo, n_novos * sizeof(int32_t));
+    t->atomo[erro] = ERRO;
+    t->linha[erro] = d->linha_erro;
+    t->offset[erro] = d->offset_erro;
+    t->atributo[erro] = 0;
+    t->quantidade = erro + 1;
+
+    // Uma região com erro sintático antes do trecho continua valendo primeiro
+    size_t da = d->pendente && d->ini_pendente < a ? d->ini_pendente : a;
+    ctx->documento = NULL;
+    TReanalise r = REANALISE_AMPLIA;
+    for (int nivel = 0; r == REANALISE_AMPLIA; nivel++) {
+        size_t ini = doc_inicio_regiao(d, da, nivel);
+        if (ini == SIZE_MAX || ini < d->inicio_comandos) break;
+        uint32_t primeiro, ultimo;
+        r = doc_analisa_lista(ini, erro, NO_NULO, NO_NULO, &primeiro, &ultimo);
+    }
+    ctx->documento = d;
+    return r == REANALISE_ERRO;
+}
+
+// Elemento de lista registrado no átomo i (coordenadas correntes)
+static uint32_t doc_elemento_em(const TDocumento *d, size_t i) {
+    return i < d->n_atomos ? d->elemento[doc_fisico(d, i)] : NO_NULO;
+}
+
+// Último átomo antes de limite que começa antes de pos, ou SIZE_MAX
+static size_t doc_atomo_antes(const TDocumento *d, size_t limite, size_t pos) {
+    if (limite == 0 || doc_offset(d, 0) >= pos) return SIZE_MAX;
+    size_t lo = 0, hi = limite;
+    while (hi - lo > 1) {
+        size_t meio = lo + (hi - lo) / 2;
+        if (doc_offset(d, meio) < pos) lo = meio;
+        else hi = meio;
+    }
+    return lo;
+}
+
+static int doc_edita(TDocumento *d, size_t pos, size_t removidos, const char *inserido, size_t n) {
+    ctx->saida_uso = 0;
+    if (pos > d->tamanho) pos = d->tamanho;
+    if (removidos > d->tamanho - pos) removidos = d->tamanho - pos;
+    if (!d->atomos_validos || (!d->valido && !d->pendente) || d->tamanho - removidos + n > UINT32_MAX / 2) {
+        texto_substitui(d, pos, removidos, inserido, n);
+        return documento_compila_tudo(d);
+    }
+
+    // Trecho a relexar: o da edição, unido ao que um erro léxico deixou sem
+    // átomos. Nesse caso só os átomos antes de atomo_dano têm posição válida,
+    // e o próprio atomo_dano tem a sua guardada
+    size_t ini_dano = pos, fim_dano = pos + n, a;
+    uint32_t inicio = 0, linha = 1;
+    int a_antes;
+    if (d->lexico_pendente && pos > d->offset_dano) {
+        a = d->atomo_dano;
+        inicio = d->offset_dano;
+        linha = d->linha_dano;
+        a_antes = 1;
+    } else {
+        a = doc_atomo_antes(d, d->lexico_pendente ? d->atomo_dano : d->n_atomos, pos);
+        a_antes = a != SIZE_MAX;
+        if (!a_antes) a = 0;
+        doc_move_gap(d, a);
+        if (a_antes) {
+            inicio = doc_offset(d, a);
+            linha = doc_linha(d, a);
+        }
+    }
+    if (d->lexico_pendente) {
+        size_t p0 = d->ini_dano, p1 = d->fim_dano;
+        p0 = p0 < pos ? p0 : p0 >= pos + removidos ? p0 + n - removidos : pos;
+        p1 = p1 <= pos ? p1 : p1 >= pos + removidos ? p1 + n - removidos : pos + n;
+        if (p0 < ini_dano) ini_dano = p0;
+        if (p1 > fim_dano) fim_dano = p1;
+    }
+    texto_substitui(d, pos, removidos, inserido, n);
+
+    size_t n_novos = 0;
+    size_t reaproveitado = doc_relexa(d, inicio, linha, fim_dano, &n_novos);
+    d->relexados = n_novos;
+    if (reaproveitado == SIZE_MAX) return documento_compila_tudo(d);
+    if (reaproveitado == 0) {
+        // Erro léxico: átomos e árvore ficam como estavam até o trecho relexar sem erro
+        d->lexico_pendente = 1;
+        d->atomo_dano = a;
+        d->offset_dano = inicio;
+        d->linha_dano = linha;
+        d->ini_dano = ini_dano;
+        d->fim_dano = fim_dano;
+        d->resultado = EDICAO_PENDENTE;
+        if (a_antes && doc_diagnostico_lexico(d, a, n_novos)) return 1;
+        return documento_compila_tudo(d);
+    }
+    d->lexico_pendente = 0;
+    size_t n_antigos = reaproveitado - d->fim_gap;
+
+    // O átomo a só foi relexado por precaução: se voltou igual, fica fora do
+    // trecho danificado e conserva o elemento que começa nele
+    TTabelaAtomos *t = &ctx->tabela;
+    size_t f = d->fim_gap;
+    int mantem = a_antes && n_novos > 0 && n_antigos > 0 && d->novo_atomo[0] == t->atomo[f] &&
+                 d->novo_offset[0] == inicio && d->nova_linha[0] == linha && d->novo_atributo[0] == t->atributo[f];
+    uint32_t elemento_a = d->elemento[f];
+
+    // Trecho danificado em coordenadas antigas, unido à região pendente
+    size_t da = a + (size_t)mantem, db = a + n_antigos;
+    if (d->pendente) {
+        if (d->ini_pendente < da) da = d->ini_pendente;
+        if (d->fim_pendente > db) db = d->fim_pendente;
+    }
+    // Saldo e mínimo de begin/end do trecho antes e depois; a região pendente
+    // vale como sequência equilibrada do lado antigo
+    int prof_antiga = 0, min_antigo = 0, prof_nova = 0, min_novo = 0;
+    for (size_t i = da; i < db; i++) {
+        if (d->pendente && i >= d->ini_pendente && i < d->fim_pendente) continue;
+        doc_perfil(doc_atomo(d, i), &prof_antiga, &min_antigo);
+    }
+    for (size_t i = da; i < a; i++) doc_perfil(doc_atomo(d, i), &prof_nova, &min_novo);
+    for (size_t k = da > a ? da - a : 0; k < n_novos; k++) doc_perfil((TAtomo)d->novo_atomo[k], &prof_nova, &min_novo);
+    for (size_t i = a + n_antigos; i < db; i++) doc_perfil(doc_atomo(d, i), &prof_nova, &min_novo);
+    int sobe = -(min_antigo < min_novo ? min_antigo : min_novo);
+
+    // Primeiro elemento antigo da região, enquanto os átomos antigos ainda existem
+    uint32_t primeiro = NO_NULO;
+    size_t ini = prof_antiga == prof_nova ? doc_inicio_regiao(d, da, sobe) : SIZE_MAX;
+    if (ini != SIZE_MAX) {
+        if (d->pendente && ini >= d->ini_pendente && ini <= d->fim_pendente) primeiro = d->primeiro_pendente;
+        else if (ini < d->n_atomos) primeiro = d->elemento[doc_fisico(d, ini)];
+    }
+
+    // Troca os átomos antigos pelos novos na lacuna
+    d->fim_gap = reaproveitado;
+    doc_reserva_gap(d, n_novos);
+    memcpy(t->atomo + d->gap, d->novo_atomo, n_novos * sizeof(uint8_t));
+    memcpy(t->linha + d->gap, d->nova_linha, n_novos * sizeof(uint32_t));
+    memcpy(t->offset + d->gap, d->novo_offset, n_novos * sizeof(uint32_t));
+    memcpy(t->atributo + d->gap, d->novo_atributo, n_novos * sizeof(int32_t));
+    memset(d->elemento + d->gap, 0, n_novos * sizeof(uint32_t));
+    if (mantem) d->elemento[d->gap] = elemento_a;
+    d->gap += n_novos;
+    d->n_atomos = d->n_atomos - n_antigos + n_novos;
+    db = db - n_antigos + n_novos;
+
+    if (primeiro == NO_NULO) return documento_compila_tudo(d);
+    size_t refeitos = 0;
+    for (int nivel = 0; refeitos <= d->n_atomos; nivel++) {
+        if (nivel > 0) {
+            ini = doc_inicio_regiao(d, da, sobe + nivel);
+            if (ini == SIZE_MAX || ini >= da) break;
+            primeiro = doc_elemento_em(d, ini);
+        }
+        size_t fim = doc_fim_regiao(d, db, sobe + prof_nova + nivel);
+        if (primeiro == NO_NULO || fim == SIZE_MAX) break;
+        uint32_t proximo = doc_atomo(d, fim) == PONTO_VIRGULA ? doc_elemento_em(d, fim + 1) : NO_NULO;
+        uint32_t lista = d->pai[primeiro];
+        if (doc_atomo(d, fim) == PONTO_VIRGULA && (proximo == NO_NULO || d->pai[proximo] != lista)) break;
+
+        TReanalise r = doc_reanalisa(d, ini, fim, lista, d->anterior[primeiro], proximo);
+        if (r == REANALISE_OK) {
+            d->pendente = 0;
+            d->valido = 1;
+            d->resultado = nivel == 0 ? EDICAO_INCREMENTAL : EDICAO_AMPLIADA;
+            return 0;
+        }
+        if (r == REANALISE_ERRO) {
+            d->pendente = 1;
+            d->ini_pendente = ini;
+            d->fim_pendente = fim;
+            d->primeiro_pendente = primeiro;
+            d->valido = 0;
+            d->resultado = EDICAO_PENDENTE;
+            return 1;
+        }
+        refeitos += fim - ini;
+    }
+    return documento_compila_tudo(d);
+}
+
+/*
+ * Aplica a edição: remove 'removidos' bytes em pos e insere n bytes. Devolve
+ * 0 se o programa ficou válido, ou 1 com o diagnóstico em ctx->saida_buf,
+ * exatamente como a análise completa do texto editado; -1 se faltar memória.
+ */
+int documento_edita(TDocumento *d, size_t pos, size_t removidos, const char *inserido, size_t n) {
+    if (setjmp(ctx->salto_erro) != 0) return -1;
+    return doc_edita(d, pos, removidos, inserido, n);
+}
+
+// Nome de um símbolo de outro contexto
+static const char *doc_nome(TContexto *c, uint32_t simbolo, int *tamanho) {
+    TContexto *atual = ctx;
+    ctx = c;
+    const char *nome = nome_simbolo(simbolo, tamanho);
+    ctx = atual;
+    return nome;
+}
+
+static int doc_mesmo_id(TContexto *a, uint32_t x, TContexto *b, uint32_t y) {
+    int n, m;
+    const char *p = doc_nome(a, x, &n), *q = doc_nome(b, y, &m);
+    return n == m && memcmp(p, q, (size_t)n) == 0;
+}
+
+// Mesma forma de árvore (tipo, átomo, valor; símbolos pelo nome), sem olhar offsets;
+// -1 se faltar memória. Sem recursão: a pilha guarda, por nível aberto, os dois irmãos seguintes
+static int doc_mesma_arvore(TContexto *a, uint32_t x, TContexto *b, uint32_t y) {
+    uint32_t *pilha = NULL;
+    size_t n_pilha = 0, capacidade = 0;
+    int igual = 1;
+    for (;;) {
+        if (x == NO_NULO || y == NO_NULO) {
+            if (x != y) {
+                igual = 0;
+                break;
+            }
+            if (n_pilha == 0) break;
+            y = pilha[--n_pilha];
+            x = pilha[--n_pilha];
+            continue;
+        }
+        const TNo *p = &a->ast.nos[x], *q = &b->ast.nos[y];
+        if (p->tipo != q->tipo || p->atomo != q->atomo ||
+            (p->tipo == NO_ID ? !doc_mesmo_id(a, (uint32_t)p->valor, b, (uint32_t)q->valor) : p->valor != q->valor)) {
+            igual = 0;
+            break;
+        }
+        if (p->filho == NO_NULO && q->filho == NO_NULO) {
+            x = p->irmao;
+            y = q->irmao;
+            continue;
+        }
+        if (n_pilha == capacidade) {
+            capacidade = capacidade ? capacidade * 2 : 128;
+            uint32_t *nova = (uint32_t*)realloc(pilha, capacidade * sizeof(uint32_t));
+            if (nova == NULL) {
+                igual = -1;
+                break;
+            }
+            pilha = nova;
+        }
+        pilha[n_pilha++] = p->irmao;
+        pilha[n_pilha++] = q->irmao;
+        x = p->filho;
+        y = q->filho;
+    }
+    free(pilha);
+    return igual;
+}
+
+/*
+ * Confere o documento contra a análise completa do mesmo texto num contexto
+ * novo: status, diagnóstico, átomos e árvore. Devolve 0 se tudo bate, ou 1
+ * com a primeira diferença descrita em erro.
+ */
+static int documento_confere(TDocumento *d, int status, char *erro, size_t tam_erro) {
+    TContexto *doc = ctx, ref;
+    char *texto = (char*)malloc(d->tamanho + FOLGA_FONTE);
+    if (texto == NULL) {
+        snprintf(erro, tam_erro, "sem memoria para a analise completa");
+        return 1;
+    }
+    texto_copia(d, texto, 0, d->tamanho);
+    memset(texto + d->tamanho, 0, FOLGA_FONTE);
+    inicia_contexto(&ref, NULL);
+    ref.fonte.dados = texto;
+    ref.fonte.tamanho = d->tamanho;
+    int status_ref = compila_fonte();
+    ref.fonte.dados = NULL;
+    ctx = doc;
+
+    int falhou = 1;
+    TTabelaAtomos *t = &ref.tabela;
+    if (ref.falha_fatal) {
+        snprintf(erro, tam_erro, "sem memoria para a analise completa");
+    } else if (status != status_ref) {
+        snprintf(erro, tam_erro, "status %d, esperado %d", status, status_ref);
+    } else if (status != 0 && (doc->saida_uso != ref.saida_uso || memcmp(doc->saida_buf, ref.saida_buf, ref.saida_uso) != 0)) {
+        snprintf(erro, tam_erro, "diagnostico [%.*s], esperado [%.*s]", (int)doc->saida_uso, doc->saida_buf, (int)ref.saida_uso, ref.saida_buf);
+    } else if (d->atomos_validos && !d->lexico_pendente && d->n_atomos != t->quantidade) {
+        snprintf(erro, tam_erro, "%zu atomos, esperados %zu", d->n_atomos, t->quantidade);
+    } else {
+        falhou = 0;
+        for (size_t i = 0; d->atomos_validos && !d->lexico_pendente && i < d->n_atomos && !falhou; i++) {
+            size_t f = doc_fisico(d, i);
+            TAtomo a = doc_atomo(d, i);
+            int32_t x = doc->tabela.atributo[f], y = t->atributo[i];
+            falhou = a != t->atomo[i] || doc_offset(d, i) != t->offset[i] || doc_linha(d, i) != t->linha[i] ||
+                     (a == IDENTIFICADOR ? !doc_mesmo_id(doc, (uint32_t)x, &ref, (uint32_t)y) : x != y);
+            if (falhou) snprintf(erro, tam_erro, "atomo %zu: %s na posicao %u, esperado %s na posicao %u", i,
+                                 nome_atomo(a), doc_offset(d, i), nome_atomo((TAtomo)t->atomo[i]), t->offset[i]);
+        }
+        int mesma = !falhou && status == 0 ? doc_mesma_arvore(doc, doc->raiz, &ref, ref.raiz) : 1;
+        if (mesma != 1) {
+            snprintf(erro, tam_erro, mesma < 0 ? "sem memoria para comparar as arvores" : "arvore diferente da analise completa");
+            falhou = 1;
+        }
+    }
+    libera_contexto(&ref);
+    ctx = doc;
+    free(texto);
+    return falhou;
+}
+
+// =================================================================
+// SESSÕES DE EDIÇÃO (--gen-edits, --bench-edits)
+// =================================================================
+
+/*
+ * Registro de edições: cada uma é a linha "posição removidos inseridos"
+ * seguida dos bytes inseridos e de '\n'. --gen-edits=N simula uma sessão
+ * de digitação sobre um arquivo, com semente fixa: redigitar um número
+ * caractere a caractere, digitar uma linha de atribuição copiada de outro
+ * ponto, apagar uma linha e colar um bloco de linhas.
+ */
+static uint64_t estado_sorteio = 0x9e3779b97f4a7c15ull;
+
+static uint32_t sorteia(uint32_t n) {
+    estado_sorteio ^= estado_sorteio << 13;
+    estado_sorteio ^= estado_sorteio >> 7;
+    estado_sorteio ^= estado_sorteio << 17;
+    return (uint32_t)((estado_sorteio >> 32) % n);
+}
+
+static char texto_em(const TDocumento *d, size_t i) {
+    return d->texto[i < d->gap_texto ? i : i + (d->fim_gap_texto - d->gap_texto)];
+}
+
+static size_t inicio_da_linha(const TDocumento *d, size_t i) {
+    while (i > 0 && texto_em(d, i - 1) != '\n') i--;
+    return i;
+}
+
+static size_t fim_da_linha(const TDocumento *d, size_t i) {
+    while (i < d->tamanho && texto_em(d, i) != '\n') i++;
+    return i < d->tamanho ? i + 1 : i;
+}
+
+// Trecho com tantos begin quanto end, e sem palavras de cabeçalho ou declaração
+static int trecho_equilibrado(const TDocumento *d, size_t ini, size_t fim) {
+    int saldo = 0;
+    char palavra[8];
+    for (size_t i = ini; i < fim; ) {
+        char c = texto_em(d, i);
+        if (classe_caractere[(unsigned char)c] != CLASSE_LETRA) {
+            i++;
+            continue;
+        }
+        size_t n = 0;
+        while (i < fim && continua_id(texto_em(d, i))) {
+            if (n < sizeof(palavra) - 1) palavra[n] = texto_em(d, i);
+            n++;
+            i++;
+        }
+        palavra[n < sizeof(palavra) ? n : sizeof(palavra) - 1] = '\0';
+        if (strcmp(palavra, "begin") == 0) saldo++;
+        else if (strcmp(palavra, "end") == 0) saldo--;
+        else if (strcmp(palavra, "program") == 0 || strcmp(palavra, "var") == 0) return 0;
+    }
+    return saldo == 0;
+}
+
+// Linha de atribuição terminada em ';' a partir de uma posição sorteada, ou 0
+static int sorteia_atribuicao(const TDocumento *d, size_t *ini, size_t *fim) {
+    size_t i = inicio_da_linha(d, sorteia((uint32_t)d->tamanho));
+    for (int tentativa = 0; tentativa < 64 && i < d->tamanho; tentativa++) {
+        size_t f = fim_da_linha(d, i), k = f;
+        int atribui = 0;
+        for (size_t j = i; j + 1 < f; j++) atribui |= texto_em(d, j) == ':' && texto_em(d, j + 1) == '=';
+        while (k > i && (texto_em(d, k - 1) == '\n' || texto_em(d, k - 1) == '\r' || texto_em(d, k - 1) == ' ')) k--;
+        if (atribui && k > i && texto_em(d, k - 1) == ';' && f - i < 200 && trecho_equilibrado(d, i, f)) {
+            *ini = i;
+            *fim = f;
+            return 1;
+        }
+        i = f;
+    }
+    return 0;
+}
+
+static void registra_edicao(TDocumento *d, size_t pos, size_t removidos, const char *inserido, size_t n) {
+    printf("%zu %zu %zu\n", pos, removidos, n);
+    fwrite(inserido, 1, n, stdout);
+    putchar('\n');
+    texto_substitui(d, pos, removidos, inserido, n);
+}
+
+int gera_edicoes(const char *arquivo, long n_edicoes) {
+    TFonte fonte;
+    if (!carrega_fonte(arquivo, &fonte)) {
+        fprintf(stderr, "%s\n", fonte.erro);
+        return 1;
+    }
+    // Só o texto do documento é usado aqui: nada de átomos nem contexto
+    TDocumento d;
+    memset(&d, 0, sizeof(d));
+    d.capacidade_texto = fonte.tamanho + 4096 + FOLGA_FONTE;
+    d.texto = (char*)malloc(d.capacidade_texto);
+    if (d.texto == NULL || fonte.tamanho < 2) {
+        fprintf(stderr, "%s: texto vazio ou memoria insuficiente\n", arquivo);
+        libera_fonte(&fonte);
+        free(d.texto);
+        return 1;
+    }
+    memcpy(d.texto, fonte.dados, fonte.tamanho);
+    d.tamanho = d.gap_texto = fonte.tamanho;
+    d.fim_gap_texto = d.capacidade_texto;
+    libera_fonte(&fonte);
+
+    char bloco[4096];
+    long feitas = 0;
+    for (long tentativas = 0; feitas < n_edicoes && tentativas < 1000 * n_edicoes; tentativas++) {
+        size_t ini, fim;
+        uint32_t tipo = sorteia(100);
+        if (tipo < 55) {
+            // Redigita um número: apaga os dígitos e digita outro, um a um
+            size_t i = sorteia((uint32_t)d.tamanho), limite = i + 4096;
+            // só constantes: dígitos que não continuam um identificador
+            while (i < d.tamanho && i < limite && !(eh_digito(texto_em(&d, i)) &&
+                   (i == 0 || !continua_id(texto_em(&d, i - 1))))) i++;
+            if (i >= d.tamanho || i >= limite) continue;
+            size_t n = 0;
+            while (i + n < d.tamanho && eh_digito(texto_em(&d, i + n))) n++;
+            registra_edicao(&d, i, n, "", 0);
+            int digitos = 1 + (int)sorteia(4);
+            for (int k = 0; k < digitos; k++) {
+                char c = (char)('0' + (k == 0 ? 1 + sorteia(9) : sorteia(10)));
+                registra_edicao(&d, i + (size_t)k, 0, &c, 1);
+            }
+            feitas += 1 + digitos;
+        } else if (tipo < 85) {
+            // Digita, caractere a caractere, uma atribuição copiada no início de uma linha
+            if (!sorteia_atribuicao(&d, &ini, &fim)) continue;
+            size_t n = fim - ini;
+            texto_copia(&d, bloco, ini, n);
+            size_t destino;
+            if (!sorteia_atribuicao(&d, &destino, &fim)) continue;
+            // Abre uma linha vazia e digita nela o conteúdo, sem a quebra de linha
+            while (n > 0 && (bloco[n - 1] == '\n' || bloco[n - 1] == '\r')) n--;
+            registra_edicao(&d, destino, 0, "\n", 1);
+            for (size_t k = 0; k < n; k++) registra_edicao(&d, destino + k, 0, bloco + k, 1);
+            feitas += 1 + (long)n;
+        } else if (tipo < 93) {
+            // Apaga uma linha de atribuição inteira
+            if (!sorteia_atribuicao(&d, &ini, &fim)) continue;
+            registra_edicao(&d, ini, fim - ini, "", 0);
+            feitas++;
+        } else {
+            // Cola um bloco de linhas copiado de outro ponto
+            size_t origem = inicio_da_linha(&d, sorteia((uint32_t)d.tamanho)), n = 0;
+            int linhas = 3 + (int)sorteia(18);
+            for (int k = 0; k < linhas && origem + n < d.tamanho; k++) n = fim_da_linha(&d, origem + n) - origem;
+            size_t k = origem + n;
+            while (k > origem && eh_espaco(texto_em(&d, k - 1))) k--;
+            if (n == 0 || n > sizeof(bloco) || texto_em(&d, k - 1) != ';' || !trecho_equilibrado(&d, origem, origem + n)) continue;
+            texto_copia(&d, bloco, origem, n);
+            if (!sorteia_atribuicao(&d, &ini, &fim)) continue;
+            registra_edicao(&d, ini, 0, bloco, n);
+            feitas++;
+        }
+    }
+    free(d.texto);
+    if (feitas < n_edicoes) fprintf(stderr, "%s: so %ld edicoes; o texto ficou sem numeros nem atribuicoes\n", arquivo, feitas);
+    return 0;
+}
+
+/*
+ * --bench-edits=REGISTRO arquivo: abre o arquivo como documento e reaplica
+ * as edições do registro, medindo a latência de cada uma contra a análise
+ * completa do texto. Com --verify-edits, cada estado é conferido contra a
+ * análise completa; sem ele, só o final.
+ */
+void bench_edicoes(const char *registro, const char *arquivo, int conferir_cada) {
+    TFonte log, fonte;
+    if (!carrega_fonte(registro, &log)) {
+        fprintf(stderr, "%s\n", log.erro);
+        return;
+    }
+    if (!carrega_fonte(arquivo, &fonte)) {
+        fprintf(stderr, "%s\n", fonte.erro);
+        libera_fonte(&log);
+        return;
+    }
+    // O documento vive sobre a tabela de átomos, e o trace não faz sentido aqui
+    modo_lexico = LEX_EM_LOTE;
+    modo_trace = TRACE_DESLIGADO;
+    TContexto contexto;
+    inicia_contexto(&contexto, NULL);
+    TDocumento d;
+    double ini = agora();
+    int status = documento_abre(&d, fonte.dados, fonte.tamanho);
+    if (status < 0) {
+        fprintf(stderr, "Erro ao alocar memoria.\n");
+        documento_libera(&d);
+        libera_contexto(&contexto);
+        libera_fonte(&fonte);
+        libera_fonte(&log);
+        return;
+    }
+    double completa[5];
+    int sem_memoria = 0;
+    completa[0] = agora() - ini;
+    for (int i = 1; i < 5; i++) {
+        ini = agora();
+        if (documento_recompila(&d) < 0) sem_memoria = 1;
+        completa[i] = agora() - ini;
+    }
+    qsort(completa, 5, sizeof(double), compara_tempos);
+
+    size_t capacidade = 1024, n[4] = {0, 0, 0, 0}, total = 0, relexados = 0;
+    double *tempos[4];
+    for (int c = 0; c < 4; c++) {
+        tempos[c] = (double*)malloc(capacidade * sizeof(double));
+        if (tempos[c] == NULL) sem_memoria = 1;
+    }
+    char erro[512];
+    int divergencias = 0;
+    const char *p = log.dados, *fim_log = log.dados + log.tamanho;
+    while (p < fim_log && !sem_memoria) {
+        char *resto;
+        size_t pos = strtoull(p, &resto, 10);
+        size_t removidos = strtoull(resto, &resto, 10);
+        size_t inseridos = strtoull(resto, &resto, 10);
+        if (*resto != '\n' || (size_t)(fim_log - resto) < inseridos + 2) break;
+        const char *inserido = resto + 1;
+        p = inserido + inseridos + 1;
+
+        ini = agora();
+        status = documento_edita(&d, pos, removidos, inserido, inseridos);
+        double dt = agora() - ini;
+        if (status < 0) {
+            sem_memoria = 1;
+            break;
+        }
+        int c = d.resultado;
+        if (n[c] == capacidade) {
+            capacidade *= 2;
+            for (int k = 0; k < 4; k++) {
+                double *novo = (double*)realloc(tempos[k], capacidade * sizeof(double));
+                if (novo == NULL) sem_memoria = 1;
+                else tempos[k] = novo;
+            }
+            if (sem_memoria) break;
+        }
+        tempos[c][n[c]++] = dt;
+        relexados += d.relexados;
+        total++;
+        if (conferir_cada && documento_confere(&d, status, erro, sizeof(erro))) {
+            if (divergencias++ < 10) printf("edicao %zu (%zu %zu %zu): %s\n", total, pos, removidos, inseridos, erro);
+        }
+    }
+
+    if (sem_memoria) {
+        fprintf(stderr, "Erro ao alocar memoria.\n");
+        for (int c = 0; c < 4; c++) free(tempos[c]);
+        documento_libera(&d);
+        libera_contexto(&contexto);
+        libera_fonte(&fonte);
+        libera_fonte(&log);
+        return;
+    }
+    printf("%s: %zu bytes, %zu atomos; analise completa %.1f us (mediana de 5)\n",
+           arquivo, fonte.tamanho, d.n_atomos, completa[2] * 1e6);
+    printf("%zu edicoes, %.1f atomos relexados por edicao\n", total, total ? (double)relexados / total : 0.0);
+    printf("%-22s %10s %10s %10s\n", "", "p50 (us)", "p99 (us)", "media (us)");
+    static const char *rotulos[4] = { "incremental", "regiao ampliada", "erro pendente", "analise completa" };
+    for (int c = 0; c < 4; c++) {
+        if (n[c] == 0) continue;
+        char rotulo[48];
+        snprintf(rotulo, sizeof(rotulo), "%s (%zu)", rotulos[c], n[c]);
+        relata_latencias(rotulo, tempos[c], (int)n[c]);
+    }
+    if (!conferir_cada && documento_confere(&d, status, erro, sizeof(erro))) {
+        printf("estado final: %s\n", erro);
+        divergencias++;
+    }
+    printf("conferencia: %s\n", divergencias ? "DIVERGENCIAS" : conferir_cada ? "todas as edicoes ok" : "estado final ok");
+
+    for (int c = 0; c < 4; c++) free(tempos[c]);
+    documento_libera(&d);
+    libera_contexto(&contexto);
+    libera_fonte(&fonte);
+    libera_fonte(&log);
+}
+
+// =================================================================
+// CARGA SINTÉTICA E MEDIÇÃO (--gen-program, --bench)
+// =================================================================
+
+/*
+ * --gen-program=TAMANHO[,chave=valor...] escreve em stdout um programa
+ * válido de cerca de TAMANHO bytes (sufixos K, M e G). Chaves:
+ *   seed=N      semente do sorteio (padrão 1)
+ *   vars=N      variáveis inteiras declaradas (padrão 64)
+ *   ids=P       % dos operandos que são variáveis; o resto, constantes (padrão 60)
+ *   comments=P  % dos comandos precedidos de comentário (padrão 10)
+ *   depth=N     aninhamento máximo de begin, if e while (padrão 4)
+ *   expr=N      operandos por expressão (padrão 4)
+ *   nest=N      envolve os comandos em N whiles aninhados (padrão 0), o
+ *               caso fundo das passadas sem recursão
+ *   loops=N     voltas de cada while (padrão 2), carga para --run
+ * Cada while conta até loops com o contador do seu nível, que nenhum outro
+ * comando altera, e div só divide por constante positiva: o programa
+ * também termina com --run. Os whiles de nest=N saem juntos quando o
+ * último comando, no mais interno, atribui 1 a w0.
+ */
+#define PROFUNDIDADE_GERACAO 60
+
+typedef struct {
+    uint64_t tamanho;
+    uint64_t semente;
+    int vars, ids, comentarios, profundidade, operandos, aninhados, voltas;
+} TGeracao;
+
+typedef struct {
+    TGeracao g;
+    char *buf;
+    size_t uso;
+    uint64_t total;               // bytes escritos, incluindo os do buffer
+    int nivel;                    // construções abertas
+    char aberto[PROFUNDIDADE_GERACAO + 1];   // 'b' begin, 'i' if, 'e' else, 'w' while
+    int primeiro[PROFUNDIDADE_GERACAO + 1];  // a lista do nível ainda não tem comando
+    uint32_t comentarios;
+} TGerador;
+
+#define TAM_BUFFER_GERACAO (1 << 16)
+
+static void gera_descarrega(TGerador *ger) {
+    fwrite(ger->buf, 1, ger->uso, stdout);
+    ger->uso = 0;
+}
+
+static void gera_texto(TGerador *ger, const char *texto) {
+    size_t n = strlen(texto);
+    if (ger->uso + n > TAM_BUFFER_GERACAO) gera_descarrega(ger);
+    memcpy(ger->buf + ger->uso, texto, n);
+    ger->uso += n;
+    ger->total += n;
+}
+
+static void gera_formato(TGerador *ger, const char *formato, ...) {
+    char linha[128];
+    va_list args;
+    va_start(args, formato);
+    vsnprintf(linha, sizeof(linha), formato, args);
+    va_end(args);
+    gera_texto(ger, linha);
+}
+
+// Prefixo seguido de um número, sem printf: é o caso quente da geração
+static void gera_numero(TGerador *ger, const char *prefixo, uint32_t n) {
+    char texto[24];
+    char *p = texto + sizeof(texto);
+    *--p = '\0';
+    do {
+        *--p = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    size_t k = strlen(prefixo);
+    memcpy(p - k, prefixo, k);
+    gera_texto(ger, p - k);
+}
+
+static void gera_recuo(TGerador *ger, int nivel) {
+    for (int i = 0; i <= nivel; i++) gera_texto(ger, "  ");
+}
+
+static void gera_expressao(TGerador *ger, int operandos, int parenteses) {
+    static const char *operadores[] = { " + ", " - ", " * ", " div " };
+    for (int k = 0; k < operandos; k++) {
+        int divide = 0;
+        if (k > 0) {
+            uint32_t op = sorteia(4);
+            divide = op == 3;
+            gera_texto(ger, operadores[op]);
+        }
+        if (divide) gera_numero(ger, "", 1 + sorteia(9));
+        else if (operandos >= 3 && parenteses < 3 && sorteia(100) < 10) {
+            gera_texto(ger, "(");
+            gera_expressao(ger, 2 + (int)sorteia(2), parenteses + 1);
+            gera_texto(ger, ")");
+        }
+        else if ((int)sorteia(100) < ger->g.ids) gera_numero(ger, "v", sorteia((uint32_t)ger->g.vars));
+        else gera_numero(ger, "", sorteia(1000));
+    }
+}
+
+static void gera_condicao(TGerador *ger) {
+    static const char *relacionais[] = { " = ", " <> ", " < ", " > ", " <= ", " >= " };
+    int lado = ger->g.operandos / 2 > 0 ? ger->g.operandos / 2 : 1;
+    gera_expressao(ger, lado, 0);
+    gera_texto(ger, relacionais[sorteia(6)]);
+    gera_expressao(ger, lado, 0);
+}
+
+// Separador e recuo antes de um comando da lista do nível corrente
+static void gera_separador(TGerador *ger) {
+    if (!ger->primeiro[ger->nivel]) gera_texto(ger, ";\n");
+    ger->primeiro[ger->nivel] = 0;
+    gera_recuo(ger, ger->nivel);
+    if ((int)sorteia(100) < ger->g.comentarios) {
+        gera_formato(ger, "(* comentario %u *)\n", ger->comentarios++);
+        gera_recuo(ger, ger->nivel);
+    }
+}
+
+static void gera_comando(TGerador *ger) {
+    gera_separador(ger);
+    uint32_t r = sorteia(100);
+    if (r < 80) {
+        gera_numero(ger, "v", sorteia((uint32_t)ger->g.vars));
+        gera_texto(ger, " := ");
+        gera_expressao(ger, ger->g.operandos, 0);
+    }
+    else if (r < 88) gera_formato(ger, "c0 := '%c'", 'a' + sorteia(26));
+    else if (r < 95) {
+        gera_texto(ger, "b0 := ");
+        gera_condicao(ger);
+    }
+    else gera_formato(ger, "write(v%u, v%u)", sorteia((uint32_t)ger->g.vars), sorteia((uint32_t)ger->g.vars));
+}
+
+static void gera_abre(TGerador *ger) {
+    gera_separador(ger);
+    uint32_t r = sorteia(3);
+    char tipo = r == 0 ? 'b' : r == 1 ? 'i' : 'w';
+    if (tipo == 'b') gera_texto(ger, "begin\n");
+    else if (tipo == 'i') {
+        gera_texto(ger, "if ");
+        gera_condicao(ger);
+        gera_texto(ger, " then begin\n");
+    }
+    else {
+        gera_formato(ger, "i%d := 0;\n", ger->nivel + 1);
+        gera_recuo(ger, ger->nivel);
+        gera_formato(ger, "while i%d < %d do begin\n", ger->nivel + 1, ger->g.voltas);
+    }
+    ger->nivel++;
+    ger->aberto[ger->nivel] = tipo;
+    ger->primeiro[ger->nivel] = 1;
+}
+
+static void gera_fecha(TGerador *ger) {
+    char tipo = ger->aberto[ger->nivel];
+    if (tipo == 'w') {
+        gera_separador(ger);
+        gera_formato(ger, "i%d := i%d + 1", ger->nivel, ger->nivel);
+    }
+    if (!ger->primeiro[ger->nivel]) gera_texto(ger, "\n");
+    gera_recuo(ger, ger->nivel - 1);
+    gera_texto(ger, "end");
+    if (tipo == 'i' && sorteia(100) < 40) {
+        gera_texto(ger, " else begin\n");
+        ger->aberto[ger->nivel] = 'e';
+        ger->primeiro[ger->nivel] = 1;
+        return;
+    }
+    ger->nivel--;
+}
+
+static int le_tamanho(const char *texto, uint64_t *tamanho) {
+    char *fim;
+    unsigned long long n = strtoull(texto, &fim, 10);
+    if (fim == texto) return 0;
+    if (*fim == 'K' || *fim == 'k') n <<= 10, fim++;
+    else if (*fim == 'M' || *fim == 'm') n <<= 20, fim++;
+    else if (*fim == 'G' || *fim == 'g') n <<= 30, fim++;
+    *tamanho = n;
+    return *fim == '\0' || *fim == ',';
+}
+
+static int le_opcao_geracao(const char *lista, TGeracao *g) {
+    if (!le_tamanho(lista, &g->tamanho)) return 0;
+    lista += strcspn(lista, ",");
+    while (*lista == ',') {
+        lista++;
+        size_t n = strcspn(lista, "=");
+        if (lista[n] != '=') return 0;
+        char *fim;
+        long valor = strtol(lista + n + 1, &fim, 10);
+        if (fim == lista + n + 1 || (*fim != '\0' && *fim != ',') || valor < 0) return 0;
+        if (n == 4 && strncmp(lista, "seed", 4) == 0) g->semente = (uint64_t)valor;
+        else if (n == 4 && strncmp(lista, "vars", 4) == 0 && valor > 0) g->vars = (int)valor;
+        else if (n == 3 && strncmp(lista, "ids", 3) == 0 && valor <= 100) g->ids = (int)valor;
+        else if (n == 8 && strncmp(lista, "comments", 8) == 0 && valor <= 100) g->comentarios = (int)valor;
+        else if (n == 5 && strncmp(lista, "depth", 5) == 0 && valor <= PROFUNDIDADE_GERACAO) g->profundidade = (int)valor;
+        else if (n == 4 && strncmp(lista, "expr", 4) == 0 && valor > 0) g->operandos = (int)valor;
+        else if (n == 4 && strncmp(lista, "nest", 4) == 0 && valor <= INT_MAX) g->aninhados = (int)valor;
+        else if (n == 5 && strncmp(lista, "loops", 5) == 0 && valor > 0 && valor <= INT_MAX) g->voltas = (int)valor;
+        else return 0;
+        lista = fim;
+    }
+    return 1;
+}
+
+int gera_programa(const char *opcoes) {
+    TGerador ger;
+    memset(&ger, 0, sizeof(ger));
+    ger.g.semente = 1;
+    ger.g.vars = 64;
+    ger.g.ids = 60;
+    ger.g.comentarios = 10;
+    ger.g.profundidade = 4;
+    ger.g.operandos = 4;
+    ger.g.voltas = 2;
+    if (!le_opcao_geracao(opcoes, &ger.g)) {
+        fprintf(stderr, "Opcoes de geracao invalidas: %s\n", opcoes);
+        return 1;
+    }
+    ger.buf = (char*)malloc(TAM_BUFFER_GERACAO);
+    if (ger.buf == NULL) {
+        fprintf(stderr, "Erro ao alocar memoria.\n");
+        return 1;
+    }
+    estado_sorteio = (ger.g.semente + 1) * 0x9e3779b97f4a7c15ull;
+
+    gera_texto(&ger, "program gerado;\nvar ");
+    for (int v = 0; v < ger.g.vars; v++)
+        gera_formato(&ger, "v%d%s", v, v + 1 == ger.g.vars ? ": integer;\n" : v % 16 == 15 ? ",\n    " : ", ");
+    if (ger.g.profundidade > 0) {
+        gera_texto(&ger, "    ");
+        for (int i = 1; i <= ger.g.profundidade; i++) gera_formato(&ger, "i%d%s", i, i == ger.g.profundidade ? ": integer;\n" : ", ");
+    }
+    gera_texto(&ger, "    c0: char;\n    b0: boolean;\n");
+    if (ger.g.aninhados > 0) {
+        gera_texto(&ger, "    w0: integer;\nbegin\n  w0 := 0;\n");
+        for (int i = 0; i < ger.g.aninhados; i++) gera_texto(&ger, "  while w0 < 1 do\n");
+    }
+    gera_texto(&ger, "begin\n");
+    ger.primeiro[0] = 1;
+
+    // Abre mais perto da superfície e fecha mais no fundo, variando a profundidade
+    while (ger.total < ger.g.tamanho) {
+        uint32_t r = sorteia(100);
+        if (ger.nivel < ger.g.profundidade && r < 12) gera_abre(&ger);
+        else if (ger.nivel > 0 && r < 12 + 4 * (uint32_t)ger.nivel) gera_fecha(&ger);
+        else gera_comando(&ger);
+    }
+    while (ger.nivel > 0) gera_fecha(&ger);
+    if (ger.g.aninhados > 0) {
+        gera_separador(&ger);
+        gera_texto(&ger, "w0 := 1\nend");
+    }
+    gera_texto(&ger, "\nend.\n");
+    gera_descarrega(&ger);
+    free(ger.buf);
+    return ferror(stdout) ? 1 : 0;
+}
+
+/*
+ * --bench arquivo...: mede cada arquivo por fase e escreve JSON em stdout,
+ * para comparar builds com diff. Cada fase roda --bench-reps vezes (padrão
+ * 5); o relatório traz mediana e mínimo:
+ *   lexico     passada em lote para a tabela de átomos
+ *   sintatico  análise a partir da tabela, sem trace
+ *   saida      trace em texto de todos os átomos da tabela, para /dev/null
+ *   completo   léxico sob demanda, análise e trace em texto (o modo padrão)
+ *   esteira    o mesmo com o léxico na thread da esteira (--lex=pipeline)
+ * ganho_esteira é a razão entre as medianas de completo e esteira: quanto a
+ * sobreposição de léxico e parser rendeu (abaixo de 1 com um só núcleo).
+ * rss_pico_kb é o pico do processo até o fim do arquivo (getrusage), então
+ * arquivos menores medidos depois de um maior herdam o pico dele.
+ */
+enum { FASE_LEXICO, FASE_SINTATICO, FASE_SAIDA, FASE_COMPLETO, FASE_ESTEIRA, N_FASES };
+
+static void json_texto(FILE *saida, const char *texto) {
+    fputc('"', saida);
+    for (const unsigned char *p = (const unsigned char*)texto; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(saida, "\\%c", *p);
+        else if (*p < 0x20) fprintf(saida, "\\u%04x", *p);
+        else fputc(*p, saida);
+    }
+    fputc('"', saida);
+}
+
+static void json_fase(const char *nome, double *tempos, int n, size_t bytes, size_t atomos, int ultima) {
+    qsort(tempos, (size_t)n, sizeof(double), compara_tempos);
+    double mediana = tempos[n / 2];
+    printf("        \"%s\": {\"mediana_s\": %.6f, \"min_s\": %.6f, \"atomos_s\": %.0f, \"mb_s\": %.2f}%s\n",
+           nome, mediana, tempos[0], mediana > 0 ? atomos / mediana : 0.0,
+           mediana > 0 ? bytes / mediana / (1024.0 * 1024.0) : 0.0, ultima ? "" : ",");
+}
+
+static int bench_arquivo(const char *caminho, int repeticoes, FILE *nulo, int ultimo) {
+    TFonte fonte;
+    if (!carrega_fonte(caminho, &fonte)) {
+        printf("    {\n      \"arquivo\": ");
+        json_texto(stdout, caminho);
+        printf(",\n      \"erro\": ");
+        json_texto(stdout, fonte.erro);
+        printf("\n    }%s\n", ultimo ? "" : ",");
+        return 1;
+    }
+    double *tempos[N_FASES];
+    for (int f = 0; f < N_FASES; f++) tempos[f] = (double*)calloc((size_t)repeticoes, sizeof(double));
+    TContexto contexto;
+    inicia_contexto(&contexto, nulo);
+    size_t atomos = 0;
+    int linhas = 0, status = 0;
+    for (int r = 0; r < repeticoes && status == 0; r++) {
+        modo_lexico = LEX_EM_LOTE;
+        modo_trace = TRACE_DESLIGADO;
+        recicla_contexto(ctx);
+        ctx->fonte = fonte;
+        status = compila_fonte();
+        tempos[FASE_LEXICO][r] = ctx->tempo_lexico;
+        tempos[FASE_SINTATICO][r] = ctx->tempo_analise;
+        atomos = ctx->tabela.quantidade;
+        if (status == 0) {
+            // A tabela continua no contexto: reentrega cada átomo ao trace
+            modo_trace = TRACE_TEXTO;
+            ctx->cursor_tabela = 0;
+            ctx->trivia.cursor = 0;
+            double ini = agora();
+            do {
+                avanca();
+                emite_atomo(&ctx->lookahead);
+            } while (ctx->lookahead.atomo != EOS);
+            saida_descarrega();
+            tempos[FASE_SAIDA][r] = agora() - ini;
+        }
+        ctx->fonte.dados = NULL;   // o texto pertence a esta função
+
+        modo_lexico = LEX_SOB_DEMANDA;
+        modo_trace = TRACE_TEXTO;
+        recicla_contexto(ctx);
+        ctx->fonte = fonte;
+        double ini = agora();
+        status |= compila_fonte();
+        tempos[FASE_COMPLETO][r] = agora() - ini;
+        linhas = ctx->nLinha;
+        ctx->fonte.dados = NULL;
+
+        modo_lexico = LEX_ESTEIRA;
+        recicla_contexto(ctx);
+        ctx->fonte = fonte;
+        ini = agora();
+        status |= compila_fonte();
+        tempos[FASE_ESTEIRA][r] = agora() - ini;
+        ctx->fonte.dados = NULL;
+    }
+    libera_contexto(&contexto);
+
+    struct rusage uso;
+    getrusage(RUSAGE_SELF, &uso);
+    printf("    {\n      \"arquivo\": ");
+    json_texto(stdout, caminho);
+    printf(",\n      \"bytes\": %zu,\n      \"linhas\": %d,\n      \"atomos\": %zu,\n      \"status\": %d,\n",
+           fonte.tamanho, linhas, atomos, status);
+    if (status == 0) {
+        printf("      \"fases\": {\n");
+        json_fase("lexico", tempos[FASE_LEXICO], repeticoes, fonte.tamanho, atomos, 0);
+        json_fase("sintatico", tempos[FASE_SINTATICO], repeticoes, fonte.tamanho, atomos, 0);
+        json_fase("saida", tempos[FASE_SAIDA], repeticoes, fonte.tamanho, atomos, 0);
+        json_fase("completo", tempos[FASE_COMPLETO], repeticoes, fonte.tamanho, atomos, 0);
+        json_fase("esteira", tempos[FASE_ESTEIRA], repeticoes, fonte.tamanho, atomos, 1);
+        printf("      },\n      \"ganho_esteira\": %.3f,\n",
+               tempos[FASE_ESTEIRA][repeticoes / 2] > 0 ? tempos[FASE_COMPLETO][repeticoes / 2] / tempos[FASE_ESTEIRA][repeticoes / 2] : 0.0);
+    }
+    printf("      \"rss_pico_kb\": %ld\n    }%s\n", uso.ru_maxrss, ultimo ? "" : ",");
+    for (int f = 0; f < N_FASES; f++) free(tempos[f]);
+    libera_fonte(&fonte);
+    return status;
+}
+
+int bench_arquivos(const char **arquivos, size_t n, int repeticoes) {
+    FILE *nulo = fopen("/dev/null", "w");
+    if (nulo == NULL) {
+        fprintf(stderr, "/dev/null: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("{\n  \"compilador\": ");
+    json_texto(stdout, __VERSION__);
+    printf(",\n  \"varredura\": \"%s\",\n  \"palavras\": \"%s\",\n  \"repeticoes\": %d,\n  \"arquivos\": [\n",
+           seleciona_varredura(modo_varredura), modo_palavras == PALAVRAS_HASH ? "hash" : "strcmp", repeticoes);
+    int status = 0;
+    for (size_t i = 0; i < n; i++) status |= bench_arquivo(arquivos[i], repeticoes, nulo, i + 1 == n);
+    printf("  ]\n}\n");
+    fclose(nulo);
+    return status;
+}
+
+// =================================================================
+// ANÁLISE DE FLUXO DE DADOS (--check)
+// =================================================================
+
+/*
+ * O grafo de fluxo sai da estrutura dos comandos: blocos básicos com as
+ * referências a variáveis na ordem de avaliação, e arestas dos if e while
+ * (o cabeçalho do while avalia a condição e recebe a volta do corpo). Cada
+ * bloco tem no máximo dois predecessores e dois sucessores, e a numeração
+ * de criação já é uma ordem topológica sem as voltas, além de ser a ordem
+ * do programa: as referências de um bloco ficam contíguas.
+ *
+ * resolve_fluxo é o resolvedor genérico: direção, encontro (união ou
+ * interseção) e a função de transferência vêm do TProblemaFluxo, e os
+ * conjuntos são vetores densos de bits, um por variável declarada (o índice
+ * do símbolo), operados palavra a palavra. Para a memória não crescer com
+ * blocos x variáveis, o universo é resolvido em faixas de PALAVRAS_FAIXA
+ * palavras, com as referências distribuídas por faixa uma vez só: cada
+ * faixa custa O(blocos + suas referências) por visita, e uma faixa sem
+ * referências nem é resolvida. Os pendentes são visitados em rodadas na
+ * ordem da direção, então um programa sem laços converge numa rodada de
+ * trabalho e cada nível de while acrescenta no máximo uma. --check-stats
+ * mostra blocos, visitas e tempos; com --gen-program=16M,vars=100000 as
+ * visitas por bloco e faixa ficam perto de 1 (inicialização) e 2 (escrita
+ * morta), e o tempo dobra com o tamanho do programa.
+ */
+int le_opcao_verificacao(const char *lista) {
+    unsigned pedidas = 0;
+    while (*lista) {
+        size_t n = strcspn(lista, ",");
+        if (n == 6 && strncmp(lista, "uninit", 6) == 0) pedidas |= VERIF_INICIALIZACAO;
+        else if (n == 4 && strncmp(lista, "dead", 4) == 0) pedidas |= VERIF_ESCRITA_MORTA;
+        else if (n == 3 && strncmp(lista, "all", 3) == 0) pedidas |= VERIF_TODAS;
+        else return 0;
+        lista += n;
+        if (*lista == ',') lista++;
+    }
+    verificacoes = pedidas;
+    return 1;
+}
+
+typedef enum { REF_USO, REF_ATRIBUI, REF_LE } TTipoRef;
+
+typedef struct {
+    uint32_t no;        // o NO_ID da referência
+    uint32_t simbolo;
+    uint32_t bloco;
+    uint32_t tipo;      // TTipoRef
+} TRefFluxo;
+
+typedef struct {
+    uint32_t pred[2], suc[2];
+    uint8_t n_pred, n_suc;
+} TBlocoFluxo;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t simbolo;
+    uint32_t tipo;      // VERIF_INICIALIZACAO ou VERIF_ESCRITA_MORTA
+} TAvisoFluxo;
+
+typedef struct {
+    uint32_t no;
+    uint32_t etapa;     // if: 0 no então, 1 no senão
+    uint32_t proximo;   // composto: próximo filho
+    uint32_t origem;    // if: bloco do teste; while: cabeçalho
+    uint32_t entao;     // if: bloco em que o então terminou
+} TQuadroFluxo;
+
+typedef struct {
+    TBlocoFluxo *blocos;
+    uint32_t n_blocos, capacidade_blocos;
+    TRefFluxo *refs;
+    uint32_t n_refs, capacidade_refs;
+    uint32_t *pilha;                // nós de expressão a visitar
+    uint32_t n_pilha, capacidade_pilha;
+    TQuadroFluxo *quadros;          // comandos compostos, if e while ainda abertos
+    uint32_t n_quadros, capacidade_quadros;
+
+    // Faixa corrente: variáveis [base, base + 64 * palavras) e, por bloco,
+    // suas referências na faixa em faixa_refs[ini_bloco[b] .. ini_bloco[b + 1])
+    uint32_t base, palavras;
+    const TRefFluxo *faixa_refs;
+    uint32_t *ini_bloco;
+    uint64_t *chegada, *partida;    // conjuntos por bloco: antes e depois da transferência
+    uint8_t *pendente;
+    uint64_t visitas;
+
+    uint64_t *relatada;             // variáveis já avisadas como não atribuídas
+    TAvisoFluxo *avisos;
+    uint32_t n_avisos, capacidade_avisos;
+} TGrafoFluxo;
+
+typedef struct {
+    int reverso;        // dos sucessores para os predecessores
+    int intersecao;     // encontro por interseção (em todos os caminhos); 0: união
+    // Aplica ao conjunto os efeitos do bloco, na direção da análise; com
+    // relata, registra os avisos no caminho
+    void (*transfere)(TGrafoFluxo *g, uint32_t bloco, uint64_t *conjunto, int relata);
+} TProblemaFluxo;
+
+static void *fluxo_cresce(void *v, uint32_t *capacidade, size_t tamanho) {
+    uint32_t nova = *capacidade ? *capacidade * 2 : 1024;
+    void *p = realloc(v, nova * tamanho);
+    if (p == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    *capacidade = nova;
+    return p;
+}
+
+static uint32_t fluxo_bloco(TGrafoFluxo *g) {
+    if (g->n_blocos == g->capacidade_blocos) g->blocos = (TBlocoFluxo*)fluxo_cresce(g->blocos, &g->capacidade_blocos, sizeof(TBlocoFluxo));
+    memset(&g->blocos[g->n_blocos], 0, sizeof(TBlocoFluxo));
+    return g->n_blocos++;
+}
+
+static void fluxo_aresta(TGrafoFluxo *g, uint32_t de, uint32_t para) {
+    g->blocos[de].suc[g->blocos[de].n_suc++] = para;
+    g->blocos[para].pred[g->blocos[para].n_pred++] = de;
+}
+
+static void fluxo_referencia(TGrafoFluxo *g, uint32_t bloco, uint32_t no, TTipoRef tipo) {
+    if (g->n_refs == g->capacidade_refs) g->refs = (TRefFluxo*)fluxo_cresce(g->refs, &g->capacidade_refs, sizeof(TRefFluxo));
+    TRefFluxo *r = &g->refs[g->n_refs++];
+    r->no = no;
+    r->simbolo = (uint32_t)ctx->ast.nos[no].valor;
+    r->bloco = bloco;
+    r->tipo = tipo;
+}
+
+// Usos de variáveis numa expressão, da esquerda para a direita, sem recursão
+static void fluxo_usos(TGrafoFluxo *g, uint32_t bloco, uint32_t expr) {
+    g->n_pilha = 0;
+    uint32_t no = expr;
+    for (;;) {
+        const TNo *n = &ctx->ast.nos[no];
+        if (no != expr && n->irmao != NO_NULO) {
+            if (g->n_pilha == g->capacidade_pilha) g->pilha = (uint32_t*)fluxo_cresce(g->pilha, &g->capacidade_pilha, sizeof(uint32_t));
+            g->pilha[g->n_pilha++] = n->irmao;
+        }
+        if (n->tipo == NO_ID) fluxo_referencia(g, bloco, no, REF_USO);
+        if (n->filho != NO_NULO) no = n->filho;
+        else if (g->n_pilha > 0) no = g->pilha[--g->n_pilha];
+        else break;
+    }
+}
+
+static TQuadroFluxo *fluxo_abre(TGrafoFluxo *g, uint32_t no) {
+    if (g->n_quadros == g->capacidade_quadros) g->quadros = (TQuadroFluxo*)fluxo_cresce(g->quadros, &g->capacidade_quadros, sizeof(TQuadroFluxo));
+    TQuadroFluxo *q = &g->quadros[g->n_quadros++];
+    memset(q, 0, sizeof(*q));
+    q->no = no;
+    return q;
+}
+
+/*
+ * Acrescenta o comando ao grafo a partir de bloco; devolve o bloco em que a
+ * execução segue. Sem recursão: compostos, if e while abertos ficam em
+ * quadros, e no == NO_NULO indica que o comando corrente terminou em bloco.
+ */
+static uint32_t fluxo_instrucao(TGrafoFluxo *g, uint32_t raiz, uint32_t bloco) {
+    g->n_quadros = 0;
+    uint32_t no = raiz;
+    for (;;) {
+        if (no != NO_NULO) {
+            const TNo *n = &ctx->ast.nos[no];
+            switch (n->tipo) {
+                case NO_ATRIBUICAO:
+                    fluxo_usos(g, bloco, ctx->ast.nos[n->filho].irmao);
+                    fluxo_referencia(g, bloco, n->filho, REF_ATRIBUI);
+                    break;
+                case NO_LEITURA:
+                    for (uint32_t id = n->filho; id != NO_NULO; id = ctx->ast.nos[id].irmao) fluxo_referencia(g, bloco, id, REF_LE);
+                    break;
+                case NO_ESCRITA:
+                    for (uint32_t id = n->filho; id != NO_NULO; id = ctx->ast.nos[id].irmao) fluxo_referencia(g, bloco, id, REF_USO);
+                    break;
+                case NO_COMPOSTO:
+                    if (n->filho != NO_NULO) {
+                        fluxo_abre(g, no)->proximo = ctx->ast.nos[n->filho].irmao;
+                        no = n->filho;
+                        continue;
+                    }
+                    break;
+                case NO_SE: {
+                    fluxo_usos(g, bloco, n->filho);
+                    uint32_t t = fluxo_bloco(g);
+                    fluxo_aresta(g, bloco, t);
+                    fluxo_abre(g, no)->origem = bloco;
+                    no = ctx->ast.nos[n->filho].irmao;
+                    bloco = t;
+                    continue;
+                }
+                case NO_ENQUANTO: {
+                    uint32_t cabecalho = fluxo_bloco(g);
+                    fluxo_aresta(g, bloco, cabecalho);
+                    fluxo_usos(g, cabecalho, n->filho);
+                    uint32_t corpo = fluxo_bloco(g);
+                    fluxo_aresta(g, cabecalho, corpo);
+                    fluxo_abre(g, no)->origem = cabecalho;
+                    no = ctx->ast.nos[n->filho].irmao;
+                    bloco = corpo;
+                    continue;
+                }
+                default: break;   // vazio
+            }
+        }
+
+        // O comando terminou em bloco: retoma o quadro de cima
+        if (g->n_quadros == 0) return bloco;
+        TQuadroFluxo *q = &g->quadros[g->n_quadros - 1];
+        const TNo *n = &ctx->ast.nos[q->no];
+        no = NO_NULO;
+        if (n->tipo == NO_COMPOSTO) {
+            if (q->proximo != NO_NULO) {
+                no = q->proximo;
+                q->proximo = ctx->ast.nos[no].irmao;
+                continue;
+            }
+        } else if (n->tipo == NO_SE) {
+            uint32_t senao = ctx->ast.nos[ctx->ast.nos[n->filho].irmao].irmao;
+            if (q->etapa == 0) {
+                q->entao = bloco;
+                bloco = q->origem;
+                if (senao != NO_NULO) {
+                    uint32_t e = fluxo_bloco(g);
+                    fluxo_aresta(g, q->origem, e);
+                    q->etapa = 1;
+                    no = senao;
+                    bloco = e;
+                    continue;
+                }
+            }
+            uint32_t juncao = fluxo_bloco(g);
+            fluxo_aresta(g, q->entao, juncao);
+            fluxo_aresta(g, bloco, juncao);
+            bloco = juncao;
+        } else {
+            fluxo_aresta(g, bloco, q->origem);
+            uint32_t saida = fluxo_bloco(g);
+            fluxo_aresta(g, q->origem, saida);
+            bloco = saida;
+        }
+        g->n_quadros--;
+    }
+}
+
+static void fluxo_aviso(TGrafoFluxo *g, const TRefFluxo *r, unsigned tipo) {
+    if (g->n_avisos == g->capacidade_avisos) g->avisos = (TAvisoFluxo*)fluxo_cresce(g->avisos, &g->capacidade_avisos, sizeof(TAvisoFluxo));
+    TAvisoFluxo *a = &g->avisos[g->n_avisos++];
+    a->offset = ctx->ast.nos[r->no].offset;
+    a->simbolo = r->simbolo;
+    a->tipo = tipo;
+}
+
+// Variáveis com valor atribuído em todos os caminhos: para a frente, interseção
+static void transfere_atribuidas(TGrafoFluxo *g, uint32_t bloco, uint64_t *conjunto, int relata) {
+    for (uint32_t i = g->ini_bloco[bloco]; i < g->ini_bloco[bloco + 1]; i++) {
+        const TRefFluxo *r = &g->faixa_refs[i];
+        uint32_t bit = r->simbolo - g->base;
+        uint64_t mascara = 1ull << (bit & 63);
+        if (r->tipo != REF_USO) conjunto[bit >> 6] |= mascara;
+        else if (relata && !(conjunto[bit >> 6] & mascara) && !(g->relatada[r->simbolo >> 6] & (1ull << (r->simbolo & 63)))) {
+            // Um aviso por variável, no primeiro uso (os blocos vão na ordem do programa)
+            g->relatada[r->simbolo >> 6] |= 1ull << (r->simbolo & 63);
+            fluxo_aviso(g, r, VERIF_INICIALIZACAO);
+        }
+    }
+}
+
+// Variáveis vivas (lidas antes de serem reescritas em algum caminho): para trás, união
+static void transfere_vivas(TGrafoFluxo *g, uint32_t bloco, uint64_t *conjunto, int relata) {
+    for (uint32_t i = g->ini_bloco[bloco + 1]; i-- > g->ini_bloco[bloco];) {
+        const TRefFluxo *r = &g->faixa_refs[i];
+        uint32_t bit = r->simbolo - g->base;
+        uint64_t mascara = 1ull << (bit & 63);
+        if (r->tipo == REF_USO) {
+            conjunto[bit >> 6] |= mascara;
+            continue;
+        }
+        if (relata && r->tipo == REF_ATRIBUI && !(conjunto[bit >> 6] & mascara)) fluxo_aviso(g, r, VERIF_ESCRITA_MORTA);
+        conjunto[bit >> 6] &= ~mascara;
+    }
+}
+
+static const TProblemaFluxo problema_atribuidas = { 0, 1, transfere_atribuidas };
+static const TProblemaFluxo problema_vivas = { 1, 0, transfere_vivas };
+
+/*
+ * Ponto fixo do problema na faixa corrente. Na fronteira (entrada do
+ * programa, ou a saída para trás) o conjunto é vazio: nada atribuído, nada
+ * vivo; os demais blocos começam no topo do encontro. Depois de convergir,
+ * uma passada na ordem do programa reaplica as transferências relatando.
+ */
+static void resolve_fluxo(TGrafoFluxo *g, const TProblemaFluxo *p) {
+    uint32_t n = g->n_blocos, w = g->palavras;
+    uint64_t topo = p->intersecao ? ~0ull : 0;
+    uint64_t conjunto[PALAVRAS_FAIXA];
+    for (size_t i = 0; i < (size_t)n * w; i++) g->partida[i] = topo;
+    memset(g->pendente, 1, n);
+    uint32_t pendentes = n;
+    while (pendentes > 0) {
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t b = p->reverso ? n - 1 - k : k;
+            if (!g->pendente[b]) continue;
+            g->pendente[b] = 0;
+            pendentes--;
+            g->visitas++;
+            const TBlocoFluxo *bl = &g->blocos[b];
+            const uint32_t *anteriores = p->reverso ? bl->suc : bl->pred;
+            uint32_t n_anteriores = p->reverso ? bl->n_suc : bl->n_pred;
+            uint64_t *chegada = g->chegada + (size_t)b * w;
+            if (n_anteriores == 0) memset(chegada, 0, w * sizeof(uint64_t));
+            else {
+                memcpy(chegada, g->partida + (size_t)anteriores[0] * w, w * sizeof(uint64_t));
+                if (n_anteriores == 2) {
+                    const uint64_t *outro = g->partida + (size_t)anteriores[1] * w;
+                    if (p->intersecao) for (uint32_t i = 0; i < w; i++) chegada[i] &= outro[i];
+                    else for (uint32_t i = 0; i < w; i++) chegada[i] |= outro[i];
+                }
+            }
+            memcpy(conjunto, chegada, w * sizeof(uint64_t));
+            p->transfere(g, b, conjunto, 0);
+            uint64_t *partida = g->partida + (size_t)b * w;
+            if (memcmp(conjunto, partida, w * sizeof(uint64_t)) == 0) continue;
+            memcpy(partida, conjunto, w * sizeof(uint64_t));
+            const uint32_t *seguintes = p->reverso ? bl->pred : bl->suc;
+            uint32_t n_seguintes = p->reverso ? bl->n_pred : bl->n_suc;
+            for (uint32_t i = 0; i < n_seguintes; i++) {
+                if (g->pendente[seguintes[i]]) continue;
+                g->pendente[seguintes[i]] = 1;
+                pendentes++;
+            }
+        }
+    }
+    for (uint32_t b = 0; b < n; b++) {
+        memcpy(conjunto, g->chegada + (size_t)b * w, w * sizeof(uint64_t));
+        p->transfere(g, b, conjunto, 1);
+    }
+}
+
+static int compara_avisos(const void *a, const void *b) {
+    const TAvisoFluxo *x = (const TAvisoFluxo*)a, *y = (const TAvisoFluxo*)b;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return (x->tipo > y->tipo) - (x->tipo < y->tipo);
+}
+
+/*
+ * Roda as análises pedidas em verificacoes sobre a árvore de uma análise
+ * bem-sucedida e imprime os avisos na ordem do fonte. Avisos não mudam o
+ * resultado da compilação.
+ */
+static void libera_grafo(TGrafoFluxo *g) {
+    free(g->blocos);
+    free(g->refs);
+    free(g->pilha);
+    free(g->quadros);
+    free(g->ini_bloco);
+    free(g->chegada);
+    free(g->partida);
+    free(g->pendente);
+    free(g->relatada);
+    free(g->avisos);
+}
+
+void verifica_fluxo(uint32_t raiz, unsigned verificacoes, TEstatisticasFluxo *est) {
+    memset(est, 0, sizeof(*est));
+    double ini = agora();
+    TGrafoFluxo g;
+    memset(&g, 0, sizeof(g));
+    uint32_t bloco = ctx->ast.nos[ctx->ast.nos[raiz].filho].irmao;
+    uint32_t corpo = ctx->ast.nos[ctx->ast.nos[bloco].filho].irmao;
+    fluxo_instrucao(&g, corpo, fluxo_bloco(&g));
+
+    // Referências por faixa (contagem estável, preservando a ordem do programa)
+    uint32_t variaveis = ctx->simbolos.quantidade, por_faixa = 64 * PALAVRAS_FAIXA;
+    uint32_t n_faixas = (variaveis + por_faixa - 1) / por_faixa;
+    uint32_t *ini_faixa = (uint32_t*)calloc((size_t)n_faixas + 1, sizeof(uint32_t));
+    g.ini_bloco = (uint32_t*)malloc(((size_t)g.n_blocos + 1) * sizeof(uint32_t));
+    g.chegada = (uint64_t*)malloc((size_t)g.n_blocos * PALAVRAS_FAIXA * sizeof(uint64_t));
+    g.partida = (uint64_t*)malloc((size_t)g.n_blocos * PALAVRAS_FAIXA * sizeof(uint64_t));
+    g.pendente = (uint8_t*)malloc(g.n_blocos);
+    g.relatada = (uint64_t*)calloc((size_t)n_faixas * PALAVRAS_FAIXA + 1, sizeof(uint64_t));
+    if (ini_faixa == NULL || g.ini_bloco == NULL || g.chegada == NULL || g.partida == NULL || g.pendente == NULL || g.relatada == NULL) {
+        free(ini_faixa);
+        libera_grafo(&g);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    for (uint32_t i = 0; i < g.n_refs; i++) ini_faixa[g.refs[i].simbolo / por_faixa + 1]++;
+    for (uint32_t f = 0; f < n_faixas; f++) ini_faixa[f + 1] += ini_faixa[f];
+    uint32_t *posicao = (uint32_t*)malloc(((size_t)n_faixas + 1) * sizeof(uint32_t));
+    if (posicao == NULL) {
+        free(ini_faixa);
+        libera_grafo(&g);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    memcpy(posicao, ini_faixa, ((size_t)n_faixas + 1) * sizeof(uint32_t));
+    TRefFluxo *ordenadas = (TRefFluxo*)malloc(((size_t)g.n_refs + 1) * sizeof(TRefFluxo));
+    if (ordenadas == NULL) {
+        free(posicao);
+        free(ini_faixa);
+        libera_grafo(&g);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    for (uint32_t i = 0; i < g.n_refs; i++) ordenadas[posicao[g.refs[i].simbolo / por_faixa]++] = g.refs[i];
+    free(posicao);
+    est->blocos = g.n_blocos;
+    est->referencias = g.n_refs;
+    est->tempo[0] = agora() - ini;
+
+    for (uint32_t f = 0; f < n_faixas; f++) {
+        if (ini_faixa[f] == ini_faixa[f + 1]) continue;
+        est->faixas++;
+        g.base = f * por_faixa;
+        g.palavras = (variaveis - g.base + 63) / 64 < PALAVRAS_FAIXA ? (variaveis - g.base + 63) / 64 : PALAVRAS_FAIXA;
+        uint32_t n = ini_faixa[f + 1] - ini_faixa[f];
+        g.faixa_refs = ordenadas + ini_faixa[f];
+        memset(g.ini_bloco, 0, ((size_t)g.n_blocos + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < n; i++) g.ini_bloco[g.faixa_refs[i].bloco + 1]++;
+        for (uint32_t b = 0; b < g.n_blocos; b++) g.ini_bloco[b + 1] += g.ini_bloco[b];
+        if (verificacoes & VERIF_INICIALIZACAO) {
+            ini = agora();
+            g.visitas = 0;
+            resolve_fluxo(&g, &problema_atribuidas);
+            est->visitas[0] += g.visitas;
+            est->tempo[1] += agora() - ini;
+        }
+        if (verificacoes & VERIF_ESCRITA_MORTA) {
+            ini = agora();
+            g.visitas = 0;
+            resolve_fluxo(&g, &problema_vivas);
+            est->visitas[1] += g.visitas;
+            est->tempo[2] += agora() - ini;
+        }
+    }
+
+    if (g.n_avisos > 0) qsort(g.avisos, g.n_avisos, sizeof(TAvisoFluxo), compara_avisos);
+    for (uint32_t i = 0; i < g.n_avisos; i++) {
+        const TAvisoFluxo *a = &g.avisos[i];
+        int tam;
+        const char *nome = nome_simbolo(a->simbolo, &tam);
+        if (a->tipo == VERIF_INICIALIZACAO) {
+            est->avisos[0]++;
+            mensagem("# %d:aviso, variavel [%.*s] pode ser usada sem valor atribuido\n", linha_do_offset(a->offset), tam, nome);
+        } else {
+            est->avisos[1]++;
+            mensagem("# %d:aviso, valor atribuido a [%.*s] nunca e usado\n", linha_do_offset(a->offset), tam, nome);
+        }
+    }
+
+    free(ini_faixa);
+    free(ordenadas);
+    libera_grafo(&g);
+}
+
+// =================================================================
+// OTIMIZAÇÃO
+// =================================================================
+
+/*
+ * Os passos reescrevem a árvore no lugar. Um nó substituído por outro
+ * recebe uma cópia do substituto mas conserva o próprio irmão, então a
+ * lista de filhos do pai não precisa ser refeita. Valores seguem a mesma
+ * aritmética de 32 bits com volta da máquina virtual; div por zero nunca
+ * é dobrado, para que o erro continue acontecendo em tempo de execução.
+ */
+int le_opcao_otim(const char *lista) {
+    if (strcmp(lista, "none") == 0) { otimizacoes = 0; return 1; }
+    if (strcmp(lista, "all") == 0) { otimizacoes = OTIM_TODAS; return 1; }
+    unsigned passos = 0;
+    while (*lista) {
+        size_t n = strcspn(lista, ",");
+        if (n == 6 && strncmp(lista, "copies", 6) == 0) passos |= OTIM_COPIAS;
+        else if (n == 4 && strncmp(lista, "fold", 4) == 0) passos |= OTIM_DOBRA;
+        else if (n == 8 && strncmp(lista, "strength", 8) == 0) passos |= OTIM_FORCA;
+        else if (n == 8 && strncmp(lista, "branches", 8) == 0) passos |= OTIM_RAMOS;
+        else return 0;
+        lista += n;
+        if (*lista == ',') lista++;
+    }
+    otimizacoes = passos;
+    return 1;
+}
+
+static inline int eh_constante(uint32_t no) {
+    uint8_t t = ctx->ast.nos[no].tipo;
+    return t == NO_CONSTINT || t == NO_CONSTCHAR || t == NO_LOGICO;
+}
+
+// Troca o conteúdo de no pelo de substituto, preservando a posição na lista de irmãos
+static void substitui_no(uint32_t no, uint32_t substituto) {
+    uint32_t irmao = ctx->ast.nos[no].irmao;
+    ctx->ast.nos[no] = ctx->ast.nos[substituto];
+    ctx->ast.nos[no].irmao = irmao;
+}
+
+static void torna_constante(uint32_t no, TTipoNo tipo, int32_t valor) {
+    ctx->ast.nos[no].tipo = (uint8_t)tipo;
+    ctx->ast.nos[no].atomo = 0;
+    ctx->ast.nos[no].filho = NO_NULO;
+    ctx->ast.nos[no].valor = valor;
+}
+
+/*
+ * Nenhum passo usa recursão nativa: as subárvores são listadas em largura,
+ * com cada nó antes dos seus descendentes, e os passos que reescrevem de
+ * baixo para cima percorrem a lista do fim para o começo. A propagação de
+ * cópias, que depende da ordem do programa, usa uma pilha de quadros.
+ */
+typedef struct {
+    uint32_t *nos;
+    size_t n;
+    size_t capacidade;
+} TListaNos;
+
+typedef struct {
+    TListaNos comandos;     // comandos do programa
+    TListaNos expressao;    // nós da expressão em reescrita
+    TListaNos auxiliar;     // subárvore consultada por pode_falhar
+    TEstatisticasOtim *est;
+} TPassoOtim;
+
+static void *otim_cresce(void *v, size_t *capacidade, size_t tamanho) {
+    size_t nova = *capacidade ? *capacidade * 2 : 256;
+    void *p = realloc(v, nova * tamanho);
+    if (p == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    *capacidade = nova;
+    return p;
+}
+
+static inline void lista_poe(TListaNos *l, uint32_t no) {
+    if (l->n == l->capacidade) l->nos = (uint32_t*)otim_cresce(l->nos, &l->capacidade, sizeof(uint32_t));
+    l->nos[l->n++] = no;
+}
+
+// Todos os nós da expressão, em largura
+static void lista_expressao(TListaNos *l, uint32_t raiz) {
+    l->n = 0;
+    lista_poe(l, raiz);
+    for (size_t i = 0; i < l->n; i++)
+        for (uint32_t f = ctx->ast.nos[l->nos[i]].filho; f != NO_NULO; f = ctx->ast.nos[f].irmao) lista_poe(l, f);
+}
+
+// Os comandos sob raiz (filhos do composto, ramos do if, corpo do while), em largura
+static void lista_comandos(TListaNos *l, uint32_t raiz) {
+    l->n = 0;
+    lista_poe(l, raiz);
+    for (size_t i = 0; i < l->n; i++) {
+        const TNo *n = &ctx->ast.nos[l->nos[i]];
+        uint32_t primeiro = n->tipo == NO_COMPOSTO ? n->filho :
+                            n->tipo == NO_SE || n->tipo == NO_ENQUANTO ? ctx->ast.nos[n->filho].irmao : NO_NULO;
+        for (uint32_t f = primeiro; f != NO_NULO; f = ctx->ast.nos[f].irmao) lista_poe(l, f);
+    }
+}
+
+// ---- dobra de constantes ----
+
+static int avalia_binario(TAtomo op, int32_t a, int32_t b, int32_t *r) {
+    switch (op) {
+        case MAIS: *r = ARIT(a, +, b); return 1;
+        case MENOS: *r = ARIT(a, -, b); return 1;
+        case ASTERISCO: *r = ARIT(a, *, b); return 1;
+        case DIV:
+            if (b == 0) return 0;
+            *r = b == -1 ? ARIT(0, -, a) : a / b;
+            return 1;
+        case IGUAL: *r = a == b; return 1;
+        case NEGACAO: *r = a != b; return 1;
+        case MENOR: *r = a < b; return 1;
+        case MAIOR: *r = a > b; return 1;
+        case MENOR_IGUAL: *r = a <= b; return 1;
+        case MAIOR_IGUAL: *r = a >= b; return 1;
+        case AND: *r = a && b; return 1;
+        case OR: *r = a || b; return 1;
+        default: return 0;
+    }
+}
+
+// Dobra no, com os filhos já dobrados
+static void dobra_expressao(TPassoOtim *o, uint32_t no) {
+    TNo *n = &ctx->ast.nos[no];
+    if (n->tipo == NO_NAO) {
+        if (eh_constante(n->filho)) {
+            torna_constante(no, NO_LOGICO, !ctx->ast.nos[n->filho].valor);
+            o->est->dobras++;
+        }
+    } else if (n->tipo == NO_BINARIO || n->tipo == NO_DESLOCA) {
+        uint32_t esq = n->filho;
+        uint32_t dir = ctx->ast.nos[esq].irmao;
+        int32_t r;
+        if (n->tipo == NO_DESLOCA) {
+            if (eh_constante(esq)) {
+                torna_constante(no, NO_CONSTINT, (int32_t)((uint32_t)ctx->ast.nos[esq].valor << n->valor));
+                o->est->dobras++;
+            }
+        } else if (eh_constante(esq) && eh_constante(dir) &&
+                   avalia_binario((TAtomo)n->atomo, ctx->ast.nos[esq].valor, ctx->ast.nos[dir].valor, &r)) {
+            TAtomo op = (TAtomo)n->atomo;
+            int aritmetico = op == MAIS || op == MENOS || op == ASTERISCO || op == DIV;
+            torna_constante(no, aritmetico ? NO_CONSTINT : NO_LOGICO, r);
+            o->est->dobras++;
+        }
+    }
+}
+
+// ---- redução de força ----
+
+static int log2_exato(int32_t v) {
+    if (v <= 0 || (v & (v - 1)) != 0) return -1;
+    return __builtin_ctz((uint32_t)v);
+}
+
+// A expressão pode parar a execução (div por algo que não é constante não nula)?
+static int pode_falhar(TPassoOtim *o, uint32_t no) {
+    lista_expressao(&o->auxiliar, no);
+    for (size_t i = 0; i < o->auxiliar.n; i++) {
+        const TNo *n = &ctx->ast.nos[o->auxiliar.nos[i]];
+        if (n->tipo == NO_BINARIO && n->atomo == DIV) {
+            const TNo *divisor = &ctx->ast.nos[ctx->ast.nos[n->filho].irmao];
+            if (divisor->tipo != NO_CONSTINT || divisor->valor == 0) return 1;
+        }
+    }
+    return 0;
+}
+
+// Reduz no, com os filhos já reduzidos
+static void reduz_expressao(TPassoOtim *o, uint32_t no) {
+    TNo *n = &ctx->ast.nos[no];
+    if (n->tipo != NO_BINARIO) return;
+    uint32_t esq = n->filho;
+    uint32_t dir = ctx->ast.nos[esq].irmao;
+    TAtomo op = (TAtomo)ctx->ast.nos[no].atomo;
+    int c_esq = ctx->ast.nos[esq].tipo == NO_CONSTINT, c_dir = ctx->ast.nos[dir].tipo == NO_CONSTINT;
+    int32_t v_esq = ctx->ast.nos[esq].valor, v_dir = ctx->ast.nos[dir].valor;
+
+    if (op == ASTERISCO && (c_esq || c_dir)) {
+        uint32_t var = c_dir ? esq : dir;
+        int32_t k = c_dir ? v_dir : v_esq;
+        int sh = log2_exato(k);
+        if (k == 0) {                                            // x * 0, se x não puder dividir por zero
+            if (pode_falhar(o, var)) return;
+            torna_constante(no, NO_CONSTINT, 0);
+        } else if (sh == 0) substitui_no(no, var);                 // x * 1
+        else if (sh > 0) {                                       // x * 2^k -> x << k
+            ctx->ast.nos[no].tipo = NO_DESLOCA;
+            ctx->ast.nos[no].atomo = 0;
+            ctx->ast.nos[no].valor = sh;
+            ctx->ast.nos[no].filho = var;
+            ctx->ast.nos[var].irmao = NO_NULO;
+        } else return;
+        o->est->reducoes++;
+    } else if ((op == MAIS && c_esq && v_esq == 0)) {
+        substitui_no(no, dir);                                   // 0 + x
+        o->est->reducoes++;
+    } else if (((op == MAIS || op == MENOS) && c_dir && v_dir == 0) || (op == DIV && c_dir && v_dir == 1)) {
+        ctx->ast.nos[esq].irmao = NO_NULO;
+        substitui_no(no, esq);                                   // x + 0, x - 0, x div 1
+        o->est->reducoes++;
+    }
+}
+
+// ---- propagação de cópias ----
+
+// Comando aberto na propagação: próximo filho (composto), ramo (if) ou corpo (while) a visitar
+typedef struct {
+    uint32_t no;
+    uint32_t proximo;
+    uint8_t iniciado;
+} TQuadroCopias;
+
+typedef struct {
+    uint8_t *tipo;          // por símbolo: 0 nenhuma, NO_ID (cópia de variável) ou tipo de constante
+    int32_t *valor;         // símbolo de origem ou valor da constante
+    uint32_t *fontes;       // quantas cópias ativas usam o símbolo como origem
+    uint32_t *ativos;       // símbolos com cópia ativa (e alguns já mortos)
+    uint32_t n_ativos;
+    uint8_t *listado;       // por símbolo: já está em ativos
+    TQuadroCopias *quadros;
+    size_t n_quadros;
+    size_t capacidade_quadros;
+} TCopias;
+
+static void copias_limpa(TCopias *c) {
+    for (uint32_t i = 0; i < c->n_ativos; i++) {
+        uint32_t s = c->ativos[i];
+        if (c->tipo[s] == NO_ID) c->fontes[c->valor[s]]--;
+        c->tipo[s] = 0;
+        c->listado[s] = 0;
+    }
+    c->n_ativos = 0;
+}
+
+// A variável s foi redefinida: some a cópia de s e as cópias que leem s
+static void copias_mata(TCopias *c, uint32_t s) {
+    if (c->tipo[s] == NO_ID) c->fontes[c->valor[s]]--;
+    c->tipo[s] = 0;
+    if (c->fontes[s] == 0) return;
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < c->n_ativos; i++) {
+        uint32_t a = c->ativos[i];
+        if (c->tipo[a] == NO_ID && (uint32_t)c->valor[a] == s) {
+            c->tipo[a] = 0;
+            c->fontes[s]--;
+        }
+        if (c->tipo[a] != 0) c->ativos[j++] = a;
+        else c->listado[a] = 0;
+    }
+    c->n_ativos = j;
+}
+
+static void copias_substitui(TPassoOtim *o, TCopias *c, uint32_t expr) {
+    lista_expressao(&o->expressao, expr);
+    for (size_t i = 0; i < o->expressao.n; i++) {
+        uint32_t no = o->expressao.nos[i];
+        TNo *n = &ctx->ast.nos[no];
+        if (n->tipo != NO_ID) continue;
+        uint32_t s = (uint32_t)n->valor;
+        if (c->tipo[s] == NO_ID) n->valor = c->valor[s];
+        else if (c->tipo[s] != 0) torna_constante(no, (TTipoNo)c->tipo[s], c->valor[s]);
+        else continue;
+        o->est->copias++;
+    }
+}
+
+static void copias_abre(TCopias *c, uint32_t no) {
+    if (c->n_quadros == c->capacidade_quadros)
+        c->quadros = (TQuadroCopias*)otim_cresce(c->quadros, &c->capacidade_quadros, sizeof(TQuadroCopias));
+    TQuadroCopias *q = &c->quadros[c->n_quadros++];
+    q->no = no;
+    q->proximo = NO_NULO;
+    q->iniciado = 0;
+}
+
+static void copias_atribuicao(TPassoOtim *o, TCopias *c, uint32_t no) {
+    uint32_t alvo = ctx->ast.nos[no].filho, expr = ctx->ast.nos[alvo].irmao;
+    uint32_t s = (uint32_t)ctx->ast.nos[alvo].valor;
+    copias_substitui(o, c, expr);
+    copias_mata(c, s);
+    uint8_t t = ctx->ast.nos[expr].tipo;
+    if ((t == NO_ID && (uint32_t)ctx->ast.nos[expr].valor != s) || t == NO_CONSTINT || t == NO_CONSTCHAR || t == NO_LOGICO) {
+        c->tipo[s] = t;
+        c->valor[s] = ctx->ast.nos[expr].valor;
+        if (t == NO_ID) c->fontes[ctx->ast.nos[expr].valor]++;
+        // copias_mata só compacta a lista quando s é origem de cópias
+        if (!c->listado[s]) {
+            c->listado[s] = 1;
+            c->ativos[c->n_ativos++] = s;
+        }
+    }
+}
+
+static void copias_instrucao(TPassoOtim *o, TCopias *c, uint32_t raiz) {
+    copias_abre(c, raiz);
+    while (c->n_quadros > 0) {
+        TQuadroCopias *q = &c->quadros[c->n_quadros - 1];
+        const TNo *n = &ctx->ast.nos[q->no];
+        if (!q->iniciado) {
+            q->iniciado = 1;
+            switch (n->tipo) {
+                case NO_ATRIBUICAO: copias_atribuicao(o, c, q->no); break;
+                case NO_LEITURA:
+                    for (uint32_t id = n->filho; id != NO_NULO; id = ctx->ast.nos[id].irmao) copias_mata(c, (uint32_t)ctx->ast.nos[id].valor);
+                    break;
+                case NO_COMPOSTO: q->proximo = n->filho; break;
+                case NO_SE:
+                    // A condição é avaliada antes dos ramos; cada ramo começa sem cópias
+                    copias_substitui(o, c, n->filho);
+                    copias_limpa(c);
+                    q->proximo = ctx->ast.nos[n->filho].irmao;
+                    break;
+                case NO_ENQUANTO:
+                    // Condição e corpo rodam várias vezes: nada atravessa o laço
+                    copias_limpa(c);
+                    q->proximo = ctx->ast.nos[n->filho].irmao;
+                    break;
+                default: break; // write usa o tipo da própria variável; vazio não faz nada
+            }
+        } else if (n->tipo == NO_SE || n->tipo == NO_ENQUANTO) {
+            copias_limpa(c);   // terminou um ramo ou o corpo
+        }
+        if (q->proximo != NO_NULO) {
+            uint32_t filho = q->proximo;
+            q->proximo = ctx->ast.nos[filho].irmao;
+            copias_abre(c, filho);
+        } else {
+            c->n_quadros--;
+        }
+    }
+}
+
+// ---- ramos mortos ----
+
+// Resolve no, com os comandos internos já resolvidos
+static void ramos_instrucao(TPassoOtim *o, uint32_t no) {
+    TNo *n = &ctx->ast.nos[no];
+    if (n->tipo == NO_SE) {
+        uint32_t cond = n->filho, entao = ctx->ast.nos[cond].irmao, senao = ctx->ast.nos[entao].irmao;
+        if (!eh_constante(cond)) return;
+        if (ctx->ast.nos[cond].valor) substitui_no(no, entao);
+        else if (senao != NO_NULO) substitui_no(no, senao);
+        else torna_constante(no, NO_VAZIO, 0);
+        o->est->ramos++;
+    } else if (n->tipo == NO_ENQUANTO) {
+        uint32_t cond = n->filho;
+        if (eh_constante(cond) && ctx->ast.nos[cond].valor == 0) {
+            torna_constante(no, NO_VAZIO, 0);
+            o->est->lacos++;
+        }
+    }
+}
+
+// Aplica a reescrita f, de baixo para cima, a todas as expressões das instruções
+static void para_cada_expressao(TPassoOtim *o, uint32_t corpo, void (*f)(TPassoOtim*, uint32_t)) {
+    lista_comandos(&o->comandos, corpo);
+    for (size_t i = 0; i < o->comandos.n; i++) {
+        const TNo *n = &ctx->ast.nos[o->comandos.nos[i]];
+        uint32_t expr = n->tipo == NO_ATRIBUICAO ? ctx->ast.nos[n->filho].irmao :
+                        n->tipo == NO_SE || n->tipo == NO_ENQUANTO ? n->filho : NO_NULO;
+        if (expr == NO_NULO) continue;
+        lista_expressao(&o->expressao, expr);
+        for (size_t j = o->expressao.n; j-- > 0; ) f(o, o->expressao.nos[j]);
+    }
+}
+
+void otimiza(uint32_t raiz, unsigned passos, TEstatisticasOtim *est) {
+    memset(est, 0, sizeof(*est));
+    uint32_t bloco = ctx->ast.nos[ctx->ast.nos[raiz].filho].irmao;
+    uint32_t corpo = ctx->ast.nos[ctx->ast.nos[bloco].filho].irmao;
+    TPassoOtim o;
+    memset(&o, 0, sizeof(o));
+    o.est = est;
+    double ini;
+
+    if (passos & OTIM_COPIAS) {
+        ini = agora();
+        TCopias c;
+        memset(&c, 0, sizeof(c));
+        uint32_t n = ctx->simbolos.quantidade + 1;
+        c.tipo = (uint8_t*)calloc(n, sizeof(uint8_t));
+        c.valor = (int32_t*)calloc(n, sizeof(int32_t));
+        c.fontes = (uint32_t*)calloc(n, sizeof(uint32_t));
+        c.ativos = (uint32_t*)malloc(n * sizeof(uint32_t));
+        c.listado = (uint8_t*)calloc(n, sizeof(uint8_t));
+        if (c.tipo == NULL || c.valor == NULL || c.fontes == NULL || c.ativos == NULL || c.listado == NULL) {
+            free(c.tipo);
+            free(c.valor);
+            free(c.fontes);
+            free(c.ativos);
+            free(c.listado);
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+        copias_instrucao(&o, &c, corpo);
+        free(c.tipo);
+        free(c.valor);
+        free(c.fontes);
+        free(c.ativos);
+        free(c.listado);
+        free(c.quadros);
+        est->tempo[0] = agora() - ini;
+    }
+    if (passos & OTIM_DOBRA) {
+        ini = agora();
+        para_cada_expressao(&o, corpo, dobra_expressao);
+        est->tempo[1] = agora() - ini;
+    }
+    if (passos & OTIM_FORCA) {
+        ini = agora();
+        para_cada_expressao(&o, corpo, reduz_expressao);
+        est->tempo[2] = agora() - ini;
+    }
+    if (passos & OTIM_RAMOS) {
+        ini = agora();
+        lista_comandos(&o.comandos, corpo);
+        for (size_t i = o.comandos.n; i-- > 0; ) ramos_instrucao(&o, o.comandos.nos[i]);
+        est->tempo[3] = agora() - ini;
+    }
+    free(o.comandos.nos);
+    free(o.expressao.nos);
+    free(o.auxiliar.nos);
+}
+
+// =================================================================
+// GERAÇÃO DE CÓDIGO (BYTECODE)
+// =================================================================
+
+/*
+ * Uma função gera_* por regra da gramática percorre a árvore montada pelo
+ * parser e emite bytecode de pilha. As variáveis de variable_declaration_part
+ * recebem posições consecutivas na ordem da declaração.
+ */
+static void emite_palavra(TPrograma *prog, int32_t palavra) {
+    if (prog->tamanho == prog->capacidade) {
+        prog->capacidade = prog->capacidade ? prog->capacidade * 2 : 1024;
+        prog->codigo = (int32_t*)realloc(prog->codigo, prog->capacidade * sizeof(int32_t));
+        if (prog->codigo == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+    }
+    prog->codigo[prog->tamanho++] = palavra;
+}
+
+static void emite_op(TPrograma *prog, TOpcode op) {
+    emite_palavra(prog, op);
+    prog->instrucoes++;
+}
+
+static void emite_op_arg(TPrograma *prog, TOpcode op, int32_t arg) {
+    emite_palavra(prog, op);
+    emite_palavra(prog, arg);
+    prog->instrucoes++;
+}
+
+/*
+ * --profile: cada comando simples, if e while vira um ponto de contagem,
+ * aberto com OP_CONTA do seu contador de entradas. O segundo contador
+ * (conta_segundo) marca o início do corpo do while e do then do if. Sem
+ * --profile nada disso é emitido e o bytecode é o mesmo de sempre.
+ */
+static void abre_ponto(TPrograma *prog, uint32_t no) {
+    if (prog->n_pontos == prog->cap_pontos) {
+        prog->cap_pontos = prog->cap_pontos ? prog->cap_pontos * 2 : 64;
+        prog->pontos = (TPontoPerfil*)realloc(prog->pontos, prog->cap_pontos * sizeof(TPontoPerfil));
+        if (prog->pontos == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+    }
+    uint32_t p = prog->n_pontos++;
+    TPontoPerfil *ponto = &prog->pontos[p];
+    ponto->no = no;
+    ponto->linha = linha_do_offset(ctx->ast.nos[no].offset);
+    ponto->pai = prog->ponto_atual;
+    ponto->custo = ponto->custo_segundo = 0;
+    prog->ponto_atual = p;
+    emite_palavra(prog, OP_CONTA);
+    emite_palavra(prog, (int32_t)(2 * p));
+}
+
+static void conta_segundo(TPrograma *prog) {
+    if (!perfilar) return;
+    emite_palavra(prog, OP_CONTA);
+    emite_palavra(prog, (int32_t)(2 * prog->ponto_atual + 1));
+}
+
+static void custo_ponto(TPrograma *prog, uint32_t custo, uint32_t custo_segundo) {
+    if (!perfilar) return;
+    prog->pontos[prog->ponto_atual].custo = custo;
+    prog->pontos[prog->ponto_atual].custo_segundo = custo_segundo;
+}
+
+// Emite um salto com destino ainda desconhecido e devolve a posição do operando
+static uint32_t emite_salto(TPrograma *prog, TOpcode op) {
+    emite_op_arg(prog, op, 0);
+    return prog->tamanho - 1;
+}
+
+static void corrige_salto(TPrograma *prog, uint32_t operando, uint32_t destino) {
+    prog->codigo[operando] = (int32_t)destino;
+}
+
+static uint32_t constante(TPrograma *prog, int32_t valor) {
+    if (prog->slots_constantes == NULL || prog->n_constantes * 2 >= prog->mascara_constantes + 1) {
+        uint32_t n = prog->slots_constantes ? (prog->mascara_constantes + 1) * 2 : 256;
+        free(prog->slots_constantes);
+        prog->slots_constantes = (uint32_t*)calloc(n, sizeof(uint32_t));
+        if (prog->slots_constantes == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+        prog->mascara_constantes = n - 1;
+        for (uint32_t i = 0; i < prog->n_constantes; i++) {
+            uint32_t j = ((uint32_t)prog->constantes[i] * 2654435761u) & prog->mascara_constantes;
+            while (prog->slots_constantes[j]) j = (j + 1) & prog->mascara_constantes;
+            prog->slots_constantes[j] = i + 1;
+        }
+    }
+    uint32_t j = ((uint32_t)valor * 2654435761u) & prog->mascara_constantes;
+    while (prog->slots_constantes[j]) {
+        if (prog->constantes[prog->slots_constantes[j] - 1] == valor) return prog->slots_constantes[j] - 1;
+        j = (j + 1) & prog->mascara_constantes;
+    }
+    if (prog->n_constantes == prog->cap_constantes) {
+        prog->cap_constantes = prog->cap_constantes ? prog->cap_constantes * 2 : 64;
+        prog->constantes = (int32_t*)realloc(prog->constantes, prog->cap_constantes * sizeof(int32_t));
+        if (prog->constantes == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+    }
+    prog->constantes[prog->n_constantes] = valor;
+    prog->slots_constantes[j] = prog->n_constantes + 1;
+    return prog->n_constantes++;
+}
+
+static uint32_t variavel(const TPrograma *prog, uint32_t no_id) {
+    return prog->variavel_do_simbolo[ctx->ast.nos[no_id].valor];
+}
+
+static void gera_block(TPrograma *prog, uint32_t no);
+static void gera_statement(TPrograma *prog, uint32_t raiz);
+static void gera_expression(TPrograma *prog, uint32_t raiz, uint32_t profundidade);
+
+void gera_program(TPrograma *prog, uint32_t raiz) {
+    memset(prog, 0, sizeof(*prog));
+    prog->variavel_do_simbolo = (uint32_t*)calloc(ctx->simbolos.quantidade + 1, sizeof(uint32_t));
+    prog->tipo_variavel = (uint8_t*)calloc(ctx->simbolos.quantidade + 1, sizeof(uint8_t));
+    if (prog->variavel_do_simbolo == NULL || prog->tipo_variavel == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    prog->ponto_atual = UINT32_MAX;
+    uint32_t nome = ctx->ast.nos[raiz].filho;
+    gera_block(prog, ctx->ast.nos[nome].irmao);
+    emite_op(prog, OP_FIM);
+    free(prog->comandos);
+    free(prog->expressoes);
+    prog->comandos = NULL;
+    prog->expressoes = NULL;
+    prog->cap_comandos = prog->cap_expressoes = 0;
+    if (perfilar) {
+        prog->contadores = (uint64_t*)calloc(2 * (size_t)prog->n_pontos + 1, sizeof(uint64_t));
+        if (prog->contadores == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
+    }
+}
+
+static void gera_variable_declaration_part(TPrograma *prog, uint32_t no) {
+    for (uint32_t decl = ctx->ast.nos[no].filho; decl != NO_NULO; decl = ctx->ast.nos[decl].irmao) {
+        for (uint32_t id = ctx->ast.nos[decl].filho; id != NO_NULO; id = ctx->ast.nos[id].irmao) {
+            uint32_t v = prog->n_variaveis++;
+            prog->variavel_do_simbolo[ctx->ast.nos[id].valor] = v;
+            prog->tipo_variavel[v] = ctx->ast.nos[decl].atomo;
+        }
+    }
+}
+
+static void gera_block(TPrograma *prog, uint32_t no) {
+    uint32_t decls = ctx->ast.nos[no].filho;
+    gera_variable_declaration_part(prog, decls);
+    gera_statement(prog, ctx->ast.nos[decls].irmao);
+}
+
+static void gera_assignment_statement(TPrograma *prog, uint32_t no) {
+    uint32_t alvo = ctx->ast.nos[no].filho;
+    gera_expression(prog, ctx->ast.nos[alvo].irmao, 0);
+    emite_op_arg(prog, OP_ARMAZENA, (int32_t)variavel(prog, alvo));
+}
+
+static void gera_read_statement(TPrograma *prog, uint32_t no) {
+    for (uint32_t id = ctx->ast.nos[no].filho; id != NO_NULO; id = ctx->ast.nos[id].irmao) {
+        uint32_t v = variavel(prog, id);
+        emite_op_arg(prog, prog->tipo_variavel[v] == CHAR ? OP_LE_CHAR : OP_LE_INTEIRO, (int32_t)v);
+    }
+}
+
+static void gera_write_statement(TPrograma *prog, uint32_t no) {
+    for (uint32_t id = ctx->ast.nos[no].filho; id != NO_NULO; id = ctx->ast.nos[id].irmao) {
+        if (id != ctx->ast.nos[no].filho) emite_op(prog, OP_ESPACO);
+        uint32_t v = variavel(prog, id);
+        TOpcode op = prog->tipo_variavel[v] == CHAR ? OP_ESCREVE_CHAR :
+                     prog->tipo_variavel[v] == BOOLEAN ? OP_ESCREVE_LOGICO : OP_ESCREVE_INTEIRO;
+        emite_op_arg(prog, op, (int32_t)v);
+    }
+    emite_op(prog, OP_FIM_LINHA);
+}
+
+static void *gera_cresce(void *pilha, size_t *capacidade, size_t tamanho) {
+    size_t nova = *capacidade ? *capacidade * 2 : 64;
+    void *p = realloc(pilha, nova * tamanho);
+    if (p == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    *capacidade = nova;
+    return p;
+}
+
+static void abre_comando(TPrograma *prog, uint32_t *n_quadros, uint32_t no) {
+    if (*n_quadros == prog->cap_comandos)
+        prog->comandos = (TQuadroComando*)gera_cresce(prog->comandos, &prog->cap_comandos, sizeof(TQuadroComando));
+    TQuadroComando *q = &prog->comandos[(*n_quadros)++];
+    uint8_t tipo = ctx->ast.nos[no].tipo;
+    q->no = no;
+    q->etapa = tipo == NO_COMPOSTO ? ctx->ast.nos[no].filho : 0;
+    q->ponto_pai = prog->ponto_atual;
+    q->antes = prog->instrucoes;
+    if (perfilar && tipo != NO_COMPOSTO && tipo != NO_VAZIO) abre_ponto(prog, no);
+}
+
+static void fecha_comando(TPrograma *prog, uint32_t *n_quadros) {
+    const TQuadroComando *q = &prog->comandos[--(*n_quadros)];
+    uint8_t tipo = ctx->ast.nos[q->no].tipo;
+    if (!perfilar || tipo == NO_COMPOSTO || tipo == NO_VAZIO) return;
+    if (tipo != NO_SE && tipo != NO_ENQUANTO) custo_ponto(prog, prog->instrucoes - q->antes, 0);
+    prog->ponto_atual = q->ponto_pai;
+}
+
+/*
+ * Comandos em pilha explícita, como no parser: um quadro por if, while
+ * ou composto aberto, com a etapa em que parou. Aninhamento profundo não
+ * consome a pilha nativa.
+ */
+static void gera_statement(TPrograma *prog, uint32_t raiz) {
+    uint32_t n_quadros = 0;
+    abre_comando(prog, &n_quadros, raiz);
+    while (n_quadros > 0) {
+        TQuadroComando *q = &prog->comandos[n_quadros - 1];
+        const TNo *n = &ctx->ast.nos[q->no];
+        switch (n->tipo) {
+            case NO_ATRIBUICAO: gera_assignment_statement(prog, q->no); break;
+            case NO_LEITURA: gera_read_statement(prog, q->no); break;
+            case NO_ESCRITA: gera_write_statement(prog, q->no); break;
+            case NO_COMPOSTO:
+                if (q->etapa != NO_NULO) {
+                    uint32_t filho = q->etapa;
+                    q->etapa = ctx->ast.nos[filho].irmao;
+                    abre_comando(prog, &n_quadros, filho);
+                    continue;
+                }
+                break;
+            case NO_SE: {
+                uint32_t cond = n->filho, entao = ctx->ast.nos[cond].irmao, senao = ctx->ast.nos[entao].irmao;
+                if (q->etapa == 0) {
+                    gera_expression(prog, cond, 0);
+                    q->salto = emite_salto(prog, OP_SALTA_FALSO);
+                    custo_ponto(prog, prog->instrucoes - q->antes, senao != NO_NULO);
+                    conta_segundo(prog);
+                    q->etapa = 1;
+                    abre_comando(prog, &n_quadros, entao);
+                    continue;
+                }
+                if (q->etapa == 1 && senao != NO_NULO) {
+                    uint32_t salto_fim = emite_salto(prog, OP_SALTA);
+                    corrige_salto(prog, q->salto, prog->tamanho);
+                    q->salto = salto_fim;
+                    q->etapa = 2;
+                    abre_comando(prog, &n_quadros, senao);
+                    continue;
+                }
+                corrige_salto(prog, q->salto, prog->tamanho);
+                break;
+            }
+            case NO_ENQUANTO:
+                if (q->etapa == 0) {
+                    q->inicio = prog->tamanho;
+                    uint32_t antes = prog->instrucoes;
+                    gera_expression(prog, n->filho, 0);
+                    q->salto = emite_salto(prog, OP_SALTA_FALSO);
+                    // A condição roda uma vez a mais que o corpo; cada volta soma o salto de retorno
+                    custo_ponto(prog, prog->instrucoes - antes, prog->instrucoes - antes + 1);
+                    conta_segundo(prog);
+                    q->etapa = 1;
+                    abre_comando(prog, &n_quadros, ctx->ast.nos[n->filho].irmao);
+                    continue;
+                }
+                emite_op_arg(prog, OP_SALTA, (int32_t)q->inicio);
+                corrige_salto(prog, q->salto, prog->tamanho);
+                break;
+            default: break; // instrução vazia
+        }
+        fecha_comando(prog, &n_quadros);
+    }
+}
+
+static TOpcode opcode_binario(TAtomo op) {
+    switch (op) {
+        case MAIS: return OP_SOMA;
+        case MENOS: return OP_SUBTRAI;
+        case ASTERISCO: return OP_MULTIPLICA;
+        case DIV: return OP_DIVIDE;
+        case IGUAL: return OP_IGUAL;
+        case NEGACAO: return OP_DIFERENTE;
+        case MENOR: return OP_MENOR;
+        case MAIOR: return OP_MAIOR;
+        case MENOR_IGUAL: return OP_MENOR_IGUAL;
+        case MAIOR_IGUAL: return OP_MAIOR_IGUAL;
+        case AND: return OP_E;
+        default: return OP_OU;
+    }
+}
+
+static void abre_expressao(TPrograma *prog, uint32_t *n_quadros, uint32_t no, uint32_t profundidade) {
+    if (*n_quadros == prog->cap_expressoes)
+        prog->expressoes = (TQuadroExpressao*)gera_cresce(prog->expressoes, &prog->cap_expressoes, sizeof(TQuadroExpressao));
+    TQuadroExpressao *q = &prog->expressoes[(*n_quadros)++];
+    q->no = no;
+    q->etapa = 0;
+    q->profundidade = profundidade;
+    if (profundidade + 1 > prog->profundidade_pilha) prog->profundidade_pilha = profundidade + 1;
+}
+
+// Pós-ordem em pilha explícita; profundidade: quantos operandos já estão na pilha quando a expressão começa
+static void gera_expression(TPrograma *prog, uint32_t raiz, uint32_t profundidade) {
+    uint32_t n_quadros = 0;
+    abre_expressao(prog, &n_quadros, raiz, profundidade);
+    while (n_quadros > 0) {
+        TQuadroExpressao *q = &prog->expressoes[n_quadros - 1];
+        const TNo *n = &ctx->ast.nos[q->no];
+        switch (n->tipo) {
+            case NO_ID: emite_op_arg(prog, OP_CARREGA, (int32_t)variavel(prog, q->no)); break;
+            case NO_CONSTINT: case NO_CONSTCHAR: case NO_LOGICO:
+                emite_op_arg(prog, OP_CONST, (int32_t)constante(prog, n->valor));
+                break;
+            case NO_NAO: case NO_DESLOCA:
+                if (q->etapa++ == 0) {
+                    abre_expressao(prog, &n_quadros, n->filho, q->profundidade);
+                    continue;
+                }
+                if (n->tipo == NO_NAO) emite_op(prog, OP_NAO);
+                else emite_op_arg(prog, OP_DESLOCA, n->valor);
+                break;
+            case NO_BINARIO:
+                if (q->etapa == 0) {
+                    q->etapa = 1;
+                    abre_expressao(prog, &n_quadros, n->filho, q->profundidade);
+                    continue;
+                }
+                if (q->etapa == 1) {
+                    q->etapa = 2;
+                    abre_expressao(prog, &n_quadros, ctx->ast.nos[n->filho].irmao, q->profundidade + 1);
+                    continue;
+                }
+                emite_op(prog, opcode_binario((TAtomo)n->atomo));
+                break;
+            default: break;
+        }
+        n_quadros--;
+    }
+}
+
+void libera_programa(TPrograma *prog) {
+    free(prog->codigo);
+    free(prog->constantes);
+    free(prog->slots_constantes);
+    free(prog->tipo_variavel);
+    free(prog->variavel_do_simbolo);
+    free(prog->pontos);
+    free(prog->contadores);
+    free(prog->comandos);
+    free(prog->expressoes);
+    memset(prog, 0, sizeof(*prog));
+}
+
+// =================================================================
+// MÁQUINA VIRTUAL
+// =================================================================
+
+/*
+ * Dois laços de despacho sobre o mesmo bytecode. Com goto computado o
+ * código é primeiro convertido para threading direto: cada opcode vira o
+ * endereço do rótulo que o implementa, e cada instrução salta sozinha para
+ * a próxima. Sem essa extensão (ou com --dispatch=switch) usa-se o switch.
+ */
+
+static void erro_execucao(const char *mensagem) {
+    fflush(saida_vm);
+    fprintf(stderr, "erro de execucao: %s\n", mensagem);
+}
+
+static int32_t le_inteiro() {
+    int v = 0;
+    if (scanf("%d", &v) != 1) v = 0;
+    return v;
+}
+
+static int32_t le_char() {
+    char c = 0;
+    if (scanf(" %c", &c) != 1) c = 0;
+    return (unsigned char)c;
+}
+
+static int32_t divide(int32_t a, int32_t b) {
+    if (b == -1) return ARIT(0, -, a); // evita o trap de INT_MIN / -1
+    return a / b;
+}
+
+// Quantas palavras de operando seguem cada opcode
+static const uint8_t operandos_opcode[TOTAL_OPCODES] = {
+    [OP_CONST] = 1, [OP_CARREGA] = 1, [OP_ARMAZENA] = 1, [OP_SALTA] = 1, [OP_SALTA_FALSO] = 1,
+    [OP_LE_INTEIRO] = 1, [OP_LE_CHAR] = 1, [OP_ESCREVE_INTEIRO] = 1, [OP_ESCREVE_CHAR] = 1,
+    [OP_ESCREVE_LOGICO] = 1, [OP_DESLOCA] = 1, [OP_CONTA] = 1
+};
+
+static int executa_switch(const TPrograma *prog, int32_t *vars, int32_t *pilha) {
+    const int32_t *codigo = prog->codigo, *k = prog->constantes;
+    const int32_t *pc = codigo;
+    int32_t *sp = pilha; // aponta para o próximo espaço livre
+    FILE *out = saida_vm;
+    for (;;) {
+        switch ((TOpcode)*pc++) {
+            case OP_CONST: *sp++ = k[*pc++]; break;
+            case OP_CARREGA: *sp++ = vars[*pc++]; break;
+            case OP_ARMAZENA: vars[*pc++] = *--sp; break;
+            case OP_SOMA: sp--; sp[-1] = ARIT(sp[-1], +, sp[0]); break;
+            case OP_SUBTRAI: sp--; sp[-1] = ARIT(sp[-1], -, sp[0]); break;
+            case OP_MULTIPLICA: sp--; sp[-1] = ARIT(sp[-1], *, sp[0]); break;
+            case OP_DIVIDE:
+                sp--;
+                if (sp[0] == 0) { erro_execucao("divisao por zero"); return 1; }
+                sp[-1] = divide(sp[-1], sp[0]);
+                break;
+            case OP_IGUAL: sp--; sp[-1] = sp[-1] == sp[0]; break;
+            case OP_DIFERENTE: sp--; sp[-1] = sp[-1] != sp[0]; break;
+            case OP_MENOR: sp--; sp[-1] = sp[-1] < sp[0]; break;
+            case OP_MAIOR: sp--; sp[-1] = sp[-1] > sp[0]; break;
+            case OP_MENOR_IGUAL: sp--; sp[-1] = sp[-1] <= sp[0]; break;
+            case OP_MAIOR_IGUAL: sp--; sp[-1] = sp[-1] >= sp[0]; break;
+            case OP_E: sp--; sp[-1] = sp[-1] && sp[0]; break;
+            case OP_OU: sp--; sp[-1] = sp[-1] || sp[0]; break;
+            case OP_NAO: sp[-1] = !sp[-1]; break;
+            case OP_DESLOCA: sp[-1] = (int32_t)((uint32_t)sp[-1] << *pc++); break;
+            case OP_SALTA: pc = codigo + *pc; break;
+            case OP_SALTA_FALSO: if (*--sp == 0) pc = codigo + *pc; else pc++; break;
+            case OP_LE_INTEIRO: vars[*pc++] = le_inteiro(); break;
+            case OP_LE_CHAR: vars[*pc++] = le_char(); break;
+            case OP_ESCREVE_INTEIRO: fprintf(out, "%d", vars[*pc++]); break;
+            case OP_ESCREVE_CHAR: fputc((char)vars[*pc++], out); break;
+            case OP_ESCREVE_LOGICO: fputs(vars[*pc++] ? "true" : "false", out); break;
+            case OP_ESPACO: fputc(' ', out); break;
+            case OP_FIM_LINHA: fputc('\n', out); break;
+            case OP_FIM: return 0;
+            case OP_CONTA: prog->contadores[*pc++]++; break;
+            default: erro_execucao("opcode invalido"); return 1;
+        }
+    }
+}
 
-    fseek(f, 0, SEEK_END);
-    long tamanho = ftell(f);
-    fseek(f, 0, SEEK_SET);
+#ifdef TEM_GOTO_COMPUTADO
+static int executa_goto(const TPrograma *prog, int32_t *vars, int32_t *pilha) {
+    static void *const rotulos[TOTAL_OPCODES] = {
+        &&op_const, &&op_carrega, &&op_armazena,
+        &&op_soma, &&op_subtrai, &&op_multiplica, &&op_divide,
+        &&op_igual, &&op_diferente, &&op_menor, &&op_maior, &&op_menor_igual, &&op_maior_igual,
+        &&op_e, &&op_ou, &&op_nao, &&op_desloca,
+        &&op_salta, &&op_salta_falso,
+        &&op_le_inteiro, &&op_le_char, &&op_escreve_inteiro, &&op_escreve_char, &&op_escreve_logico,
+        &&op_espaco, &&op_fim_linha, &&op_fim, &&op_conta
+    };
 
-    buffer = (char*)malloc(tamanho + 1);
-    if(buffer == NULL){
-        printf("Erro ao alocar memoria.\n");
-        fclose(f);
-        return 1;
+    // Threading direto: opcodes viram endereços de rótulo e saltos viram ponteiros
+    intptr_t *fio = (intptr_t*)malloc(prog->tamanho * sizeof(intptr_t));
+    if (fio == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    for (uint32_t i = 0; i < prog->tamanho; ) {
+        TOpcode op = (TOpcode)prog->codigo[i];
+        fio[i] = (intptr_t)rotulos[op];
+        if (operandos_opcode[op]) {
+            int32_t arg = prog->codigo[i + 1];
+            fio[i + 1] = (op == OP_SALTA || op == OP_SALTA_FALSO) ? (intptr_t)(fio + arg) : arg;
+            i += 2;
+        } else {
+            i += 1;
+        }
     }
-    fread(buffer, 1, tamanho, f);
-    buffer[tamanho] = '\0';
-    fclose(f);
-
-    nLinha = 1;
 
-    lookahead = obter_atomo();
-    program();
+    const int32_t *k = prog->constantes;
+    const intptr_t *pc = fio;
+    int32_t *sp = pilha;
+    FILE *out = saida_vm;
+    int status = 0;
+#define PROXIMA goto *(void*)*pc++
+    PROXIMA;
+op_const: *sp++ = k[*pc++]; PROXIMA;
+op_carrega: *sp++ = vars[*pc++]; PROXIMA;
+op_armazena: vars[*pc++] = *--sp; PROXIMA;
+op_soma: sp--; sp[-1] = ARIT(sp[-1], +, sp[0]); PROXIMA;
+op_subtrai: sp--; sp[-1] = ARIT(sp[-1], -, sp[0]); PROXIMA;
+op_multiplica: sp--; sp[-1] = ARIT(sp[-1], *, sp[0]); PROXIMA;
+op_divide:
+    sp--;
+    if (sp[0] == 0) { erro_execucao("divisao por zero"); status = 1; goto op_fim; }
+    sp[-1] = divide(sp[-1], sp[0]);
+    PROXIMA;
+op_igual: sp--; sp[-1] = sp[-1] == sp[0]; PROXIMA;
+op_diferente: sp--; sp[-1] = sp[-1] != sp[0]; PROXIMA;
+op_menor: sp--; sp[-1] = sp[-1] < sp[0]; PROXIMA;
+op_maior: sp--; sp[-1] = sp[-1] > sp[0]; PROXIMA;
+op_menor_igual: sp--; sp[-1] = sp[-1] <= sp[0]; PROXIMA;
+op_maior_igual: sp--; sp[-1] = sp[-1] >= sp[0]; PROXIMA;
+op_e: sp--; sp[-1] = sp[-1] && sp[0]; PROXIMA;
+op_ou: sp--; sp[-1] = sp[-1] || sp[0]; PROXIMA;
+op_nao: sp[-1] = !sp[-1]; PROXIMA;
+op_desloca: sp[-1] = (int32_t)((uint32_t)sp[-1] << *pc++); PROXIMA;
+op_salta: pc = (const intptr_t*)*pc; PROXIMA;
+op_salta_falso: if (*--sp == 0) pc = (const intptr_t*)*pc; else pc++; PROXIMA;
+op_le_inteiro: vars[*pc++] = le_inteiro(); PROXIMA;
+op_le_char: vars[*pc++] = le_char(); PROXIMA;
+op_escreve_inteiro: fprintf(out, "%d", vars[*pc++]); PROXIMA;
+op_escreve_char: fputc((char)vars[*pc++], out); PROXIMA;
+op_escreve_logico: fputs(vars[*pc++] ? "true" : "false", out); PROXIMA;
+op_espaco: fputc(' ', out); PROXIMA;
+op_fim_linha: fputc('\n', out); PROXIMA;
+op_conta: prog->contadores[*pc++]++; PROXIMA;
+op_fim:
+#undef PROXIMA
+    free(fio);
+    return status;
+}
+#endif
 
-    consome(EOS);
-    printf("%d linhas analisadas, programa sintaticamente correto\n", nLinha);
+int executa(const TPrograma *prog, TModoDespacho despacho) {
+#ifdef TEM_NATIVO
+    if (despacho == DESPACHO_JIT) return executa_jit(prog);
+#endif
+    int32_t *vars = (int32_t*)calloc(prog->n_variaveis + 1, sizeof(int32_t));
+    int32_t *pilha = (int32_t*)malloc((prog->profundidade_pilha + 1) * sizeof(int32_t));
+    if (vars == NULL || pilha == NULL) {
+        free(vars);
+        free(pilha);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    int status;
+#ifdef TEM_GOTO_COMPUTADO
+    if (despacho == DESPACHO_GOTO) status = executa_goto(prog, vars, pilha);
+    else
+#endif
+    status = executa_switch(prog, vars, pilha);
+    (void)despacho;
+    fflush(saida_vm);
+    free(vars);
+    free(pilha);
+    return status;
+}
 
-    free(buffer);
-    return 0;
+// Roda o mesmo programa com os dois despachos, descartando a saída de write
+void bench_despacho(const TPrograma *prog) {
+    FILE *nulo = fopen("/dev/null", "w");
+    saida_vm = nulo ? nulo : stdout;
+    const char *nomes[] = { "goto", "switch", "jit" };
+    for (int d = 0; d < 3; d++) {
+#ifndef TEM_GOTO_COMPUTADO
+        if (d == DESPACHO_GOTO) continue;
+#endif
+#ifndef TEM_NATIVO
+        if (d == DESPACHO_JIT) continue;
+#endif
+        double ini = agora();
+        executa(prog, (TModoDespacho)d);
+        double dt = agora() - ini;
+        fprintf(stderr, "%-6s: %.3f s (%u palavras de bytecode)\n", nomes[d], dt, prog->tamanho);
+    }
+    if (nulo) fclose(nulo);
+    saida_vm = stdout;
 }
 
-// =================================================================
-// ANALISADOR LÉXICO
-// =================================================================
+/*
+ * Relatório do --profile, em stderr depois da execução: os pontos mais
+ * quentes pelo número de instruções de bytecode próprias que executaram
+ * (entradas × custo, mais voltas ou then × custo do segundo contador),
+ * sem contar os comandos aninhados nem os OP_CONTA. Com caminho, grava
+ * também as pilhas colapsadas "programa;enquanto linha 8;atribuicao linha 13 N"
+ * que flamegraph.pl e speedscope leem; acima de PILHA_PERFIL quadros a
+ * pilha guarda os de cima e o próprio ponto, com ";..." no lugar do meio,
+ * para que nest=100000 não escreva um arquivo quadrático. Os contadores
+ * seguem a árvore já otimizada: para ver todo comando do fonte, use
+ * --opt=none. Custo medido com --gen-program=64K,seed=1,loops=60 e --run
+ * (mediana de 5): goto de 0,40 s para 0,48 s (+20%), switch de 0,75 s
+ * para 0,86 s (+14%). Sem --profile o bytecode é o mesmo e o tempo também.
+ */
+#define PONTOS_RELATORIO 30
+#define PILHA_PERFIL 64
 
-const char* nome_atomo(TAtomo a) {
-    if (a >= 0 && a <= EOS) return TAtomo_str[a];
-    return "TOKEN_DESCONHECIDO";
+typedef struct {
+    uint64_t instrucoes;
+    uint32_t ponto;
+} TCustoPonto;
+
+static int compara_custos(const void *a, const void *b) {
+    const TCustoPonto *x = (const TCustoPonto*)a, *y = (const TCustoPonto*)b;
+    if (x->instrucoes != y->instrucoes) return x->instrucoes < y->instrucoes ? 1 : -1;
+    return x->ponto < y->ponto ? -1 : x->ponto > y->ponto;
 }
 
-TInfoAtomo obter_atomo() {
-    TInfoAtomo infoAtomo;
-    infoAtomo.atomo = ERRO;
+static void escreve_quadro(FILE *f, const TPrograma *prog, uint32_t p) {
+    fprintf(f, ";%s linha %d", nome_no[ctx->ast.nos[prog->pontos[p].no].tipo], prog->pontos[p].linha);
+}
 
-    while (*buffer == ' ' || *buffer == '\t' || *buffer == '\n' || *buffer == '\r' ) {
-        if (*buffer == '\n') nLinha++;
-        buffer++;
+/*
+ * Quadros do programa até o ponto p. Acima de PILHA_PERFIL quadros,
+ * corte[p] é o ancestral de nível PILHA_PERFIL - 2: a pilha vai até ele,
+ * segue com ";..." e termina em p. Nos demais pontos corte[p] é
+ * UINT32_MAX e a pilha sai inteira.
+ */
+static void escreve_pilha(FILE *f, const TPrograma *prog, uint32_t p, const uint32_t *corte) {
+    uint32_t cadeia[PILHA_PERFIL];
+    uint32_t n = 0;
+    for (uint32_t q = corte[p] != UINT32_MAX ? corte[p] : p; q != UINT32_MAX; q = prog->pontos[q].pai) cadeia[n++] = q;
+    fputs("programa", f);
+    while (n > 0) escreve_quadro(f, prog, cadeia[--n]);
+    if (corte[p] != UINT32_MAX) {
+        fputs(";...", f);
+        escreve_quadro(f, prog, p);
     }
+}
 
-    infoAtomo.linha = nLinha;
-
-    if (*buffer == '\0') {
-        infoAtomo.atomo = EOS;
-        return infoAtomo;
-    }
-    if (*buffer == '(' && *(buffer + 1) == '*') {
-        reconhece_comentario(&infoAtomo);
-        return infoAtomo;
-    }
-    if (isdigit(*buffer)) {
-        reconhece_numero(&infoAtomo);
-        return infoAtomo;
+/*
+ * Preenche corte numa passada só: pai < p, então o nível e o ancestral
+ * do pai já estão prontos. nivel[p] é 0 nos pontos de topo.
+ */
+static void calcula_cortes(const TPrograma *prog, uint32_t *nivel, uint32_t *ancestral, uint32_t *corte) {
+    for (uint32_t p = 0; p < prog->n_pontos; p++) {
+        uint32_t pai = prog->pontos[p].pai;
+        nivel[p] = pai == UINT32_MAX ? 0 : nivel[pai] + 1;
+        ancestral[p] = nivel[p] == PILHA_PERFIL - 2 ? p : nivel[p] > PILHA_PERFIL - 2 ? ancestral[pai] : UINT32_MAX;
+        corte[p] = nivel[p] >= PILHA_PERFIL ? ancestral[p] : UINT32_MAX;
     }
-    if (isalpha(*buffer) || *buffer == '_') {
-        reconhece_id(&infoAtomo);
-        return infoAtomo;
+}
+
+void relata_perfil(const TPrograma *prog, const char *caminho) {
+    TCustoPonto *custos = (TCustoPonto*)malloc(((size_t)prog->n_pontos + 1) * sizeof(TCustoPonto));
+    if (custos == NULL) {
+        erro_fatal("Erro ao alocar memoria.\n");
     }
-    if (*buffer == '\'') {
-        reconhece_constchar(&infoAtomo);
-        return infoAtomo;
+    uint64_t total = 0;
+    uint32_t n = 0;
+    for (uint32_t p = 0; p < prog->n_pontos; p++) {
+        const TPontoPerfil *ponto = &prog->pontos[p];
+        uint64_t entradas = prog->contadores[2 * p], segundo = prog->contadores[2 * p + 1];
+        if (entradas == 0) continue;
+        custos[n].instrucoes = entradas * ponto->custo + segundo * ponto->custo_segundo;
+        custos[n++].ponto = p;
+        total += entradas * ponto->custo + segundo * ponto->custo_segundo;
     }
+    if (n > 0) qsort(custos, n, sizeof(TCustoPonto), compara_custos);
 
-    reconhece_qualquer(&infoAtomo);
-    return infoAtomo;
-}
+    fprintf(stderr, "perfil: %llu instrucoes de bytecode, %u de %u pontos executados\n",
+            (unsigned long long)total, n, prog->n_pontos);
+    fprintf(stderr, "%7s  %-10s %14s %16s %6s  %s\n", "linha", "comando", "execucoes", "instrucoes", "%", "detalhe");
+    for (uint32_t i = 0; i < n && i < PONTOS_RELATORIO; i++) {
+        uint32_t p = custos[i].ponto;
+        uint8_t tipo = ctx->ast.nos[prog->pontos[p].no].tipo;
+        uint64_t entradas = prog->contadores[2 * p], segundo = prog->contadores[2 * p + 1];
+        fprintf(stderr, "%7d  %-10s %14llu %16llu %5.1f%%", prog->pontos[p].linha, nome_no[tipo],
+                (unsigned long long)entradas, (unsigned long long)custos[i].instrucoes, 100.0 * custos[i].instrucoes / total);
+        if (tipo == NO_ENQUANTO) fprintf(stderr, "  %llu voltas, %.1f por entrada", (unsigned long long)segundo, (double)segundo / entradas);
+        else if (tipo == NO_SE) fprintf(stderr, "  entao %llu, senao %llu", (unsigned long long)segundo, (unsigned long long)(entradas - segundo));
+        fputc('\n', stderr);
+    }
+    if (n > PONTOS_RELATORIO) fprintf(stderr, "(mais %u pontos executados)\n", n - PONTOS_RELATORIO);
 
-void reconhece_comentario(TInfoAtomo *infoAtomo) {
-    buffer += 2; // pula "(*"
-    while (*buffer != '\0') {
-        if (*buffer == '\n') nLinha++;
-        if (*buffer == '*' && *(buffer + 1) == ')') {
-            buffer += 2; // pula "*)"
-            infoAtomo->atomo = COMENTARIO;
-            return;
+    if (caminho != NULL) {
+        FILE *f = fopen(caminho, "w");
+        uint32_t *cortes = (uint32_t*)malloc(((size_t)prog->n_pontos + 1) * 3 * sizeof(uint32_t));
+        int ok = f != NULL && cortes != NULL;
+        if (ok) calcula_cortes(prog, cortes + prog->n_pontos + 1, cortes + 2 * ((size_t)prog->n_pontos + 1), cortes);
+        for (uint32_t p = 0; p < prog->n_pontos && ok; p++) {
+            uint64_t proprias = prog->contadores[2 * p] * prog->pontos[p].custo + prog->contadores[2 * p + 1] * prog->pontos[p].custo_segundo;
+            if (proprias == 0) continue;
+            escreve_pilha(f, prog, p, cortes);
+            fprintf(f, " %llu\n", (unsigned long long)proprias);
         }
-        buffer++;
+        if (f != NULL) ok = fclose(f) == 0 && ok;
+        if (!ok) fprintf(stderr, "Erro ao escrever %s\n", caminho);
+        free(cortes);
     }
-    printf("# %d: erro lexico, comentario nao fechado.\n", infoAtomo->linha);
-    exit(1);
+    free(custos);
 }
 
-void reconhece_numero(TInfoAtomo *infoAtomo) {
-    char *ini_lexema = buffer;
-    char lexema_base[50], lexema_expoente[10];
-    int sinal_expoente = 1;
+// =================================================================
+// IMAGEM BINÁRIA DO PROGRAMA (--emit-image, --run-image)
+// =================================================================
 
-    while(isdigit(*buffer)) buffer++;
+/*
+ * Bytecode compilado pronto para distribuir: --emit-image=ARQ grava e
+ * --run-image=ARQ executa sem tocar no fonte. A imagem é little-endian e
+ * só guarda offsets relativos ao próprio início, então pode ser mapeada em
+ * qualquer endereço; a máquina virtual lê código e constantes direto do
+ * mapeamento, somente leitura, sem passada de desserialização; por isso
+ * --run-image despacha com switch, salvo --dispatch explícito. Ao abrir,
+ * o hash do arquivo e uma conferência do bytecode (opcodes, operandos e
+ * destinos de salto nos limites) recusam imagens truncadas ou corrompidas
+ * antes que cheguem ao executor.
+ *
+ *   cabeçalho   TCabecalhoImagem
+ *   símbolos    um TSimboloImagem por variável, na ordem da declaração
+ *   nomes       texto dos nomes, referenciado pelos símbolos
+ *   constantes  int32 por constante
+ *   código      int32 por palavra de bytecode
+ */
+#define VERSAO_IMAGEM 1
 
-    int tamanho_base = buffer - ini_lexema;
-    strncpy(lexema_base, ini_lexema, tamanho_base);
-    lexema_base[tamanho_base] = '\0';
+typedef struct {
+    uint64_t offset;    // a partir do início da imagem, múltiplo de 8
+    uint64_t tamanho;   // em bytes
+} TSecaoImagem;
 
-    double valor_final = atof(lexema_base);
+typedef struct {
+    char magica[4];             // "PKIM"
+    uint16_t versao;
+    uint16_t tamanho_cabecalho;
+    uint32_t n_variaveis;
+    uint32_t profundidade_pilha;
+    uint64_t tamanho_imagem;
+    uint64_t soma;              // hash da imagem com este campo zerado
+    TSecaoImagem simbolos, nomes, constantes, codigo;
+} TCabecalhoImagem;
 
-    if (tolower(*buffer) == 'd') {
-        buffer++;
-        if (*buffer == '-') {
-            sinal_expoente = -1;
-            buffer++;
-        } else if (*buffer == '+') {
-            buffer++;
-        }
+typedef struct {
+    uint32_t nome;      // offset na seção de nomes
+    uint8_t tamanho;
+    uint8_t tipo;       // TAtomo: INTEGER, CHAR ou BOOLEAN
+    uint16_t reservado;
+} TSimboloImagem;
 
-        if (!isdigit(*buffer)) {
-             printf("# %d: erro lexico, 'd' de expoente deve ser seguido por um digito.\n", infoAtomo->linha);
-             exit(1);
-        }
+typedef struct {
+    void *base;
+    size_t tamanho;
+} TImagem;
 
-        char *ini_expoente = buffer;
-        while(isdigit(*buffer)) buffer++;
-        int tamanho_expoente = buffer - ini_expoente;
-        strncpy(lexema_expoente, ini_expoente, tamanho_expoente);
-        lexema_expoente[tamanho_expoente] = '\0';
+static inline uint64_t alinha8(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
 
-        int expoente = atoi(lexema_expoente);
-        valor_final = valor_final * pow(10, expoente * sinal_expoente);
-    }
+static uint64_t soma_imagem(const void *imagem, uint64_t tamanho) {
+    TCabecalhoImagem c;
+    memcpy(&c, imagem, sizeof(c));
+    c.soma = 0;
+    uint64_t h[2] = { 0, 0 };
+    hash_bytes(&c, sizeof(c), h);
+    hash_bytes((const char*)imagem + sizeof(c), tamanho - sizeof(c), h);
+    return h[0];
+}
 
-    infoAtomo->atributo.numero = (int)valor_final;
-    infoAtomo->atomo = CONSTINT;
+static void secao_imagem(TSecaoImagem *s, uint64_t *pos, uint64_t tamanho) {
+    s->offset = *pos;
+    s->tamanho = tamanho;
+    *pos = alinha8(*pos + tamanho);
 }
 
-void reconhece_id(TInfoAtomo *infoAtomo){
-    char *ini_lexema = buffer;
-    while(isalnum(*buffer) || *buffer == '_') buffer++;
+// Grava a imagem de prog; os símbolos vêm das declarações da árvore em raiz
+int escreve_imagem(const TPrograma *prog, uint32_t raiz, const char *caminho) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    printf("Imagens sao little-endian; este computador nao as grava.\n");
+    return 0;
+#endif
+    TCabecalhoImagem c;
+    memset(&c, 0, sizeof(c));
+    memcpy(c.magica, "PKIM", 4);
+    c.versao = VERSAO_IMAGEM;
+    c.tamanho_cabecalho = sizeof(c);
+    c.n_variaveis = prog->n_variaveis;
+    c.profundidade_pilha = prog->profundidade_pilha;
 
-    int tamanho = buffer - ini_lexema;
-    if (tamanho > 15) {
-        printf("# %d: erro lexico, identificador com mais de 15 caracteres.\n", infoAtomo->linha);
-        exit(1);
+    // Nomes têm no máximo 15 caracteres
+    size_t tam_nomes = 0;
+    TSimboloImagem *simbolos = (TSimboloImagem*)calloc((size_t)prog->n_variaveis + 1, sizeof(TSimboloImagem));
+    char *nomes = (char*)malloc((size_t)prog->n_variaveis * 16 + 1);
+    if (simbolos == NULL || nomes == NULL) {
+        free(simbolos);
+        free(nomes);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    uint32_t bloco = ctx->ast.nos[ctx->ast.nos[raiz].filho].irmao, v = 0;
+    for (uint32_t decl = ctx->ast.nos[ctx->ast.nos[bloco].filho].filho; decl != NO_NULO; decl = ctx->ast.nos[decl].irmao) {
+        for (uint32_t id = ctx->ast.nos[decl].filho; id != NO_NULO && v < prog->n_variaveis; id = ctx->ast.nos[id].irmao, v++) {
+            int n;
+            const char *nome = nome_simbolo((uint32_t)ctx->ast.nos[id].valor, &n);
+            simbolos[v].nome = (uint32_t)tam_nomes;
+            simbolos[v].tamanho = (uint8_t)n;
+            simbolos[v].tipo = ctx->ast.nos[decl].atomo;
+            memcpy(nomes + tam_nomes, nome, (size_t)n);
+            tam_nomes += (size_t)n;
+        }
     }
 
-    strncpy(infoAtomo->atributo.id, ini_lexema, tamanho);
-    infoAtomo->atributo.id[tamanho] = '\0';
-
-    if (strcmp(infoAtomo->atributo.id, "div") == 0) infoAtomo->atomo = DIV;
-    else if (strcmp(infoAtomo->atributo.id, "or") == 0) infoAtomo->atomo = OR;
-    else if (strcmp(infoAtomo->atributo.id, "and") == 0) infoAtomo->atomo = AND;
-    else if (strcmp(infoAtomo->atributo.id, "not") == 0) infoAtomo->atomo = NOT;
-    else if (strcmp(infoAtomo->atributo.id, "if") == 0) infoAtomo->atomo = IF;
-    else if (strcmp(infoAtomo->atributo.id, "then") == 0) infoAtomo->atomo = THEN;
-    else if (strcmp(infoAtomo->atributo.id, "else") == 0) infoAtomo->atomo = ELSE;
-    else if (strcmp(infoAtomo->atributo.id, "while") == 0) infoAtomo->atomo = WHILE;
-    else if (strcmp(infoAtomo->atributo.id, "do") == 0) infoAtomo->atomo = DO;
-    else if (strcmp(infoAtomo->atributo.id, "begin") == 0) infoAtomo->atomo = BEGIN;
-    else if (strcmp(infoAtomo->atributo.id, "end") == 0) infoAtomo->atomo = END;
-    else if (strcmp(infoAtomo->atributo.id, "read") == 0) infoAtomo->atomo = READ;
-    else if (strcmp(infoAtomo->atributo.id, "write") == 0) infoAtomo->atomo = WRITE;
-    else if (strcmp(infoAtomo->atributo.id, "var") == 0) infoAtomo->atomo = VAR;
-    else if (strcmp(infoAtomo->atributo.id, "program") == 0) infoAtomo->atomo = PROGRAM;
-    else if (strcmp(infoAtomo->atributo.id, "true") == 0) infoAtomo->atomo = TRUE_TOKEN;
-    else if (strcmp(infoAtomo->atributo.id, "false") == 0) infoAtomo->atomo = FALSE_TOKEN;
-    else if (strcmp(infoAtomo->atributo.id, "char") == 0) infoAtomo->atomo = CHAR;
-    else if (strcmp(infoAtomo->atributo.id, "integer") == 0) infoAtomo->atomo = INTEGER;
-    else if (strcmp(infoAtomo->atributo.id, "boolean") == 0) infoAtomo->atomo = BOOLEAN;
-    else infoAtomo->atomo = IDENTIFICADOR;
-}
+    uint64_t pos = alinha8(sizeof(c));
+    secao_imagem(&c.simbolos, &pos, (uint64_t)prog->n_variaveis * sizeof(TSimboloImagem));
+    secao_imagem(&c.nomes, &pos, tam_nomes);
+    secao_imagem(&c.constantes, &pos, (uint64_t)prog->n_constantes * sizeof(int32_t));
+    secao_imagem(&c.codigo, &pos, (uint64_t)prog->tamanho * sizeof(int32_t));
+    c.tamanho_imagem = pos;
 
-void reconhece_constchar(TInfoAtomo *infoAtomo){
-    buffer++; // consome o '
-    if (*buffer != '\0' && *(buffer + 1) == '\'') {
-        infoAtomo->atributo.ch = *buffer;
-        buffer += 2;
-        infoAtomo->atomo = CONSTCHAR;
-    } else {
-        printf("# %d: erro lexico, constante char mal formada.\n", infoAtomo->linha);
-        exit(1);
+    char *imagem = (char*)calloc(1, (size_t)pos);
+    if (imagem == NULL) {
+        free(simbolos);
+        free(nomes);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    memcpy(imagem + c.simbolos.offset, simbolos, c.simbolos.tamanho);
+    memcpy(imagem + c.nomes.offset, nomes, c.nomes.tamanho);
+    if (prog->n_constantes > 0) memcpy(imagem + c.constantes.offset, prog->constantes, c.constantes.tamanho);
+    memcpy(imagem + c.codigo.offset, prog->codigo, c.codigo.tamanho);
+    memcpy(imagem, &c, sizeof(c));
+    c.soma = soma_imagem(imagem, pos);
+    memcpy(imagem, &c, sizeof(c));
+    free(simbolos);
+    free(nomes);
+
+    // Temporário e rename: um executor com a versão anterior mapeada não vê o arquivo mudar
+    char temporario[4200];
+    snprintf(temporario, sizeof(temporario), "%s.tmp-%ld", caminho, (long)getpid());
+    int ok = 0;
+    int fd = open(temporario, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        struct iovec parte = { imagem, (size_t)pos };
+        ok = escreve_tudo(fd, &parte, 1);
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(temporario, caminho) == 0;
+        if (!ok) unlink(temporario);
     }
+    if (!ok) printf("Erro ao escrever %s\n", caminho);
+    free(imagem);
+    return ok;
+}
+
+static int secao_valida(const TSecaoImagem *s, uint64_t tamanho_imagem, size_t elemento) {
+    return s->offset % 8 == 0 && s->offset >= sizeof(TCabecalhoImagem) && s->offset <= tamanho_imagem &&
+           s->tamanho <= tamanho_imagem - s->offset && s->tamanho % elemento == 0;
 }
 
-void reconhece_qualquer(TInfoAtomo *infoAtomo){
-    switch(*buffer) {
-        case '+': infoAtomo->atomo = MAIS; buffer++; break;
-        case '-': infoAtomo->atomo = MENOS; buffer++; break;
-        case '*': infoAtomo->atomo = ASTERISCO; buffer++; break;
-        case ';': infoAtomo->atomo = PONTO_VIRGULA; buffer++; break;
-        case ',': infoAtomo->atomo = VIRGULA; buffer++; break;
-        case '.': infoAtomo->atomo = PONTO; buffer++; break;
-        case '(': infoAtomo->atomo = ABRE_PAR; buffer++; break;
-        case ')': infoAtomo->atomo = FECHA_PAR; buffer++; break;
-        case '=': infoAtomo->atomo = IGUAL; buffer++; break;
-        case ':':
-            if (*(buffer + 1) == '=') { infoAtomo->atomo = ATRIBUICAO; buffer += 2; }
-            else { infoAtomo->atomo = DOIS_PONTOS; buffer++; }
+// Operandos que cada opcode tira da pilha e que põe de volta
+static const uint8_t desempilha_opcode[TOTAL_OPCODES] = {
+    [OP_ARMAZENA] = 1, [OP_SOMA] = 2, [OP_SUBTRAI] = 2, [OP_MULTIPLICA] = 2, [OP_DIVIDE] = 2,
+    [OP_IGUAL] = 2, [OP_DIFERENTE] = 2, [OP_MENOR] = 2, [OP_MAIOR] = 2, [OP_MENOR_IGUAL] = 2,
+    [OP_MAIOR_IGUAL] = 2, [OP_E] = 2, [OP_OU] = 2, [OP_NAO] = 1, [OP_DESLOCA] = 1, [OP_SALTA_FALSO] = 1
+};
+static const uint8_t empilha_opcode[TOTAL_OPCODES] = {
+    [OP_CONST] = 1, [OP_CARREGA] = 1, [OP_SOMA] = 1, [OP_SUBTRAI] = 1, [OP_MULTIPLICA] = 1, [OP_DIVIDE] = 1,
+    [OP_IGUAL] = 1, [OP_DIFERENTE] = 1, [OP_MENOR] = 1, [OP_MAIOR] = 1, [OP_MENOR_IGUAL] = 1,
+    [OP_MAIOR_IGUAL] = 1, [OP_E] = 1, [OP_OU] = 1, [OP_NAO] = 1, [OP_DESLOCA] = 1
+};
+
+/*
+ * Confere o bytecode antes de executá-lo: opcodes conhecidos, operandos
+ * nos limites, saltos para inícios de instrução e, seguindo o fluxo de
+ * controle, a altura da pilha, nunca negativa nem acima de profundidade.
+ * Exige também o que o gerador sempre produz e o backend nativo, que
+ * traduz o código em ordem, pressupõe: pilha vazia em todo salto, destino
+ * de salto e OP_FIM, nenhuma instrução inalcançável e nenhum caminho
+ * passando do fim do código.
+ */
+static const char *confere_codigo(const int32_t *codigo, uint32_t tamanho, uint32_t n_constantes, uint32_t n_variaveis, uint32_t profundidade) {
+    int32_t *altura = (int32_t*)malloc((size_t)tamanho * sizeof(int32_t));   // -2 meio de instrução, -1 ainda não alcançada
+    uint32_t *pendentes = (uint32_t*)malloc((size_t)tamanho * sizeof(uint32_t));
+    if (altura == NULL || pendentes == NULL) {
+        free(altura);
+        free(pendentes);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    const char *motivo = NULL;
+    for (uint32_t i = 0; i < tamanho; i++) altura[i] = -2;
+    for (uint32_t i = 0; i < tamanho && motivo == NULL; ) {
+        if (codigo[i] < 0 || codigo[i] >= TOTAL_OPCODES) {
+            motivo = "opcode invalido";
             break;
-        case '<':
-            if (*(buffer + 1) == '=') { infoAtomo->atomo = MENOR_IGUAL; buffer += 2; }
-            else if (*(buffer + 1) == '>') { infoAtomo->atomo = NEGACAO; buffer += 2; }
-            else { infoAtomo->atomo = MENOR; buffer++; }
+        }
+        if (codigo[i] == OP_CONTA) {   // só existe com --profile, que não grava imagem
+            motivo = "contador de perfil na imagem";
             break;
-        case '>':
-            if (*(buffer + 1) == '=') { infoAtomo->atomo = MAIOR_IGUAL; buffer += 2; }
-            else { infoAtomo->atomo = MAIOR; buffer++; }
+        }
+        TOpcode op = (TOpcode)codigo[i];
+        altura[i] = -1;
+        if (!operandos_opcode[op]) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= tamanho) {
+            motivo = "instrucao truncada";
             break;
-        default:
-            printf("# %d: erro lexico, simbolo desconhecido: %c\n", infoAtomo->linha, *buffer);
-            exit(1);
+        }
+        int32_t arg = codigo[i + 1];
+        switch (op) {
+            case OP_CONST: if (arg < 0 || (uint32_t)arg >= n_constantes) motivo = "constante fora da tabela"; break;
+            case OP_DESLOCA: if (arg < 0 || arg > 31) motivo = "deslocamento invalido"; break;
+            case OP_SALTA: case OP_SALTA_FALSO: if (arg < 0 || (uint32_t)arg >= tamanho) motivo = "salto para fora do codigo"; break;
+            default: if (arg < 0 || (uint32_t)arg >= n_variaveis) motivo = "variavel fora da tabela"; break;
+        }
+        i += 2;
     }
-}
 
-// =================================================================
-// ANALISADOR SINTÁTICO
-// =================================================================
-void consome(TAtomo esperado) {
-     while(lookahead.atomo==COMENTARIO){
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
-        
+    size_t n_pendentes = 0;
+    if (motivo == NULL) {
+        altura[0] = 0;
+        pendentes[n_pendentes++] = 0;
     }
-    if (lookahead.atomo == esperado) {
-        // Imprime o token ANTES de obter o próximo
-        switch (esperado) {
-            case PROGRAM: printf("# %d:program\n", lookahead.linha); break;
-            case IDENTIFICADOR: printf("# %d:identifier : %s\n", lookahead.linha, lookahead.atributo.id); break;
-            case VAR: printf("# %d:var\n", lookahead.linha); break;
-            case INTEGER: printf("# %d:integer\n", lookahead.linha); break;
-            case CHAR: printf("# %d:char\n", lookahead.linha); break;
-            case BOOLEAN: printf("# %d:boolean\n", lookahead.linha); break;
-            case BEGIN: printf("# %d:begin\n", lookahead.linha); break;
-            case END: printf("# %d:end\n", lookahead.linha); break;
-            case READ: printf("# %d:read\n", lookahead.linha); break;
-            case WRITE: printf("# %d:write\n", lookahead.linha); break;
-            case IF: printf("# %d:if\n", lookahead.linha); break;
-            case THEN: printf("# %d:then\n", lookahead.linha); break;
-            case ELSE: printf("# %d:else\n", lookahead.linha); break;
-            case WHILE: printf("# %d:while\n", lookahead.linha); break;
-            case DO: printf("# %d:do\n", lookahead.linha); break;
-            case TRUE_TOKEN: printf("# %d:true\n", lookahead.linha); break;
-            case FALSE_TOKEN: printf("# %d:false\n", lookahead.linha); break;
-
-            case PONTO_VIRGULA: printf("# %d:ponto_virgula\n", lookahead.linha); break;
-            case VIRGULA: printf("# %d:virgula\n", lookahead.linha); break;
-            case DOIS_PONTOS: printf("# %d:dois_pontos\n", lookahead.linha); break;
-            case PONTO: printf("# %d:ponto\n", lookahead.linha); break;
-            case ABRE_PAR: printf("# %d:abre_par\n", lookahead.linha); break;
-            case FECHA_PAR: printf("# %d:fecha_par\n", lookahead.linha); break;
-
-            case MAIS: printf("# %d:mais\n", lookahead.linha); break;
-            case MENOS: printf("# %d:menos\n", lookahead.linha); break;
-            case ASTERISCO: printf("# %d:asterisco\n", lookahead.linha); break;
-            case BARRA: printf("# %d:barra\n", lookahead.linha); break;
-            case IGUAL: printf("# %d:igual\n", lookahead.linha); break;
-            case ATRIBUICAO: printf("# %d:atribuicao\n", lookahead.linha); break;
-            case MENOR: printf("# %d:menor\n", lookahead.linha); break;
-            case MAIOR: printf("# %d:maior\n", lookahead.linha); break;
-            case MENOR_IGUAL: printf("# %d:menor_igual\n", lookahead.linha); break;
-            case MAIOR_IGUAL: printf("# %d:maior_igual\n", lookahead.linha); break;
-            case NEGACAO: printf("# %d:negacao\n", lookahead.linha); break;
-
-            case DIV: printf("# %d:div\n", lookahead.linha); break;
-            case OR: printf("# %d:or\n", lookahead.linha); break;
-            case AND: printf("# %d:and\n", lookahead.linha); break;
-            case NOT: printf("# %d:not\n", lookahead.linha); break;
-
-            case NUMERO: printf("# %d:constint : %d\n", lookahead.linha, lookahead.atributo.numero); break;
-            case CONSTCHAR: printf("# %d:constchar : '%c'\n", lookahead.linha, lookahead.atributo.ch); break;
-
-            case COMENTARIO: printf("# %d:comentario\n", lookahead.linha); break;case EOS: break; // Não imprime nada para o fim do arquivo
-            case EOS: printf("# %d:end_of_stream\n", lookahead.linha); break;
-
-            default: printf("# %d:%s\n", lookahead.linha, nome_atomo(lookahead.atomo)); break;
+    while (n_pendentes > 0 && motivo == NULL) {
+        uint32_t i = pendentes[--n_pendentes];
+        TOpcode op = (TOpcode)codigo[i];
+        int32_t h = altura[i] - desempilha_opcode[op];
+        if (h < 0) {
+            motivo = "pilha esvaziada alem do fundo";
+            break;
         }
-        // Obtém o próximo token apenas se não for o fim
-        if (lookahead.atomo != EOS) {
-            lookahead = obter_atomo();
+        h += empilha_opcode[op];
+        if ((uint32_t)h > profundidade) {
+            motivo = "pilha acima da profundidade registrada";
+            break;
+        }
+        if ((op == OP_SALTA || op == OP_SALTA_FALSO || op == OP_FIM) && h != 0) {
+            motivo = "salto com a pilha nao vazia";
+            break;
+        }
+        uint32_t sucessores[2];
+        int n = 0;
+        if (op == OP_SALTA || op == OP_SALTA_FALSO) sucessores[n++] = (uint32_t)codigo[i + 1];
+        if (op != OP_SALTA && op != OP_FIM) sucessores[n++] = i + 1 + operandos_opcode[op];
+        for (int k = 0; k < n && motivo == NULL; k++) {
+            uint32_t s = sucessores[k];
+            if (s >= tamanho) motivo = "codigo termina sem OP_FIM";
+            else if (altura[s] == -2) motivo = "salto para o meio de uma instrucao";
+            else if (altura[s] == -1) {
+                altura[s] = h;
+                pendentes[n_pendentes++] = s;
+            } else if (altura[s] != h) motivo = "altura da pilha difere entre caminhos";
         }
-    } else {
-        printf("# %d:erro sintatico, esperado [%s] encontrado [%s]\n", lookahead.linha, nome_atomo(esperado), nome_atomo(lookahead.atomo));
-        exit(1);
     }
+    for (uint32_t i = 0; i < tamanho && motivo == NULL; i++) {
+        if (altura[i] == -1) motivo = "instrucao inalcancavel";
+    }
+    free(altura);
+    free(pendentes);
+    return motivo;
 }
 
-void program() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+static const char *confere_imagem(const char *base, uint64_t tamanho) {
+    const TCabecalhoImagem *c = (const TCabecalhoImagem*)base;
+    if (tamanho < sizeof(TCabecalhoImagem) || memcmp(c->magica, "PKIM", 4) != 0) return "nao e uma imagem de programa";
+    if (c->versao != VERSAO_IMAGEM || c->tamanho_cabecalho != sizeof(TCabecalhoImagem)) return "versao de imagem nao suportada";
+    if (c->tamanho_imagem != tamanho) return "tamanho diferente do registrado (arquivo truncado?)";
+    if (!secao_valida(&c->simbolos, tamanho, sizeof(TSimboloImagem)) || !secao_valida(&c->nomes, tamanho, 1) ||
+        !secao_valida(&c->constantes, tamanho, sizeof(int32_t)) || !secao_valida(&c->codigo, tamanho, sizeof(int32_t)) ||
+        c->codigo.tamanho == 0 || c->codigo.tamanho / sizeof(int32_t) > UINT32_MAX ||
+        c->constantes.tamanho / sizeof(int32_t) > UINT32_MAX ||
+        c->simbolos.tamanho != (uint64_t)c->n_variaveis * sizeof(TSimboloImagem)) return "secoes fora dos limites";
+    if (soma_imagem(base, tamanho) != c->soma) return "hash nao confere (arquivo corrompido)";
+    if (c->profundidade_pilha > c->codigo.tamanho / sizeof(int32_t)) return "profundidade da pilha invalida";   // cada empilhamento é uma instrução
+    const TSimboloImagem *simbolos = (const TSimboloImagem*)(base + c->simbolos.offset);
+    for (uint32_t v = 0; v < c->n_variaveis; v++) {
+        if ((uint64_t)simbolos[v].nome + simbolos[v].tamanho > c->nomes.tamanho) return "simbolo fora da tabela de nomes";
+        if (simbolos[v].tipo != INTEGER && simbolos[v].tipo != CHAR && simbolos[v].tipo != BOOLEAN) return "tipo de variavel invalido";
     }
-    consome(PROGRAM);
-    consome(IDENTIFICADOR);
-    consome(PONTO_VIRGULA);
-    block();
-    consome(PONTO);
+    return confere_codigo((const int32_t*)(base + c->codigo.offset), (uint32_t)(c->codigo.tamanho / sizeof(int32_t)),
+                          (uint32_t)(c->constantes.tamanho / sizeof(int32_t)), c->n_variaveis, c->profundidade_pilha);
 }
 
-void block(){
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+// Mapeia e confere a imagem; prog aponta para dentro do mapeamento até fecha_imagem
+static int abre_imagem(const char *caminho, TImagem *img, TPrograma *prog, char *erro, size_t tam_erro) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    snprintf(erro, tam_erro, "Imagens sao little-endian; este computador nao as executa.");
+    return 0;
+#endif
+    int fd = open(caminho, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        snprintf(erro, tam_erro, "Erro ao abrir a imagem '%s': %s", caminho, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    const char *motivo = NULL;
+    img->tamanho = (size_t)st.st_size;
+    img->base = st.st_size > 0 ? mmap(NULL, img->tamanho, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (img->base == MAP_FAILED) motivo = st.st_size > 0 ? strerror(errno) : "arquivo vazio";
+    else if ((motivo = confere_imagem((const char*)img->base, img->tamanho)) != NULL) munmap(img->base, img->tamanho);
+    if (motivo != NULL) {
+        snprintf(erro, tam_erro, "Imagem '%s' invalida: %s", caminho, motivo);
+        return 0;
     }
-    variable_declaration_part();
-    statement_part();
+
+    const TCabecalhoImagem *c = (const TCabecalhoImagem*)img->base;
+    memset(prog, 0, sizeof(*prog));
+    prog->codigo = (int32_t*)((char*)img->base + c->codigo.offset);
+    prog->tamanho = prog->capacidade = (uint32_t)(c->codigo.tamanho / sizeof(int32_t));
+    prog->constantes = (int32_t*)((char*)img->base + c->constantes.offset);
+    prog->n_constantes = prog->cap_constantes = (uint32_t)(c->constantes.tamanho / sizeof(int32_t));
+    prog->n_variaveis = c->n_variaveis;
+    prog->profundidade_pilha = c->profundidade_pilha;
+    return 1;
+}
+
+static void fecha_imagem(TImagem *img) {
+    munmap(img->base, img->tamanho);
+    img->base = NULL;
 }
 
-void variable_declaration_part() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+int roda_imagem(const char *caminho) {
+    TImagem img;
+    TPrograma prog;
+    TContexto contexto;
+    char erro[4400];
+    // Sem compilação, o contexto serve só para a falta de memória na conferência e na execução
+    inicia_contexto(&contexto, stdout);
+    if (setjmp(ctx->salto_erro) != 0) {
+        libera_contexto(&contexto);
+        return 1;
     }
-    if (lookahead.atomo == VAR) {
-        consome(VAR);
-        variable_declaration();
-        consome(PONTO_VIRGULA);
-        while (lookahead.atomo == IDENTIFICADOR) {
-            variable_declaration();
-            consome(PONTO_VIRGULA);
-        }
+    if (!abre_imagem(caminho, &img, &prog, erro, sizeof(erro))) {
+        fprintf(stderr, "%s\n", erro);
+        libera_contexto(&contexto);
+        return 1;
     }
+    int status = 0;
+    saida_vm = stdout;
+    if (executar == 2) bench_despacho(&prog);
+#ifdef TEM_NATIVO
+    else if (executar == 3) status = escreve_elf(&prog, caminho_elf) ? 0 : 1;
+#endif
+    else status = executa(&prog, modo_despacho);
+    fecha_imagem(&img);
+    libera_contexto(&contexto);
+    return status;
+}
+
+// Compila, otimiza e gera o bytecode no contexto corrente; 0 em erro, inclusive falta de memória
+static int bytecode_do_fonte(const char *arquivo, TPrograma *prog) {
+    if (compila_arquivo(arquivo) != 0) return 0;
+    if (setjmp(ctx->salto_erro) != 0) return 0;
+    TEstatisticasOtim est;
+    otimiza(ctx->raiz, otimizacoes, &est);
+    gera_program(prog, ctx->raiz);
+    return 1;
 }
 
-void variable_declaration() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+// Tempo de abre_imagem, que confere o bytecode, em cada execução; 0 se faltou memória
+static int mede_abertura(const char *imagem, double *tempos, int execucoes) {
+    TContexto c;
+    TPrograma prog;
+    char erro[4400];
+    inicia_contexto(&c, NULL);
+    if (setjmp(c.salto_erro) != 0) {
+        fprintf(stderr, "%.*s", (int)c.saida_uso, c.saida_buf);
+        libera_contexto(&c);
+        return 0;
     }
-    consome(IDENTIFICADOR);
-    while (lookahead.atomo == VIRGULA) {
-        consome(VIRGULA);
-        consome(IDENTIFICADOR);
+    for (int i = 0; i < execucoes; i++) {
+        TImagem img;
+        double ini = agora();
+        if (abre_imagem(imagem, &img, &prog, erro, sizeof(erro))) fecha_imagem(&img);
+        tempos[i] = agora() - ini;
     }
-    consome(DOIS_PONTOS);
-    type();
+    libera_contexto(&c);
+    return 1;
 }
 
-void type() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+/*
+ * --bench-image[=N] arquivo: latência até o bytecode estar pronto para
+ * executar, compilando o fonte (carga, análise, otimização e geração) e
+ * abrindo a imagem (mmap e conferência), N vezes cada; depois o processo
+ * inteiro, fork+exec com --run e com --run-image, entrada e saída em
+ * /dev/null.
+ */
+void bench_imagem(const char *arquivo, int execucoes) {
+    char executavel[4096];
+    ssize_t n = readlink("/proc/self/exe", executavel, sizeof(executavel) - 1);
+    char *absoluto = realpath(arquivo, NULL);
+    if (n < 0 || absoluto == NULL) {
+        fprintf(stderr, "%s: %s\n", n < 0 ? "/proc/self/exe" : arquivo, strerror(errno));
+        free(absoluto);
+        return;
+    }
+    executavel[n] = '\0';
+    TModoTrace trace = modo_trace;
+    modo_trace = TRACE_DESLIGADO;
+
+    char imagem[64], opcao_imagem[80];
+    snprintf(imagem, sizeof(imagem), "/tmp/pk-bench-%d.pkim", (int)getpid());
+    snprintf(opcao_imagem, sizeof(opcao_imagem), "--run-image=%s", imagem);
+    TContexto c;
+    TPrograma prog;
+    inicia_contexto(&c, NULL);
+    int ok = compila_arquivo(absoluto) == 0;
+    if (ok && setjmp(c.salto_erro) != 0) ok = 0;
+    else if (ok) {
+        TEstatisticasOtim est;
+        otimiza(ctx->raiz, otimizacoes, &est);
+        gera_program(&prog, ctx->raiz);
+        ok = escreve_imagem(&prog, ctx->raiz, imagem);
+        libera_programa(&prog);
+    } else {
+        fprintf(stderr, "%.*s", (int)c.saida_uso, c.saida_buf);
     }
-    if (lookahead.atomo == CHAR) consome(CHAR);
-    else if (lookahead.atomo == INTEGER) consome(INTEGER);
-    else if (lookahead.atomo == BOOLEAN) consome(BOOLEAN);
-    else {
-        printf("# %d:erro sintatico, tipo invalido esperado [char, integer, boolean] mas encontrado [%s]\n", lookahead.linha, nome_atomo(lookahead.atomo));
-        exit(1);
+    size_t tamanho_fonte = c.fonte.tamanho;
+    libera_contexto(&c);
+    struct stat st;
+    if (!ok || stat(imagem, &st) != 0) {
+        modo_trace = trace;
+        free(absoluto);
+        return;
     }
-}
 
-void statement_part() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+    double *tempos = (double*)malloc((size_t)execucoes * sizeof(double));
+    if (tempos == NULL) {
+        printf("Erro ao alocar memoria.\n");
+        unlink(imagem);
+        modo_trace = trace;
+        free(absoluto);
+        return;
     }
-    consome(BEGIN);
-    statement();
-    while (lookahead.atomo == PONTO_VIRGULA) {
-        consome(PONTO_VIRGULA);
-        statement();
+    printf("%s: %zu bytes de fonte, imagem de %lld bytes, %d execucoes por modo\n",
+           arquivo, tamanho_fonte, (long long)st.st_size, execucoes);
+    printf("%-22s %10s %10s %10s\n", "", "p50 (us)", "p99 (us)", "media (us)");
+    for (int i = 0; i < execucoes; i++) {
+        double ini = agora();
+        inicia_contexto(&c, NULL);
+        if (bytecode_do_fonte(absoluto, &prog)) libera_programa(&prog);
+        libera_contexto(&c);
+        tempos[i] = agora() - ini;
     }
-    consome(END);
+    relata_latencias("compila do fonte", tempos, execucoes);
+    if (mede_abertura(imagem, tempos, execucoes)) relata_latencias("abre imagem", tempos, execucoes);
+    modo_trace = trace;
+
+    fflush(stdout);
+    int nulo = open("/dev/null", O_RDWR);
+    char *via_fonte[] = { executavel, (char*)"--run", absoluto, NULL };
+    char *via_imagem[] = { executavel, opcao_imagem, NULL };
+    for (int i = 0; i < execucoes; i++) tempos[i] = tempo_processo(via_fonte, nulo);
+    relata_latencias("fork+exec --run", tempos, execucoes);
+    fflush(stdout);
+    for (int i = 0; i < execucoes; i++) tempos[i] = tempo_processo(via_imagem, nulo);
+    relata_latencias("fork+exec --run-image", tempos, execucoes);
+
+    close(nulo);
+    unlink(imagem);
+    free(tempos);
+    free(absoluto);
 }
 
-void statement() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
-    }
-    if (lookahead.atomo == IDENTIFICADOR) assignment_statement();
-    else if (lookahead.atomo == READ) read_statement();
-    else if (lookahead.atomo == WRITE) write_statement();
-    else if (lookahead.atomo == IF) if_statement();
-    else if (lookahead.atomo == WHILE) while_statement();
-    else if (lookahead.atomo == BEGIN) statement_part();
-    else { /* Instrução Vazia */ }
+// =================================================================
+// GERAÇÃO DE CÓDIGO NATIVO (x86-64)
+// =================================================================
+
+/*
+ * Traduz o bytecode para x86-64 numa única passada. A pilha de operandos
+ * existe só em tempo de compilação: constantes e variáveis empilhadas viram
+ * operandos diretos da instrução que as consome, e cada profundidade tem um
+ * lugar fixo (r8d..r11d, esi, edi e, além disso, memória). As cinco variáveis
+ * mais usadas, com peso maior dentro de laços, moram em rbx e r12..r15; as
+ * demais ficam no bloco apontado por rbp. read/write chamam rotinas de
+ * suporte: funções em C no modo JIT, código próprio com syscalls no ELF.
+ */
+#ifdef TEM_NATIVO
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+       CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+// Operando: registrador de 32 bits, [base + deslocamento] ou imediato
+typedef enum { OPR_REG, OPR_MEM, OPR_IMED } TTipoOperando;
+typedef struct {
+    TTipoOperando tipo;
+    int reg;        // registrador ou base da memória
+    int32_t valor;  // deslocamento ou imediato
+} TOperando;
+
+static inline TOperando em_reg(int r) { TOperando o = { OPR_REG, r, 0 }; return o; }
+static inline TOperando em_mem(int base, int32_t d) { TOperando o = { OPR_MEM, base, d }; return o; }
+static inline TOperando imediato(int32_t v) { TOperando o = { OPR_IMED, 0, v }; return o; }
+
+static inline int mesmo_operando(TOperando a, TOperando b) {
+    return a.tipo == b.tipo && a.reg == b.reg && a.valor == b.valor;
 }
 
-void assignment_statement(){
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+static void x86_byte(TCodigoNativo *c, uint8_t b) {
+    if (c->tamanho == c->capacidade) {
+        c->capacidade = c->capacidade ? c->capacidade * 2 : 4096;
+        c->codigo = (uint8_t*)realloc(c->codigo, c->capacidade);
+        if (c->codigo == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
     }
-    consome(IDENTIFICADOR);
-    consome(ATRIBUICAO);
-    expression();
+    c->codigo[c->tamanho++] = b;
 }
 
-void read_statement() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
-    }
-    consome(READ);
-    consome(ABRE_PAR);
-    consome(IDENTIFICADOR);
-    while (lookahead.atomo == VIRGULA) {
-        consome(VIRGULA);
-        consome(IDENTIFICADOR);
-    }
-    consome(FECHA_PAR);
+static void x86_u32(TCodigoNativo *c, uint32_t v) {
+    for (int i = 0; i < 4; i++) x86_byte(c, (uint8_t)(v >> (8 * i)));
 }
 
-void write_statement() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
-    }
-    consome(WRITE);
-    consome(ABRE_PAR);
-    consome(IDENTIFICADOR);
-    while (lookahead.atomo == VIRGULA) {
-        consome(VIRGULA);
-        consome(IDENTIFICADOR);
+static uint32_t novo_rotulo(TCodigoNativo *c) {
+    if (c->n_rotulos == c->cap_rotulos) {
+        c->cap_rotulos = c->cap_rotulos ? c->cap_rotulos * 2 : 64;
+        c->rotulos = (uint32_t*)realloc(c->rotulos, c->cap_rotulos * sizeof(uint32_t));
+        if (c->rotulos == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
     }
-    consome(FECHA_PAR);
+    c->rotulos[c->n_rotulos] = UINT32_MAX;
+    return c->n_rotulos++;
 }
 
-void if_statement() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
-    }
-    consome(IF);
-    expression();
-    consome(THEN);
-    statement();
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
-    }
-    if (lookahead.atomo == ELSE) {
-        consome(ELSE);
-        statement();
-    }
+static inline void fixa_rotulo(TCodigoNativo *c, uint32_t rotulo) {
+    c->rotulos[rotulo] = c->tamanho;
 }
 
-void while_statement() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+// Deslocamento de 32 bits até o rótulo, relativo ao fim da instrução;
+// resolvido em resolve_rotulos (o rel32 é sempre o último campo)
+static void x86_rel32(TCodigoNativo *c, uint32_t rotulo) {
+    if (c->n_correcoes + 2 > c->cap_correcoes) {
+        c->cap_correcoes = c->cap_correcoes ? c->cap_correcoes * 2 : 256;
+        c->correcoes = (uint32_t*)realloc(c->correcoes, c->cap_correcoes * sizeof(uint32_t));
+        if (c->correcoes == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
     }
-    consome(WHILE);
-    expression();
-    consome(DO);
-    statement();
+    c->correcoes[c->n_correcoes++] = c->tamanho;
+    c->correcoes[c->n_correcoes++] = rotulo;
+    x86_u32(c, 0);
 }
 
-void expression() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+static void resolve_rotulos(TCodigoNativo *c) {
+    for (uint32_t i = 0; i < c->n_correcoes; i += 2) {
+        uint32_t pos = c->correcoes[i];
+        int32_t rel = (int32_t)(c->rotulos[c->correcoes[i + 1]] - (pos + 4));
+        memcpy(c->codigo + pos, &rel, 4);
     }
-    simple_expression();
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+}
+
+static void libera_codigo_nativo(TCodigoNativo *c) {
+    free(c->codigo);
+    free(c->rotulos);
+    free(c->correcoes);
+    free(c->dados);
+    memset(c, 0, sizeof(*c));
+}
+
+// [REX] opcode ModRM [SIB] [disp32]. Opcodes acima de 0xFF são 0x0F xx.
+// byte_baixo força o REX para que os registradores 4..7 sejam spl..dil.
+static void x86_op_rm(TCodigoNativo *c, int w, uint32_t opcode, int reg, TOperando rm, int byte_baixo) {
+    uint8_t rex = (uint8_t)(0x40 | (w << 3) | ((reg >> 3) << 2) | (rm.reg >> 3));
+    if (rex != 0x40 || (byte_baixo && reg >= 4 && reg < 8)) x86_byte(c, rex);
+    if (opcode > 0xFF) x86_byte(c, 0x0F);
+    x86_byte(c, (uint8_t)opcode);
+    if (rm.tipo == OPR_REG) {
+        x86_byte(c, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm.reg & 7)));
+    } else {
+        x86_byte(c, (uint8_t)(0x80 | ((reg & 7) << 3) | (rm.reg & 7)));
+        if ((rm.reg & 7) == RSP) x86_byte(c, 0x24);
+        x86_u32(c, (uint32_t)rm.valor);
     }
-    if (lookahead.atomo == MENOR || lookahead.atomo == MAIOR || lookahead.atomo == MENOR_IGUAL ||
-        lookahead.atomo == MAIOR_IGUAL || lookahead.atomo == NEGACAO || lookahead.atomo == IGUAL ||
-        lookahead.atomo == OR || lookahead.atomo == AND ) {
-        relational_operator();
-        simple_expression();
+}
+
+static void x86_mov(TCodigoNativo *c, TOperando dst, TOperando src) {
+    if (mesmo_operando(dst, src)) return;
+    if (src.tipo == OPR_IMED) {
+        if (dst.tipo == OPR_REG) {
+            if (dst.reg >= 8) x86_byte(c, 0x41);
+            x86_byte(c, (uint8_t)(0xB8 + (dst.reg & 7)));
+        } else {
+            x86_op_rm(c, 0, 0xC7, 0, dst, 0);
+        }
+        x86_u32(c, (uint32_t)src.valor);
+    } else if (src.tipo == OPR_REG) {
+        x86_op_rm(c, 0, 0x89, src.reg, dst, 0);
+    } else if (dst.tipo == OPR_REG) {
+        x86_op_rm(c, 0, 0x8B, dst.reg, src, 0);
+    } else {
+        x86_op_rm(c, 0, 0x8B, RCX, src, 0);
+        x86_op_rm(c, 0, 0x89, RCX, dst, 0);
     }
 }
 
-void relational_operator() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+// add/or/and/sub/xor/cmp de 32 bits; memória com memória passa por ecx
+static void x86_alu(TCodigoNativo *c, int alu, TOperando dst, TOperando src) {
+    if (src.tipo == OPR_IMED) {
+        int curto = src.valor >= -128 && src.valor <= 127;
+        x86_op_rm(c, 0, curto ? 0x83 : 0x81, alu, dst, 0);
+        if (curto) x86_byte(c, (uint8_t)src.valor);
+        else x86_u32(c, (uint32_t)src.valor);
+    } else if (src.tipo == OPR_REG) {
+        x86_op_rm(c, 0, (uint32_t)(alu * 8 + 1), src.reg, dst, 0);
+    } else if (dst.tipo == OPR_REG) {
+        x86_op_rm(c, 0, (uint32_t)(alu * 8 + 3), dst.reg, src, 0);
+    } else {
+        x86_mov(c, em_reg(RCX), src);
+        x86_op_rm(c, 0, (uint32_t)(alu * 8 + 1), RCX, dst, 0);
     }
-    switch (lookahead.atomo) {
-        case MENOR: consome(MENOR); break;
-        case MAIOR: consome(MAIOR); break;
-        case MENOR_IGUAL: consome(MENOR_IGUAL); break;
-        case MAIOR_IGUAL: consome(MAIOR_IGUAL); break;
-        case NEGACAO: consome(NEGACAO); break;
-        case IGUAL: consome(IGUAL); break;
-        case OR: consome(OR); break;
-        case AND: consome(AND); break;
-        default:
-             printf("# %d:erro sintatico, operador relacional esperado mas encontrado [%s]\n", lookahead.linha, nome_atomo(lookahead.atomo));
-             exit(1);
+}
+
+static void x86_imul(TCodigoNativo *c, int dst, TOperando src) {
+    if (src.tipo == OPR_IMED) {
+        x86_op_rm(c, 0, 0x69, dst, em_reg(dst), 0);
+        x86_u32(c, (uint32_t)src.valor);
+    } else {
+        x86_op_rm(c, 0, 0x1AF, dst, src, 0);
     }
 }
 
-void simple_expression() { //S
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+// Grupo F7: /3 neg, /6 div, /7 idiv
+static inline void x86_f7(TCodigoNativo *c, int ext, TOperando rm) { x86_op_rm(c, 0, 0xF7, ext, rm, 0); }
+
+static void x86_shl(TCodigoNativo *c, TOperando dst, int k) {
+    x86_op_rm(c, 0, 0xC1, 4, dst, 0);
+    x86_byte(c, (uint8_t)k);
+}
+
+// setcc al; movzx eax, al
+static void x86_setcc_eax(TCodigoNativo *c, int cc) {
+    x86_op_rm(c, 0, (uint32_t)(0x190 + cc), 0, em_reg(RAX), 0);
+    x86_op_rm(c, 0, 0x1B6, RAX, em_reg(RAX), 0);
+}
+
+static void x86_jmp(TCodigoNativo *c, uint32_t rotulo) { x86_byte(c, 0xE9); x86_rel32(c, rotulo); }
+static void x86_jcc(TCodigoNativo *c, int cc, uint32_t rotulo) {
+    x86_byte(c, 0x0F);
+    x86_byte(c, (uint8_t)(0x80 + cc));
+    x86_rel32(c, rotulo);
+}
+static void x86_call(TCodigoNativo *c, uint32_t rotulo) { x86_byte(c, 0xE8); x86_rel32(c, rotulo); }
+static void x86_push(TCodigoNativo *c, int r) { if (r >= 8) x86_byte(c, 0x41); x86_byte(c, (uint8_t)(0x50 + (r & 7))); }
+static void x86_pop(TCodigoNativo *c, int r) { if (r >= 8) x86_byte(c, 0x41); x86_byte(c, (uint8_t)(0x58 + (r & 7))); }
+static inline void x86_ret(TCodigoNativo *c) { x86_byte(c, 0xC3); }
+static inline void x86_syscall(TCodigoNativo *c) { x86_byte(c, 0x0F); x86_byte(c, 0x05); }
+
+// ---- rotinas de suporte ----
+
+// Modo JIT: read/write são funções em C chamadas por endereço absoluto
+static void rt_escreve_inteiro(int32_t v) { fprintf(saida_vm, "%d", v); }
+static void rt_escreve_char(int32_t v) { fputc((char)v, saida_vm); }
+static void rt_escreve_logico(int32_t v) { fputs(v ? "true" : "false", saida_vm); }
+static void rt_espaco(void) { fputc(' ', saida_vm); }
+static void rt_fim_linha(void) { fputc('\n', saida_vm); }
+static void rt_erro_divisao(void) { erro_execucao("divisao por zero"); }
+
+static void *const rotinas_jit[TOTAL_ROTINAS] = {
+    [RT_LE_INTEIRO] = (void*)le_inteiro, [RT_LE_CHAR] = (void*)le_char,
+    [RT_ESCREVE_INTEIRO] = (void*)rt_escreve_inteiro, [RT_ESCREVE_CHAR] = (void*)rt_escreve_char,
+    [RT_ESCREVE_LOGICO] = (void*)rt_escreve_logico, [RT_ESPACO] = (void*)rt_espaco,
+    [RT_FIM_LINHA] = (void*)rt_fim_linha, [RT_ERRO_DIVISAO] = (void*)rt_erro_divisao
+};
+
+/*
+ * Executável ELF: sem libc. Um segmento de código (cabeçalhos, _start,
+ * rotinas e programa) e, na página seguinte ao fim dele, um segmento
+ * zerado de dados com o buffer de saída, o byte devolvido pela leitura e
+ * as variáveis. As rotinas são emitidas antes do programa, quando o
+ * endereço dos dados ainda não se conhece: cada imediato que o usa sai
+ * com ELF_DADOS_PROVISORIO (que força a forma de 32 bits) e é corrigido
+ * por escreve_elf.
+ */
+#define ELF_BASE_TEXTO 0x400000u
+#define ELF_DADOS_PROVISORIO 0x7FFFF000
+#define ELF_CABECALHOS (64 + 2 * 56)
+#define ELF_TAM_SAIDA 4096
+enum {
+    DADO_USO = 0,        // bytes ocupados no buffer de saída
+    DADO_PENDENTE = 4,   // byte devolvido pela leitura + 1 (0 = nenhum)
+    DADO_LIDO = 8,       // destino do read(2) de um byte
+    DADO_DIGITOS = 16,   // conversão de inteiros, de trás para frente
+    DADO_SAIDA = 64,
+    DADO_VARIAVEIS = DADO_SAIDA + ELF_TAM_SAIDA
+};
+
+static void anota_dado(TCodigoNativo *c, int32_t deslocamento) {
+    if (c->n_dados + 2 > c->cap_dados) {
+        c->cap_dados = c->cap_dados ? c->cap_dados * 2 : 64;
+        c->dados = (uint32_t*)realloc(c->dados, c->cap_dados * sizeof(uint32_t));
+        if (c->dados == NULL) {
+            erro_fatal("Erro ao alocar memoria.\n");
+        }
     }
-    term();
-    while (lookahead.atomo == MAIS || lookahead.atomo == MENOS) {
-        adding_operator();
-        term();
+    c->dados[c->n_dados++] = c->tamanho - 4;   // o imm32 é sempre o último campo
+    c->dados[c->n_dados++] = (uint32_t)deslocamento;
+}
+
+// reg = endereço do dado
+static void x86_mov_dado(TCodigoNativo *c, int reg, int32_t deslocamento) {
+    x86_mov(c, em_reg(reg), imediato(ELF_DADOS_PROVISORIO));
+    anota_dado(c, deslocamento);
+}
+
+static void x86_cmp_dado(TCodigoNativo *c, int reg, int32_t deslocamento) {
+    x86_alu(c, ALU_CMP, em_reg(reg), imediato(ELF_DADOS_PROVISORIO));
+    anota_dado(c, deslocamento);
+}
+
+static void emite_caractere(TCodigoNativo *c, char ch, uint32_t poe_byte) {
+    x86_mov(c, em_reg(RDI), imediato((unsigned char)ch));
+    x86_call(c, poe_byte);
+}
+
+// _start e as rotinas de E/S em syscalls; devolve o rótulo da função do programa.
+// As rotinas só usam registradores voláteis e preservam r8..r10 entre si.
+static uint32_t emite_rotinas_elf(TCodigoNativo *c, uint32_t *rotinas) {
+    uint32_t programa = novo_rotulo(c);
+    uint32_t descarrega = novo_rotulo(c), poe_byte = novo_rotulo(c);
+    uint32_t le_byte = novo_rotulo(c), pula_brancos = novo_rotulo(c);
+    for (int r = 0; r < TOTAL_ROTINAS; r++) rotinas[r] = novo_rotulo(c);
+
+    // _start: status = programa(variáveis); descarrega; exit(status)
+    x86_mov_dado(c, RDI, DADO_VARIAVEIS);
+    x86_call(c, programa);
+    x86_mov(c, em_reg(RBX), em_reg(RAX));
+    x86_call(c, descarrega);
+    x86_mov(c, em_reg(RDI), em_reg(RBX));
+    x86_mov(c, em_reg(RAX), imediato(60));
+    x86_syscall(c);
+
+    // descarrega: write(1, saída, uso); uso = 0
+    uint32_t vazio = novo_rotulo(c);
+    fixa_rotulo(c, descarrega);
+    x86_mov_dado(c, RCX, 0);
+    x86_mov(c, em_reg(RDX), em_mem(RCX, DADO_USO));
+    x86_alu(c, ALU_CMP, em_reg(RDX), imediato(0));
+    x86_jcc(c, CC_E, vazio);
+    x86_mov(c, em_reg(RAX), imediato(1));
+    x86_mov(c, em_reg(RDI), imediato(1));
+    x86_mov_dado(c, RSI, DADO_SAIDA);
+    x86_syscall(c);
+    x86_mov_dado(c, RCX, 0);
+    x86_mov(c, em_mem(RCX, DADO_USO), imediato(0));
+    fixa_rotulo(c, vazio);
+    x86_ret(c);
+
+    // poe_byte(dil): acrescenta ao buffer, descarregando se cheio
+    uint32_t cabe = novo_rotulo(c);
+    fixa_rotulo(c, poe_byte);
+    x86_mov_dado(c, RCX, 0);
+    x86_mov(c, em_reg(RAX), em_mem(RCX, DADO_USO));
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato(ELF_TAM_SAIDA));
+    x86_jcc(c, CC_B, cabe);
+    x86_push(c, RDI);
+    x86_call(c, descarrega);
+    x86_pop(c, RDI);
+    x86_mov_dado(c, RCX, 0);
+    x86_mov(c, em_reg(RAX), imediato(0));
+    fixa_rotulo(c, cabe);
+    x86_alu(c, ALU_ADD, em_reg(RCX), em_reg(RAX));
+    x86_op_rm(c, 0, 0x88, RDI, em_mem(RCX, DADO_SAIDA), 1);
+    x86_alu(c, ALU_ADD, em_reg(RAX), imediato(1));
+    x86_mov_dado(c, RCX, 0);
+    x86_mov(c, em_mem(RCX, DADO_USO), em_reg(RAX));
+    x86_ret(c);
+
+    // le_byte -> eax (-1 no fim da entrada). A saída pendente é descarregada
+    // antes de bloquear, como o stdout de linha da libc num terminal.
+    uint32_t ler = novo_rotulo(c), fim_entrada = novo_rotulo(c);
+    fixa_rotulo(c, le_byte);
+    x86_mov_dado(c, RCX, 0);
+    x86_mov(c, em_reg(RAX), em_mem(RCX, DADO_PENDENTE));
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato(0));
+    x86_jcc(c, CC_E, ler);
+    x86_mov(c, em_mem(RCX, DADO_PENDENTE), imediato(0));
+    x86_alu(c, ALU_SUB, em_reg(RAX), imediato(1));
+    x86_ret(c);
+    fixa_rotulo(c, ler);
+    x86_call(c, descarrega);
+    x86_mov(c, em_reg(RAX), imediato(0));
+    x86_mov(c, em_reg(RDI), imediato(0));
+    x86_mov_dado(c, RSI, DADO_LIDO);
+    x86_mov(c, em_reg(RDX), imediato(1));
+    x86_syscall(c);
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato(1));
+    x86_jcc(c, CC_NE, fim_entrada);
+    x86_mov_dado(c, RCX, 0);
+    x86_op_rm(c, 0, 0x1B6, RAX, em_mem(RCX, DADO_LIDO), 0);
+    x86_ret(c);
+    fixa_rotulo(c, fim_entrada);
+    x86_mov(c, em_reg(RAX), imediato(-1));
+    x86_ret(c);
+
+    // pula_brancos -> eax: primeiro byte que não é espaço (isspace do scanf)
+    fixa_rotulo(c, pula_brancos);
+    x86_call(c, le_byte);
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato(' '));
+    x86_jcc(c, CC_E, pula_brancos);
+    x86_mov(c, em_reg(RCX), em_reg(RAX));
+    x86_alu(c, ALU_SUB, em_reg(RCX), imediato('\t'));
+    x86_alu(c, ALU_CMP, em_reg(RCX), imediato('\r' - '\t'));
+    x86_jcc(c, CC_BE, pula_brancos);
+    x86_ret(c);
+
+    // le_inteiro: [sinal] dígitos, devolvendo o primeiro byte que não é dígito
+    uint32_t mais = novo_rotulo(c), digito = novo_rotulo(c), fim_num = novo_rotulo(c), positivo = novo_rotulo(c);
+    fixa_rotulo(c, rotinas[RT_LE_INTEIRO]);
+    x86_call(c, pula_brancos);
+    x86_mov(c, em_reg(R8), imediato(0));
+    x86_mov(c, em_reg(R9), imediato(0));
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato('-'));
+    x86_jcc(c, CC_NE, mais);
+    x86_mov(c, em_reg(R9), imediato(1));
+    x86_call(c, le_byte);
+    x86_jmp(c, digito);
+    fixa_rotulo(c, mais);
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato('+'));
+    x86_jcc(c, CC_NE, digito);
+    x86_call(c, le_byte);
+    fixa_rotulo(c, digito);
+    x86_mov(c, em_reg(RCX), em_reg(RAX));
+    x86_alu(c, ALU_SUB, em_reg(RCX), imediato('0'));
+    x86_alu(c, ALU_CMP, em_reg(RCX), imediato(9));
+    x86_jcc(c, CC_A, fim_num);
+    x86_imul(c, R8, imediato(10));
+    x86_alu(c, ALU_ADD, em_reg(R8), em_reg(RCX));
+    x86_call(c, le_byte);
+    x86_jmp(c, digito);
+    fixa_rotulo(c, fim_num);
+    x86_alu(c, ALU_ADD, em_reg(RAX), imediato(1));
+    x86_mov_dado(c, RCX, 0);
+    x86_mov(c, em_mem(RCX, DADO_PENDENTE), em_reg(RAX));
+    x86_mov(c, em_reg(RAX), em_reg(R8));
+    x86_alu(c, ALU_CMP, em_reg(R9), imediato(0));
+    x86_jcc(c, CC_E, positivo);
+    x86_f7(c, 3, em_reg(RAX));
+    fixa_rotulo(c, positivo);
+    x86_ret(c);
+
+    // le_char: primeiro byte que não é espaço, 0 no fim da entrada
+    uint32_t tem_char = novo_rotulo(c);
+    fixa_rotulo(c, rotinas[RT_LE_CHAR]);
+    x86_call(c, pula_brancos);
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato(-1));
+    x86_jcc(c, CC_NE, tem_char);
+    x86_mov(c, em_reg(RAX), imediato(0));
+    fixa_rotulo(c, tem_char);
+    x86_ret(c);
+
+    // escreve_inteiro(edi): dígitos de trás para frente em DADO_DIGITOS, r10 = início
+    const int32_t fim_digitos = DADO_DIGITOS + 12;
+    uint32_t nao_negativo = novo_rotulo(c), divide_10 = novo_rotulo(c), copia = novo_rotulo(c), fim_copia = novo_rotulo(c);
+    fixa_rotulo(c, rotinas[RT_ESCREVE_INTEIRO]);
+    x86_mov(c, em_reg(RAX), em_reg(RDI));
+    x86_mov(c, em_reg(R8), em_reg(RDI));
+    x86_mov_dado(c, R10, fim_digitos);
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato(0));
+    x86_jcc(c, CC_GE, nao_negativo);
+    x86_f7(c, 3, em_reg(RAX)); // INT_MIN continua certo como unsigned
+    fixa_rotulo(c, nao_negativo);
+    x86_mov(c, em_reg(R9), imediato(10));
+    fixa_rotulo(c, divide_10);
+    x86_mov(c, em_reg(RDX), imediato(0));
+    x86_f7(c, 6, em_reg(R9));
+    x86_alu(c, ALU_ADD, em_reg(RDX), imediato('0'));
+    x86_alu(c, ALU_SUB, em_reg(R10), imediato(1));
+    x86_op_rm(c, 0, 0x88, RDX, em_mem(R10, 0), 1);
+    x86_alu(c, ALU_CMP, em_reg(RAX), imediato(0));
+    x86_jcc(c, CC_NE, divide_10);
+    x86_alu(c, ALU_CMP, em_reg(R8), imediato(0));
+    x86_jcc(c, CC_GE, copia);
+    x86_mov(c, em_reg(RDX), imediato('-'));
+    x86_alu(c, ALU_SUB, em_reg(R10), imediato(1));
+    x86_op_rm(c, 0, 0x88, RDX, em_mem(R10, 0), 1);
+    fixa_rotulo(c, copia);
+    x86_cmp_dado(c, R10, fim_digitos);
+    x86_jcc(c, CC_AE, fim_copia);
+    x86_op_rm(c, 0, 0x1B6, RDI, em_mem(R10, 0), 0);
+    x86_call(c, poe_byte);
+    x86_alu(c, ALU_ADD, em_reg(R10), imediato(1));
+    x86_jmp(c, copia);
+    fixa_rotulo(c, fim_copia);
+    x86_ret(c);
+
+    fixa_rotulo(c, rotinas[RT_ESCREVE_CHAR]);
+    x86_jmp(c, poe_byte);
+
+    uint32_t falso = novo_rotulo(c);
+    fixa_rotulo(c, rotinas[RT_ESCREVE_LOGICO]);
+    x86_alu(c, ALU_CMP, em_reg(RDI), imediato(0));
+    x86_jcc(c, CC_E, falso);
+    for (const char *s = "true"; *s; s++) emite_caractere(c, *s, poe_byte);
+    x86_ret(c);
+    fixa_rotulo(c, falso);
+    for (const char *s = "false"; *s; s++) emite_caractere(c, *s, poe_byte);
+    x86_ret(c);
+
+    fixa_rotulo(c, rotinas[RT_ESPACO]);
+    x86_mov(c, em_reg(RDI), imediato(' '));
+    x86_jmp(c, poe_byte);
+
+    fixa_rotulo(c, rotinas[RT_FIM_LINHA]);
+    x86_mov(c, em_reg(RDI), imediato('\n'));
+    x86_jmp(c, poe_byte);
+
+    // erro_divisao: descarrega e escreve a mensagem em stderr
+    static const char mensagem[] = "erro de execucao: divisao por zero\n";
+    uint32_t texto = novo_rotulo(c);
+    fixa_rotulo(c, rotinas[RT_ERRO_DIVISAO]);
+    x86_call(c, descarrega);
+    x86_mov(c, em_reg(RAX), imediato(1));
+    x86_mov(c, em_reg(RDI), imediato(2));
+    x86_byte(c, 0x48); x86_byte(c, 0x8D); x86_byte(c, 0x35); // lea rsi, [rip + texto]
+    x86_rel32(c, texto);
+    x86_mov(c, em_reg(RDX), imediato((int32_t)sizeof(mensagem) - 1));
+    x86_syscall(c);
+    x86_ret(c);
+    fixa_rotulo(c, texto);
+    for (const char *s = mensagem; *s; s++) x86_byte(c, (uint8_t)*s);
+    return programa;
+}
+
+// ---- tradução do bytecode ----
+
+#define REGS_VARIAVEIS 5
+#define REGS_PILHA 6
+static const int regs_variavel[REGS_VARIAVEIS] = { RBX, R12, R13, R14, R15 };
+static const int regs_pilha[REGS_PILHA] = { R8, R9, R10, R11, RSI, RDI };
+
+typedef struct {
+    TCodigoNativo *c;
+    TOperando *lugar_var;     // onde mora cada variável
+    TOperando *pilha;         // operando em cada profundidade da pilha simulada
+    uint32_t base_pilha;      // primeira palavra do bloco de memória usada pela pilha
+    const uint32_t *rotinas;  // rótulos das rotinas (ELF) ou NULL (JIT)
+    uint32_t erro_divisao;
+    uint32_t epilogo;
+} TTradutor;
+
+// Lugar fixo da profundidade d: registrador ou palavra no bloco de rbp
+static inline TOperando lugar_pilha(const TTradutor *t, uint32_t d) {
+    if (d < REGS_PILHA) return em_reg(regs_pilha[d]);
+    return em_mem(RBP, (int32_t)(4 * (t->base_pilha + d - REGS_PILHA)));
+}
+
+// Leva o operando da profundidade d para seu lugar fixo
+static TOperando materializa(TTradutor *t, uint32_t d) {
+    TOperando lugar = lugar_pilha(t, d);
+    x86_mov(t->c, lugar, t->pilha[d]);
+    t->pilha[d] = lugar;
+    return lugar;
+}
+
+static void chama_rotina(TTradutor *t, TRotina r) {
+    if (t->rotinas) {
+        x86_call(t->c, t->rotinas[r]);
+    } else {
+        x86_byte(t->c, 0x48); x86_byte(t->c, 0xB8); // mov rax, imm64
+        uint64_t endereco = (uint64_t)(uintptr_t)rotinas_jit[r];
+        for (int i = 0; i < 8; i++) x86_byte(t->c, (uint8_t)(endereco >> (8 * i)));
+        x86_byte(t->c, 0xFF); x86_byte(t->c, 0xD0);  // call rax
     }
 }
 
-void adding_operator() { //S
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+static int condicao(TOpcode op) {
+    switch (op) {
+        case OP_IGUAL: return CC_E;
+        case OP_DIFERENTE: return CC_NE;
+        case OP_MENOR: return CC_L;
+        case OP_MAIOR: return CC_G;
+        case OP_MENOR_IGUAL: return CC_LE;
+        default: return CC_GE;
     }
-    if (lookahead.atomo == MAIS) consome(MAIS);
-    else if (lookahead.atomo == MENOS) consome(MENOS);
-    else {
-        printf("# %d:erro sintatico, Esperado: %s, Encontrado: %s\n", lookahead.linha, nome_atomo(esperado), nome_atomo(lookahead.atomo));
-        exit(1);
+}
+
+// Troca os lados de uma comparação: a < b  <=>  b > a
+static int condicao_espelhada(int cc) {
+    switch (cc) {
+        case CC_L: return CC_G;
+        case CC_G: return CC_L;
+        case CC_LE: return CC_GE;
+        case CC_GE: return CC_LE;
+        default: return cc;
     }
 }
 
-void term() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+// Pesos de uso das variáveis: cada laço (salto para trás) em volta multiplica por 8;
+// as REGS_VARIAVEIS mais pesadas ganham registrador
+static void escolhe_registradores(const TPrograma *prog, TTradutor *t, uint32_t *n_memoria) {
+    uint32_t n = prog->n_variaveis + 1;
+    uint64_t *peso = (uint64_t*)calloc(n, sizeof(uint64_t));
+    int32_t *aninhamento = (int32_t*)calloc(prog->tamanho + 1, sizeof(int32_t));
+    if (peso == NULL || aninhamento == NULL) {
+        free(peso);
+        free(aninhamento);
+        erro_fatal("Erro ao alocar memoria.\n");
+    }
+    for (uint32_t i = 0; i < prog->tamanho; i += 1 + operandos_opcode[prog->codigo[i]]) {
+        if (prog->codigo[i] == OP_SALTA && (uint32_t)prog->codigo[i + 1] <= i) {
+            aninhamento[prog->codigo[i + 1]]++;
+            aninhamento[i + 1]--;
+        }
+    }
+    int32_t nivel = 0;
+    for (uint32_t i = 0; i < prog->tamanho; i++) {
+        nivel += aninhamento[i];
+        aninhamento[i] = nivel;
+    }
+    for (uint32_t i = 0; i < prog->tamanho; i += 1 + operandos_opcode[prog->codigo[i]]) {
+        switch ((TOpcode)prog->codigo[i]) {
+            case OP_CARREGA: case OP_ARMAZENA: case OP_LE_INTEIRO: case OP_LE_CHAR:
+            case OP_ESCREVE_INTEIRO: case OP_ESCREVE_CHAR: case OP_ESCREVE_LOGICO:
+                peso[prog->codigo[i + 1]] += (uint64_t)1 << (3 * (aninhamento[i] < 6 ? aninhamento[i] : 6));
+                break;
+            default: break;
+        }
     }
-    factor();
-    while (lookahead.atomo == ASTERISCO || lookahead.atomo == DIV) {
-        multiplying_operator();
-        factor();
+    uint32_t memoria = 0;
+    for (uint32_t v = 0; v < n; v++) t->lugar_var[v] = em_mem(RBP, 0);
+    for (int r = 0; r < REGS_VARIAVEIS; r++) {
+        uint32_t melhor = UINT32_MAX;
+        for (uint32_t v = 0; v < n; v++)
+            if (peso[v] > 0 && t->lugar_var[v].tipo == OPR_MEM && (melhor == UINT32_MAX || peso[v] > peso[melhor])) melhor = v;
+        if (melhor == UINT32_MAX) break;
+        t->lugar_var[melhor] = em_reg(regs_variavel[r]);
     }
+    for (uint32_t v = 0; v < n; v++)
+        if (t->lugar_var[v].tipo == OPR_MEM) t->lugar_var[v].valor = (int32_t)(4 * memoria++);
+    *n_memoria = memoria;
+    free(peso);
+    free(aninhamento);
 }
 
-void multiplying_operator() { //s
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
+/*
+ * Gera a função int32_t programa(int32_t *memoria), que recebe o bloco das
+ * variáveis fora de registrador (zerado) seguido das profundidades de pilha
+ * além de REGS_PILHA. Devolve 0 ou 1 (erro de execução). rotinas == NULL
+ * gera chamadas absolutas para as funções de rotinas_jit.
+ * *palavras_memoria recebe o tamanho do bloco, em palavras de 32 bits.
+ */
+static void traduz_programa(const TPrograma *prog, TCodigoNativo *c, uint32_t funcao,
+                            const uint32_t *rotinas, uint32_t *palavras_memoria) {
+    TTradutor t;
+    t.c = c;
+    t.rotinas = rotinas;
+    t.lugar_var = (TOperando*)malloc((prog->n_variaveis + 1) * sizeof(TOperando));
+    t.pilha = (TOperando*)malloc((prog->profundidade_pilha + 1) * sizeof(TOperando));
+    uint8_t *destino = (uint8_t*)calloc(prog->tamanho + 1, 1);
+    if (t.lugar_var == NULL || t.pilha == NULL || destino == NULL) {
+        free(t.lugar_var);
+        free(t.pilha);
+        free(destino);
+        erro_fatal("Erro ao alocar memoria.\n");
     }
-    if (lookahead.atomo == ASTERISCO) consome(ASTERISCO);
-    else if (lookahead.atomo == DIV) consome(DIV);
-    else {
-             printf("# %d:erro sintatico, Esperado: %s, Encontrado: %s\n", lookahead.linha, nome_atomo(esperado), nome_atomo(lookahead.atomo));
-        exit(1);
+    escolhe_registradores(prog, &t, &t.base_pilha);
+    uint32_t extra = prog->profundidade_pilha > REGS_PILHA ? prog->profundidade_pilha - REGS_PILHA : 0;
+    *palavras_memoria = t.base_pilha + extra;
+
+    // Um rótulo por posição do bytecode que é destino de salto
+    uint32_t primeiro = c->n_rotulos;
+    for (uint32_t i = 0; i < prog->tamanho; i++) novo_rotulo(c);
+    for (uint32_t i = 0; i < prog->tamanho; i += 1 + operandos_opcode[prog->codigo[i]])
+        if (prog->codigo[i] == OP_SALTA || prog->codigo[i] == OP_SALTA_FALSO) destino[prog->codigo[i + 1]] = 1;
+    t.erro_divisao = novo_rotulo(c);
+    t.epilogo = novo_rotulo(c);
+
+    // Prólogo: salva os registradores preservados e alinha a pilha em 16
+    fixa_rotulo(c, funcao);
+    x86_push(c, RBX); x86_push(c, RBP);
+    x86_push(c, R12); x86_push(c, R13); x86_push(c, R14); x86_push(c, R15);
+    x86_op_rm(c, 1, 0x83, ALU_SUB, em_reg(RSP), 0); x86_byte(c, 8);
+    x86_op_rm(c, 1, 0x89, RDI, em_reg(RBP), 0);
+    for (uint32_t v = 0; v <= prog->n_variaveis; v++)
+        if (t.lugar_var[v].tipo == OPR_REG) x86_mov(c, t.lugar_var[v], imediato(0));
+
+    const int32_t *codigo = prog->codigo, *k = prog->constantes;
+    uint32_t d = 0; // profundidade da pilha simulada
+    for (uint32_t i = 0; i < prog->tamanho; ) {
+        TOpcode op = (TOpcode)codigo[i];
+        int32_t arg = operandos_opcode[op] ? codigo[i + 1] : 0;
+        uint32_t proxima = i + 1 + operandos_opcode[op];
+        if (destino[i]) fixa_rotulo(c, primeiro + i);
+        switch (op) {
+            case OP_CONST: t.pilha[d++] = imediato(k[arg]); break;
+            case OP_CARREGA: t.pilha[d++] = t.lugar_var[arg]; break;
+            case OP_ARMAZENA: x86_mov(c, t.lugar_var[arg], t.pilha[--d]); break;
+            case OP_SOMA: case OP_SUBTRAI: {
+                TOperando a = materializa(&t, d - 2);
+                x86_alu(c, op == OP_SOMA ? ALU_ADD : ALU_SUB, a, t.pilha[d - 1]);
+                d--;
+                break;
+            }
+            case OP_MULTIPLICA: {
+                TOperando a = materializa(&t, d - 2);
+                if (a.tipo == OPR_REG) {
+                    x86_imul(c, a.reg, t.pilha[d - 1]);
+                } else {
+                    x86_mov(c, em_reg(RCX), a);
+                    x86_imul(c, RCX, t.pilha[d - 1]);
+                    x86_mov(c, a, em_reg(RCX));
+                }
+                d--;
+                break;
+            }
+            case OP_DIVIDE: {
+                // divisor em ecx; zero vai para o erro, -1 vira negação (evita o trap de INT_MIN / -1)
+                TOperando a = materializa(&t, d - 2), b = t.pilha[d - 1];
+                d--;
+                if (b.tipo == OPR_IMED) {
+                    if (b.valor == 0) x86_jmp(c, t.erro_divisao);
+                    else if (b.valor == -1) x86_f7(c, 3, a);
+                    else {
+                        x86_mov(c, em_reg(RAX), a);
+                        x86_byte(c, 0x99); // cdq
+                        x86_mov(c, em_reg(RCX), b);
+                        x86_f7(c, 7, em_reg(RCX));
+                        x86_mov(c, a, em_reg(RAX));
+                    }
+                    break;
+                }
+                uint32_t nega = novo_rotulo(c), fim = novo_rotulo(c);
+                x86_mov(c, em_reg(RCX), b);
+                x86_alu(c, ALU_CMP, em_reg(RCX), imediato(0));
+                x86_jcc(c, CC_E, t.erro_divisao);
+                x86_alu(c, ALU_CMP, em_reg(RCX), imediato(-1));
+                x86_jcc(c, CC_E, nega);
+                x86_mov(c, em_reg(RAX), a);
+                x86_byte(c, 0x99); // cdq
+                x86_f7(c, 7, em_reg(RCX));
+                x86_mov(c, a, em_reg(RAX));
+                x86_jmp(c, fim);
+                fixa_rotulo(c, nega);
+                x86_f7(c, 3, a);
+                fixa_rotulo(c, fim);
+                break;
+            }
+            case OP_IGUAL: case OP_DIFERENTE: case OP_MENOR: case OP_MAIOR:
+            case OP_MENOR_IGUAL: case OP_MAIOR_IGUAL: {
+                int cc = condicao(op);
+                TOperando a = t.pilha[d - 2], b = t.pilha[d - 1];
+                if (a.tipo == OPR_IMED && b.tipo != OPR_IMED) {
+                    TOperando troca = a; a = b; b = troca;
+                    cc = condicao_espelhada(cc);
+                } else if (a.tipo == OPR_IMED) {
+                    a = materializa(&t, d - 2);
+                }
+                x86_alu(c, ALU_CMP, a, b);
+                d -= 2;
+                // Comparação seguida de desvio condicional vira cmp + jcc
+                if (proxima < prog->tamanho && codigo[proxima] == OP_SALTA_FALSO && !destino[proxima]) {
+                    x86_jcc(c, cc ^ 1, primeiro + (uint32_t)codigo[proxima + 1]);
+                    proxima += 2;
+                } else {
+                    x86_setcc_eax(c, cc);
+                    x86_mov(c, lugar_pilha(&t, d), em_reg(RAX));
+                    t.pilha[d] = lugar_pilha(&t, d);
+                    d++;
+                }
+                break;
+            }
+            case OP_E: case OP_OU: {
+                // a and b = (a != 0) & (b != 0); a or b = (a | b) != 0
+                TOperando a = materializa(&t, d - 2);
+                if (op == OP_OU) {
+                    x86_alu(c, ALU_OR, a, t.pilha[d - 1]);
+                    x86_setcc_eax(c, CC_NE);
+                } else {
+                    x86_mov(c, em_reg(RCX), t.pilha[d - 1]);
+                    x86_alu(c, ALU_CMP, em_reg(RCX), imediato(0));
+                    x86_op_rm(c, 0, 0x190 + CC_NE, 0, em_reg(RCX), 0); // setne cl
+                    x86_alu(c, ALU_CMP, a, imediato(0));
+                    x86_setcc_eax(c, CC_NE);
+                    x86_op_rm(c, 0, 0x21, RCX, em_reg(RAX), 0);           // and eax, ecx
+                }
+                x86_mov(c, a, em_reg(RAX));
+                d--;
+                break;
+            }
+            case OP_NAO: {
+                TOperando a = materializa(&t, d - 1);
+                x86_alu(c, ALU_CMP, a, imediato(0));
+                x86_setcc_eax(c, CC_E);
+                x86_mov(c, a, em_reg(RAX));
+                break;
+            }
+            case OP_DESLOCA: x86_shl(c, materializa(&t, d - 1), arg); break;
+            case OP_SALTA: x86_jmp(c, primeiro + (uint32_t)arg); break;
+            case OP_SALTA_FALSO: {
+                TOperando v = t.pilha[--d];
+                if (v.tipo == OPR_IMED) {
+                    if (v.valor == 0) x86_jmp(c, primeiro + (uint32_t)arg);
+                } else {
+                    x86_alu(c, ALU_CMP, v, imediato(0));
+                    x86_jcc(c, CC_E, primeiro + (uint32_t)arg);
+                }
+                break;
+            }
+            case OP_LE_INTEIRO: case OP_LE_CHAR:
+                chama_rotina(&t, op == OP_LE_CHAR ? RT_LE_CHAR : RT_LE_INTEIRO);
+                x86_mov(c, t.lugar_var[arg], em_reg(RAX));
+                break;
+            case OP_ESCREVE_INTEIRO: case OP_ESCREVE_CHAR: case OP_ESCREVE_LOGICO:
+                x86_mov(c, em_reg(RDI), t.lugar_var[arg]);
+                chama_rotina(&t, op == OP_ESCREVE_INTEIRO ? RT_ESCREVE_INTEIRO :
+                                 op == OP_ESCREVE_CHAR ? RT_ESCREVE_CHAR : RT_ESCREVE_LOGICO);
+                break;
+            case OP_ESPACO: chama_rotina(&t, RT_ESPACO); break;
+            case OP_FIM_LINHA: chama_rotina(&t, RT_FIM_LINHA); break;
+            case OP_FIM:
+                x86_mov(c, em_reg(RAX), imediato(0));
+                x86_jmp(c, t.epilogo);
+                break;
+            default: break;
+        }
+        i = proxima;
     }
+
+    fixa_rotulo(c, t.erro_divisao);
+    chama_rotina(&t, RT_ERRO_DIVISAO);
+    x86_mov(c, em_reg(RAX), imediato(1));
+    fixa_rotulo(c, t.epilogo);
+    x86_op_rm(c, 1, 0x83, ALU_ADD, em_reg(RSP), 0); x86_byte(c, 8);
+    x86_pop(c, R15); x86_pop(c, R14); x86_pop(c, R13); x86_pop(c, R12);
+    x86_pop(c, RBP); x86_pop(c, RBX);
+    x86_ret(c);
+
+    free(t.lugar_var);
+    free(t.pilha);
+    free(destino);
 }
 
-void factor() {
-    while(lookahead.atomo == COMENTARIO) {
-        printf("# %d:comentario\n", lookahead.linha);
-        lookahead = obter_atomo();
-    }
-    if (lookahead.atomo == IDENTIFICADOR) consome(IDENTIFICADOR);
-    else if (lookahead.atomo == CONSTINT) consome(CONSTINT);// constint
-    else if (lookahead.atomo == NUMERO)   consome(NUMERO);
-    else if (lookahead.atomo == CONSTCHAR) consome(CONSTCHAR);
-    else if (lookahead.atomo == ABRE_PAR) {
-        consome(ABRE_PAR);
-        expression();
-        consome(FECHA_PAR);
+// JIT: gera, copia para páginas executáveis (nunca graváveis e executáveis
+// ao mesmo tempo) e chama
+int executa_jit(const TPrograma *prog) {
+    TCodigoNativo c;
+    memset(&c, 0, sizeof(c));
+    uint32_t palavras;
+    uint32_t funcao = novo_rotulo(&c);
+    traduz_programa(prog, &c, funcao, NULL, &palavras);
+    resolve_rotulos(&c);
+
+    size_t tamanho = (c.tamanho + 4095) & ~(size_t)4095;
+    void *pagina = mmap(NULL, tamanho, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pagina == MAP_FAILED) {
+        libera_codigo_nativo(&c);
+        erro_fatal("Erro ao alocar memoria executavel.\n");
     }
-    else if (lookahead.atomo == NOT) {
-        consome(NOT);
-        factor();
+    memcpy(pagina, c.codigo, c.tamanho);
+    if (mprotect(pagina, tamanho, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pagina, tamanho);
+        libera_codigo_nativo(&c);
+        erro_fatal("Erro ao proteger memoria executavel.\n");
     }
-    else if (lookahead.atomo == TRUE_TOKEN) consome(TRUE_TOKEN);
-    else if (lookahead.atomo == FALSE_TOKEN) consome(FALSE_TOKEN);
-    else {
-             printf("# %d:erro sintatico, Esperado: %s, Encontrado: %s\n", lookahead.linha, nome_atomo(esperado), nome_atomo(lookahead.atomo));
-        exit(1);
+    int32_t *memoria = (int32_t*)calloc(palavras + 1, sizeof(int32_t));
+    if (memoria == NULL) {
+        munmap(pagina, tamanho);
+        libera_codigo_nativo(&c);
+        erro_fatal("Erro ao alocar memoria.\n");
     }
+    int32_t (*programa)(int32_t*) = (int32_t (*)(int32_t*))((uint8_t*)pagina + c.rotulos[funcao]);
+    int status = programa(memoria);
+    fflush(saida_vm);
+
+    free(memoria);
+    munmap(pagina, tamanho);
+    libera_codigo_nativo(&c);
+    return status;
 }
 
+static void poe_u16(uint8_t *p, uint16_t v) { memcpy(p, &v, 2); }
+static void poe_u32(uint8_t *p, uint32_t v) { memcpy(p, &v, 4); }
+static void poe_u64(uint8_t *p, uint64_t v) { memcpy(p, &v, 8); }
+
+// Executável ELF64 estático: _start no início do código, sem libc
+int escreve_elf(const TPrograma *prog, const char *caminho) {
+    TCodigoNativo c;
+    memset(&c, 0, sizeof(c));
+    uint32_t rotinas[TOTAL_ROTINAS], palavras;
+    for (int i = 0; i < ELF_CABECALHOS; i++) x86_byte(&c, 0);
+    uint32_t funcao = emite_rotinas_elf(&c, rotinas);
+    traduz_programa(prog, &c, funcao, rotinas, &palavras);
+    resolve_rotulos(&c);
+
+    // Dados na página seguinte ao código; os endereços têm de caber nos imediatos de 32 bits
+    uint64_t base_dados = ((uint64_t)ELF_BASE_TEXTO + c.tamanho + 4095) & ~(uint64_t)4095;
+    uint64_t tamanho_dados = DADO_VARIAVEIS + 4 * ((uint64_t)palavras + 1);
+    if (base_dados + tamanho_dados > INT32_MAX) {
+        libera_codigo_nativo(&c);
+        erro_fatal("Programa grande demais para o executavel ELF.\n");
+    }
+    for (uint32_t i = 0; i < c.n_dados; i += 2) poe_u32(c.codigo + c.dados[i], (uint32_t)(base_dados + c.dados[i + 1]));
+
+    uint8_t *h = c.codigo;
+    memcpy(h, "\177ELF", 4);
+    h[4] = 2; h[5] = 1; h[6] = 1;                          // 64 bits, little-endian, versão 1
+    poe_u16(h + 16, 2);                                    // ET_EXEC
+    poe_u16(h + 18, 62);                                   // EM_X86_64
+    poe_u32(h + 20, 1);
+    poe_u64(h + 24, ELF_BASE_TEXTO + ELF_CABECALHOS);      // entrada: _start
+    poe_u64(h + 32, 64);                                   // tabela de segmentos
+    poe_u16(h + 52, 64);
+    poe_u16(h + 54, 56);
+    poe_u16(h + 56, 2);
+
+    uint8_t *ph = h + 64;                                  // código: arquivo inteiro, R+X
+    poe_u32(ph, 1); poe_u32(ph + 4, 5);
+    poe_u64(ph + 16, ELF_BASE_TEXTO); poe_u64(ph + 24, ELF_BASE_TEXTO);
+    poe_u64(ph + 32, c.tamanho); poe_u64(ph + 40, c.tamanho);
+    poe_u64(ph + 48, 4096);
+    ph += 56;                                              // dados: só memória zerada, R+W
+    poe_u32(ph, 1); poe_u32(ph + 4, 6);
+    poe_u64(ph + 16, base_dados); poe_u64(ph + 24, base_dados);
+    poe_u64(ph + 40, tamanho_dados);
+    poe_u64(ph + 48, 4096);
+
+    int ok = 0;
+    FILE *f = fopen(caminho, "wb");
+    if (f != NULL) {
+        ok = fwrite(c.codigo, 1, c.tamanho, f) == c.tamanho;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && chmod(caminho, 0755) == 0;
+    }
+    if (!ok) printf("Erro ao escrever %s\n", caminho);
+    libera_codigo_nativo(&c);
+    return ok;
+}
 
+#endif
@@ -0,0 +1,117 @@
+#!/bin/sh
+#
+# Teste diferencial: cada programa de --gen-program passa por todos os
+# caminhos de execução e a saída tem de ser a mesma da referência
+# (--run --trace=off, máquina virtual com goto):
+#   despacho goto, switch e jit; --opt=none; executável de --emit-elf;
+#   imagem de --emit-image com --run-image (switch e goto); --cache na
+#   falta e no acerto.
+# A análise (trace em stdout) também é comparada entre --lex=stream,
+# bulk e pipeline e --parse-threads=4, as edições de --gen-edits passam
+# por --verify-edits, e o caso de recuperação "if a then b := 1 els b := 2;"
+# tem de dar exatamente um diagnóstico com --max-errors=10.
+#
+# Uso: tests/diferencial.sh [SEMENTES]    (padrão: 1 2 3 4 5)
+# PK aponta um compilador já construído; sem ele, compila com $CC.
+
+set -u
+
+raiz=$(cd "$(dirname "$0")/.." && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+if [ -n "${PK:-}" ]; then
+    pk=$PK
+else
+    pk=$tmp/pk
+    ${CC:-cc} -O2 -o "$pk" "$raiz/compiladorexe.c" -pthread || exit 1
+fi
+
+nativo=0
+[ "$(uname -s)" = Linux ] && [ "$(uname -m)" = x86_64 ] && nativo=1
+
+falhas=0
+casos=0
+
+falha() {
+    echo "FALHOU: $*"
+    falhas=$((falhas + 1))
+}
+
+# confere NOME ARQUIVO: ARQUIVO tem de ser igual à referência
+confere() {
+    casos=$((casos + 1))
+    cmp -s "$tmp/ref" "$2" || falha "$1"
+}
+
+sementes=${*:-1 2 3 4 5}
+
+for s in $sementes; do
+    for forma in "32K,seed=$s" "16K,seed=$s,loops=5,depth=6" "8K,seed=$s,nest=300"; do
+        p=$tmp/p.pas
+        "$pk" --gen-program="$forma" > "$tmp/gerado" || { falha "--gen-program=$forma"; continue; }
+        # Troca o "end." final por um write que põe o estado na saída comparada
+        { sed '$d' "$tmp/gerado"; printf ';\n  write(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15)\nend.\n'; } > "$p"
+        rotulo="--gen-program=$forma"
+
+        # Execução
+        "$pk" --run --trace=off --dispatch=goto "$p" < /dev/null > "$tmp/ref" || falha "$rotulo: --run"
+        "$pk" --run --trace=off --dispatch=switch "$p" < /dev/null > "$tmp/saida"
+        confere "$rotulo: --dispatch=switch" "$tmp/saida"
+        "$pk" --run --trace=off --opt=none "$p" < /dev/null > "$tmp/saida"
+        confere "$rotulo: --opt=none" "$tmp/saida"
+        if [ $nativo = 1 ]; then
+            "$pk" --run --trace=off --dispatch=jit "$p" < /dev/null > "$tmp/saida"
+            confere "$rotulo: --dispatch=jit" "$tmp/saida"
+            rm -f "$tmp/p.elf"
+            "$pk" --trace=off --emit-elf="$tmp/p.elf" "$p" > /dev/null
+            "$tmp/p.elf" < /dev/null > "$tmp/saida"
+            confere "$rotulo: --emit-elf" "$tmp/saida"
+        fi
+        rm -f "$tmp/p.pkim"
+        "$pk" --trace=off --emit-image="$tmp/p.pkim" "$p" > /dev/null
+        "$pk" --run-image="$tmp/p.pkim" < /dev/null > "$tmp/saida"
+        confere "$rotulo: --run-image" "$tmp/saida"
+        "$pk" --run-image="$tmp/p.pkim" --dispatch=goto < /dev/null > "$tmp/saida"
+        confere "$rotulo: --run-image --dispatch=goto" "$tmp/saida"
+
+        # Cache: a primeira vez grava, a segunda acerta; saídas iguais
+        rm -rf "$tmp/cache"
+        for vez in falta acerto; do
+            "$pk" --run --trace=off --cache="$tmp/cache" --cache-stats "$p" < /dev/null > "$tmp/saida" 2> "$tmp/estat"
+            confere "$rotulo: --cache ($vez)" "$tmp/saida"
+        done
+        grep -q '^cache .*: 1 acertos' "$tmp/estat" || falha "$rotulo: --cache nao acertou"
+
+        # Análise: o trace não depende do léxico nem das threads
+        "$pk" "$p" > "$tmp/ref"
+        for modo in --lex=stream --lex=bulk --lex=pipeline --parse-threads=4; do
+            "$pk" $modo "$p" > "$tmp/saida"
+            confere "$rotulo: $modo" "$tmp/saida"
+        done
+
+        # Edições incrementais conferidas contra a análise do zero
+        casos=$((casos + 1))
+        "$pk" --gen-edits=200 "$p" > "$tmp/edicoes"
+        "$pk" --bench-edits="$tmp/edicoes" --verify-edits "$p" 2>&1 | grep -q 'todas as edicoes ok' ||
+            falha "$rotulo: --verify-edits"
+    done
+done
+
+# Recuperação de erro: "els" no lugar de "else" é um só erro
+cat > "$tmp/recupera.pas" <<'FIM'
+program p;
+var a: boolean; b: integer;
+begin
+  a := true;
+  if a then b := 1 els b := 2;
+  b := 3
+end.
+FIM
+casos=$((casos + 1))
+"$pk" --max-errors=10 "$tmp/recupera.pas" > "$tmp/saida"
+n=$(grep -c 'erro sintatico' "$tmp/saida")
+[ "$n" = 1 ] && grep -q ', 1 erros$' "$tmp/saida" || falha "recuperacao: $n diagnosticos em vez de 1"
+
+echo "$casos casos, $falhas falhas"
+[ $falhas = 0 ]